@@ -3932,6 +3932,36 @@ struct _virDomainStatsRecord {
  */
 # define VIR_DOMAIN_STATS_DIRTYRATE_VCPU_SUFFIX_MEGABYTES_PER_SECOND ".megabytes_per_second"
 
+/**
+ * VIR_DOMAIN_STATS_DIRTYRATE_SAMPLES:
+ *
+ * Number of memory dirty rate samples collected periodically by the
+ * hypervisor in the background, which the average and peak values are
+ * computed from, as unsigned long long. The sampled values are reported only
+ * if background sampling is enabled and at least one sample was collected.
+ *
+ * Since: 11.3.0
+ */
+# define VIR_DOMAIN_STATS_DIRTYRATE_SAMPLES "dirtyrate.samples"
+
+/**
+ * VIR_DOMAIN_STATS_DIRTYRATE_AVERAGE_MEGABYTES_PER_SECOND:
+ *
+ * The average of the sampled memory dirty rates in MiB/s as long long.
+ *
+ * Since: 11.3.0
+ */
+# define VIR_DOMAIN_STATS_DIRTYRATE_AVERAGE_MEGABYTES_PER_SECOND "dirtyrate.average_megabytes_per_second"
+
+/**
+ * VIR_DOMAIN_STATS_DIRTYRATE_PEAK_MEGABYTES_PER_SECOND:
+ *
+ * The highest of the sampled memory dirty rates in MiB/s as long long.
+ *
+ * Since: 11.3.0
+ */
+# define VIR_DOMAIN_STATS_DIRTYRATE_PEAK_MEGABYTES_PER_SECOND "dirtyrate.peak_megabytes_per_second"
+
 
 /**
  * VIR_DOMAIN_STATS_VM_PREFIX:
@@ -5842,6 +5872,17 @@ typedef enum {
  */
 # define VIR_DOMAIN_JOB_VFIO_DATA_TRANSFERRED "vfio_data_transferred"
 
+/**
+ * VIR_DOMAIN_JOB_QUEUE_POSITION:
+ * virDomainGetJobStats field: position of a migration waiting in a queue
+ * for other migrations to finish, as VIR_TYPED_PARAM_ULLONG. The migration
+ * with position 1 starts next. The field is present only while the
+ * migration is waiting.
+ *
+ * Since: 11.3.0
+ */
+# define VIR_DOMAIN_JOB_QUEUE_POSITION "queue_position"
+
 /**
  * virConnectDomainEventGenericCallback:
  * @conn: the connection pointer
@@ -88,6 +88,15 @@ typedef enum {
     VIR_STORAGE_POOL_DELETE_ZEROED = 1 << 0,  /* Clear all data to zeros (slow) (Since: 0.4.1) */
 } virStoragePoolDeleteFlags;
 
+/**
+ * virStoragePoolRefreshFlags:
+ *
+ * Since: 11.3.0
+ */
+typedef enum {
+    VIR_STORAGE_POOL_REFRESH_INCREMENTAL = 1 << 0, /* Probe only volumes which changed since the last refresh (Since: 11.3.0) */
+} virStoragePoolRefreshFlags;
+
 /**
  * virStoragePoolCreateFlags:
  *
@@ -2807,7 +2807,7 @@ virNWFilterRuleDefDetailsFormat(virBuffer *buf,
 }
 
 
-static void
+void
 virNWFilterRuleDefFormat(virBuffer *buf,
                          virNWFilterRuleDef *def)
 {
@@ -538,6 +538,10 @@ virNWFilterDeleteDef(const char *configDir,
 char *
 virNWFilterDefFormat(const virNWFilterDef *def);
 
+void
+virNWFilterRuleDefFormat(virBuffer *buf,
+                         virNWFilterRuleDef *def);
+
 int
 virNWFilterSaveConfig(const char *configDir,
                       virNWFilterDef *def);
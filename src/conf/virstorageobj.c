@@ -91,6 +91,9 @@ struct _virStoragePoolObj {
     virStoragePoolDef *newDef;
 
     virStorageVolObjList *volumes;
+    /* volumes from before the refresh in progress, see
+     * virStoragePoolObjStashVols() */
+    virStorageVolObjList *stashedVolumes;
 };
 
 struct _virStoragePoolObjList {
@@ -348,6 +351,7 @@ virStoragePoolObjDispose(void *opaque)
 
     virStoragePoolObjClearVols(obj);
     virObjectUnref(obj->volumes);
+    virObjectUnref(obj->stashedVolumes);
 
     virStoragePoolDefFree(obj->def);
     virStoragePoolDefFree(obj->newDef);
@@ -614,6 +618,79 @@ virStoragePoolObjClearVols(virStoragePoolObj *obj)
 }
 
 
+/**
+ * virStoragePoolObjStashVols:
+ * @obj: storage pool object
+ *
+ * Like virStoragePoolObjClearVols() but keeps the removed volume
+ * definitions aside so that the backend refreshing the pool can reuse
+ * those which didn't change via virStoragePoolObjTakeStashedVol().
+ * Volumes that were not taken are freed by
+ * virStoragePoolObjClearStashedVols().
+ */
+void
+virStoragePoolObjStashVols(virStoragePoolObj *obj)
+{
+    virStorageVolObjList *fresh;
+
+    virStoragePoolObjClearStashedVols(obj);
+
+    if (!(fresh = virStorageVolObjListNew())) {
+        virStoragePoolObjClearVols(obj);
+        return;
+    }
+
+    obj->stashedVolumes = g_steal_pointer(&obj->volumes);
+    obj->volumes = fresh;
+}
+
+
+/**
+ * virStoragePoolObjTakeStashedVol:
+ * @obj: storage pool object
+ * @name: volume name
+ *
+ * Removes volume @name from the volumes stashed by
+ * virStoragePoolObjStashVols() and passes its definition to the
+ * caller.
+ *
+ * Returns the volume definition or NULL if there is none.
+ */
+virStorageVolDef *
+virStoragePoolObjTakeStashedVol(virStoragePoolObj *obj,
+                                const char *name)
+{
+    virStorageVolObjList *volumes = obj->stashedVolumes;
+    virStorageVolObj *volobj;
+    virStorageVolDef *voldef = NULL;
+
+    if (!volumes)
+        return NULL;
+
+    virObjectRWLockWrite(volumes);
+    if ((volobj = virHashLookup(volumes->objsName, name))) {
+        virObjectRef(volobj);
+        VIR_WITH_OBJECT_LOCK_GUARD(volobj) {
+            voldef = g_steal_pointer(&volobj->voldef);
+            g_hash_table_remove(volumes->objsKey, voldef->key);
+            g_hash_table_remove(volumes->objsName, voldef->name);
+            g_hash_table_remove(volumes->objsPath, voldef->target.path);
+        }
+        virObjectUnref(volobj);
+    }
+    virObjectRWUnlock(volumes);
+
+    return voldef;
+}
+
+
+void
+virStoragePoolObjClearStashedVols(virStoragePoolObj *obj)
+{
+    g_clear_pointer(&obj->stashedVolumes, virObjectUnref);
+}
+
+
 int
 virStoragePoolObjAddVol(virStoragePoolObj *obj,
                         virStorageVolDef *voldef)
@@ -171,6 +171,16 @@ virStorageVolDefFindByName(virStoragePoolObj *obj,
 void
 virStoragePoolObjClearVols(virStoragePoolObj *obj);
 
+void
+virStoragePoolObjStashVols(virStoragePoolObj *obj);
+
+virStorageVolDef *
+virStoragePoolObjTakeStashedVol(virStoragePoolObj *obj,
+                                const char *name);
+
+void
+virStoragePoolObjClearStashedVols(virStoragePoolObj *obj);
+
 typedef bool
 (*virStoragePoolVolumeACLFilter)(virConnectPtr conn,
                                  virStoragePoolDef *pool,
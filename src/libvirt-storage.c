@@ -930,12 +930,17 @@ virStoragePoolRef(virStoragePoolPtr pool)
 /**
  * virStoragePoolRefresh:
  * @pool: pointer to storage pool
- * @flags: extra flags; not used yet, so callers should always pass 0
+ * @flags: bitwise-OR of virStoragePoolRefreshFlags
  *
  * Request that the pool refresh its list of volumes. This may
  * involve communicating with a remote server, and/or initializing
  * new devices at the OS layer
  *
+ * If @flags contains VIR_STORAGE_POOL_REFRESH_INCREMENTAL, pools
+ * backed by a local directory only probe the volumes whose files were
+ * added or changed since the last refresh and reuse the information
+ * gathered previously for the rest. Other pool types ignore the flag.
+ *
  * Returns 0 if the volume list was refreshed, -1 on failure
  *
  * Since: 0.4.1
@@ -212,8 +212,10 @@ virLogCleanerChainCB(gpointer key,
 
     for (i = 0; i <= chain->rotated_max_index; i++) {
         g_autofree char *rotated_path = g_strdup_printf("%s.%zu", path, i);
+        g_autofree char *compressed_path = g_strdup_printf("%s.gz", rotated_path);
 
         virLogCleanerDeleteFile(rotated_path);
+        virLogCleanerDeleteFile(compressed_path);
     }
 }
 
@@ -241,7 +243,7 @@ virLogCleanerInit(virLogHandler *handler)
     if (handler->config->max_age_days <= 0)
         return 0;
 
-    log_regex = g_regex_new("^(.*)\\.log(\\.(\\d+))?$", 0, 0, NULL);
+    log_regex = g_regex_new("^(.*)\\.log(\\.(\\d+)(\\.gz)?)?$", 0, 0, NULL);
     if (!log_regex) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                         _("Unable to compile regex"));
@@ -95,6 +95,8 @@ virLogDaemonConfigLoadOptions(virLogDaemonConfig *data,
         return -1;
     if (virConfGetValueSizeT(conf, "max_backups", &data->max_backups) < 0)
         return -1;
+    if (virConfGetValueBool(conf, "compress_backups", &data->compress_backups) < 0)
+        return -1;
     if (virConfGetValueSizeT(conf, "max_age_days", &data->max_age_days) < 0)
         return -1;
     if (virConfGetValueString(conf, "log_root", &data->log_root) < 0)
@@ -33,6 +33,7 @@ struct _virLogDaemonConfig {
 
     size_t max_backups;
     size_t max_size;
+    bool compress_backups;
 
     char *log_root;
     size_t max_age_days;
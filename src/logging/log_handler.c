@@ -32,6 +32,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <poll.h>
+#include <sys/ioctl.h>
 
 #include "configmake.h"
 
@@ -41,6 +42,13 @@ VIR_LOG_INIT("logging.log_handler");
 
 #define DEFAULT_MODE 0600
 
+/* Most data moved from a single pipe on one wakeup, so that a chatty
+ * domain doesn't hold off the others */
+#define VIR_LOG_HANDLER_MAX_BATCH (256 * 1024)
+
+/* Size of reads when the amount of queued data is unknown */
+#define VIR_LOG_HANDLER_READ_SIZE 1024
+
 
 static virClass *virLogHandlerClass;
 static void virLogHandlerDispose(void *obj);
@@ -106,6 +114,43 @@ virLogHandlerGetLogFileFromWatch(virLogHandler *handler,
 }
 
 
+/*
+ * Moves all data queued in the pipe of @file, up to VIR_LOG_HANDLER_MAX_BATCH
+ * bytes, to the log file without waiting for more to arrive.
+ *
+ * Returns the number of bytes moved, 0 on end of file, or -1 on error.
+ */
+static ssize_t
+virLogHandlerDomainLogFileForward(virLogHandlerLogFile *file)
+{
+    ssize_t total = 0;
+
+    while (total < VIR_LOG_HANDLER_MAX_BATCH) {
+        int avail = 0;
+        ssize_t len;
+
+        if (ioctl(file->pipefd, FIONREAD, &avail) < 0 || avail <= 0) {
+            if (total > 0)
+                break;
+
+            /* Let read() tell whether the other end was closed */
+            avail = VIR_LOG_HANDLER_READ_SIZE;
+        }
+
+        len = virRotatingFileWriterAppendFD(file->file, file->pipefd,
+                                            MIN(avail, VIR_LOG_HANDLER_MAX_BATCH - total));
+        if (len < 0)
+            return -1;
+        if (len == 0)
+            break;
+
+        total += len;
+    }
+
+    return total;
+}
+
+
 static void
 virLogHandlerDomainLogFileEvent(int watch,
                                 int fd,
@@ -114,8 +159,6 @@ virLogHandlerDomainLogFileEvent(int watch,
 {
     virLogHandler *handler = opaque;
     virLogHandlerLogFile *logfile;
-    char buf[1024];
-    ssize_t len;
 
     virObjectLock(handler);
     logfile = virLogHandlerGetLogFileFromWatch(handler, watch);
@@ -130,20 +173,7 @@ virLogHandlerDomainLogFileEvent(int watch,
         goto cleanup;
     }
 
- reread:
-    len = read(fd, buf, sizeof(buf));
-    if (len < 0) {
-        if (errno == EINTR)
-            goto reread;
-
-        virReportSystemError(errno, "%s",
-                             _("Unable to read from log pipe"));
-        goto error;
-    } else if (len == 0) {
-        goto error;
-    }
-
-    if (virRotatingFileWriterAppend(logfile->file, buf, len) != len)
+    if (virLogHandlerDomainLogFileForward(logfile) <= 0)
         goto error;
 
  cleanup:
@@ -238,6 +268,8 @@ virLogHandlerLogFilePostExecRestart(virLogHandler *handler,
                                                false,
                                                DEFAULT_MODE)) == NULL)
         goto error;
+    virRotatingFileWriterSetCompress(file->file,
+                                     handler->config->compress_backups);
 
     if (virJSONValueObjectGetNumberInt(object, "pipefd", &file->pipefd) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -378,6 +410,8 @@ virLogHandlerDomainOpenLogFile(virLogHandler *handler,
                                                trunc,
                                                DEFAULT_MODE)) == NULL)
         goto error;
+    virRotatingFileWriterSetCompress(file->file,
+                                     handler->config->compress_backups);
 
     VIR_APPEND_ELEMENT_COPY(handler->files, handler->nfiles, file);
 
@@ -409,8 +443,6 @@ virLogHandlerDomainOpenLogFile(virLogHandler *handler,
 static void
 virLogHandlerDomainLogFileDrain(virLogHandlerLogFile *file)
 {
-    char buf[1024];
-    ssize_t len;
     struct pollfd pfd;
     int ret;
 
@@ -430,18 +462,11 @@ virLogHandlerDomainLogFileDrain(virLogHandlerLogFile *file)
         if (ret == 0)
             return;
 
-        len = read(file->pipefd, buf, sizeof(buf));
         file->drained = true;
-        if (len < 0) {
-            if (errno == EINTR)
-                continue;
-            return;
-        } else if (len == 0) {
+        if (virLogHandlerDomainLogFileForward(file) <= 0) {
+            virResetLastError();
             return;
         }
-
-        if (virRotatingFileWriterAppend(file->file, buf, len) != len)
-            return;
     }
 }
 
@@ -565,6 +590,8 @@ virLogHandlerDomainAppendLogFile(virLogHandler *handler,
                                                    DEFAULT_MODE)))
             goto cleanup;
 
+        virRotatingFileWriterSetCompress(newwriter,
+                                         handler->config->compress_backups);
         writer = newwriter;
     }
 
@@ -39,6 +39,8 @@
 #include "virerror.h"
 #include "datatypes.h"
 #include "bridge_driver.h"
+#define LIBVIRT_BRIDGE_DRIVERPRIV_H_ALLOW
+#include "bridge_driverpriv.h"
 #include "bridge_driver_platform.h"
 #include "driver.h"
 #include "virbuffer.h"
@@ -48,6 +50,7 @@
 #include "viruuid.h"
 #include "virlog.h"
 #include "virdnsmasq.h"
+#include "virevent.h"
 #include "configmake.h"
 #include "virnetdev.h"
 #include "virnetdevip.h"
@@ -61,6 +64,7 @@
 #include "network_event.h"
 #include "virhook.h"
 #include "virjson.h"
+#include "virleaseindex.h"
 #include "virnetworkportdef.h"
 #include "virutil.h"
 #include "virsystemd.h"
@@ -80,6 +84,14 @@ static virMutex bridgeNameValidateMutex = VIR_MUTEX_INITIALIZER;
 
 #define SYSCTL_PATH "/proc/sys"
 
+/**
+ * VIR_NETWORK_DNSMASQ_RELOAD_DELAY:
+ *
+ * Time (in milliseconds) for which changes of dnsmasq host files are
+ * collected before dnsmasq is reloaded
+ */
+#define VIR_NETWORK_DNSMASQ_RELOAD_DELAY 200
+
 VIR_LOG_INIT("network.bridge_driver");
 
 static virNetworkDriverState *network_driver;
@@ -335,7 +347,9 @@ networkCleanupInactive(virNetworkDriverState *driver,
     g_autofree char *customleasefile = NULL;
     g_autofree char *configfile = NULL;
     g_autofree char *statusfile = NULL;
+    g_autofree char *customleaseindex = NULL;
     g_autofree char *macMapFile = NULL;
+    g_autofree char *macMapIndex = NULL;
     g_autoptr(dnsmasqContext) dctx = NULL;
     virNetworkDef *def = virNetworkObjGetPersistentDef(obj);
 
@@ -360,14 +374,19 @@ networkCleanupInactive(virNetworkDriverState *driver,
     if (!(macMapFile = virMacMapFileName(cfg->dnsmasqStateDir, def->bridge)))
         return -1;
 
+    customleaseindex = virLeaseIndexFileName(customleasefile);
+    macMapIndex = virLeaseIndexFileName(macMapFile);
+
     /* dnsmasq */
     dnsmasqDelete(dctx);
     unlink(leasefile);
     unlink(customleasefile);
+    unlink(customleaseindex);
     unlink(configfile);
 
     /* MAC map manager */
     unlink(macMapFile);
+    unlink(macMapIndex);
 
     /* remove status file */
     unlink(statusfile);
@@ -638,6 +657,11 @@ networkStateInitialize(bool privileged,
     network_driver = g_new0(virNetworkDriverState, 1);
 
     network_driver->lockFD = -1;
+    network_driver->dnsmasqReloadTimer = -1;
+    network_driver->dnsmasqReloadPending = g_hash_table_new_full(g_str_hash,
+                                                                 g_str_equal,
+                                                                 g_free,
+                                                                 NULL);
     if (virMutexInit(&network_driver->lock) < 0) {
         g_clear_pointer(&network_driver, g_free);
         goto error;
@@ -790,6 +814,12 @@ networkStateCleanup(void)
     if (!network_driver)
         return -1;
 
+    /* any pending reload is done by networkRefreshDaemons() on the
+     * next start anyway */
+    if (network_driver->dnsmasqReloadTimer != -1)
+        virEventRemoveTimeout(network_driver->dnsmasqReloadTimer);
+    g_clear_pointer(&network_driver->dnsmasqReloadPending, g_hash_table_unref);
+
     virObjectUnref(network_driver->networkEventState);
     virObjectUnref(network_driver->xmlopt);
 
@@ -1588,38 +1618,24 @@ networkStartDhcpDaemon(virNetworkDriverState *driver,
 }
 
 
-/* networkRefreshDhcpDaemon:
- *  Update dnsmasq config files, then send a SIGHUP so that it rereads
- *  them.   This only works for the dhcp-hostsfile and the
- *  addn-hosts file.
+/* networkBuildDnsmasqHostsContext:
+ *  Build the contents of the dhcp-hostsfile and the addn-hosts file
+ *  of the network.
  *
- *  Returns 0 on success, -1 on failure.
+ *  Returns the dnsmasq context on success, NULL on failure.
  */
-static int
-networkRefreshDhcpDaemon(virNetworkDriverState *driver,
-                         virNetworkObj *obj)
+static dnsmasqContext *
+networkBuildDnsmasqHostsContext(virNetworkDriverConfig *cfg,
+                                virNetworkDef *def)
 {
-    g_autoptr(virNetworkDriverConfig) cfg = virNetworkDriverGetConfig(driver);
-    virNetworkDef *def = virNetworkObjGetDef(obj);
     size_t i;
-    pid_t dnsmasqPid;
     virNetworkIPDef *ipdef;
     virNetworkIPDef *ipv4def;
     virNetworkIPDef *ipv6def;
     g_autoptr(dnsmasqContext) dctx = NULL;
 
-    /* if no IP addresses specified, nothing to do */
-    if (!virNetworkDefGetIPByIndex(def, AF_UNSPEC, 0))
-        return 0;
-
-    /* if there's no running dnsmasq, just start it */
-    dnsmasqPid = virNetworkObjGetDnsmasqPid(obj);
-    if (dnsmasqPid <= 0 || (kill(dnsmasqPid, 0) < 0))
-        return networkStartDhcpDaemon(driver, obj);
-
-    VIR_INFO("Refreshing dnsmasq for network %s", def->bridge);
     if (!(dctx = dnsmasqContextNew(def->name, cfg->dnsmasqStateDir)))
-        return -1;
+        return NULL;
 
     /* Look for first IPv4 address that has dhcp defined.
      * We only support dhcp-host config on one IPv4 subnetwork
@@ -1642,13 +1658,177 @@ networkRefreshDhcpDaemon(virNetworkDriverState *driver,
     }
 
     if (ipv4def && (networkBuildDnsmasqDhcpHostsList(dctx, ipv4def) < 0))
-        return -1;
+        return NULL;
 
     if (ipv6def && (networkBuildDnsmasqDhcpHostsList(dctx, ipv6def) < 0))
-        return -1;
+        return NULL;
 
     if (networkBuildDnsmasqHostsList(dctx, &def->dns) < 0)
+        return NULL;
+
+    return g_steal_pointer(&dctx);
+}
+
+
+/* networkCheckDnsmasqHostsWritable:
+ *  Make sure the host files of @dctx can be written by dnsmasqSave,
+ *  so that a deferred write can't fail on that.
+ *
+ *  Returns 0 on success, -1 on failure.
+ */
+static int
+networkCheckDnsmasqHostsWritable(dnsmasqContext *dctx)
+{
+    const char *paths[] = {
+        dctx->hostsfile->path,
+        dctx->addnhostsfile->path,
+    };
+    size_t i;
+
+    if (g_mkdir_with_parents(dctx->config_dir, 0777) < 0) {
+        virReportSystemError(errno,
+                             _("cannot create config directory '%1$s'"),
+                             dctx->config_dir);
+        return -1;
+    }
+
+    /* the files are replaced with new ones created next to them, or
+     * overwritten in place if that's not possible */
+    if (access(dctx->config_dir, W_OK) == 0)
+        return 0;
+
+    for (i = 0; i < G_N_ELEMENTS(paths); i++) {
+        if (access(paths[i], W_OK) < 0) {
+            virReportSystemError(errno,
+                                 _("cannot write config file '%1$s'"),
+                                 paths[i]);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static void
+networkDnsmasqReloadTimer(int timer G_GNUC_UNUSED,
+                          void *opaque)
+{
+    virNetworkDriverState *driver = opaque;
+    g_autoptr(virNetworkDriverConfig) cfg = virNetworkDriverGetConfig(driver);
+    g_autoptr(GHashTable) pending = NULL;
+    GHashTableIter iter;
+    const char *name;
+
+    VIR_WITH_MUTEX_LOCK_GUARD(&driver->lock) {
+        virEventRemoveTimeout(driver->dnsmasqReloadTimer);
+        driver->dnsmasqReloadTimer = -1;
+        pending = g_steal_pointer(&driver->dnsmasqReloadPending);
+        driver->dnsmasqReloadPending = g_hash_table_new_full(g_str_hash,
+                                                             g_str_equal,
+                                                             g_free,
+                                                             NULL);
+    }
+
+    g_hash_table_iter_init(&iter, pending);
+    while (g_hash_table_iter_next(&iter, (void **) &name, NULL)) {
+        virNetworkObj *obj = virNetworkObjFindByName(driver->networks, name);
+        pid_t dnsmasqPid;
+
+        if (!obj)
+            continue;
+
+        dnsmasqPid = virNetworkObjGetDnsmasqPid(obj);
+        if (virNetworkObjIsActive(obj) && dnsmasqPid > 0) {
+            g_autoptr(dnsmasqContext) dctx = NULL;
+
+            if (!(dctx = networkBuildDnsmasqHostsContext(cfg, virNetworkObjGetDef(obj))) ||
+                dnsmasqSave(dctx) < 0) {
+                VIR_WARN("Failed to update dnsmasq host files for network %s: %s",
+                         name, virGetLastErrorMessage());
+                virResetLastError();
+            } else if (kill(dnsmasqPid, SIGHUP) < 0) {
+                VIR_WARN("Failed to reload dnsmasq for network %s: %s",
+                         name, g_strerror(errno));
+            }
+        }
+
+        virNetworkObjEndAPI(&obj);
+    }
+}
+
+
+/* networkScheduleReloadDhcpDaemon:
+ *  Write the host files of the network and send SIGHUP to its dnsmasq
+ *  once VIR_NETWORK_DNSMASQ_RELOAD_DELAY passes, so that any number of
+ *  host updates made in the meantime result in a single write and
+ *  reload.
+ *
+ *  Returns 0 on success, -1 if the reload couldn't be scheduled.
+ */
+static int
+networkScheduleReloadDhcpDaemon(virNetworkDriverState *driver,
+                                virNetworkObj *obj)
+{
+    virNetworkDef *def = virNetworkObjGetDef(obj);
+    VIR_LOCK_GUARD lock = virLockGuardLock(&driver->lock);
+
+    if (driver->dnsmasqReloadTimer == -1) {
+        driver->dnsmasqReloadTimer =
+            virEventAddTimeout(VIR_NETWORK_DNSMASQ_RELOAD_DELAY,
+                               networkDnsmasqReloadTimer,
+                               driver, NULL);
+    }
+
+    if (driver->dnsmasqReloadTimer < 0) {
+        driver->dnsmasqReloadTimer = -1;
         return -1;
+    }
+
+    g_hash_table_add(driver->dnsmasqReloadPending, g_strdup(def->name));
+    return 0;
+}
+
+
+/* networkRefreshDhcpDaemon:
+ *  Update dnsmasq config files, then send a SIGHUP so that it rereads
+ *  them.   This only works for the dhcp-hostsfile and the
+ *  addn-hosts file. If @deferReload is true, the files are only
+ *  checked to be writable and both the write and the SIGHUP are done
+ *  later by networkScheduleReloadDhcpDaemon.
+ *
+ *  Returns 0 on success, -1 on failure.
+ */
+int
+networkRefreshDhcpDaemon(virNetworkDriverState *driver,
+                         virNetworkObj *obj,
+                         bool deferReload)
+{
+    g_autoptr(virNetworkDriverConfig) cfg = virNetworkDriverGetConfig(driver);
+    virNetworkDef *def = virNetworkObjGetDef(obj);
+    pid_t dnsmasqPid;
+    g_autoptr(dnsmasqContext) dctx = NULL;
+
+    /* if no IP addresses specified, nothing to do */
+    if (!virNetworkDefGetIPByIndex(def, AF_UNSPEC, 0))
+        return 0;
+
+    /* if there's no running dnsmasq, just start it */
+    dnsmasqPid = virNetworkObjGetDnsmasqPid(obj);
+    if (dnsmasqPid <= 0 || (kill(dnsmasqPid, 0) < 0))
+        return networkStartDhcpDaemon(driver, obj);
+
+    VIR_INFO("Refreshing dnsmasq for network %s", def->bridge);
+    if (!(dctx = networkBuildDnsmasqHostsContext(cfg, def)))
+        return -1;
+
+    if (deferReload) {
+        if (networkCheckDnsmasqHostsWritable(dctx) < 0)
+            return -1;
+
+        if (networkScheduleReloadDhcpDaemon(driver, obj) == 0)
+            return 0;
+    }
 
     if (dnsmasqSave(dctx) < 0)
         return -1;
@@ -1700,7 +1880,7 @@ networkRefreshDaemonsHelper(virNetworkObj *obj,
              * with them.  Here we send a SIGHUP to an existing
              * dnsmasq, or restart it if it has disappeared.
              */
-            networkRefreshDhcpDaemon(driver, obj);
+            networkRefreshDhcpDaemon(driver, obj, false);
             break;
 
         case VIR_NETWORK_FORWARD_BRIDGE:
@@ -3436,7 +3616,7 @@ networkUpdate(virNetworkPtr net,
 
             if ((newDhcpActive != oldDhcpActive &&
                  networkRestartDhcpDaemon(driver, obj) < 0) ||
-                networkRefreshDhcpDaemon(driver, obj) < 0) {
+                networkRefreshDhcpDaemon(driver, obj, true) < 0) {
                 goto cleanup;
             }
 
@@ -3445,7 +3625,7 @@ networkUpdate(virNetworkPtr net,
              * (not the .conf file) so we can just update the config
              * files and send SIGHUP to dnsmasq.
              */
-            if (networkRefreshDhcpDaemon(driver, obj) < 0)
+            if (networkRefreshDhcpDaemon(driver, obj, true) < 0)
                 goto cleanup;
 
         }
@@ -75,6 +75,12 @@ struct _virNetworkDriverState {
     virObjectEventState *networkEventState;
 
     virNetworkXMLOption *xmlopt;
+
+    /* Require lock. Names of networks whose dnsmasq is to be sent
+     * SIGHUP once @dnsmasqReloadTimer fires, so that a burst of host
+     * file updates results in a single reload. */
+    GHashTable *dnsmasqReloadPending;
+    int dnsmasqReloadTimer;
 };
 
 virNetworkDriverConfig *
@@ -29,6 +29,7 @@
 #include "virerror.h"
 #include "virjson.h"
 #include "virlease.h"
+#include "virleaseindex.h"
 #include "virenum.h"
 #include "configmake.h"
 #include "virgettext.h"
@@ -95,6 +96,7 @@ main(int argc, char **argv)
     bool delete = false;
     g_autoptr(virJSONValue) lease_new = NULL;
     g_autoptr(virJSONValue) leases_array_new = NULL;
+    g_autoptr(virLeaseIndex) leases_index = NULL;
 
     virSetErrorFunc(NULL, NULL);
     virSetErrorLogPriorityFunc(NULL);
@@ -240,6 +242,14 @@ main(int argc, char **argv)
         /* Write to file */
         if (virFileRewriteStr(custom_lease_file, 0644, leases_str) < 0)
             goto cleanup;
+
+        /* The index merely saves the NSS module from parsing the
+         * file, which it falls back to if the index is missing or
+         * stale, so failing to write it is not fatal. */
+        leases_index = virLeaseIndexNew();
+        if (virLeaseIndexAddLeases(leases_index, leases_array_new) < 0 ||
+            virLeaseIndexWrite(leases_index, custom_lease_file) < 0)
+            virDispatchError(NULL);
         break;
 
     case VIR_LEASE_ACTION_LAST:
@@ -28,8 +28,8 @@
  *   Inside a couple of VMs that for example use the 'clean-traffic' filter:
  *      while :; do kill -SIGTERM `pidof dhclient`; dhclient eth0; ifconfig eth0; done
  *
- *   On the host check the lease file and that it's periodically shortened:
- *      cat $runstatedir/libvirt/network/nwfilter.leases; date +%s
+ *   On the host check that the lease journal is periodically shortened:
+ *      ls -l $runstatedir/libvirt/network/nwfilter.leases
  *
  *   On the host also check that the ebtables rules 'look' ok:
  *      ebtables -t nat -L
@@ -38,6 +38,11 @@
 
 #ifdef WITH_LIBPCAP
 # include <pcap.h>
+# include <sys/mman.h>
+# include <sys/socket.h>
+# include <linux/filter.h>
+# include <linux/if_ether.h>
+# include <linux/if_packet.h>
 #endif
 
 #include <fcntl.h>
@@ -50,9 +55,12 @@
 #include "virerror.h"
 #include "nwfilter_gentech_driver.h"
 #include "nwfilter_dhcpsnoop.h"
+#define LIBVIRT_NWFILTER_DHCPSNOOPPRIV_H_ALLOW
+#include "nwfilter_dhcpsnooppriv.h"
 #include "nwfilter_ipaddrmap.h"
 #include "virnetdev.h"
 #include "virfile.h"
+#include "virhashcode.h"
 #include "virsocketaddr.h"
 #include "virthreadpool.h"
 #include "configmake.h"
@@ -69,11 +77,30 @@ VIR_LOG_INIT("nwfilter.nwfilter_dhcpsnoop");
 # define LEASEFILE LEASEFILE_DIR "nwfilter.leases"
 # define TMPLEASEFILE LEASEFILE_DIR "nwfilter.ltmp"
 
+/*
+ * The lease file starts with the magic and is followed by records
+ * which are only ever appended. Files without the magic are read
+ * as the text format used by older versions.
+ */
+# define LEASEFILE_MAGIC "LVNWFLJ1"
+# define LEASEFILE_MAGIC_LEN (sizeof(LEASEFILE_MAGIC) - 1)
+
+# define SNOOP_SHARED_WORKERS       4
+
 struct virNWFilterSnoopState {
-    /* lease file */
+    /* lease file; only used by the journal thread while it runs */
     int                  leaseFD;
     int                  nLeases; /* number of active leases */
     int                  wLeases; /* number of written leases */
+    GHashTable *         journalIndex; /* leases in the lease file */
+    int                  pruneWanted; /* lease file was compacted */
+    /* lease journal thread */
+    virMutex             journalLock; /* protects the members below */
+    virCond              journalCond;
+    GByteArray *         journalPending; /* records not written yet */
+    bool                 journalQuit;
+    bool                 journalRunning;
+    virThread            journalThread;
     int                  nThreads; /* number of running threads */
     /* thread management */
     GHashTable *     snoopReqs;
@@ -81,6 +108,13 @@ struct virNWFilterSnoopState {
     virMutex             snoopLock;  /* protects SnoopReqs and IfNameToKey */
     GHashTable *     active;
     virMutex             activeLock; /* protects Active */
+    /* single capture socket shared by all interfaces */
+    bool                 shared;
+    virMutex             sharedLock; /* protects the members below */
+    GHashTable *         sharedPorts; /* ifindex -> virNWFilterSnoopSharedPort */
+    GSList *             sharedRetired; /* ports replaced in sharedPorts */
+    bool                 sharedRunning; /* capture thread is running */
+    virThreadPool *      sharedWorkers[SNOOP_SHARED_WORKERS];
 };
 
 # define VIR_IFKEY_LEN   ((VIR_UUID_STRING_BUFLEN) + (VIR_MAC_STRING_BUFLEN))
@@ -118,7 +152,8 @@ struct _virNWFilterSnoopReq {
     virCond                              threadStatusCond;
 
     int                                  jobCompletionStatus;
-    /* the number of submitted jobs in the worker's queue */
+    /* the number of submitted jobs in the shared workers' queues */
+    int                                  sharedQCtr[2];
     /*
      * protect those members that can change while the
      * req is on the public SnoopReq hash and
@@ -138,6 +173,7 @@ struct _virNWFilterSnoopReq {
  * Note about lock-order:
  * 1st: virNWFilterSnoopState.snoopLock
  * 2nd: &req->lock
+ * 3rd: virNWFilterSnoopState.sharedLock
  *
  * Rationale: Former protects the SnoopReqs hash, latter its contents
  */
@@ -161,6 +197,21 @@ struct _virNWFilterSnoopEthHdr {
 } ATTRIBUTE_PACKED;
 G_STATIC_ASSERT(sizeof(struct _virNWFilterSnoopEthHdr) == 14);
 
+typedef struct _virNWFilterSnoopLeaseRec virNWFilterSnoopLeaseRec;
+struct _virNWFilterSnoopLeaseRec {
+    uint64_t timeout; /* 0 if the lease was removed */
+    unsigned char vmuuid[VIR_UUID_BUFLEN];
+    virMacAddr mac;
+    uint32_t ipAddress; /* network byte order */
+    uint32_t ipServer; /* network byte order, 0 if unknown */
+} ATTRIBUTE_PACKED;
+G_STATIC_ASSERT(sizeof(struct _virNWFilterSnoopLeaseRec) == 38);
+
+/* a lease is identified by its interface key and IP address */
+# define LEASE_REC_KEY_OFFSET offsetof(virNWFilterSnoopLeaseRec, vmuuid)
+# define LEASE_REC_KEY_LEN \
+    (offsetof(virNWFilterSnoopLeaseRec, ipServer) - LEASE_REC_KEY_OFFSET)
+
 typedef struct _virNWFilterSnoopDHCPHdr virNWFilterSnoopDHCPHdr;
 struct _virNWFilterSnoopDHCPHdr {
     uint8_t   d_op;
@@ -208,6 +259,7 @@ struct _virNWFilterDHCPDecodeJob {
     int caplen;
     bool fromVM;
     int *qCtr;
+    virNWFilterSnoopReq *req; /* set for jobs of the shared capture */
 };
 
 # define DHCP_PKT_RATE          10 /* pkts/sec */
@@ -238,6 +290,40 @@ struct _virNWFilterSnoopPcapConf {
     unsigned long long penaltyTimeoutAbs;
 };
 
+/*
+ * The shared capture uses one AF_PACKET socket for all interfaces
+ * with a TPACKET_V3 ring so that the kernel hands over whole blocks
+ * of DHCP packets rather than waking up a thread per packet.
+ */
+# define SNOOP_SHARED_FILTER \
+    "(dst port 67 and src port 68) or (src port 67 and dst port 68)"
+# define SNOOP_SHARED_BLOCK_SIZE    (64 * 1024)
+# define SNOOP_SHARED_BLOCK_NR      8
+# define SNOOP_SHARED_FRAME_SIZE    2048
+# define SNOOP_SHARED_BLOCK_TOV_MS  10 /* ms */
+# define SNOOP_SHARED_POLL_MS       1000 /* ms */
+
+typedef struct _virNWFilterSnoopSharedSock virNWFilterSnoopSharedSock;
+struct _virNWFilterSnoopSharedSock {
+    int fd;
+    uint8_t *ring;
+    size_t ringlen;
+};
+
+typedef struct _virNWFilterSnoopSharedPort virNWFilterSnoopSharedPort;
+struct _virNWFilterSnoopSharedPort {
+    virNWFilterSnoopReq *req; /* holds a reference */
+    char *threadkey;
+    char *ifname;
+    int ifindex;
+    virMacAddr mac;
+    /* index 0: from VM, index 1: to VM */
+    virNWFilterSnoopRateLimitConf rateLimit[2];
+    unsigned long long penaltyTimeoutAbs[2];
+    time_t lastWarning;
+    virThreadPool *worker;
+};
+
 /* local function prototypes */
 static int virNWFilterSnoopReqLeaseDel(virNWFilterSnoopReq *req,
                                        virSocketAddr *ipaddr,
@@ -246,6 +332,7 @@ static int virNWFilterSnoopReqLeaseDel(virNWFilterSnoopReq *req,
 
 static void virNWFilterSnoopLeaseFileLoad(void);
 static void virNWFilterSnoopLeaseFileSave(virNWFilterSnoopIPLease *ipl);
+static void virNWFilterSnoopPruneWanted(void);
 
 /* local variables */
 static struct virNWFilterSnoopState virNWFilterSnoopState = {
@@ -992,29 +1079,43 @@ virNWFilterSnoopDHCPOpen(const char *ifname, virMacAddr *mac,
  */
 static void virNWFilterDHCPDecodeWorker(void *jobdata, void *opaque)
 {
-    virNWFilterSnoopReq *req = opaque;
     g_autofree virNWFilterDHCPDecodeJob *job = jobdata;
+    virNWFilterSnoopReq *req = job->req ? job->req : opaque;
     virNWFilterSnoopEthHdr *packet = (virNWFilterSnoopEthHdr *)job->packet;
 
-    if (virNWFilterSnoopDHCPDecode(req, packet,
-                                   job->caplen, job->fromVM) == -1) {
-        req->jobCompletionStatus = -1;
+    if (job->caplen == 0) {
+        /* lease timer tick sent by the shared capture thread */
+        virNWFilterSnoopReqLeaseTimerRun(req);
+    } else if (virNWFilterSnoopDHCPDecode(req, packet,
+                                          job->caplen, job->fromVM) == -1) {
+        VIR_WITH_MUTEX_LOCK_GUARD(&req->lock) {
+            req->jobCompletionStatus = -1;
+        }
 
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Instantiation of rules failed on interface '%1$s'"),
                        req->binding->portdevname);
     }
-    ignore_value(g_atomic_int_dec_and_test(job->qCtr));
+
+    if (job->qCtr)
+        ignore_value(g_atomic_int_dec_and_test(job->qCtr));
+
+    if (job->req)
+        virNWFilterSnoopReqPut(job->req);
 }
 
 /*
  * Submit a job to the worker thread doing the time-consuming work...
+ *
+ * @req is only passed by the shared capture whose workers serve many
+ * requests; the job then holds a reference to it.
  */
 static int
 virNWFilterSnoopDHCPDecodeJobSubmit(virThreadPool *pool,
                                     virNWFilterSnoopEthHdr *pep,
                                     int len, pcap_direction_t dir,
-                                    int *qCtr)
+                                    int *qCtr,
+                                    virNWFilterSnoopReq *req)
 {
     virNWFilterDHCPDecodeJob *job;
     int ret;
@@ -1028,13 +1129,20 @@ virNWFilterSnoopDHCPDecodeJobSubmit(virThreadPool *pool,
     job->caplen = len;
     job->fromVM = (dir == PCAP_D_IN);
     job->qCtr = qCtr;
+    job->req = req;
+
+    if (req)
+        virNWFilterSnoopReqGet(req);
 
     ret = virThreadPoolSendJob(pool, 0, job);
 
-    if (ret == 0)
+    if (ret == 0) {
         g_atomic_int_add(qCtr, 1);
-    else
+    } else {
+        if (req)
+            virNWFilterSnoopReqPut(req);
         g_free(job);
+    }
 
     return ret;
 }
@@ -1088,16 +1196,16 @@ virNWFilterSnoopRateLimit(virNWFilterSnoopRateLimitConf *rl)
 /*
  * virNWFilterSnoopRatePenalty
  *
- * @pc: pointer to the virNWFilterSnoopPcapConf
+ * @penaltyTimeoutAbs: pointer to the penalty timeout of the packet source
  * @diff: the amount of pkts beyond the rate, i.e., if the rate is 10
  *        and 13 pkts have been received now in one seconds, then
  *        this should be 3.
  *
- * Adjusts the timeout the virNWFilterSnooPcapConf will be penalized for
+ * Adjusts the timeout the packet source will be penalized for
  * sending too many packets.
  */
 static void
-virNWFilterSnoopRatePenalty(virNWFilterSnoopPcapConf *pc,
+virNWFilterSnoopRatePenalty(unsigned long long *penaltyTimeoutAbs,
                             unsigned int diff, unsigned int limit)
 {
     if (diff > limit) {
@@ -1105,10 +1213,10 @@ virNWFilterSnoopRatePenalty(virNWFilterSnoopPcapConf *pc,
 
         if (virTimeMillisNowRaw(&now) < 0) {
             g_usleep(PCAP_FLOOD_TIMEOUT_MS); /* 1 ms */
-            pc->penaltyTimeoutAbs = 0;
+            *penaltyTimeoutAbs = 0;
         } else {
             /* don't listen to the fd for 1 ms */
-            pc->penaltyTimeoutAbs = now + PCAP_FLOOD_TIMEOUT_MS;
+            *penaltyTimeoutAbs = now + PCAP_FLOOD_TIMEOUT_MS;
         }
     }
 }
@@ -1340,8 +1448,8 @@ virNWFilterDHCPSnoopThread(void *req0)
 
                 diff = virNWFilterSnoopRateLimit(&pcapConf[i].rateLimit);
                 if (diff > 0) {
-                    virNWFilterSnoopRatePenalty(&pcapConf[i], diff,
-                                                DHCP_PKT_RATE);
+                    virNWFilterSnoopRatePenalty(&pcapConf[i].penaltyTimeoutAbs,
+                                                diff, DHCP_PKT_RATE);
                     /* rate-limited warnings */
                     if (time(0) - last_displayed > 10) {
                          last_displayed = time(0);
@@ -1354,7 +1462,8 @@ virNWFilterDHCPSnoopThread(void *req0)
                 if (virNWFilterSnoopDHCPDecodeJobSubmit(worker, packet,
                                                       hdr->caplen,
                                                       pcapConf[i].dir,
-                                                      &pcapConf[i].qCtr) < 0) {
+                                                      &pcapConf[i].qCtr,
+                                                      NULL) < 0) {
                     virReportError(VIR_ERR_INTERNAL_ERROR,
                                    _("Job submission failed on interface '%1$s'"),
                                    req->binding->portdevname);
@@ -1393,6 +1502,542 @@ virNWFilterDHCPSnoopThread(void *req0)
     return;
 }
 
+static void
+virNWFilterSnoopSharedSockFree(virNWFilterSnoopSharedSock *sock)
+{
+    if (!sock)
+        return;
+
+    if (sock->ring)
+        munmap(sock->ring, sock->ringlen);
+    VIR_FORCE_CLOSE(sock->fd);
+    g_free(sock);
+}
+
+/*
+ * Open the packet socket of the shared capture. It is not bound to
+ * any interface since traffic between ports of a bridge never passes
+ * through the bridge device itself; packets are demultiplexed by
+ * their interface index instead.
+ */
+static virNWFilterSnoopSharedSock *
+virNWFilterSnoopSharedOpen(void)
+{
+    virNWFilterSnoopSharedSock *sock;
+    VIR_AUTOCLOSE fd = -1;
+    pcap_t *dead;
+    struct bpf_program fp;
+    struct sock_fprog prog;
+    int version = TPACKET_V3;
+    struct tpacket_req3 treq = {
+        .tp_block_size = SNOOP_SHARED_BLOCK_SIZE,
+        .tp_block_nr = SNOOP_SHARED_BLOCK_NR,
+        .tp_frame_size = SNOOP_SHARED_FRAME_SIZE,
+        .tp_frame_nr = (SNOOP_SHARED_BLOCK_SIZE / SNOOP_SHARED_FRAME_SIZE) *
+                       SNOOP_SHARED_BLOCK_NR,
+        .tp_retire_blk_tov = SNOOP_SHARED_BLOCK_TOV_MS,
+    };
+    struct sockaddr_ll sll = {
+        .sll_family = AF_PACKET,
+        .sll_protocol = htons(ETH_P_ALL),
+        .sll_ifindex = 0, /* all interfaces */
+    };
+    size_t ringlen = (size_t)SNOOP_SHARED_BLOCK_SIZE * SNOOP_SHARED_BLOCK_NR;
+    void *ring;
+    int rc;
+
+    /* protocol 0: don't receive anything before the filter is attached */
+    if ((fd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, 0)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot open DHCP snooping socket"));
+        return NULL;
+    }
+
+    if (!(dead = pcap_open_dead(DLT_EN10MB, PCAP_PBUFSIZE))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("pcap_open_dead failed"));
+        return NULL;
+    }
+
+    if (pcap_compile(dead, &fp, SNOOP_SHARED_FILTER, 1,
+                     PCAP_NETMASK_UNKNOWN) != 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("pcap_compile: %1$s"), pcap_geterr(dead));
+        pcap_close(dead);
+        return NULL;
+    }
+
+    prog.len = fp.bf_len;
+    prog.filter = (struct sock_filter *)fp.bf_insns;
+
+    rc = setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+
+    pcap_freecode(&fp);
+    pcap_close(dead);
+
+    if (rc < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot attach filter to DHCP snooping socket"));
+        return NULL;
+    }
+
+    if (setsockopt(fd, SOL_PACKET, PACKET_VERSION,
+                   &version, sizeof(version)) < 0 ||
+        setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &treq, sizeof(treq)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot set up ring buffer of DHCP snooping socket"));
+        return NULL;
+    }
+
+    ring = mmap(NULL, ringlen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ring == MAP_FAILED) {
+        virReportSystemError(errno, "%s",
+                             _("cannot map ring buffer of DHCP snooping socket"));
+        return NULL;
+    }
+
+    if (bind(fd, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot bind DHCP snooping socket"));
+        munmap(ring, ringlen);
+        return NULL;
+    }
+
+    sock = g_new0(virNWFilterSnoopSharedSock, 1);
+    sock->fd = fd;
+    sock->ring = ring;
+    sock->ringlen = ringlen;
+    fd = -1;
+
+    return sock;
+}
+
+/*
+ * Release a port of the shared capture. If the request is still
+ * snooping through this port, i.e. the port is dropped due to an
+ * error, its interface association is removed like when a per
+ * interface snooping thread fails.
+ */
+static void
+virNWFilterSnoopSharedPortFree(void *opaque)
+{
+    virNWFilterSnoopSharedPort *port = opaque;
+    virNWFilterSnoopReq *req = port->req;
+
+    /* protect IfNameToKey */
+    VIR_WITH_MUTEX_LOCK_GUARD(&virNWFilterSnoopState.snoopLock) {
+        /* protect req->binding->portdevname & req->threadkey */
+        VIR_WITH_MUTEX_LOCK_GUARD(&req->lock) {
+            if (req->threadkey && STREQ(req->threadkey, port->threadkey)) {
+                virNWFilterSnoopCancel(&req->threadkey);
+
+                /* the name may already belong to another request */
+                if (req->binding->portdevname &&
+                    virHashLookup(virNWFilterSnoopState.ifnameToKey,
+                                  req->binding->portdevname) == req->ifkey)
+                    ignore_value(virHashRemoveEntry(virNWFilterSnoopState.ifnameToKey,
+                                                    req->binding->portdevname));
+
+                g_clear_pointer(&req->binding->portdevname, g_free);
+            }
+        }
+    }
+
+    virNWFilterSnoopReqPut(req);
+
+    g_free(port->threadkey);
+    g_free(port->ifname);
+    g_free(port);
+}
+
+/*
+ * The socket filter accepts DHCP packets in both directions; check
+ * that the UDP ports fit the direction the packet travels.
+ */
+static bool
+virNWFilterSnoopSharedIsDHCP(virNWFilterSnoopEthHdr *pep, int len,
+                             bool fromVM)
+{
+    struct iphdr *pip;
+    struct udphdr *pup;
+    int iplen;
+
+    len -= offsetof(virNWFilterSnoopEthHdr, eh_data);
+
+    if (len < (int)sizeof(*pip) || ntohs(pep->eh_type) != ETHERTYPE_IP)
+        return false;
+
+    VIR_WARNINGS_NO_CAST_ALIGN
+    pip = (struct iphdr *)pep->eh_data;
+    VIR_WARNINGS_RESET
+    iplen = pip->ihl << 2;
+
+    if (pip->protocol != IPPROTO_UDP || len < iplen + (int)sizeof(*pup))
+        return false;
+
+    VIR_WARNINGS_NO_CAST_ALIGN
+    pup = (struct udphdr *)((char *)pip + iplen);
+    VIR_WARNINGS_RESET
+
+    if (fromVM)
+        return ntohs(pup->source) == 68 && ntohs(pup->dest) == 67;
+
+    return ntohs(pup->source) == 67 && ntohs(pup->dest) == 68;
+}
+
+/*
+ * Check whether the DHCP snooping of the interface with MAC address
+ * @mac is interested in the packet captured on that interface.
+ */
+bool
+virNWFilterSnoopSharedAccept(const virMacAddr *mac,
+                             void *packet,
+                             int len,
+                             bool fromVM)
+{
+    virNWFilterSnoopEthHdr *pep = packet;
+
+    if (!virNWFilterSnoopSharedIsDHCP(pep, len, fromVM))
+        return false;
+
+    /* don't want to hear about another VM's DHCP requests */
+    if (fromVM && virMacAddrCmp(mac, &pep->eh_src) != 0)
+        return false;
+
+    return true;
+}
+
+static void
+virNWFilterSnoopSharedPacket(int ifindex,
+                             bool fromVM,
+                             void *packet,
+                             int len,
+                             void *opaque G_GNUC_UNUSED)
+{
+    virNWFilterSnoopSharedPort *port = NULL;
+    size_t dir = fromVM ? 0 : 1;
+    unsigned int diff;
+
+    /* ports are only freed by the capture thread, i.e. our caller */
+    VIR_WITH_MUTEX_LOCK_GUARD(&virNWFilterSnoopState.sharedLock) {
+        port = g_hash_table_lookup(virNWFilterSnoopState.sharedPorts,
+                                   GINT_TO_POINTER(ifindex));
+    }
+
+    if (!port || !virNWFilterSnoopSharedAccept(&port->mac, packet, len, fromVM))
+        return;
+
+    if (port->penaltyTimeoutAbs[dir] != 0) {
+        unsigned long long now;
+
+        if (virTimeMillisNowRaw(&now) == 0 &&
+            now < port->penaltyTimeoutAbs[dir])
+            return;
+
+        port->penaltyTimeoutAbs[dir] = 0;
+    }
+
+    if (g_atomic_int_get(&port->req->sharedQCtr[dir]) > MAX_QUEUED_JOBS) {
+        if (time(0) - port->lastWarning > 10) {
+            port->lastWarning = time(0);
+            VIR_WARN("Worker thread for interface '%s' has a "
+                     "job queue that is too long", port->ifname);
+        }
+        return;
+    }
+
+    diff = virNWFilterSnoopRateLimit(&port->rateLimit[dir]);
+    if (diff > 0) {
+        virNWFilterSnoopRatePenalty(&port->penaltyTimeoutAbs[dir],
+                                    diff, DHCP_PKT_RATE);
+        /* rate-limited warnings */
+        if (time(0) - port->lastWarning > 10) {
+            port->lastWarning = time(0);
+            VIR_WARN("Too many DHCP packets on interface '%s'",
+                     port->ifname);
+        }
+        return;
+    }
+
+    /* the port holds a reference, so the job may take another one */
+    if (virNWFilterSnoopDHCPDecodeJobSubmit(port->worker, packet, len,
+                                            fromVM ? PCAP_D_IN : PCAP_D_OUT,
+                                            &port->req->sharedQCtr[dir],
+                                            port->req) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Job submission failed on interface '%1$s'"),
+                       port->ifname);
+    }
+}
+
+/*
+ * Walk the packets of a TPACKET_V3 block of the ring buffer and pass
+ * each one to @func along with the index of the interface it was
+ * captured on and its direction.
+ */
+void
+virNWFilterSnoopSharedBlock(struct tpacket_block_desc *bd,
+                            virNWFilterSnoopSharedPacketFunc func,
+                            void *opaque)
+{
+    struct tpacket3_hdr *ppd;
+    uint32_t i;
+
+    VIR_WARNINGS_NO_CAST_ALIGN
+    ppd = (struct tpacket3_hdr *)((uint8_t *)bd +
+                                  bd->hdr.bh1.offset_to_first_pkt);
+
+    for (i = 0; i < bd->hdr.bh1.num_pkts; i++) {
+        struct sockaddr_ll *sll;
+
+        sll = (struct sockaddr_ll *)((uint8_t *)ppd +
+                                     TPACKET_ALIGN(sizeof(*ppd)));
+
+        /* outgoing packets of a tap device are sent to the VM */
+        func(sll->sll_ifindex,
+             sll->sll_pkttype != PACKET_OUTGOING,
+             (uint8_t *)ppd + ppd->tp_mac,
+             ppd->tp_snaplen,
+             opaque);
+
+        ppd = (struct tpacket3_hdr *)((uint8_t *)ppd + ppd->tp_next_offset);
+    }
+    VIR_WARNINGS_RESET
+}
+
+static void
+virNWFilterSnoopSharedTimerSubmit(virNWFilterSnoopSharedPort *port)
+{
+    virNWFilterDHCPDecodeJob *job = g_new0(virNWFilterDHCPDecodeJob, 1);
+
+    /* a job without packet runs the lease timer of the request */
+    job->req = port->req;
+    virNWFilterSnoopReqGet(job->req);
+
+    if (virThreadPoolSendJob(port->worker, 0, job) < 0) {
+        virNWFilterSnoopReqPut(job->req);
+        g_free(job);
+    }
+}
+
+/*
+ * Drop the ports whose request was cancelled or failed, or all ports
+ * if @all is set, marking their requests as failed, and run the lease
+ * timers of the others if @timer is set.
+ *
+ * Returns true if no port is left and the capture thread has to end.
+ */
+static bool
+virNWFilterSnoopSharedReap(bool all, bool timer)
+{
+    g_autoptr(GPtrArray) gone =
+        g_ptr_array_new_with_free_func(virNWFilterSnoopSharedPortFree);
+    g_autoptr(GPtrArray) dead = g_ptr_array_new();
+    g_autoptr(GPtrArray) live = g_ptr_array_new();
+    g_autoptr(GPtrArray) ports = g_ptr_array_new();
+    GHashTableIter iter;
+    gpointer value;
+    GSList *next;
+    bool quit = false;
+    size_t i;
+
+    /* ports are only freed by this thread, so they can be looked at
+     * outside of the lock which must not be held while taking the
+     * lock of a request */
+    VIR_WITH_MUTEX_LOCK_GUARD(&virNWFilterSnoopState.sharedLock) {
+        g_hash_table_iter_init(&iter, virNWFilterSnoopState.sharedPorts);
+        while (g_hash_table_iter_next(&iter, NULL, &value))
+            g_ptr_array_add(ports, value);
+    }
+
+    for (i = 0; i < ports->len; i++) {
+        virNWFilterSnoopSharedPort *port = g_ptr_array_index(ports, i);
+        bool failed = false;
+
+        VIR_WITH_MUTEX_LOCK_GUARD(&port->req->lock) {
+            /* like a snooping thread of a single interface failing */
+            if (all)
+                port->req->jobCompletionStatus = -1;
+            failed = port->req->jobCompletionStatus != 0;
+        }
+
+        if (failed || !virNWFilterSnoopIsActive(port->threadkey))
+            g_ptr_array_add(dead, port);
+        else if (timer)
+            g_ptr_array_add(live, port);
+    }
+
+    VIR_WITH_MUTEX_LOCK_GUARD(&virNWFilterSnoopState.sharedLock) {
+        /* ports replaced meanwhile are on the retired list */
+        for (i = 0; i < dead->len; i++) {
+            virNWFilterSnoopSharedPort *port = g_ptr_array_index(dead, i);
+
+            if (g_hash_table_lookup(virNWFilterSnoopState.sharedPorts,
+                                    GINT_TO_POINTER(port->ifindex)) != port)
+                continue;
+
+            g_hash_table_remove(virNWFilterSnoopState.sharedPorts,
+                                GINT_TO_POINTER(port->ifindex));
+            g_ptr_array_add(gone, port);
+        }
+
+        for (i = 0; i < live->len; ) {
+            virNWFilterSnoopSharedPort *port = g_ptr_array_index(live, i);
+
+            if (g_hash_table_lookup(virNWFilterSnoopState.sharedPorts,
+                                    GINT_TO_POINTER(port->ifindex)) != port)
+                g_ptr_array_remove_index_fast(live, i);
+            else
+                i++;
+        }
+
+        for (next = virNWFilterSnoopState.sharedRetired; next; next = next->next)
+            g_ptr_array_add(gone, next->data);
+        g_clear_pointer(&virNWFilterSnoopState.sharedRetired, g_slist_free);
+
+        if (g_hash_table_size(virNWFilterSnoopState.sharedPorts) == 0) {
+            virNWFilterSnoopState.sharedRunning = false;
+            quit = true;
+        }
+    }
+
+    for (i = 0; i < live->len; i++)
+        virNWFilterSnoopSharedTimerSubmit(g_ptr_array_index(live, i));
+
+    return quit;
+}
+
+/*
+ * The shared DHCP snooping thread. It reads the packets of all
+ * snooped interfaces from the ring buffer of a single socket and
+ * submits them to the worker thread serving the interface.
+ */
+static void
+virNWFilterSnoopSharedThread(void *opaque)
+{
+    virNWFilterSnoopSharedSock *sock = opaque;
+    struct pollfd pfd = {
+        .fd = sock->fd,
+        .events = POLLIN | POLLERR,
+    };
+    size_t blocknum = 0;
+    time_t lastReap = time(0);
+    time_t lastTimer = lastReap;
+    bool error = false;
+
+    while (true) {
+        struct tpacket_block_desc *bd;
+        time_t now;
+
+        VIR_WARNINGS_NO_CAST_ALIGN
+        bd = (struct tpacket_block_desc *)(sock->ring +
+                                           blocknum * SNOOP_SHARED_BLOCK_SIZE);
+        VIR_WARNINGS_RESET
+
+        if (g_atomic_int_get(&bd->hdr.bh1.block_status) & TP_STATUS_USER) {
+            virNWFilterSnoopSharedBlock(bd, virNWFilterSnoopSharedPacket, NULL);
+
+            /* hand the block back to the kernel */
+            g_atomic_int_set(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL);
+            blocknum = (blocknum + 1) % SNOOP_SHARED_BLOCK_NR;
+        } else if (poll(&pfd, 1, SNOOP_SHARED_POLL_MS) < 0 &&
+                   errno != EAGAIN && errno != EINTR) {
+            virReportSystemError(errno, "%s",
+                                 _("poll on DHCP snooping socket failed"));
+            error = true;
+        }
+
+        now = time(0);
+        if (error || now != lastReap) {
+            bool timer = now - lastTimer >= SNOOP_POLL_MAX_TIMEOUT_MS / 1000;
+
+            lastReap = now;
+            if (timer)
+                lastTimer = now;
+
+            if (virNWFilterSnoopSharedReap(error, timer))
+                break;
+        }
+    }
+
+    virNWFilterSnoopSharedSockFree(sock);
+
+    ignore_value(g_atomic_int_dec_and_test(&virNWFilterSnoopState.nThreads));
+}
+
+/*
+ * Add the interface of @req to the shared capture, starting the
+ * capture thread if it is not running. The request's reference
+ * held by the caller is passed on to the shared capture on success.
+ */
+static int
+virNWFilterSnoopSharedAdd(virNWFilterSnoopReq *req)
+{
+    VIR_LOCK_GUARD lock = virLockGuardLock(&virNWFilterSnoopState.sharedLock);
+    virNWFilterSnoopSharedPort *port;
+    virNWFilterSnoopSharedPort *old;
+    virNWFilterSnoopRateLimitConf rateLimit = {
+        .prev = time(0),
+        .rate = DHCP_PKT_RATE,
+        .burstRate = DHCP_PKT_BURST,
+        .burstInterval = DHCP_BURST_INTERVAL_S,
+    };
+    size_t i;
+
+    for (i = 0; i < SNOOP_SHARED_WORKERS; i++) {
+        if (virNWFilterSnoopState.sharedWorkers[i])
+            continue;
+
+        if (!(virNWFilterSnoopState.sharedWorkers[i] =
+              virThreadPoolNewFull(1, 1, 0, virNWFilterDHCPDecodeWorker,
+                                   "dhcp-decode", NULL, NULL)))
+            return -1;
+    }
+
+    if (!virNWFilterSnoopState.sharedRunning) {
+        virNWFilterSnoopSharedSock *sock;
+        virThread thread;
+
+        if (!(sock = virNWFilterSnoopSharedOpen()))
+            return -1;
+
+        if (virThreadCreateFull(&thread, false, virNWFilterSnoopSharedThread,
+                                "dhcp-snoop", false, sock) != 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("could not create shared DHCP snooping thread"));
+            virNWFilterSnoopSharedSockFree(sock);
+            return -1;
+        }
+
+        g_atomic_int_add(&virNWFilterSnoopState.nThreads, 1);
+        virNWFilterSnoopState.sharedRunning = true;
+    }
+
+    port = g_new0(virNWFilterSnoopSharedPort, 1);
+    port->req = req;
+    port->threadkey = g_strdup(req->threadkey);
+    port->ifname = g_strdup(req->binding->portdevname);
+    port->ifindex = req->ifindex;
+    /* serve all packets of an interface by the same worker, in order */
+    port->worker = virNWFilterSnoopState.sharedWorkers[req->ifindex %
+                                                        SNOOP_SHARED_WORKERS];
+    virMacAddrSet(&port->mac, &req->binding->mac);
+    for (i = 0; i < G_N_ELEMENTS(port->rateLimit); i++)
+        memcpy(&port->rateLimit[i], &rateLimit, sizeof(rateLimit));
+
+    /* the index of a vanished interface may have been reused */
+    old = g_hash_table_lookup(virNWFilterSnoopState.sharedPorts,
+                              GINT_TO_POINTER(port->ifindex));
+    if (old)
+        virNWFilterSnoopState.sharedRetired =
+            g_slist_prepend(virNWFilterSnoopState.sharedRetired, old);
+
+    g_hash_table_insert(virNWFilterSnoopState.sharedPorts,
+                        GINT_TO_POINTER(port->ifindex), port);
+
+    return 0;
+}
+
 static void
 virNWFilterSnoopIFKeyFMT(char *ifkey, const unsigned char *vmuuid,
                          const virMacAddr *macaddr)
@@ -1458,6 +2103,8 @@ virNWFilterDHCPSnoopReq(virNWFilterTechDriver *techdriver,
 
     virMutexLock(&virNWFilterSnoopState.snoopLock);
 
+    virNWFilterSnoopPruneWanted();
+
     if (virHashAddEntry(virNWFilterSnoopState.ifnameToKey,
                         req->binding->portdevname,
                         req->ifkey) < 0) {
@@ -1480,17 +2127,19 @@ virNWFilterDHCPSnoopReq(virNWFilterTechDriver *techdriver,
     /* prevent thread from holding req */
     virMutexLock(&req->lock);
 
-    if (virThreadCreateFull(&thread, false, virNWFilterDHCPSnoopThread,
-                            "dhcp-snoop", false, req) != 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("virNWFilterDHCPSnoopReq virThreadCreate failed on interface '%1$s'"),
-                       binding->portdevname);
-        goto exit_snoopreq_unlock;
-    }
+    if (!virNWFilterSnoopState.shared) {
+        if (virThreadCreateFull(&thread, false, virNWFilterDHCPSnoopThread,
+                                "dhcp-snoop", false, req) != 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("virNWFilterDHCPSnoopReq virThreadCreate failed on interface '%1$s'"),
+                           binding->portdevname);
+            goto exit_snoopreq_unlock;
+        }
 
-    threadPuts = true;
+        threadPuts = true;
 
-    g_atomic_int_add(&virNWFilterSnoopState.nThreads, 1);
+        g_atomic_int_add(&virNWFilterSnoopState.nThreads, 1);
+    }
 
     req->threadkey = virNWFilterSnoopActivate(req);
     if (!req->threadkey) {
@@ -1500,6 +2149,14 @@ virNWFilterDHCPSnoopReq(virNWFilterTechDriver *techdriver,
         goto exit_snoopreq_unlock;
     }
 
+    if (virNWFilterSnoopState.shared) {
+        if (virNWFilterSnoopSharedAdd(req) < 0)
+            goto exit_snoop_cancel;
+
+        /* the shared capture 'puts' the req like the thread would */
+        threadPuts = true;
+    }
+
     if (virNWFilterSnoopReqRestore(req) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Restoring of leases failed on interface '%1$s'"),
@@ -1508,15 +2165,17 @@ virNWFilterDHCPSnoopReq(virNWFilterTechDriver *techdriver,
     }
 
     /* sync with thread */
-    if (virCondWait(&req->threadStatusCond, &req->lock) < 0) {
-        virReportSystemError(errno, "%s",
-                             _("unable to wait on dhcp snoop thread"));
-        goto exit_snoop_cancel;
-    }
+    if (!virNWFilterSnoopState.shared) {
+        if (virCondWait(&req->threadStatusCond, &req->lock) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("unable to wait on dhcp snoop thread"));
+            goto exit_snoop_cancel;
+        }
 
-    if (req->threadStatus != THREAD_STATUS_OK) {
-        virErrorRestore(&req->threadError);
-        goto exit_snoop_cancel;
+        if (req->threadStatus != THREAD_STATUS_OK) {
+            virErrorRestore(&req->threadError);
+            goto exit_snoop_cancel;
+        }
     }
 
     virMutexUnlock(&req->lock);
@@ -1542,74 +2201,291 @@ virNWFilterDHCPSnoopReq(virNWFilterTechDriver *techdriver,
     return -1;
 }
 
+/*
+ * Fill the journal record of a lease. Returns -1 if the lease cannot be
+ * represented by a record.
+ */
+static int
+virNWFilterSnoopLeaseRecFill(virNWFilterSnoopLeaseRec *rec,
+                             const char *ifkey,
+                             virNWFilterSnoopIPLease *ipl)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+
+    memset(rec, 0, sizeof(*rec));
+
+    /* the ifkey is formatted by virNWFilterSnoopIFKeyFMT() */
+    memcpy(uuidstr, ifkey, VIR_UUID_STRING_BUFLEN - 1);
+    uuidstr[VIR_UUID_STRING_BUFLEN - 1] = '\0';
+
+    if (virUUIDParse(uuidstr, rec->vmuuid) < 0 ||
+        virMacAddrParse(ifkey + VIR_UUID_STRING_BUFLEN, &rec->mac) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("invalid interface key \"%1$s\""), ifkey);
+        return -1;
+    }
+
+    if (!VIR_SOCKET_ADDR_IS_FAMILY(&ipl->ipAddress, AF_INET))
+        return -1;
+
+    rec->timeout = ipl->timeout;
+    rec->ipAddress = ipl->ipAddress.data.inet4.sin_addr.s_addr;
+    if (VIR_SOCKET_ADDR_IS_FAMILY(&ipl->ipServer, AF_INET))
+        rec->ipServer = ipl->ipServer.data.inet4.sin_addr.s_addr;
+
+    return 0;
+}
+
+static guint
+virNWFilterSnoopLeaseRecHash(gconstpointer rec)
+{
+    return virHashCodeGen((const char *)rec + LEASE_REC_KEY_OFFSET,
+                          LEASE_REC_KEY_LEN, 0);
+}
+
+static gboolean
+virNWFilterSnoopLeaseRecEqual(gconstpointer a, gconstpointer b)
+{
+    return memcmp((const char *)a + LEASE_REC_KEY_OFFSET,
+                  (const char *)b + LEASE_REC_KEY_OFFSET,
+                  LEASE_REC_KEY_LEN) == 0;
+}
+
+/*
+ * Apply the records to the index of the leases in the lease file.
+ * Only call this function from the journal thread or while it is
+ * not running.
+ */
 static void
-virNWFilterSnoopLeaseFileClose(void)
+virNWFilterSnoopJournalIndexApply(GByteArray *records)
 {
-    VIR_FORCE_CLOSE(virNWFilterSnoopState.leaseFD);
+    size_t nrecs = records->len / sizeof(virNWFilterSnoopLeaseRec);
+    size_t i;
+
+    for (i = 0; i < nrecs; i++) {
+        virNWFilterSnoopLeaseRec *rec =
+            (virNWFilterSnoopLeaseRec *)records->data + i;
+
+        if (rec->timeout == 0) {
+            g_hash_table_remove(virNWFilterSnoopState.journalIndex, rec);
+        } else {
+            rec = g_memdup(rec, sizeof(*rec));
+            g_hash_table_replace(virNWFilterSnoopState.journalIndex, rec, rec);
+        }
+    }
 }
 
+/*
+ * Replace the lease file with one holding just @records and use it
+ * for appending records from now on.
+ */
 static void
-virNWFilterSnoopLeaseFileOpen(void)
+virNWFilterSnoopJournalReplace(GByteArray *records)
 {
-    virNWFilterSnoopLeaseFileClose();
+    VIR_AUTOCLOSE tfd = -1;
+
+    VIR_FORCE_CLOSE(virNWFilterSnoopState.leaseFD);
+
+    if (g_mkdir_with_parents(LEASEFILE_DIR, 0700) < 0) {
+        virReportSystemError(errno, _("mkdir(\"%1$s\")"), LEASEFILE_DIR);
+        return;
+    }
+
+    if (unlink(TMPLEASEFILE) < 0 && errno != ENOENT)
+        virReportSystemError(errno, _("unlink(\"%1$s\")"), TMPLEASEFILE);
+
+    tfd = open(TMPLEASEFILE, O_CREAT|O_WRONLY|O_TRUNC|O_EXCL|O_CLOEXEC, 0644);
+    if (tfd < 0) {
+        virReportSystemError(errno, _("open(\"%1$s\")"), TMPLEASEFILE);
+        return;
+    }
+
+    if (safewrite(tfd, LEASEFILE_MAGIC,
+                  LEASEFILE_MAGIC_LEN) != (ssize_t)LEASEFILE_MAGIC_LEN ||
+        safewrite(tfd, records->data, records->len) != (ssize_t)records->len ||
+        g_fsync(tfd) < 0) {
+        virReportSystemError(errno, _("unable to write %1$s"), TMPLEASEFILE);
+        unlink(TMPLEASEFILE);
+        return;
+    }
+
+    if (VIR_CLOSE(tfd) < 0) {
+        virReportSystemError(errno, _("unable to close %1$s"), TMPLEASEFILE);
+        /* assuming the old lease file is still better, skip the renaming */
+        unlink(TMPLEASEFILE);
+        return;
+    }
+
+    if (rename(TMPLEASEFILE, LEASEFILE) < 0) {
+        virReportSystemError(errno, _("rename(\"%1$s\", \"%2$s\")"),
+                             TMPLEASEFILE, LEASEFILE);
+        unlink(TMPLEASEFILE);
+        return;
+    }
+
+    virNWFilterSnoopState.leaseFD = open(LEASEFILE, O_WRONLY|O_APPEND|O_CLOEXEC);
+    if (virNWFilterSnoopState.leaseFD < 0)
+        virReportSystemError(errno, _("open(\"%1$s\")"), LEASEFILE);
 
-    virNWFilterSnoopState.leaseFD = open(LEASEFILE, O_CREAT|O_RDWR|O_APPEND,
-                                         0644);
+    g_atomic_int_set(&virNWFilterSnoopState.wLeases, 0);
 }
 
 /*
- * Write a single lease to the given file.
- *
+ * Rewrite the lease file with the leases of the index that didn't
+ * expire yet.
  */
-static int
-virNWFilterSnoopLeaseFileWrite(int lfd, const char *ifkey,
-                               virNWFilterSnoopIPLease *ipl)
+static void
+virNWFilterSnoopJournalCompact(void)
 {
-    g_autofree char *lbuf = NULL;
-    g_autofree char *ipstr = virSocketAddrFormat(&ipl->ipAddress);
-    g_autofree char *dhcpstr = virSocketAddrFormat(&ipl->ipServer);
-    int len;
+    g_autoptr(GByteArray) records = g_byte_array_new();
+    time_t now = time(0);
+    GHashTableIter iter;
+    gpointer key;
 
-    if (!dhcpstr || !ipstr)
-        return -1;
+    g_hash_table_iter_init(&iter, virNWFilterSnoopState.journalIndex);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        virNWFilterSnoopLeaseRec *rec = key;
 
-    /* time intf ip dhcpserver */
-    lbuf = g_strdup_printf("%llu %s %s %s\n",
-                           (unsigned long long) ipl->timeout,
-                           ifkey, ipstr, dhcpstr);
-    len = strlen(lbuf);
+        if (rec->timeout < (uint64_t)now) {
+            g_hash_table_iter_remove(&iter);
+            continue;
+        }
 
-    if (safewrite(lfd, lbuf, len) != len) {
-        virReportSystemError(errno, "%s", _("lease file write failed"));
-        return -1;
+        g_byte_array_append(records, key, sizeof(*rec));
     }
 
-    ignore_value(g_fsync(lfd));
-    return 0;
+    virNWFilterSnoopJournalReplace(records);
+
+    /* have the requests of the expired leases cleaned up */
+    g_atomic_int_set(&virNWFilterSnoopState.pruneWanted, 1);
 }
 
 /*
- * Append a single lease to the end of the lease file.
- * To keep a limited number of dead leases, re-read the lease
- * file if the threshold of active leases versus written ones
- * exceeds a threshold.
+ * Append a batch of records to the lease file, syncing it once for
+ * the whole batch.
  */
 static void
-virNWFilterSnoopLeaseFileSave(virNWFilterSnoopIPLease *ipl)
+virNWFilterSnoopJournalWrite(GByteArray *batch)
 {
-    VIR_LOCK_GUARD lock = virLockGuardLock(&virNWFilterSnoopState.snoopLock);
-    virNWFilterSnoopReq *req = ipl->snoopReq;
+    int nrecs = batch->len / sizeof(virNWFilterSnoopLeaseRec);
+    int fd = virNWFilterSnoopState.leaseFD;
 
-    if (virNWFilterSnoopState.leaseFD < 0)
-        virNWFilterSnoopLeaseFileOpen();
-    if (virNWFilterSnoopLeaseFileWrite(virNWFilterSnoopState.leaseFD,
-                                       req->ifkey, ipl) < 0)
+    if (nrecs == 0)
         return;
 
+    virNWFilterSnoopJournalIndexApply(batch);
+
+    if (fd < 0 ||
+        safewrite(fd, batch->data, batch->len) != (ssize_t)batch->len) {
+        if (fd >= 0)
+            virReportSystemError(errno, "%s", _("lease file write failed"));
+        /* a rewrite also gets rid of a partially written record */
+        virNWFilterSnoopJournalCompact();
+        return;
+    }
+
+    ignore_value(g_fsync(fd));
+
     /* keep dead leases at < ~95% of file size */
-    if (g_atomic_int_add(&virNWFilterSnoopState.wLeases, 1) >=
+    if (g_atomic_int_add(&virNWFilterSnoopState.wLeases, nrecs) + nrecs >=
         g_atomic_int_get(&virNWFilterSnoopState.nLeases) * 20)
-        virNWFilterSnoopLeaseFileLoad();   /* load & refresh lease file */
+        virNWFilterSnoopJournalCompact();
+}
+
+/*
+ * The lease journal thread. It writes the records queued by
+ * virNWFilterSnoopLeaseFileSave() and compacts the lease file, so
+ * that no file I/O happens while the snoop lock or a request's
+ * lock is held. The thread never takes any of these locks.
+ */
+static void
+virNWFilterSnoopJournalThread(void *opaque G_GNUC_UNUSED)
+{
+    bool quit = false;
+
+    while (!quit) {
+        g_autoptr(GByteArray) batch = NULL;
+
+        VIR_WITH_MUTEX_LOCK_GUARD(&virNWFilterSnoopState.journalLock) {
+            while (!virNWFilterSnoopState.journalQuit &&
+                   virNWFilterSnoopState.journalPending->len == 0)
+                ignore_value(virCondWait(&virNWFilterSnoopState.journalCond,
+                                         &virNWFilterSnoopState.journalLock));
+
+            quit = virNWFilterSnoopState.journalQuit;
+            batch = g_steal_pointer(&virNWFilterSnoopState.journalPending);
+            virNWFilterSnoopState.journalPending = g_byte_array_new();
+        }
+
+        /* records queued while writing are batched for the next sync */
+        virNWFilterSnoopJournalWrite(batch);
+    }
+}
+
+/*
+ * Stop the journal thread after it wrote all queued records.
+ */
+static void
+virNWFilterSnoopLeaseFileClose(void)
+{
+    bool running = false;
+
+    VIR_WITH_MUTEX_LOCK_GUARD(&virNWFilterSnoopState.journalLock) {
+        running = virNWFilterSnoopState.journalRunning;
+        virNWFilterSnoopState.journalQuit = true;
+        virCondSignal(&virNWFilterSnoopState.journalCond);
+    }
+
+    if (running)
+        virThreadJoin(&virNWFilterSnoopState.journalThread);
+
+    VIR_WITH_MUTEX_LOCK_GUARD(&virNWFilterSnoopState.journalLock) {
+        virNWFilterSnoopState.journalRunning = false;
+        virNWFilterSnoopState.journalQuit = false;
+    }
+
+    VIR_FORCE_CLOSE(virNWFilterSnoopState.leaseFD);
+}
+
+/*
+ * Start the journal thread appending to the lease file.
+ */
+static void
+virNWFilterSnoopLeaseFileOpen(void)
+{
+    VIR_LOCK_GUARD lock = virLockGuardLock(&virNWFilterSnoopState.journalLock);
+
+    if (virNWFilterSnoopState.journalRunning)
+        return;
+
+    if (virThreadCreateFull(&virNWFilterSnoopState.journalThread, true,
+                            virNWFilterSnoopJournalThread,
+                            "dhcp-leases", false, NULL) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to create lease journal thread"));
+        return;
+    }
+
+    virNWFilterSnoopState.journalRunning = true;
+}
+
+/*
+ * Queue a single lease for being appended to the lease file by the
+ * journal thread.
+ */
+static void
+virNWFilterSnoopLeaseFileSave(virNWFilterSnoopIPLease *ipl)
+{
+    virNWFilterSnoopLeaseRec rec;
+
+    if (virNWFilterSnoopLeaseRecFill(&rec, ipl->snoopReq->ifkey, ipl) < 0)
+        return;
+
+    VIR_WITH_MUTEX_LOCK_GUARD(&virNWFilterSnoopState.journalLock) {
+        g_byte_array_append(virNWFilterSnoopState.journalPending,
+                            (const guint8 *)&rec, sizeof(rec));
+        virCondSignal(&virNWFilterSnoopState.journalCond);
+    }
 }
 
 /*
@@ -1639,7 +2515,23 @@ virNWFilterSnoopPruneIter(const void *payload,
 }
 
 /*
- * Iterator to write all leases of a single request to a file.
+ * Prune the requests if the lease file was compacted since the last
+ * time, i.e. leases are likely to have expired in the meantime.
+ * Call this function with the SnoopLock held.
+ */
+static void
+virNWFilterSnoopPruneWanted(void)
+{
+    if (!g_atomic_int_compare_and_exchange(&virNWFilterSnoopState.pruneWanted,
+                                           1, 0))
+        return;
+
+    virHashRemoveSet(virNWFilterSnoopState.snoopReqs,
+                     virNWFilterSnoopPruneIter, NULL);
+}
+
+/*
+ * Iterator to collect the records of all leases of a single request.
  * Call this function with the SnoopLock held.
  */
 static int
@@ -1648,85 +2540,102 @@ virNWFilterSnoopSaveIter(void *payload,
                          void *data)
 {
     virNWFilterSnoopReq *req = payload;
-    int tfd = *(int *)data;
+    GByteArray *records = data;
     virNWFilterSnoopIPLease *ipl;
+    virNWFilterSnoopLeaseRec rec;
 
     /* protect req->start */
     VIR_LOCK_GUARD lock = virLockGuardLock(&req->lock);
 
-    for (ipl = req->start; ipl; ipl = ipl->next)
-        ignore_value(virNWFilterSnoopLeaseFileWrite(tfd, req->ifkey, ipl));
+    for (ipl = req->start; ipl; ipl = ipl->next) {
+        if (virNWFilterSnoopLeaseRecFill(&rec, req->ifkey, ipl) == 0)
+            g_byte_array_append(records, (const guint8 *)&rec, sizeof(rec));
+    }
 
     return 0;
 }
 
 /*
- * Write all valid leases into a temporary file and then
- * rename the file to the final file.
+ * Add a lease read from the lease file to its request.
  * Call this function with the SnoopLock held.
+ *
+ * Returns -1 if no more leases should be read.
  */
-static void
-virNWFilterSnoopLeaseFileRefresh(void)
+static int
+virNWFilterSnoopLeaseFileRestore(const char *ifkey,
+                                 virNWFilterSnoopIPLease *ipl)
 {
-    int tfd;
-
-    if (g_mkdir_with_parents(LEASEFILE_DIR, 0700) < 0) {
-        virReportError(errno, _("mkdir(\"%1$s\")"), LEASEFILE_DIR);
-        return;
-    }
+    virNWFilterSnoopReq *req;
 
-    if (unlink(TMPLEASEFILE) < 0 && errno != ENOENT)
-        virReportSystemError(errno, _("unlink(\"%1$s\")"), TMPLEASEFILE);
+    req = virNWFilterSnoopReqGetByIFKey(ifkey);
+    if (!req) {
+        req = virNWFilterSnoopReqNew(ifkey);
+        if (!req)
+            return -1;
 
-    /* lease file loaded, delete old one */
-    tfd = open(TMPLEASEFILE, O_CREAT|O_RDWR|O_TRUNC|O_EXCL, 0644);
-    if (tfd < 0) {
-        virReportSystemError(errno, _("open(\"%1$s\")"), TMPLEASEFILE);
-        return;
+        if (virHashAddEntry(virNWFilterSnoopState.snoopReqs, ifkey, req) < 0) {
+            virNWFilterSnoopReqPut(req);
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("virNWFilterSnoopLeaseFileLoad req add failed on interface \"%1$s\""),
+                           ifkey);
+            return 0;
+        }
     }
 
-    if (virNWFilterSnoopState.snoopReqs) {
-        /* clean up the requests */
-        virHashRemoveSet(virNWFilterSnoopState.snoopReqs,
-                         virNWFilterSnoopPruneIter, NULL);
-        /* now save them */
-        virHashForEach(virNWFilterSnoopState.snoopReqs,
-                       virNWFilterSnoopSaveIter, (void *)&tfd);
-    }
+    ipl->snoopReq = req;
 
-    if (VIR_CLOSE(tfd) < 0) {
-        virReportSystemError(errno, _("unable to close %1$s"), TMPLEASEFILE);
-        /* assuming the old lease file is still better, skip the renaming */
-        goto cleanup;
-    }
+    if (ipl->timeout)
+        virNWFilterSnoopReqLeaseAdd(req, ipl, false);
+    else
+        virNWFilterSnoopReqLeaseDel(req, &ipl->ipAddress, false, false);
 
-    if (rename(TMPLEASEFILE, LEASEFILE) < 0) {
-        virReportSystemError(errno, _("rename(\"%1$s\", \"%2$s\")"),
-                             TMPLEASEFILE, LEASEFILE);
-        unlink(TMPLEASEFILE);
-    }
-    g_atomic_int_set(&virNWFilterSnoopState.wLeases, 0);
+    virNWFilterSnoopReqPut(req);
 
- cleanup:
-    virNWFilterSnoopLeaseFileOpen();
+    return 0;
 }
 
+/*
+ * Read the records following the magic of the lease file.
+ * Call this function with the SnoopLock held.
+ */
+static void
+virNWFilterSnoopLeaseFileLoadJournal(FILE *fp, time_t now)
+{
+    virNWFilterSnoopLeaseRec rec;
+    virNWFilterSnoopIPLease ipl;
+    char ifkey[VIR_IFKEY_LEN];
+
+    /* a truncated record at the end is from an interrupted write */
+    while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+        memset(&ipl, 0, sizeof(ipl));
+
+        ipl.timeout = rec.timeout;
+        if (ipl.timeout && ipl.timeout < now)
+            continue;
+
+        virNWFilterSnoopIFKeyFMT(ifkey, rec.vmuuid, &rec.mac);
+        virSocketAddrSetIPv4AddrNetOrder(&ipl.ipAddress, rec.ipAddress);
+        if (rec.ipServer)
+            virSocketAddrSetIPv4AddrNetOrder(&ipl.ipServer, rec.ipServer);
 
+        if (virNWFilterSnoopLeaseFileRestore(ifkey, &ipl) < 0)
+            break;
+    }
+}
+
+/*
+ * Read a lease file in the text format of older versions.
+ * Call this function with the SnoopLock held.
+ */
 static void
-virNWFilterSnoopLeaseFileLoad(void)
+virNWFilterSnoopLeaseFileLoadText(FILE *fp, time_t now)
 {
     char line[256], ifkey[VIR_IFKEY_LEN];
     char ipstr[INET_ADDRSTRLEN], srvstr[INET_ADDRSTRLEN];
     virNWFilterSnoopIPLease ipl;
-    virNWFilterSnoopReq *req;
-    time_t now;
-    FILE *fp;
-    int ln = 0, tmp;
-    VIR_LOCK_GUARD lock = virLockGuardLock(&virNWFilterSnoopState.snoopLock);
+    int ln = 0;
 
-    fp = fopen(LEASEFILE, "r");
-    time(&now);
-    while (fp && fgets(line, sizeof(line), fp)) {
+    while (fgets(line, sizeof(line), fp)) {
         unsigned long long timeout;
 
         if (line[strlen(line)-1] != '\n') {
@@ -1744,47 +2653,61 @@ virNWFilterSnoopLeaseFileLoad(void)
                            ln);
             break;
         }
+        memset(&ipl, 0, sizeof(ipl));
         ipl.timeout = timeout;
         if (ipl.timeout && ipl.timeout < now)
             continue;
-        req = virNWFilterSnoopReqGetByIFKey(ifkey);
-        if (!req) {
-            req = virNWFilterSnoopReqNew(ifkey);
-            if (!req)
-               break;
-
-            tmp = virHashAddEntry(virNWFilterSnoopState.snoopReqs, ifkey, req);
-
-            if (tmp < 0) {
-                virNWFilterSnoopReqPut(req);
-                virReportError(VIR_ERR_INTERNAL_ERROR,
-                               _("virNWFilterSnoopLeaseFileLoad req add failed on interface \"%1$s\""),
-                               ifkey);
-                continue;
-            }
-        }
 
         if (virSocketAddrParseIPv4(&ipl.ipAddress, ipstr) < 0) {
             virReportError(VIR_ERR_INTERNAL_ERROR,
                            _("line %1$d corrupt ipaddr \"%2$s\""),
                            ln, ipstr);
-            virNWFilterSnoopReqPut(req);
             continue;
         }
         ignore_value(virSocketAddrParseIPv4(&ipl.ipServer, srvstr));
-        ipl.snoopReq = req;
-
-        if (ipl.timeout)
-            virNWFilterSnoopReqLeaseAdd(req, &ipl, false);
-        else
-            virNWFilterSnoopReqLeaseDel(req, &ipl.ipAddress, false, false);
 
-        virNWFilterSnoopReqPut(req);
+        if (virNWFilterSnoopLeaseFileRestore(ifkey, &ipl) < 0)
+            break;
     }
+}
 
-    VIR_FORCE_FCLOSE(fp);
+/*
+ * Load the leases from the lease file and rewrite it with the valid
+ * ones. The journal thread must not be running.
+ */
+static void
+virNWFilterSnoopLeaseFileLoad(void)
+{
+    g_autoptr(GByteArray) records = g_byte_array_new();
+    char magic[LEASEFILE_MAGIC_LEN];
+    time_t now = time(0);
+    FILE *fp;
 
-    virNWFilterSnoopLeaseFileRefresh();
+    VIR_WITH_MUTEX_LOCK_GUARD(&virNWFilterSnoopState.snoopLock) {
+        if ((fp = fopen(LEASEFILE, "r"))) {
+            if (fread(magic, sizeof(magic), 1, fp) == 1 &&
+                memcmp(magic, LEASEFILE_MAGIC, sizeof(magic)) == 0) {
+                virNWFilterSnoopLeaseFileLoadJournal(fp, now);
+            } else {
+                rewind(fp);
+                virNWFilterSnoopLeaseFileLoadText(fp, now);
+            }
+        }
+
+        VIR_FORCE_FCLOSE(fp);
+
+        /* clean up the requests */
+        virHashRemoveSet(virNWFilterSnoopState.snoopReqs,
+                         virNWFilterSnoopPruneIter, NULL);
+
+        /* now save them */
+        virHashForEach(virNWFilterSnoopState.snoopReqs,
+                       virNWFilterSnoopSaveIter, records);
+    }
+
+    g_hash_table_remove_all(virNWFilterSnoopState.journalIndex);
+    virNWFilterSnoopJournalIndexApply(records);
+    virNWFilterSnoopJournalReplace(records);
 }
 
 /*
@@ -1850,12 +2773,12 @@ virNWFilterSnoopEndThreads(void)
 }
 
 int
-virNWFilterDHCPSnoopInit(void)
+virNWFilterDHCPSnoopInit(bool shared)
 {
     if (virNWFilterSnoopState.snoopReqs)
         return 0;
 
-    VIR_DEBUG("Initializing DHCP snooping");
+    VIR_DEBUG("Initializing DHCP snooping, shared=%d", shared);
 
     if (virMutexInitRecursive(&virNWFilterSnoopState.snoopLock) < 0)
         return -1;
@@ -1865,6 +2788,36 @@ virNWFilterDHCPSnoopInit(void)
         return -1;
     }
 
+    if (virMutexInit(&virNWFilterSnoopState.sharedLock) < 0) {
+        virMutexDestroy(&virNWFilterSnoopState.activeLock);
+        virMutexDestroy(&virNWFilterSnoopState.snoopLock);
+        return -1;
+    }
+
+    if (virMutexInit(&virNWFilterSnoopState.journalLock) < 0) {
+        virMutexDestroy(&virNWFilterSnoopState.sharedLock);
+        virMutexDestroy(&virNWFilterSnoopState.activeLock);
+        virMutexDestroy(&virNWFilterSnoopState.snoopLock);
+        return -1;
+    }
+
+    if (virCondInit(&virNWFilterSnoopState.journalCond) < 0) {
+        virMutexDestroy(&virNWFilterSnoopState.journalLock);
+        virMutexDestroy(&virNWFilterSnoopState.sharedLock);
+        virMutexDestroy(&virNWFilterSnoopState.activeLock);
+        virMutexDestroy(&virNWFilterSnoopState.snoopLock);
+        return -1;
+    }
+
+    virNWFilterSnoopState.journalPending = g_byte_array_new();
+    virNWFilterSnoopState.journalIndex =
+        g_hash_table_new_full(virNWFilterSnoopLeaseRecHash,
+                              virNWFilterSnoopLeaseRecEqual,
+                              g_free, NULL);
+
+    virNWFilterSnoopState.shared = shared;
+    virNWFilterSnoopState.sharedPorts = g_hash_table_new(g_direct_hash,
+                                                         g_direct_equal);
     virNWFilterSnoopState.ifnameToKey = virHashNew(NULL);
     virNWFilterSnoopState.active = virHashNew(NULL);
     virNWFilterSnoopState.snoopReqs =
@@ -1924,6 +2877,8 @@ virNWFilterDHCPSnoopEnd(const char *ifname)
         }
 
         virNWFilterSnoopReqPut(req);
+
+        virNWFilterSnoopPruneWanted();
     } else {                      /* free all of them */
         virNWFilterSnoopLeaseFileClose();
 
@@ -1933,18 +2888,32 @@ virNWFilterDHCPSnoopEnd(const char *ifname)
         virNWFilterSnoopEndThreads();
 
         virNWFilterSnoopLeaseFileLoad();
+        virNWFilterSnoopLeaseFileOpen();
     }
 }
 
 void
 virNWFilterDHCPSnoopShutdown(void)
 {
+    size_t i;
+
     if (!virNWFilterSnoopState.snoopReqs)
         return;
 
     virNWFilterSnoopEndThreads();
     virNWFilterSnoopJoinThreads();
 
+    /* the capture thread is gone, wait for its workers */
+    for (i = 0; i < SNOOP_SHARED_WORKERS; i++)
+        g_clear_pointer(&virNWFilterSnoopState.sharedWorkers[i],
+                        virThreadPoolFree);
+
+    VIR_WITH_MUTEX_LOCK_GUARD(&virNWFilterSnoopState.sharedLock) {
+        g_clear_pointer(&virNWFilterSnoopState.sharedPorts, g_hash_table_unref);
+    }
+
+    virMutexDestroy(&virNWFilterSnoopState.sharedLock);
+
     VIR_WITH_MUTEX_LOCK_GUARD(&virNWFilterSnoopState.snoopLock) {
         virNWFilterSnoopLeaseFileClose();
         g_clear_pointer(&virNWFilterSnoopState.ifnameToKey, g_hash_table_unref);
@@ -1953,6 +2922,15 @@ virNWFilterDHCPSnoopShutdown(void)
 
     virMutexDestroy(&virNWFilterSnoopState.snoopLock);
 
+    VIR_WITH_MUTEX_LOCK_GUARD(&virNWFilterSnoopState.journalLock) {
+        g_clear_pointer(&virNWFilterSnoopState.journalPending,
+                        g_byte_array_unref);
+    }
+
+    g_clear_pointer(&virNWFilterSnoopState.journalIndex, g_hash_table_unref);
+    virCondDestroy(&virNWFilterSnoopState.journalCond);
+    virMutexDestroy(&virNWFilterSnoopState.journalLock);
+
     VIR_WITH_MUTEX_LOCK_GUARD(&virNWFilterSnoopState.activeLock) {
         g_clear_pointer(&virNWFilterSnoopState.active, g_hash_table_unref);
     }
@@ -1963,7 +2941,7 @@ virNWFilterDHCPSnoopShutdown(void)
 #else /* WITH_LIBPCAP */
 
 int
-virNWFilterDHCPSnoopInit(void)
+virNWFilterDHCPSnoopInit(bool shared G_GNUC_UNUSED)
 {
     VIR_DEBUG("No DHCP snooping support available");
     return 0;
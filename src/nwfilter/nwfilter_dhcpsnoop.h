@@ -24,7 +24,7 @@
 
 #include "nwfilter_tech_driver.h"
 
-int virNWFilterDHCPSnoopInit(void);
+int virNWFilterDHCPSnoopInit(bool shared);
 void virNWFilterDHCPSnoopShutdown(void);
 int virNWFilterDHCPSnoopReq(virNWFilterTechDriver *techdriver,
                             virNWFilterBindingDef *binding,
@@ -0,0 +1,52 @@
+/*
+ * nwfilter_dhcpsnooppriv.h: private declarations for DHCP snooping
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef LIBVIRT_NWFILTER_DHCPSNOOPPRIV_H_ALLOW
+# error "nwfilter_dhcpsnooppriv.h may only be included by nwfilter_dhcpsnoop.c or test suites"
+#endif /* LIBVIRT_NWFILTER_DHCPSNOOPPRIV_H_ALLOW */
+
+#pragma once
+
+#ifdef WITH_LIBPCAP
+# include <linux/if_packet.h>
+
+# include "virmacaddr.h"
+
+/*
+ * This header file should never be used outside unit tests.
+ */
+
+typedef void (*virNWFilterSnoopSharedPacketFunc)(int ifindex,
+                                                 bool fromVM,
+                                                 void *packet,
+                                                 int len,
+                                                 void *opaque);
+
+void
+virNWFilterSnoopSharedBlock(struct tpacket_block_desc *bd,
+                            virNWFilterSnoopSharedPacketFunc func,
+                            void *opaque);
+
+bool
+virNWFilterSnoopSharedAccept(const virMacAddr *mac,
+                             void *packet,
+                             int len,
+                             bool fromVM);
+
+#endif /* WITH_LIBPCAP */
@@ -36,10 +36,15 @@
 #include "configmake.h"
 #include "virpidfile.h"
 #include "viraccessapicheck.h"
+#include "virconf.h"
+#include "virfile.h"
+#include "virstring.h"
 
 #include "nwfilter_ipaddrmap.h"
 #include "nwfilter_dhcpsnoop.h"
 #include "nwfilter_learnipaddr.h"
+#include "nwfilter_ebiptables_driver.h"
+#include "nwfilter_nftables_driver.h"
 
 #define VIR_FROM_THIS VIR_FROM_NWFILTER
 
@@ -156,6 +161,86 @@ virNWFilterTriggerRebuildImpl(void *opaque)
 }
 
 
+/*
+ * Reads the technology driver to use from the driver config file
+ */
+static int
+nwfilterLoadDriverConfig(const char *filename,
+                         const char **techdriver,
+                         bool *snoopShared)
+{
+    g_autoptr(virConf) conf = NULL;
+    g_autofree char *fwBackendStr = NULL;
+    g_autofree char *snoopStr = NULL;
+
+    *techdriver = EBIPTABLES_DRIVER_ID;
+    *snoopShared = false;
+
+    if (access(filename, R_OK) != 0)
+        return 0;
+
+    if (!(conf = virConfReadFile(filename, 0)))
+        return -1;
+
+    if (virConfGetValueString(conf, "firewall_backend", &fwBackendStr) < 0)
+        return -1;
+
+    if (fwBackendStr && STREQ(fwBackendStr, "nftables")) {
+        *techdriver = NFTABLES_DRIVER_ID;
+    } else if (fwBackendStr && STRNEQ(fwBackendStr, "iptables")) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("unrecognized firewall_backend = '%1$s' set in nwfilter driver config file %2$s"),
+                       fwBackendStr, filename);
+        return -1;
+    }
+
+    if (virConfGetValueString(conf, "dhcp_snooping", &snoopStr) < 0)
+        return -1;
+
+    if (snoopStr && STREQ(snoopStr, "shared")) {
+        *snoopShared = true;
+    } else if (snoopStr && STRNEQ(snoopStr, "interface")) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("unrecognized dhcp_snooping = '%1$s' set in nwfilter driver config file %2$s"),
+                       snoopStr, filename);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Removes the rules instantiated by a different technology driver before
+ * the daemon was restarted, they would otherwise stay around next to the
+ * ones of the driver in use now.
+ */
+static int
+nwfilterSwitchTechDriver(virNWFilterDriverState *nwdriver)
+{
+    g_autofree char *path = g_strdup_printf("%s/techdriver", nwdriver->stateDir);
+    g_autofree char *previous = NULL;
+    const char *current = virNWFilterTechDriverGetName();
+
+    if (virFileReadAllQuiet(path, 1024, &previous) >= 0) {
+        virStringTrimOptionalNewline(previous);
+
+        if (STRNEQ(previous, current)) {
+            VIR_INFO("Switching from ACL tech driver '%s' to '%s'",
+                     previous, current);
+            virNWFilterTeardownAllWithDriver(nwdriver, previous);
+        }
+    }
+
+    if (virFileWriteStr(path, current, S_IRUSR | S_IWUSR) < 0) {
+        virReportSystemError(errno, _("cannot write '%1$s'"), path);
+        return -1;
+    }
+
+    return 0;
+}
+
+
 static int
 nwfilterStateCleanupLocked(void)
 {
@@ -217,6 +302,8 @@ nwfilterStateInitialize(bool privileged,
 {
     VIR_LOCK_GUARD lock = virLockGuardLock(&driverMutex);
     GDBusConnection *sysbus = NULL;
+    const char *techdriver = NULL;
+    bool snoopShared = false;
 
     if (root != NULL) {
         virReportError(VIR_ERR_INVALID_ARG, "%s",
@@ -263,10 +350,14 @@ nwfilterStateInitialize(bool privileged,
     if (virNWFilterLearnInit() < 0)
         goto error;
 
-    if (virNWFilterDHCPSnoopInit() < 0)
+    if (nwfilterLoadDriverConfig(SYSCONFDIR "/libvirt/nwfilter.conf",
+                                 &techdriver, &snoopShared) < 0)
+        goto error;
+
+    if (virNWFilterDHCPSnoopInit(snoopShared) < 0)
         goto error;
 
-    if (virNWFilterTechDriversInit(privileged) < 0)
+    if (virNWFilterTechDriversInit(privileged, techdriver) < 0)
         goto error;
 
     if (virNWFilterConfLayerInit(virNWFilterTriggerRebuildImpl, driver) < 0)
@@ -301,6 +392,9 @@ nwfilterStateInitialize(bool privileged,
     if (virNWFilterBindingObjListLoadAllConfigs(driver->bindings, driver->bindingDir) < 0)
         goto error;
 
+    if (nwfilterSwitchTechDriver(driver) < 0)
+        goto error;
+
     if (virNWFilterBuildAll(driver, false) < 0)
         goto error;
 
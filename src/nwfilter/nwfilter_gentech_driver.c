@@ -25,10 +25,13 @@
 #include "internal.h"
 
 #include "viralloc.h"
+#include "vircrypto.h"
 #include "virlog.h"
 #include "virerror.h"
+#include "virthread.h"
 #include "nwfilter_gentech_driver.h"
 #include "nwfilter_ebiptables_driver.h"
+#include "nwfilter_nftables_driver.h"
 #include "nwfilter_dhcpsnoop.h"
 #include "nwfilter_ipaddrmap.h"
 #include "nwfilter_learnipaddr.h"
@@ -43,27 +46,54 @@ VIR_LOG_INIT("nwfilter.nwfilter_gentech_driver");
 
 #define NWFILTER_DFLT_LEARN  "any"
 
+/* maximum number of threads updating the rules of interfaces in parallel */
+#define NWFILTER_BUILD_MAX_THREADS 8
+
 static int _virNWFilterTeardownFilter(const char *ifname);
 
 
 static virNWFilterTechDriver *filter_tech_drivers[] = {
     &ebiptables_driver,
+    &nftables_driver,
     NULL
 };
 
-int virNWFilterTechDriversInit(bool privileged)
+/* the driver used for instantiating filters */
+static const char *filter_tech_driver_name = EBIPTABLES_DRIVER_ID;
+
+/* interface name -> digest of the filter rules in effect on it */
+static virMutex rulesetsLock = VIR_MUTEX_INITIALIZER;
+static GHashTable *rulesets;
+
+int virNWFilterTechDriversInit(bool privileged, const char *name)
 {
     size_t i = 0;
     VIR_DEBUG("Initializing NWFilter technology drivers");
     while (filter_tech_drivers[i]) {
         if (!(filter_tech_drivers[i]->flags & TECHDRV_FLAG_INITIALIZED))
             filter_tech_drivers[i]->init(privileged);
+        if (name && STREQ(filter_tech_drivers[i]->name, name))
+            filter_tech_driver_name = filter_tech_drivers[i]->name;
         i++;
     }
+
+    if (name && STRNEQ(filter_tech_driver_name, name)) {
+        virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                       _("unknown ACL tech driver '%1$s'"), name);
+        return -1;
+    }
+
+    VIR_DEBUG("Using NWFilter technology driver '%s'", filter_tech_driver_name);
     return 0;
 }
 
 
+const char *virNWFilterTechDriverGetName(void)
+{
+    return filter_tech_driver_name;
+}
+
+
 void virNWFilterTechDriversShutdown(void)
 {
     size_t i = 0;
@@ -72,6 +102,10 @@ void virNWFilterTechDriversShutdown(void)
             filter_tech_drivers[i]->shutdown();
         i++;
     }
+
+    VIR_WITH_MUTEX_LOCK_GUARD(&rulesetsLock) {
+        g_clear_pointer(&rulesets, g_hash_table_unref);
+    }
 }
 
 
@@ -197,7 +231,7 @@ struct _virNWFilterInst {
 
 
 static void
-virNWFilterInstReset(virNWFilterInst *inst)
+virNWFilterInstUnlockFilters(virNWFilterInst *inst)
 {
     size_t i;
 
@@ -205,6 +239,15 @@ virNWFilterInstReset(virNWFilterInst *inst)
         virNWFilterObjUnlock(inst->filters[i]);
     g_clear_pointer(&inst->filters, g_free);
     inst->nfilters = 0;
+}
+
+
+static void
+virNWFilterInstReset(virNWFilterInst *inst)
+{
+    size_t i;
+
+    virNWFilterInstUnlockFilters(inst);
 
     for (i = 0; i < inst->nrules; i++)
         virNWFilterRuleInstFree(inst->rules[i]);
@@ -214,6 +257,113 @@ virNWFilterInstReset(virNWFilterInst *inst)
 
 
 
+/*
+ * Rules of an interface instantiated while updating filters, waiting to
+ * be applied along with the rules of the other interfaces
+ */
+typedef struct _virNWFilterPendingRules virNWFilterPendingRules;
+struct _virNWFilterPendingRules {
+    bool apply;
+    int ifindex;
+    char *digest;
+    virNWFilterInst inst;
+};
+
+
+static void
+virNWFilterPendingRulesReset(virNWFilterPendingRules *pending)
+{
+    virNWFilterInstReset(&pending->inst);
+    g_clear_pointer(&pending->digest, g_free);
+    pending->apply = false;
+}
+
+
+/**
+ * virNWFilterRulesDigest:
+ * @rules: the instantiated rules
+ * @nrules: number of rules
+ *
+ * Returns a digest of the rules and the values of the variables they
+ * reference, or NULL on error. Rules with equal digests produce the same
+ * firewall rules.
+ */
+static char *
+virNWFilterRulesDigest(virNWFilterRuleInst **rules,
+                       size_t nrules)
+{
+    g_auto(virBuffer) buf = VIR_BUFFER_INITIALIZER;
+    g_autofree char *str = NULL;
+    char *digest = NULL;
+    size_t i, j, k;
+
+    for (i = 0; i < nrules; i++) {
+        virNWFilterRuleDef *def = rules[i]->def;
+
+        virBufferAsprintf(&buf, "<chain name='%s' priority='%d'/>\n",
+                          rules[i]->chainSuffix, rules[i]->chainPriority);
+        virNWFilterRuleDefFormat(&buf, def);
+
+        for (j = 0; j < def->nVarAccess; j++) {
+            const char *name = virNWFilterVarAccessGetVarName(def->varAccess[j]);
+            virNWFilterVarValue *val = virHashLookup(rules[i]->vars, name);
+
+            if (!val)
+                continue;
+
+            for (k = 0; k < virNWFilterVarValueGetCardinality(val); k++)
+                virBufferAsprintf(&buf, "<parameter name='%s' value='%s'/>\n",
+                                  name, virNWFilterVarValueGetNthValue(val, k));
+        }
+    }
+
+    str = virBufferContentAndReset(&buf);
+
+    if (virCryptoHashString(VIR_CRYPTO_HASH_SHA256, NULLSTR_EMPTY(str),
+                            &digest) < 0)
+        return NULL;
+
+    return digest;
+}
+
+
+/*
+ * Record @digest (consumed) as the digest of the rules in effect on
+ * @ifname, or forget about the rules if @digest is NULL.
+ */
+static void
+virNWFilterRulesetUpdate(const char *ifname,
+                         char *digest)
+{
+    VIR_LOCK_GUARD lock = virLockGuardLock(&rulesetsLock);
+
+    if (!digest) {
+        if (rulesets)
+            ignore_value(virHashRemoveEntry(rulesets, ifname));
+        return;
+    }
+
+    if (!rulesets)
+        rulesets = virHashNew(g_free);
+
+    if (virHashUpdateEntry(rulesets, ifname, digest) < 0)
+        g_free(digest);
+}
+
+
+static bool
+virNWFilterRulesetIsActive(const char *ifname,
+                           const char *digest)
+{
+    VIR_LOCK_GUARD lock = virLockGuardLock(&rulesetsLock);
+
+    if (!rulesets)
+        return false;
+
+    return STREQ_NULLABLE(virHashLookup(rulesets, ifname), digest);
+}
+
+
 static int
 virNWFilterDefToInst(virNWFilterDriverState *driver,
                      virNWFilterDef *def,
@@ -434,11 +584,56 @@ virNWFilterDetermineMissingVarsRec(virNWFilterDef *filter,
 }
 
 
+/*
+ * Apply @rules to the interface @ifname; with @teardownOld switch to them
+ * right away, otherwise leave the old rules in effect until
+ * virNWFilterTearOldFilter is called.
+ */
+static int
+virNWFilterApplyRules(virNWFilterTechDriver *techdriver,
+                      const char *ifname,
+                      int ifindex,
+                      virNWFilterRuleInst **rules,
+                      size_t nrules,
+                      bool teardownOld)
+{
+    int rc;
+
+    if (virNWFilterLockIface(ifname) < 0)
+        return -1;
+
+    rc = techdriver->applyNewRules(ifname, rules, nrules);
+
+    /* the new rules may not be in effect if switching to them failed,
+     * don't leave the interface with whatever is left */
+    if (teardownOld && rc == 0 &&
+        techdriver->tearOldRules(ifname) < 0) {
+        techdriver->allTeardown(ifname);
+        virNWFilterRulesetUpdate(ifname, NULL);
+        rc = -1;
+    }
+
+    if (rc == 0 && (virNetDevValidateConfig(ifname, NULL, ifindex) <= 0)) {
+        virResetLastError();
+        /* interface changed/disappeared */
+        techdriver->allTeardown(ifname);
+        virNWFilterRulesetUpdate(ifname, NULL);
+        rc = -1;
+    }
+
+    virNWFilterUnlockIface(ifname);
+
+    return rc;
+}
+
+
 /**
  * virNWFilterDoInstantiate:
  * @techdriver: The driver to use for instantiation
  * @binding: description of port to bind the filter to
  * @filter: The filter to instantiate
+ * @pending: if not NULL, the rules are returned here instead of being
+ *  applied, unless they equal the rules already in effect
  * @forceWithPendingReq: Ignore the check whether a pending learn request
  *  is active; 'true' only when the rules are applied late
  *
@@ -458,7 +653,7 @@ virNWFilterDoInstantiate(virNWFilterTechDriver *techdriver,
                          int ifindex,
                          enum instCase useNewFilter,
                          bool *foundNewFilter,
-                         bool teardownOld,
+                         virNWFilterPendingRules *pending,
                          virNWFilterDriverState *driver,
                          bool forceWithPendingReq)
 {
@@ -495,6 +690,8 @@ virNWFilterDoInstantiate(virNWFilterTechDriver *techdriver,
                 reportIP = true;
                 goto err_unresolvable_vars;
             }
+            /* learning replaces the rules of the interface */
+            virNWFilterRulesetUpdate(binding->portdevname, NULL);
             if (STRCASEEQ(learning, "dhcp")) {
                 rc = virNWFilterDHCPSnoopReq(techdriver,
                                              binding,
@@ -545,22 +742,38 @@ virNWFilterDoInstantiate(virNWFilterTechDriver *techdriver,
     }
 
     if (instantiate) {
-        if (virNWFilterLockIface(binding->portdevname) < 0)
+        g_autofree char *digest = NULL;
+
+        if (!(digest = virNWFilterRulesDigest(inst.rules, inst.nrules))) {
+            rc = -1;
             goto error;
+        }
 
-        rc = techdriver->applyNewRules(binding->portdevname, inst.rules, inst.nrules);
+        if (pending) {
+            if (virNWFilterRulesetIsActive(binding->portdevname, digest)) {
+                VIR_DEBUG("Rules of %s unchanged", binding->portdevname);
+                goto error;
+            }
 
-        if (teardownOld && rc == 0)
-            techdriver->tearOldRules(binding->portdevname);
+            /* The rules only point into filter definitions, which cannot
+             * change while the update lock is held; don't keep the filters
+             * locked until the rules get applied. */
+            virNWFilterInstUnlockFilters(&inst);
 
-        if (rc == 0 && (virNetDevValidateConfig(binding->portdevname, NULL, ifindex) <= 0)) {
-            virResetLastError();
-            /* interface changed/disappeared */
-            techdriver->allTeardown(binding->portdevname);
-            rc = -1;
+            pending->apply = true;
+            pending->ifindex = ifindex;
+            pending->digest = g_steal_pointer(&digest);
+            pending->inst = inst;
+            memset(&inst, 0, sizeof(inst));
+        } else {
+            rc = virNWFilterApplyRules(techdriver, binding->portdevname,
+                                       ifindex, inst.rules, inst.nrules,
+                                       true);
+            if (rc < 0)
+                g_clear_pointer(&digest, g_free);
+            virNWFilterRulesetUpdate(binding->portdevname,
+                                     g_steal_pointer(&digest));
         }
-
-        virNWFilterUnlockIface(binding->portdevname);
     }
 
  error:
@@ -609,7 +822,7 @@ virNWFilterVarHashmapAddStdValue(GHashTable *table,
  */
 static int
 virNWFilterInstantiateFilterUpdate(virNWFilterDriverState *driver,
-                                   bool teardownOld,
+                                   virNWFilterPendingRules *pending,
                                    virNWFilterBindingDef *binding,
                                    int ifindex,
                                    enum instCase useNewFilter,
@@ -617,7 +830,7 @@ virNWFilterInstantiateFilterUpdate(virNWFilterDriverState *driver,
                                    bool *foundNewFilter)
 {
     int rc = -1;
-    const char *drvname = EBIPTABLES_DRIVER_ID;
+    const char *drvname = filter_tech_driver_name;
     virNWFilterTechDriver *techdriver;
     virNWFilterObj *obj;
     virNWFilterDef *filter;
@@ -671,7 +884,7 @@ virNWFilterInstantiateFilterUpdate(virNWFilterDriverState *driver,
 
     rc = virNWFilterDoInstantiate(techdriver, binding, filter,
                                   ifindex, useNewFilter, foundNewFilter,
-                                  teardownOld, driver,
+                                  pending, driver,
                                   forceWithPendingReq);
 
  error:
@@ -684,7 +897,7 @@ virNWFilterInstantiateFilterUpdate(virNWFilterDriverState *driver,
 static int
 virNWFilterInstantiateFilterInternal(virNWFilterDriverState *driver,
                                      virNWFilterBindingDef *binding,
-                                     bool teardownOld,
+                                     virNWFilterPendingRules *pending,
                                      enum instCase useNewFilter,
                                      bool *foundNewFilter)
 {
@@ -701,7 +914,7 @@ virNWFilterInstantiateFilterInternal(virNWFilterDriverState *driver,
         return 0;
     }
 
-    return virNWFilterInstantiateFilterUpdate(driver, teardownOld,
+    return virNWFilterInstantiateFilterUpdate(driver, pending,
                                               binding,
                                               ifindex,
                                               useNewFilter,
@@ -718,7 +931,7 @@ virNWFilterInstantiateFilterLate(virNWFilterDriverState *driver,
     bool foundNewFilter = false;
     VIR_LOCK_GUARD lock = virLockGuardLock(&driver->updateLock);
 
-    rc = virNWFilterInstantiateFilterUpdate(driver, true,
+    rc = virNWFilterInstantiateFilterUpdate(driver, NULL,
                                             binding, ifindex,
                                             INSTANTIATE_ALWAYS, true,
                                             &foundNewFilter);
@@ -743,33 +956,58 @@ virNWFilterInstantiateFilter(virNWFilterDriverState *driver,
     bool foundNewFilter = false;
 
     return virNWFilterInstantiateFilterInternal(driver, binding,
-                                                1,
+                                                NULL,
                                                 INSTANTIATE_ALWAYS,
                                                 &foundNewFilter);
 }
 
 
+/*
+ * Instantiate the rules of @binding following new filters; rules which
+ * need applying are returned in @pending.
+ */
 static int
 virNWFilterUpdateInstantiateFilter(virNWFilterDriverState *driver,
                                    virNWFilterBindingDef *binding,
-                                   bool *skipIface)
+                                   virNWFilterPendingRules *pending)
 {
     bool foundNewFilter = false;
 
-    int rc = virNWFilterInstantiateFilterInternal(driver, binding,
-                                                  0,
-                                                  INSTANTIATE_FOLLOW_NEWFILTER,
-                                                  &foundNewFilter);
+    return virNWFilterInstantiateFilterInternal(driver, binding,
+                                                pending,
+                                                INSTANTIATE_FOLLOW_NEWFILTER,
+                                                &foundNewFilter);
+}
 
-    *skipIface = !foundNewFilter;
-    return rc;
+
+static int
+virNWFilterApplyPendingRules(virNWFilterBindingDef *binding,
+                             virNWFilterPendingRules *pending)
+{
+    const char *drvname = filter_tech_driver_name;
+    virNWFilterTechDriver *techdriver;
+
+    techdriver = virNWFilterTechDriverForName(drvname);
+    if (!techdriver) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Could not get access to ACL tech driver '%1$s'"),
+                       drvname);
+        return -1;
+    }
+
+    return virNWFilterApplyRules(techdriver, binding->portdevname,
+                                 pending->ifindex,
+                                 pending->inst.rules, pending->inst.nrules,
+                                 false);
 }
 
+
 static int
 virNWFilterRollbackUpdateFilter(virNWFilterBindingDef *binding)
 {
-    const char *drvname = EBIPTABLES_DRIVER_ID;
+    const char *drvname = filter_tech_driver_name;
     int ifindex;
+    int ret;
     virNWFilterTechDriver *techdriver;
 
     techdriver = virNWFilterTechDriverForName(drvname);
@@ -786,15 +1024,24 @@ virNWFilterRollbackUpdateFilter(virNWFilterBindingDef *binding)
     else if (virNWFilterHasLearnReq(ifindex))
         return 0;
 
-    return techdriver->tearNewRules(binding->portdevname);
+    if (virNWFilterLockIface(binding->portdevname) < 0)
+        return -1;
+
+    ret = techdriver->tearNewRules(binding->portdevname);
+
+    virNWFilterUnlockIface(binding->portdevname);
+
+    return ret;
 }
 
 
 static int
-virNWFilterTearOldFilter(virNWFilterBindingDef *binding)
+virNWFilterTearOldFilter(virNWFilterBindingDef *binding,
+                         virNWFilterPendingRules *pending)
 {
-    const char *drvname = EBIPTABLES_DRIVER_ID;
+    const char *drvname = filter_tech_driver_name;
     int ifindex;
+    int ret;
     virNWFilterTechDriver *techdriver;
 
     techdriver = virNWFilterTechDriverForName(drvname);
@@ -811,14 +1058,24 @@ virNWFilterTearOldFilter(virNWFilterBindingDef *binding)
     else if (virNWFilterHasLearnReq(ifindex))
         return 0;
 
-    return techdriver->tearOldRules(binding->portdevname);
+    if (virNWFilterLockIface(binding->portdevname) < 0)
+        return -1;
+
+    if ((ret = techdriver->tearOldRules(binding->portdevname)) < 0)
+        g_clear_pointer(&pending->digest, g_free);
+    virNWFilterRulesetUpdate(binding->portdevname,
+                             g_steal_pointer(&pending->digest));
+
+    virNWFilterUnlockIface(binding->portdevname);
+
+    return ret;
 }
 
 
 static int
 _virNWFilterTeardownFilter(const char *ifname)
 {
-    const char *drvname = EBIPTABLES_DRIVER_ID;
+    const char *drvname = filter_tech_driver_name;
     virNWFilterTechDriver *techdriver;
     techdriver = virNWFilterTechDriverForName(drvname);
 
@@ -837,6 +1094,7 @@ _virNWFilterTeardownFilter(const char *ifname)
         return -1;
 
     techdriver->allTeardown(ifname);
+    virNWFilterRulesetUpdate(ifname, NULL);
 
     virNWFilterIPAddrMapDelIPAddr(ifname, NULL);
 
@@ -856,106 +1114,327 @@ enum {
     STEP_APPLY_NEW,
     STEP_ROLLBACK,
     STEP_SWITCH,
-    STEP_APPLY_CURRENT,
 };
 
-static int
-virNWFilterBuildOne(virNWFilterDriverState *driver,
-                    virNWFilterBindingDef *binding,
-                    GHashTable *skipInterfaces,
-                    int step)
+
+/*
+ * Returns whether the filter @name or any of the filters it references
+ * is being updated or removed. Results are cached in @affected.
+ */
+static bool
+virNWFilterIsAffected(virNWFilterDriverState *driver,
+                      const char *name,
+                      GHashTable *affected)
 {
-    bool skipIface;
-    int ret = 0;
-    VIR_DEBUG("Building filter for portdev=%s step=%d", binding->portdevname, step);
+    virNWFilterObj *obj;
+    virNWFilterDef *defs[2];
+    gpointer cached;
+    bool ret;
+    size_t i, j;
 
-    switch (step) {
-    case STEP_APPLY_NEW:
-        ret = virNWFilterUpdateInstantiateFilter(driver,
-                                                 binding,
-                                                 &skipIface);
-        if (ret == 0 && skipIface) {
-            /* filter tree unchanged -- no update needed */
-            ret = virHashAddEntry(skipInterfaces,
-                                  binding->portdevname,
-                                  (void *)~0);
-        }
-        break;
+    if (g_hash_table_lookup_extended(affected, name, NULL, &cached))
+        return GPOINTER_TO_INT(cached);
 
-    case STEP_ROLLBACK:
-        if (!virHashLookup(skipInterfaces, binding->portdevname))
-            ret = virNWFilterRollbackUpdateFilter(binding);
-        break;
+    /* missing filters can't be instantiated either way */
+    if (!(obj = virNWFilterObjListFindByName(driver->nwfilters, name)))
+        return false;
 
-    case STEP_SWITCH:
-        if (!virHashLookup(skipInterfaces, binding->portdevname))
-            ret = virNWFilterTearOldFilter(binding);
-        break;
+    defs[0] = virNWFilterObjGetDef(obj);
+    defs[1] = virNWFilterObjGetNewDef(obj);
+    ret = virNWFilterObjWantRemoved(obj) || defs[1];
+    virNWFilterObjUnlock(obj);
 
-    case STEP_APPLY_CURRENT:
-        ret = virNWFilterInstantiateFilter(driver,
-                                           binding);
-        break;
+    /* the definitions can't change while the update lock is held */
+    for (i = 0; i < G_N_ELEMENTS(defs) && !ret; i++) {
+        if (!defs[i])
+            continue;
+
+        for (j = 0; j < defs[i]->nentries && !ret; j++) {
+            virNWFilterIncludeDef *inc = defs[i]->filterEntries[j]->include;
+
+            if (inc && virNWFilterIsAffected(driver, inc->filterref, affected))
+                ret = true;
+        }
     }
 
+    g_hash_table_insert(affected, g_strdup(name), GINT_TO_POINTER(ret));
+
     return ret;
 }
 
 
+typedef struct _virNWFilterBuildJob virNWFilterBuildJob;
+struct _virNWFilterBuildJob {
+    virNWFilterBindingObj *binding;
+    virNWFilterPendingRules pending;
+    virErrorPtr error;
+};
+
+
+static void
+virNWFilterBuildJobFree(virNWFilterBuildJob *job)
+{
+    if (!job)
+        return;
+
+    virNWFilterPendingRulesReset(&job->pending);
+    virFreeError(job->error);
+    virObjectUnref(job->binding);
+    g_free(job);
+}
+
+
 struct virNWFilterBuildData {
     virNWFilterDriverState *driver;
-    GHashTable *skipInterfaces;
+    GHashTable *affected;
+    virNWFilterBuildJob **jobs;
+    size_t njobs;
     int step;
+    int next;
+    int failed;
 };
 
+
 static int
-virNWFilterBuildIter(virNWFilterBindingObj *binding, void *opaque)
+virNWFilterBuildCollectIter(virNWFilterBindingObj *binding, void *opaque)
 {
     struct virNWFilterBuildData *data = opaque;
     virNWFilterBindingDef *def = virNWFilterBindingObjGetDef(binding);
+    virNWFilterBuildJob *job;
 
-    return virNWFilterBuildOne(data->driver, def,
-                               data->skipInterfaces, data->step);
+    if (!virNWFilterIsAffected(data->driver, def->filter, data->affected)) {
+        /* filter tree unchanged -- no update needed */
+        return 0;
+    }
+
+    job = g_new0(virNWFilterBuildJob, 1);
+    job->binding = virObjectRef(binding);
+    VIR_APPEND_ELEMENT(data->jobs, data->njobs, job);
+
+    return 0;
 }
 
-int
-virNWFilterBuildAll(virNWFilterDriverState *driver,
-                    bool newFilters)
+
+static int
+virNWFilterBuildOne(virNWFilterBuildJob *job,
+                    int step)
+{
+    virNWFilterBindingDef *def = virNWFilterBindingObjGetDef(job->binding);
+
+    VIR_DEBUG("Building filter for portdev=%s step=%d", def->portdevname, step);
+
+    switch (step) {
+    case STEP_APPLY_NEW:
+        return virNWFilterApplyPendingRules(def, &job->pending);
+
+    case STEP_ROLLBACK:
+        return virNWFilterRollbackUpdateFilter(def);
+
+    case STEP_SWITCH:
+        return virNWFilterTearOldFilter(def, &job->pending);
+    }
+
+    return 0;
+}
+
+
+static void
+virNWFilterBuildWorker(void *opaque)
+{
+    struct virNWFilterBuildData *data = opaque;
+    int i;
+
+    while ((i = g_atomic_int_add(&data->next, 1)) < (int) data->njobs) {
+        virNWFilterBuildJob *job = data->jobs[i];
+
+        /* no point in applying further rules if the update failed */
+        if (data->step == STEP_APPLY_NEW && g_atomic_int_get(&data->failed))
+            break;
+
+        if (!job->pending.apply)
+            continue;
+
+        if (virNWFilterBuildOne(job, data->step) < 0) {
+            virErrorPreserveLast(&job->error);
+            g_atomic_int_set(&data->failed, 1);
+        }
+    }
+}
+
+
+/*
+ * Run @step for all jobs in @data, using up to NWFILTER_BUILD_MAX_THREADS
+ * threads. Returns -1 with the error of the first failed job set, or 0.
+ */
+static int
+virNWFilterBuildRun(struct virNWFilterBuildData *data,
+                    int step)
 {
+    size_t nthreads = MIN(data->njobs, NWFILTER_BUILD_MAX_THREADS);
+    g_autofree virThread *threads = g_new0(virThread, nthreads);
+    size_t nstarted;
+    size_t i;
+
+    data->step = step;
+    data->next = 0;
+    data->failed = 0;
+
+    for (i = 0; i < data->njobs; i++)
+        g_clear_pointer(&data->jobs[i]->error, virFreeError);
+
+    /* the calling thread is the last worker */
+    for (nstarted = 0; nstarted + 1 < nthreads; nstarted++) {
+        if (virThreadCreateFull(&threads[nstarted], true,
+                                virNWFilterBuildWorker, "nwfilter-build",
+                                false, data) < 0) {
+            VIR_WARN("Failed to create nwfilter build thread");
+            break;
+        }
+    }
+
+    virNWFilterBuildWorker(data);
+
+    for (i = 0; i < nstarted; i++)
+        virThreadJoin(&threads[i]);
+
+    for (i = 0; i < data->njobs; i++) {
+        if (data->jobs[i]->error) {
+            virErrorRestore(&data->jobs[i]->error);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * Call this function while holding the NWFilter filter update lock
+ */
+static int
+virNWFilterBuildUpdate(virNWFilterDriverState *driver)
+{
+    g_autoptr(GHashTable) affected = virHashNew(NULL);
     struct virNWFilterBuildData data = {
         .driver = driver,
+        .affected = affected,
     };
+    virErrorPtr orig_err = NULL;
     int ret = 0;
+    size_t i;
 
-    VIR_DEBUG("Build all filters newFilters=%d", newFilters);
+    /* only bindings referencing an updated filter need to be rebuilt */
+    virNWFilterBindingObjListForEach(driver->bindings,
+                                     virNWFilterBuildCollectIter,
+                                     &data);
 
-    if (newFilters) {
-        g_autoptr(GHashTable) skipInterfaces = virHashNew(NULL);
-        data.skipInterfaces = skipInterfaces;
-
-        data.step = STEP_APPLY_NEW;
-        if (virNWFilterBindingObjListForEach(driver->bindings,
-                                             virNWFilterBuildIter,
-                                             &data) < 0)
-            ret = -1;
-
-        if (ret == -1) {
-            data.step = STEP_ROLLBACK;
-            virNWFilterBindingObjListForEach(driver->bindings,
-                                             virNWFilterBuildIter,
-                                             &data);
-        } else  {
-            data.step = STEP_SWITCH;
-            virNWFilterBindingObjListForEach(driver->bindings,
-                                             virNWFilterBuildIter,
-                                             &data);
-        }
+    VIR_DEBUG("Updating filters of %zu bindings", data.njobs);
+
+    /* Instantiating looks up the filters and may start learning of IP
+     * addresses, which needs the update lock held by this thread; only
+     * the rules are applied in parallel. */
+    for (i = 0; i < data.njobs && ret == 0; i++) {
+        virNWFilterBindingDef *def = virNWFilterBindingObjGetDef(data.jobs[i]->binding);
+
+        ret = virNWFilterUpdateInstantiateFilter(driver, def,
+                                                 &data.jobs[i]->pending);
+    }
+
+    if (ret == 0)
+        ret = virNWFilterBuildRun(&data, STEP_APPLY_NEW);
+
+    if (ret < 0) {
+        virErrorPreserveLast(&orig_err);
+        virNWFilterBuildRun(&data, STEP_ROLLBACK);
+        virErrorRestore(&orig_err);
     } else {
-        data.step = STEP_APPLY_CURRENT;
-        if (virNWFilterBindingObjListForEach(driver->bindings,
-                                             virNWFilterBuildIter,
-                                             &data) < 0)
-            ret = -1;
+        virNWFilterBuildRun(&data, STEP_SWITCH);
     }
+
+    for (i = 0; i < data.njobs; i++)
+        virNWFilterBuildJobFree(data.jobs[i]);
+    g_free(data.jobs);
+
     return ret;
 }
+
+
+static int
+virNWFilterBuildIter(virNWFilterBindingObj *binding, void *opaque)
+{
+    virNWFilterDriverState *driver = opaque;
+    virNWFilterBindingDef *def = virNWFilterBindingObjGetDef(binding);
+
+    VIR_DEBUG("Building filter for portdev=%s", def->portdevname);
+
+    return virNWFilterInstantiateFilter(driver, def);
+}
+
+int
+virNWFilterBuildAll(virNWFilterDriverState *driver,
+                    bool newFilters)
+{
+    int ret = 0;
+
+    VIR_DEBUG("Build all filters newFilters=%d", newFilters);
+
+    if (newFilters)
+        return virNWFilterBuildUpdate(driver);
+
+    if (virNWFilterBindingObjListForEach(driver->bindings,
+                                         virNWFilterBuildIter,
+                                         driver) < 0)
+        ret = -1;
+
+    return ret;
+}
+
+
+static int
+virNWFilterTeardownIter(virNWFilterBindingObj *binding, void *opaque)
+{
+    virNWFilterTechDriver *techdriver = opaque;
+    virNWFilterBindingDef *def = virNWFilterBindingObjGetDef(binding);
+
+    if (virNWFilterLockIface(def->portdevname) < 0)
+        return 0;
+
+    if (techdriver->allTeardown(def->portdevname) < 0) {
+        VIR_WARN("Failed to remove %s rules of interface %s: %s",
+                 techdriver->name, def->portdevname,
+                 virGetLastErrorMessage());
+        virResetLastError();
+    }
+    virNWFilterRulesetUpdate(def->portdevname, NULL);
+
+    virNWFilterUnlockIface(def->portdevname);
+
+    return 0;
+}
+
+
+/**
+ * virNWFilterTeardownAllWithDriver:
+ * @driver: the nwfilter driver state
+ * @name: name of the technology driver which instantiated the filters
+ *
+ * Removes the rules created by technology driver @name for all bindings,
+ * eg. after switching to a different driver. Failures are only logged.
+ */
+void
+virNWFilterTeardownAllWithDriver(virNWFilterDriverState *driver,
+                                 const char *name)
+{
+    virNWFilterTechDriver *techdriver = virNWFilterTechDriverForName(name);
+
+    if (!techdriver) {
+        VIR_WARN("Cannot remove rules of unknown ACL tech driver '%s'", name);
+        return;
+    }
+
+    VIR_DEBUG("Removing all rules of ACL tech driver '%s'", name);
+
+    virNWFilterBindingObjListForEach(driver->bindings,
+                                     virNWFilterTeardownIter,
+                                     techdriver);
+}
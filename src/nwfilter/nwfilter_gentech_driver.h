@@ -25,8 +25,9 @@
 #include "virnwfilterobj.h"
 #include "virnwfilterbindingdef.h"
 
-int virNWFilterTechDriversInit(bool privileged);
+int virNWFilterTechDriversInit(bool privileged, const char *name);
 void virNWFilterTechDriversShutdown(void);
+const char *virNWFilterTechDriverGetName(void);
 
 enum instCase {
     INSTANTIATE_ALWAYS,
@@ -45,3 +46,6 @@ int virNWFilterTeardownFilter(virNWFilterBindingDef *binding);
 
 int virNWFilterBuildAll(virNWFilterDriverState *driver,
                         bool newFilters);
+
+void virNWFilterTeardownAllWithDriver(virNWFilterDriverState *driver,
+                                      const char *name);
@@ -0,0 +1,2689 @@
+/*
+ * nwfilter_nftables_driver.c: nftables driver for nwfilter rules on tap devices
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include <config.h>
+
+#include "internal.h"
+
+#include "virbuffer.h"
+#include "viralloc.h"
+#include "virlog.h"
+#include "virerror.h"
+#include "virhash.h"
+#include "virthread.h"
+#include "virstring.h"
+#include "virsocketaddr.h"
+#include "virfirewall.h"
+#include "nwfilter_conf.h"
+#include "nwfilter_nftables_driver.h"
+
+#define VIR_FROM_THIS VIR_FROM_NWFILTER
+
+VIR_LOG_INIT("nwfilter.nwfilter_nftables_driver");
+
+/*
+ * All rules live in a single table of the bridge family. Its base chains
+ * only contain one rule per direction, which looks up the port the packet
+ * is traveling through in a verdict map and jumps to the chain of that
+ * port. Thus the number of rules a packet has to traverse does not grow
+ * with the number of ports.
+ *
+ * Each port has one dispatch chain per direction, "<ifname>/<direction>",
+ * which is referenced from the verdict map and holds a single goto rule
+ * to the root chain of the generation of rules currently in effect,
+ * "<ifname>/<generation>/<direction>". Ethernet rules may be spread over
+ * protocol specific sub chains, "<ifname>/<generation>/<direction>/<name>".
+ *
+ * A new set of rules is always written to chains of a new generation
+ * which are switched to by repointing the dispatch chains once they are
+ * complete. This replaces the renaming of chains done by the ebiptables
+ * driver and allows each of the operations to be a single nft transaction.
+ * The transactions are VIR_FIREWALL_TRANSACTION_ATOMIC so that a failed
+ * one is never replayed command by command, leaving a part of it applied.
+ */
+#define NFTABLES_FAMILY "bridge"
+#define NFTABLES_TABLE "libvirt_nwfilter"
+
+/* comments longer than this are refused by nft */
+#define NFTABLES_MAX_COMMENT_LENGTH 128
+
+typedef enum {
+    NFTABLES_DIR_L2_IN = 0,   /* frames sent by the VM */
+    NFTABLES_DIR_L2_OUT,      /* frames sent to the VM */
+    NFTABLES_DIR_FWD_IN,      /* forwarded packets sent by the VM */
+    NFTABLES_DIR_FWD_OUT,     /* forwarded packets sent to the VM */
+    NFTABLES_DIR_HOST_IN,     /* packets sent by the VM to the host */
+
+    NFTABLES_DIR_LAST
+} nftablesDirection;
+
+typedef struct _nftablesDirectionInfo nftablesDirectionInfo;
+struct _nftablesDirectionInfo {
+    const char *name;       /* name of the verdict map and chain suffix */
+    const char *basechain;
+    const char *match;      /* expression giving the port */
+};
+
+static const nftablesDirectionInfo nftablesDirections[NFTABLES_DIR_LAST] = {
+    [NFTABLES_DIR_L2_IN] = { "l2_in", "prerouting", "iifname" },
+    [NFTABLES_DIR_L2_OUT] = { "l2_out", "postrouting", "oifname" },
+    [NFTABLES_DIR_FWD_IN] = { "fwd_in", "forward", "iifname" },
+    [NFTABLES_DIR_FWD_OUT] = { "fwd_out", "forward", "oifname" },
+    [NFTABLES_DIR_HOST_IN] = { "host_in", "input", "iifname" },
+};
+
+typedef struct _nftablesBaseChain nftablesBaseChain;
+struct _nftablesBaseChain {
+    const char *name;
+    const char *spec;
+};
+
+/* Priorities match those of the ebtables nat table for ethernet rules
+ * and those of the iptables filter table for IP rules */
+static const nftablesBaseChain nftablesBaseChains[] = {
+    { "prerouting", "{ type filter hook prerouting priority -300; policy accept; }" },
+    { "postrouting", "{ type filter hook postrouting priority 300; policy accept; }" },
+    { "forward", "{ type filter hook forward priority 0; policy accept; }" },
+    { "input", "{ type filter hook input priority 0; policy accept; }" },
+};
+
+typedef struct _nftablesSubChainProtocol nftablesSubChainProtocol;
+struct _nftablesSubChainProtocol {
+    const char *prefix;     /* chains with names starting with it */
+    unsigned int ethertype; /* 0 if not matched by ethertype */
+    const char *daddr;      /* destination MAC address to match instead */
+};
+
+/* None of the prefixes may be a prefix of another one */
+static const nftablesSubChainProtocol nftablesSubChainProtocols[] = {
+    { "ipv4", ETHERTYPE_IP, NULL },
+    { "ipv6", ETHERTYPE_IPV6, NULL },
+    { "arp", ETHERTYPE_ARP, NULL },
+    { "rarp", ETHERTYPE_REVARP, NULL },
+    { "vlan", ETHERTYPE_VLAN, NULL },
+    { "stp", 0, NWFILTER_MAC_BGA },
+    { "mac", 0, NULL },
+};
+
+
+typedef struct _nftablesGeneration nftablesGeneration;
+struct _nftablesGeneration {
+    unsigned int id;
+    /* the root chains come first, in the order of nftablesDirection */
+    char **chains;
+    size_t nchains;
+};
+
+typedef struct _nftablesPort nftablesPort;
+struct _nftablesPort {
+    nftablesGeneration *live;       /* rules currently in effect */
+    nftablesGeneration *pending;    /* rules waiting to be switched to */
+    char **stale;                   /* chains which failed to be removed */
+    size_t nstale;
+};
+
+/* Protects the table of ports and the generation counter. The state of a
+ * single port is only ever touched by the thread which holds the lock of
+ * the interface (see virNWFilterLockIface). */
+static virMutex nftablesLock = VIR_MUTEX_INITIALIZER;
+static GHashTable *nftablesPorts;
+static unsigned int nftablesLastGeneration;
+static bool nftablesRecovered;
+
+
+static void
+nftablesGenerationFree(nftablesGeneration *gen)
+{
+    size_t i;
+
+    if (!gen)
+        return;
+
+    for (i = 0; i < gen->nchains; i++)
+        g_free(gen->chains[i]);
+    g_free(gen->chains);
+    g_free(gen);
+}
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(nftablesGeneration, nftablesGenerationFree);
+
+
+static void
+nftablesPortFree(void *opaque)
+{
+    nftablesPort *port = opaque;
+    size_t i;
+
+    if (!port)
+        return;
+
+    nftablesGenerationFree(port->live);
+    nftablesGenerationFree(port->pending);
+    for (i = 0; i < port->nstale; i++)
+        g_free(port->stale[i]);
+    g_free(port->stale);
+    g_free(port);
+}
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(nftablesPort, nftablesPortFree);
+
+
+static char *
+nftablesChainName(const char *ifname,
+                  unsigned int gen,
+                  nftablesDirection dir,
+                  const char *suffix)
+{
+    if (suffix)
+        return g_strdup_printf("%s/%u/%s/%s", ifname, gen,
+                               nftablesDirections[dir].name, suffix);
+
+    return g_strdup_printf("%s/%u/%s", ifname, gen,
+                           nftablesDirections[dir].name);
+}
+
+
+static char *
+nftablesDispatchChainName(const char *ifname,
+                          nftablesDirection dir)
+{
+    return g_strdup_printf("%s/%s", ifname, nftablesDirections[dir].name);
+}
+
+
+static nftablesGeneration *
+nftablesGenerationNew(const char *ifname)
+{
+    nftablesGeneration *gen = g_new0(nftablesGeneration, 1);
+    size_t i;
+
+    VIR_WITH_MUTEX_LOCK_GUARD(&nftablesLock) {
+        gen->id = ++nftablesLastGeneration;
+    }
+
+    for (i = 0; i < NFTABLES_DIR_LAST; i++) {
+        char *chain = nftablesChainName(ifname, gen->id, i, NULL);
+
+        VIR_APPEND_ELEMENT(gen->chains, gen->nchains, chain);
+    }
+
+    return gen;
+}
+
+
+/* Must be called with nftablesLock held */
+static nftablesPort *
+nftablesPortLookupLocked(const char *ifname,
+                         bool create)
+{
+    nftablesPort *port;
+
+    if (!nftablesPorts)
+        nftablesPorts = virHashNew(nftablesPortFree);
+
+    if (!(port = virHashLookup(nftablesPorts, ifname)) && create) {
+        port = g_new0(nftablesPort, 1);
+        if (virHashAddEntry(nftablesPorts, ifname, port) < 0) {
+            nftablesPortFree(port);
+            return NULL;
+        }
+    }
+
+    return port;
+}
+
+
+static nftablesPort *
+nftablesPortLookup(const char *ifname,
+                   bool create)
+{
+    VIR_LOCK_GUARD lock = virLockGuardLock(&nftablesLock);
+
+    return nftablesPortLookupLocked(ifname, create);
+}
+
+
+/* Moves the chains of *@gen to the stale chains of @port */
+static void
+nftablesPortRetire(nftablesPort *port,
+                   nftablesGeneration **gen)
+{
+    size_t i;
+
+    if (!*gen)
+        return;
+
+    for (i = 0; i < (*gen)->nchains; i++)
+        VIR_APPEND_ELEMENT(port->stale, port->nstale, (*gen)->chains[i]);
+
+    g_clear_pointer(gen, nftablesGenerationFree);
+}
+
+
+static void
+nftablesPortClearStale(nftablesPort *port)
+{
+    size_t i;
+
+    for (i = 0; i < port->nstale; i++)
+        g_free(port->stale[i]);
+    g_clear_pointer(&port->stale, g_free);
+    port->nstale = 0;
+}
+
+
+/*
+ * Chain names and variable values are pasted into nft commands, make sure
+ * they cannot break out of the quotes or the expression they are used in.
+ */
+static int
+nftablesCheckIfname(const char *ifname)
+{
+    const char *p;
+
+    for (p = ifname; *p; p++) {
+        if (!g_ascii_isprint(*p) || strchr("\"\\/", *p))
+            break;
+    }
+
+    if (!*ifname || *p) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("interface name '%1$s' cannot be used with the nftables driver"),
+                       ifname);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+nftablesCheckValue(const char *varName,
+                   const char *val)
+{
+    const char *p;
+
+    for (p = val; *p; p++) {
+        if (!g_ascii_isalnum(*p) && !strchr(":.-_", *p))
+            break;
+    }
+
+    if (!*val || *p) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("value '%1$s' of variable '%2$s' cannot be used in an nftables rule"),
+                       val, varName);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static void
+nftablesChainCmdFW(virFirewall *fw,
+                   const char *verb,
+                   const char *chain)
+{
+    g_autofree char *quoted = g_strdup_printf("\"%s\"", chain);
+
+    virFirewallAddCmd(fw, VIR_FIREWALL_LAYER_ETHERNET,
+                      verb, "chain", NFTABLES_FAMILY, NFTABLES_TABLE,
+                      quoted, NULL);
+}
+
+
+static virFirewallCmd *
+nftablesAddRuleFW(virFirewall *fw,
+                  const char *chain,
+                  const char *rule)
+{
+    g_autofree char *quoted = g_strdup_printf("\"%s\"", chain);
+
+    return virFirewallAddCmd(fw, VIR_FIREWALL_LAYER_ETHERNET,
+                             "add", "rule", NFTABLES_FAMILY, NFTABLES_TABLE,
+                             quoted, rule, NULL);
+}
+
+
+/*
+ * Makes sure the table, its base chains and verdict maps exist. This is
+ * part of every transaction so that none of them depends on the state
+ * left behind by previous ones.
+ */
+static void
+nftablesSetupInfraFW(virFirewall *fw)
+{
+    size_t i;
+
+    virFirewallAddCmd(fw, VIR_FIREWALL_LAYER_ETHERNET,
+                      "add", "table", NFTABLES_FAMILY, NFTABLES_TABLE, NULL);
+
+    for (i = 0; i < NFTABLES_DIR_LAST; i++) {
+        virFirewallAddCmd(fw, VIR_FIREWALL_LAYER_ETHERNET,
+                          "add", "map", NFTABLES_FAMILY, NFTABLES_TABLE,
+                          nftablesDirections[i].name,
+                          "{ type ifname : verdict; }", NULL);
+    }
+
+    for (i = 0; i < G_N_ELEMENTS(nftablesBaseChains); i++) {
+        virFirewallAddCmd(fw, VIR_FIREWALL_LAYER_ETHERNET,
+                          "add", "chain", NFTABLES_FAMILY, NFTABLES_TABLE,
+                          nftablesBaseChains[i].name,
+                          nftablesBaseChains[i].spec, NULL);
+        virFirewallAddCmd(fw, VIR_FIREWALL_LAYER_ETHERNET,
+                          "flush", "chain", NFTABLES_FAMILY, NFTABLES_TABLE,
+                          nftablesBaseChains[i].name, NULL);
+    }
+
+    for (i = 0; i < NFTABLES_DIR_LAST; i++) {
+        g_autofree char *map = g_strdup_printf("@%s", nftablesDirections[i].name);
+
+        virFirewallAddCmd(fw, VIR_FIREWALL_LAYER_ETHERNET,
+                          "add", "rule", NFTABLES_FAMILY, NFTABLES_TABLE,
+                          nftablesDirections[i].basechain,
+                          nftablesDirections[i].match, "vmap", map, NULL);
+    }
+}
+
+
+static void
+nftablesSetupDispatchFW(virFirewall *fw,
+                        const char *ifname)
+{
+    size_t i;
+
+    for (i = 0; i < NFTABLES_DIR_LAST; i++) {
+        g_autofree char *chain = nftablesDispatchChainName(ifname, i);
+        g_autofree char *element = g_strdup_printf("{ \"%s\" : jump \"%s\" }",
+                                                   ifname, chain);
+
+        nftablesChainCmdFW(fw, "add", chain);
+        virFirewallAddCmd(fw, VIR_FIREWALL_LAYER_ETHERNET,
+                          "add", "element", NFTABLES_FAMILY, NFTABLES_TABLE,
+                          nftablesDirections[i].name, element, NULL);
+    }
+}
+
+
+static void
+nftablesRemoveDispatchFW(virFirewall *fw,
+                         const char *ifname)
+{
+    g_autofree char *element = g_strdup_printf("{ \"%s\" }", ifname);
+    size_t i;
+
+    for (i = 0; i < NFTABLES_DIR_LAST; i++) {
+        virFirewallAddCmd(fw, VIR_FIREWALL_LAYER_ETHERNET,
+                          "delete", "element", NFTABLES_FAMILY, NFTABLES_TABLE,
+                          nftablesDirections[i].name, element, NULL);
+    }
+}
+
+
+static void
+nftablesLinkGenerationFW(virFirewall *fw,
+                         const char *ifname,
+                         nftablesGeneration *gen)
+{
+    size_t i;
+
+    for (i = 0; i < NFTABLES_DIR_LAST; i++) {
+        g_autofree char *chain = nftablesDispatchChainName(ifname, i);
+        g_autofree char *rule = g_strdup_printf("goto \"%s\"", gen->chains[i]);
+
+        nftablesChainCmdFW(fw, "flush", chain);
+        nftablesAddRuleFW(fw, chain, rule);
+    }
+}
+
+
+static void
+nftablesCreateChainsFW(virFirewall *fw,
+                       nftablesGeneration *gen)
+{
+    size_t i;
+
+    for (i = 0; i < gen->nchains; i++)
+        nftablesChainCmdFW(fw, "add", gen->chains[i]);
+}
+
+
+/*
+ * Chains may still be referenced by each other, so all of them are
+ * emptied before any of them is deleted. Adding them first makes sure
+ * the removal does not fail for chains which are already gone.
+ */
+static void
+nftablesRemoveChainsFW(virFirewall *fw,
+                       char **chains,
+                       size_t nchains)
+{
+    size_t i;
+
+    for (i = 0; i < nchains; i++) {
+        nftablesChainCmdFW(fw, "add", chains[i]);
+        nftablesChainCmdFW(fw, "flush", chains[i]);
+    }
+
+    for (i = 0; i < nchains; i++)
+        nftablesChainCmdFW(fw, "delete", chains[i]);
+}
+
+
+/* Must be called with nftablesLock held */
+static void
+nftablesRecoverChain(const char *name)
+{
+    g_auto(GStrv) parts = g_strsplit(name, "/", 3);
+    nftablesPort *port;
+    unsigned int id;
+    bool isGeneration;
+    char *chain;
+
+    if (g_strv_length(parts) < 2 || !*parts[0])
+        return;
+
+    if (!(port = nftablesPortLookupLocked(parts[0], true)))
+        return;
+
+    isGeneration = virStrToLong_ui(parts[1], NULL, 10, &id) == 0;
+
+    /* dispatch chains are recreated as needed */
+    if (!isGeneration && !parts[2])
+        return;
+
+    if (isGeneration && id > nftablesLastGeneration)
+        nftablesLastGeneration = id;
+
+    chain = g_strdup(name);
+    VIR_APPEND_ELEMENT(port->stale, port->nstale, chain);
+}
+
+
+static int
+nftablesRecoverQuery(virFirewall *fw G_GNUC_UNUSED,
+                     virFirewallLayer layer G_GNUC_UNUSED,
+                     const char *const *lines,
+                     void *opaque G_GNUC_UNUSED)
+{
+    bool inTable = false;
+    size_t i;
+
+    for (i = 0; lines[i]; i++) {
+        const char *line = lines[i];
+        g_autofree char *name = NULL;
+        char *tmp;
+
+        while (g_ascii_isspace(*line))
+            line++;
+
+        if (STRPREFIX(line, "table ")) {
+            inTable = STREQ(line, "table " NFTABLES_FAMILY " " NFTABLES_TABLE " {");
+            continue;
+        }
+
+        if (!inTable || !STRPREFIX(line, "chain "))
+            continue;
+
+        name = g_strdup(line + strlen("chain "));
+        if ((tmp = strstr(name, " {")))
+            *tmp = '\0';
+        if (name[0] == '"' && (tmp = strrchr(name + 1, '"'))) {
+            *tmp = '\0';
+            memmove(name, name + 1, strlen(name));
+        }
+
+        if (strchr(name, '/'))
+            nftablesRecoverChain(name);
+    }
+
+    return 0;
+}
+
+
+/*
+ * The chains created by a previous instance of the daemon are not known
+ * to this one. Since the filters of all ports are rebuilt when the daemon
+ * starts, all of them are treated as stale and removed along with the
+ * first change to the port they belong to.
+ */
+static int
+nftablesRecover(void)
+{
+    VIR_LOCK_GUARD lock = virLockGuardLock(&nftablesLock);
+    g_autoptr(virFirewall) fw = NULL;
+
+    if (nftablesRecovered)
+        return 0;
+
+    fw = virFirewallNew(VIR_FIREWALL_BACKEND_NFTABLES);
+    virFirewallStartTransaction(fw, 0);
+    virFirewallAddCmdFull(fw, VIR_FIREWALL_LAYER_ETHERNET,
+                          false, nftablesRecoverQuery, NULL,
+                          "list", "chains", NFTABLES_FAMILY, NULL);
+
+    if (virFirewallApply(fw) < 0)
+        return -1;
+
+    nftablesRecovered = true;
+    return 0;
+}
+
+
+/************************ rule generation ************************/
+
+typedef struct _nftablesRuleCtx nftablesRuleCtx;
+struct _nftablesRuleCtx {
+    virNWFilterRuleInst *rule;
+    virNWFilterVarCombIter *vars;
+
+    /* Variables which are matched with an anonymous set holding all of
+     * their values rather than iterated over */
+    virNWFilterVarAccess **setVars;
+    size_t nsetVars;
+    bool *setVarUsed;
+
+    /* Commands created for the rule so far */
+    virFirewallCmd **cmds;
+    size_t ncmds;
+};
+
+
+static int
+nftablesFormatSet(const virNWFilterVarValue *value,
+                  const char *varName,
+                  char **res)
+{
+    g_auto(virBuffer) buf = VIR_BUFFER_INITIALIZER;
+    unsigned int n = virNWFilterVarValueGetCardinality(value);
+    unsigned int i;
+    unsigned int j;
+
+    virBufferAddLit(&buf, "{ ");
+
+    for (i = 0; i < n; i++) {
+        const char *val = virNWFilterVarValueGetNthValue(value, i);
+
+        if (nftablesCheckValue(varName, val) < 0)
+            return -1;
+
+        /* nft refuses duplicate elements */
+        for (j = 0; j < i; j++) {
+            if (STREQ(val, virNWFilterVarValueGetNthValue(value, j)))
+                break;
+        }
+        if (j < i)
+            continue;
+
+        if (i > 0)
+            virBufferAddLit(&buf, ", ");
+        virBufferAdd(&buf, val, -1);
+    }
+
+    virBufferAddLit(&buf, " }");
+
+    *res = virBufferContentAndReset(&buf);
+    return 0;
+}
+
+
+/*
+ * nftablesPrintItem:
+ * @ctx: the rule being instantiated
+ * @item: the attribute to format
+ * @asHex: whether numbers are to be printed in hexadecimal
+ * @single: whether a single value is needed
+ * @value: filled in with the formatted value
+ *
+ * Formats the value of @item. If it is given by a variable whose values
+ * are matched with an anonymous set, they are all formatted as a set.
+ *
+ * Returns 0 on success, -1 on error and -2 if the set cannot be used and
+ * the rule has to be instantiated once per value of the variable instead.
+ */
+static int
+nftablesPrintItem(nftablesRuleCtx *ctx,
+                  nwItemDesc *item,
+                  bool asHex,
+                  bool single,
+                  char **value)
+{
+    if ((item->flags & NWFILTER_ENTRY_ITEM_FLAG_HAS_VAR)) {
+        const char *varName = virNWFilterVarAccessGetVarName(item->varAccess);
+        const char *val;
+        size_t i;
+
+        for (i = 0; i < ctx->nsetVars; i++) {
+            if (ctx->setVars[i] == item->varAccess)
+                break;
+        }
+
+        if (i < ctx->nsetVars) {
+            /* A negated set matches values not in any of the rules that
+             * would have been created; and a variable used twice in a
+             * rule has to have the same value in both places. */
+            if (single || ENTRY_WANT_NEG_SIGN(item) || ctx->setVarUsed[i])
+                return -2;
+
+            ctx->setVarUsed[i] = true;
+            return nftablesFormatSet(virHashLookup(ctx->rule->vars, varName),
+                                     varName, value);
+        }
+
+        if (!(val = virNWFilterVarCombIterGetVarValue(ctx->vars, item->varAccess)))
+            return -1;
+
+        if (nftablesCheckValue(varName, val) < 0)
+            return -1;
+
+        *value = g_strdup(val);
+        return 0;
+    }
+
+    switch (item->datatype) {
+    case DATATYPE_IPADDR:
+    case DATATYPE_IPV6ADDR:
+        if (!(*value = virSocketAddrFormat(&item->u.ipaddr)))
+            return -1;
+        break;
+
+    case DATATYPE_MACADDR:
+    case DATATYPE_MACMASK:
+        *value = g_new0(char, VIR_MAC_STRING_BUFLEN);
+        virMacAddrFormat(&item->u.macaddr, *value);
+        break;
+
+    case DATATYPE_IPMASK:
+    case DATATYPE_IPV6MASK:
+        *value = g_strdup_printf("%u", item->u.u8);
+        break;
+
+    case DATATYPE_UINT32:
+    case DATATYPE_UINT32_HEX:
+        *value = g_strdup_printf(asHex ? "0x%x" : "%u", item->u.u32);
+        break;
+
+    case DATATYPE_UINT16:
+    case DATATYPE_UINT16_HEX:
+        *value = g_strdup_printf(asHex ? "0x%x" : "%u", item->u.u16);
+        break;
+
+    case DATATYPE_UINT8:
+    case DATATYPE_UINT8_HEX:
+        *value = g_strdup_printf(asHex ? "0x%x" : "%u", item->u.u8);
+        break;
+
+    case DATATYPE_STRING:
+    case DATATYPE_STRINGCOPY:
+    case DATATYPE_BOOLEAN:
+    case DATATYPE_IPSETNAME:
+    case DATATYPE_IPSETFLAGS:
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Cannot print data type %1$x"), item->datatype);
+        return -1;
+    case DATATYPE_LAST:
+    default:
+        virReportEnumRangeError(virNWFilterAttrDataType, item->datatype);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static const char *
+nftablesNegation(nwItemDesc *item)
+{
+    return ENTRY_WANT_NEG_SIGN(item) ? "!= " : "";
+}
+
+
+static int
+nftablesUnsupported(const char *what)
+{
+    virReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                   _("filtering by %1$s is not supported by the nftables driver"),
+                   what);
+    return -1;
+}
+
+
+static int
+nftablesAddMatch(nftablesRuleCtx *ctx,
+                 virBuffer *buf,
+                 const char *field,
+                 nwItemDesc *item,
+                 bool asHex)
+{
+    g_autofree char *val = NULL;
+    int rc;
+
+    if (!HAS_ENTRY_ITEM(item))
+        return 0;
+
+    if ((rc = nftablesPrintItem(ctx, item, asHex, false, &val)) < 0)
+        return rc;
+
+    virBufferAsprintf(buf, "%s %s%s ", field, nftablesNegation(item), val);
+    return 0;
+}
+
+
+static int
+nftablesAddRangeMatch(nftablesRuleCtx *ctx,
+                      virBuffer *buf,
+                      const char *field,
+                      nwItemDesc *start,
+                      nwItemDesc *end)
+{
+    g_autofree char *lo = NULL;
+    g_autofree char *hi = NULL;
+    int rc;
+
+    if (!HAS_ENTRY_ITEM(start))
+        return 0;
+
+    if (!HAS_ENTRY_ITEM(end))
+        return nftablesAddMatch(ctx, buf, field, start, false);
+
+    if ((rc = nftablesPrintItem(ctx, start, false, true, &lo)) < 0 ||
+        (rc = nftablesPrintItem(ctx, end, false, true, &hi)) < 0)
+        return rc;
+
+    virBufferAsprintf(buf, "%s %s%s-%s ", field, nftablesNegation(start), lo, hi);
+    return 0;
+}
+
+
+/* @mask is either a prefix length or a netmask */
+static int
+nftablesParsePrefix(const char *mask,
+                    int family,
+                    unsigned int *prefix)
+{
+    virSocketAddr netmask;
+    int nbits;
+
+    if (virStrToLong_ui(mask, NULL, 10, prefix) == 0)
+        return 0;
+
+    if (virSocketAddrParse(&netmask, mask, family) < 0)
+        return -1;
+
+    if ((nbits = virSocketAddrGetNumNetmaskBits(&netmask)) < 0) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("invalid netmask '%1$s'"), mask);
+        return -1;
+    }
+
+    *prefix = nbits;
+    return 0;
+}
+
+
+/* nft refuses prefixes with host bits set */
+static int
+nftablesAddAddrMatch(nftablesRuleCtx *ctx,
+                     virBuffer *buf,
+                     const char *field,
+                     nwItemDesc *addr,
+                     nwItemDesc *mask)
+{
+    g_autofree char *addrStr = NULL;
+    g_autofree char *maskStr = NULL;
+    g_autofree char *netStr = NULL;
+    virSocketAddr sa;
+    virSocketAddr net;
+    unsigned int prefix;
+    int rc;
+
+    if (!HAS_ENTRY_ITEM(addr))
+        return 0;
+
+    if (!HAS_ENTRY_ITEM(mask))
+        return nftablesAddMatch(ctx, buf, field, addr, false);
+
+    if ((rc = nftablesPrintItem(ctx, addr, false, true, &addrStr)) < 0 ||
+        (rc = nftablesPrintItem(ctx, mask, false, true, &maskStr)) < 0)
+        return rc;
+
+    if (virSocketAddrParse(&sa, addrStr, AF_UNSPEC) < 0 ||
+        nftablesParsePrefix(maskStr, VIR_SOCKET_ADDR_FAMILY(&sa), &prefix) < 0)
+        return -1;
+
+    if (virSocketAddrMaskByPrefix(&sa, prefix, &net) < 0) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("invalid prefix '%1$s' for address '%2$s'"),
+                       maskStr, addrStr);
+        return -1;
+    }
+
+    if (!(netStr = virSocketAddrFormat(&net)))
+        return -1;
+
+    virBufferAsprintf(buf, "%s %s%s/%u ", field, nftablesNegation(addr),
+                      netStr, prefix);
+    return 0;
+}
+
+
+static int
+nftablesAddMACMatch(nftablesRuleCtx *ctx,
+                    virBuffer *buf,
+                    const char *field,
+                    nwItemDesc *addr,
+                    nwItemDesc *mask)
+{
+    g_autofree char *addrStr = NULL;
+    g_autofree char *maskStr = NULL;
+    char netStr[VIR_MAC_STRING_BUFLEN];
+    virMacAddr mac;
+    virMacAddr macmask;
+    size_t i;
+    int rc;
+
+    if (!HAS_ENTRY_ITEM(addr))
+        return 0;
+
+    if (!HAS_ENTRY_ITEM(mask))
+        return nftablesAddMatch(ctx, buf, field, addr, false);
+
+    if ((rc = nftablesPrintItem(ctx, addr, false, true, &addrStr)) < 0 ||
+        (rc = nftablesPrintItem(ctx, mask, false, true, &maskStr)) < 0)
+        return rc;
+
+    if (virMacAddrParse(addrStr, &mac) < 0 ||
+        virMacAddrParse(maskStr, &macmask) < 0) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("invalid MAC address '%1$s' or mask '%2$s'"),
+                       addrStr, maskStr);
+        return -1;
+    }
+
+    for (i = 0; i < VIR_MAC_BUFLEN; i++)
+        mac.addr[i] &= macmask.addr[i];
+
+    virBufferAsprintf(buf, "%s & %s %s%s ", field, maskStr,
+                      ENTRY_WANT_NEG_SIGN(addr) ? "!=" : "==",
+                      virMacAddrFormat(&mac, netStr));
+    return 0;
+}
+
+
+static int
+nftablesRawValue(const char *val,
+                 unsigned int len,
+                 unsigned long long *res)
+{
+    virMacAddr mac;
+    virSocketAddr sa;
+    unsigned char bytes[4];
+    size_t i;
+
+    *res = 0;
+
+    switch (len) {
+    case 48:
+        if (virMacAddrParse(val, &mac) < 0)
+            break;
+        for (i = 0; i < VIR_MAC_BUFLEN; i++)
+            *res = (*res << 8) | mac.addr[i];
+        return 0;
+
+    case 32:
+        if (virSocketAddrParseIPv4(&sa, val) < 0 ||
+            virSocketAddrBytes(&sa, bytes, sizeof(bytes)) != sizeof(bytes))
+            break;
+        for (i = 0; i < sizeof(bytes); i++)
+            *res = (*res << 8) | bytes[i];
+        return 0;
+
+    default:
+        if (virStrToLong_ull(val, NULL, 0, res) == 0)
+            return 0;
+        break;
+    }
+
+    virReportError(VIR_ERR_INVALID_ARG,
+                   _("invalid value '%1$s'"), val);
+    return -1;
+}
+
+
+/*
+ * Matches @len bits at @offset of the network header. nft has no RARP
+ * expressions, the layout of its header is the same as the one of ARP.
+ */
+static int
+nftablesAddRawMatch(nftablesRuleCtx *ctx,
+                    virBuffer *buf,
+                    unsigned int offset,
+                    unsigned int len,
+                    nwItemDesc *item,
+                    nwItemDesc *mask)
+{
+    g_autofree char *valStr = NULL;
+    g_autofree char *maskStr = NULL;
+    unsigned long long val;
+    int width = len / 4;
+    int rc;
+
+    if (!HAS_ENTRY_ITEM(item))
+        return 0;
+
+    if ((rc = nftablesPrintItem(ctx, item, false, true, &valStr)) < 0)
+        return rc;
+
+    if (nftablesRawValue(valStr, len, &val) < 0)
+        return -1;
+
+    if (mask && HAS_ENTRY_ITEM(mask)) {
+        unsigned int prefix;
+        unsigned long long bits;
+
+        if ((rc = nftablesPrintItem(ctx, mask, false, true, &maskStr)) < 0)
+            return rc;
+
+        if (nftablesParsePrefix(maskStr, AF_INET, &prefix) < 0)
+            return -1;
+
+        if (prefix > len) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("invalid prefix '%1$s'"), maskStr);
+            return -1;
+        }
+
+        bits = prefix ? (((1ULL << prefix) - 1) << (len - prefix)) : 0;
+
+        virBufferAsprintf(buf, "@nh,%u,%u & 0x%0*llx %s 0x%0*llx ",
+                          offset, len, width, bits,
+                          ENTRY_WANT_NEG_SIGN(item) ? "!=" : "==",
+                          width, val & bits);
+        return 0;
+    }
+
+    virBufferAsprintf(buf, "@nh,%u,%u %s0x%0*llx ",
+                      offset, len, nftablesNegation(item), width, val);
+    return 0;
+}
+
+
+static int
+nftablesAddComment(virBuffer *buf,
+                   nwItemDesc *comment)
+{
+    const char *p;
+
+    if (!HAS_ENTRY_ITEM(comment))
+        return 0;
+
+    for (p = comment->u.string; *p; p++) {
+        if (!g_ascii_isprint(*p) || *p == '"' || *p == '\\')
+            break;
+    }
+
+    /* comments do not influence filtering, rather drop than refuse them */
+    if (*p || p - comment->u.string > NFTABLES_MAX_COMMENT_LENGTH) {
+        VIR_DEBUG("Skipping comment '%s' which cannot be used with nft",
+                  comment->u.string);
+        return 0;
+    }
+
+    virBufferAsprintf(buf, " comment \"%s\"", comment->u.string);
+    return 0;
+}
+
+
+static void
+nftablesRuleCtxAddCmd(virFirewall *fw,
+                      nftablesRuleCtx *ctx,
+                      const char *chain,
+                      virBuffer *buf)
+{
+    virFirewallCmd *cmd = nftablesAddRuleFW(fw, chain, virBufferCurrentContent(buf));
+
+    VIR_APPEND_ELEMENT(ctx->cmds, ctx->ncmds, cmd);
+}
+
+
+static void
+nftablesRuleCtxNewCmd(nftablesRuleCtx *ctx)
+{
+    size_t i;
+
+    for (i = 0; i < ctx->nsetVars; i++)
+        ctx->setVarUsed[i] = false;
+}
+
+
+static int
+nftablesHandleEthHdr(nftablesRuleCtx *ctx,
+                     virBuffer *buf,
+                     ethHdrDataDef *ethHdr,
+                     bool reverse)
+{
+    int rc;
+
+    if ((rc = nftablesAddMACMatch(ctx, buf,
+                                  reverse ? "ether daddr" : "ether saddr",
+                                  &ethHdr->dataSrcMACAddr,
+                                  &ethHdr->dataSrcMACMask)) < 0)
+        return rc;
+
+    if ((rc = nftablesAddMACMatch(ctx, buf,
+                                  reverse ? "ether saddr" : "ether daddr",
+                                  &ethHdr->dataDstMACAddr,
+                                  &ethHdr->dataDstMACMask)) < 0)
+        return rc;
+
+    return 0;
+}
+
+
+static int
+nftablesHandleIPv6ICMP(nftablesRuleCtx *ctx,
+                       virBuffer *buf,
+                       ipv6HdrFilterDef *ipv6)
+{
+    nwItemDesc *typeStart = &ipv6->dataICMPTypeStart;
+    nwItemDesc *typeEnd = &ipv6->dataICMPTypeEnd;
+    nwItemDesc *codeStart = &ipv6->dataICMPCodeStart;
+    nwItemDesc *codeEnd = &ipv6->dataICMPCodeEnd;
+    g_autofree char *typeLo = NULL;
+    g_autofree char *typeHi = NULL;
+    g_autofree char *codeLo = NULL;
+    g_autofree char *codeHi = NULL;
+    bool hasType = HAS_ENTRY_ITEM(typeStart) || HAS_ENTRY_ITEM(typeEnd);
+    bool hasCode = HAS_ENTRY_ITEM(codeStart) || HAS_ENTRY_ITEM(codeEnd);
+    bool negate = ENTRY_WANT_NEG_SIGN(typeStart);
+    int rc;
+
+    if (!hasType && !hasCode)
+        return 0;
+
+    /* Missing bounds default to the whole range like with ebtables */
+    if (HAS_ENTRY_ITEM(typeStart) &&
+        (rc = nftablesPrintItem(ctx, typeStart, false, true, &typeLo)) < 0)
+        return rc;
+    if (HAS_ENTRY_ITEM(typeEnd) &&
+        (rc = nftablesPrintItem(ctx, typeEnd, false, true, &typeHi)) < 0)
+        return rc;
+    if (HAS_ENTRY_ITEM(codeStart) &&
+        (rc = nftablesPrintItem(ctx, codeStart, false, true, &codeLo)) < 0)
+        return rc;
+    if (HAS_ENTRY_ITEM(codeEnd) &&
+        (rc = nftablesPrintItem(ctx, codeEnd, false, true, &codeHi)) < 0)
+        return rc;
+
+    if (!typeLo)
+        typeLo = g_strdup("0");
+    if (!typeHi)
+        typeHi = g_strdup(HAS_ENTRY_ITEM(typeStart) ? typeLo : "255");
+    if (!codeLo)
+        codeLo = g_strdup("0");
+    if (!codeHi)
+        codeHi = g_strdup(HAS_ENTRY_ITEM(codeStart) ? codeLo : "255");
+
+    if (!negate || !hasType || !hasCode) {
+        if (hasType) {
+            virBufferAsprintf(buf, "icmpv6 type %s%s", negate ? "!= " : "", typeLo);
+            if (STRNEQ(typeLo, typeHi))
+                virBufferAsprintf(buf, "-%s", typeHi);
+            virBufferAddChar(buf, ' ');
+        }
+        if (hasCode) {
+            virBufferAsprintf(buf, "icmpv6 code %s%s",
+                              negate && !hasType ? "!= " : "", codeLo);
+            if (STRNEQ(codeLo, codeHi))
+                virBufferAsprintf(buf, "-%s", codeHi);
+            virBufferAddChar(buf, ' ');
+        }
+        return 0;
+    }
+
+    /* Negating a combination of type and code needs a concatenation,
+     * which does not work with ranges */
+    if (STRNEQ(typeLo, typeHi) || STRNEQ(codeLo, codeHi))
+        return nftablesUnsupported(_("negated ranges of ICMPv6 types and codes"));
+
+    virBufferAsprintf(buf, "icmpv6 type . icmpv6 code != %s . %s ",
+                      typeLo, codeLo);
+    return 0;
+}
+
+
+static const char *
+nftablesL2Verdict(virNWFilterRuleActionType action)
+{
+    switch (action) {
+    case VIR_NWFILTER_RULE_ACTION_ACCEPT:
+        return "accept";
+    case VIR_NWFILTER_RULE_ACTION_RETURN:
+        return "return";
+    case VIR_NWFILTER_RULE_ACTION_CONTINUE:
+        return "continue";
+    case VIR_NWFILTER_RULE_ACTION_REJECT:
+        /* there is no way to reject frames, like with ebtables */
+    case VIR_NWFILTER_RULE_ACTION_DROP:
+    case VIR_NWFILTER_RULE_ACTION_LAST:
+    default:
+        return "drop";
+    }
+}
+
+
+/*
+ * nftablesCreateL2RuleInstance:
+ * @fw: the firewall ruleset to add to
+ * @ctx: the rule being instantiated
+ * @chain: the chain to add the rule to
+ * @reverse: whether to swap source and destination attributes
+ *
+ * Returns 0 on success, -1 on error and -2 if the rule has to be
+ * instantiated without anonymous sets.
+ */
+static int
+nftablesCreateL2RuleInstance(virFirewall *fw,
+                             nftablesRuleCtx *ctx,
+                             const char *chain,
+                             bool reverse)
+{
+    virNWFilterRuleDef *rule = ctx->rule->def;
+    g_auto(virBuffer) buf = VIR_BUFFER_INITIALIZER;
+    int rc;
+
+    nftablesRuleCtxNewCmd(ctx);
+
+    switch ((int)rule->prtclType) {
+    case VIR_NWFILTER_RULE_PROTOCOL_MAC:
+        if ((rc = nftablesHandleEthHdr(ctx, &buf,
+                                       &rule->p.ethHdrFilter.ethHdr,
+                                       reverse)) < 0 ||
+            (rc = nftablesAddMatch(ctx, &buf, "ether type",
+                                   &rule->p.ethHdrFilter.dataProtocolID,
+                                   true)) < 0)
+            return rc;
+        break;
+
+    case VIR_NWFILTER_RULE_PROTOCOL_VLAN:
+        if ((rc = nftablesHandleEthHdr(ctx, &buf,
+                                       &rule->p.vlanHdrFilter.ethHdr,
+                                       reverse)) < 0)
+            return rc;
+
+        virBufferAddLit(&buf, "ether type vlan ");
+
+        if ((rc = nftablesAddMatch(ctx, &buf, "vlan id",
+                                   &rule->p.vlanHdrFilter.dataVlanID,
+                                   false)) < 0 ||
+            (rc = nftablesAddMatch(ctx, &buf, "vlan type",
+                                   &rule->p.vlanHdrFilter.dataVlanEncap,
+                                   true)) < 0)
+            return rc;
+        break;
+
+    case VIR_NWFILTER_RULE_PROTOCOL_STP:
+        /* cannot handle inout direction with srcmask set in reverse dir.
+           since this clashes with the destination address below... */
+        if (reverse &&
+            HAS_ENTRY_ITEM(&rule->p.stpHdrFilter.ethHdr.dataSrcMACAddr)) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("STP filtering in %1$s direction with source MAC address set is not supported"),
+                           virNWFilterRuleDirectionTypeToString(
+                               VIR_NWFILTER_RULE_DIRECTION_INOUT));
+            return -1;
+        }
+
+        if (HAS_ENTRY_ITEM(&rule->p.stpHdrFilter.dataType) ||
+            HAS_ENTRY_ITEM(&rule->p.stpHdrFilter.dataFlags) ||
+            HAS_ENTRY_ITEM(&rule->p.stpHdrFilter.dataRootPri) ||
+            HAS_ENTRY_ITEM(&rule->p.stpHdrFilter.dataRootAddr) ||
+            HAS_ENTRY_ITEM(&rule->p.stpHdrFilter.dataRootCost) ||
+            HAS_ENTRY_ITEM(&rule->p.stpHdrFilter.dataSndrPrio) ||
+            HAS_ENTRY_ITEM(&rule->p.stpHdrFilter.dataSndrAddr) ||
+            HAS_ENTRY_ITEM(&rule->p.stpHdrFilter.dataPort) ||
+            HAS_ENTRY_ITEM(&rule->p.stpHdrFilter.dataAge) ||
+            HAS_ENTRY_ITEM(&rule->p.stpHdrFilter.dataMaxAge) ||
+            HAS_ENTRY_ITEM(&rule->p.stpHdrFilter.dataHelloTime) ||
+            HAS_ENTRY_ITEM(&rule->p.stpHdrFilter.dataFwdDelay))
+            return nftablesUnsupported(_("STP header fields"));
+
+        if ((rc = nftablesHandleEthHdr(ctx, &buf,
+                                       &rule->p.stpHdrFilter.ethHdr,
+                                       reverse)) < 0)
+            return rc;
+
+        virBufferAddLit(&buf, "ether daddr " NWFILTER_MAC_BGA " ");
+        break;
+
+    case VIR_NWFILTER_RULE_PROTOCOL_ARP:
+        if ((rc = nftablesHandleEthHdr(ctx, &buf,
+                                       &rule->p.arpHdrFilter.ethHdr,
+                                       reverse)) < 0)
+            return rc;
+
+        virBufferAddLit(&buf, "ether type arp ");
+
+        if (HAS_ENTRY_ITEM(&rule->p.arpHdrFilter.dataGratuitousARP) &&
+            rule->p.arpHdrFilter.dataGratuitousARP.u.boolean)
+            return nftablesUnsupported(_("gratuitous ARP"));
+
+        if ((rc = nftablesAddMatch(ctx, &buf, "arp htype",
+                                   &rule->p.arpHdrFilter.dataHWType,
+                                   false)) < 0 ||
+            (rc = nftablesAddMatch(ctx, &buf, "arp operation",
+                                   &rule->p.arpHdrFilter.dataOpcode,
+                                   false)) < 0 ||
+            (rc = nftablesAddMatch(ctx, &buf, "arp ptype",
+                                   &rule->p.arpHdrFilter.dataProtocolType,
+                                   true)) < 0 ||
+            (rc = nftablesAddAddrMatch(ctx, &buf,
+                                       reverse ? "arp daddr ip" : "arp saddr ip",
+                                       &rule->p.arpHdrFilter.dataARPSrcIPAddr,
+                                       &rule->p.arpHdrFilter.dataARPSrcIPMask)) < 0 ||
+            (rc = nftablesAddAddrMatch(ctx, &buf,
+                                       reverse ? "arp saddr ip" : "arp daddr ip",
+                                       &rule->p.arpHdrFilter.dataARPDstIPAddr,
+                                       &rule->p.arpHdrFilter.dataARPDstIPMask)) < 0 ||
+            (rc = nftablesAddMatch(ctx, &buf,
+                                   reverse ? "arp daddr ether" : "arp saddr ether",
+                                   &rule->p.arpHdrFilter.dataARPSrcMACAddr,
+                                   false)) < 0 ||
+            (rc = nftablesAddMatch(ctx, &buf,
+                                   reverse ? "arp saddr ether" : "arp daddr ether",
+                                   &rule->p.arpHdrFilter.dataARPDstMACAddr,
+                                   false)) < 0)
+            return rc;
+        break;
+
+    case VIR_NWFILTER_RULE_PROTOCOL_RARP:
+        if ((rc = nftablesHandleEthHdr(ctx, &buf,
+                                       &rule->p.arpHdrFilter.ethHdr,
+                                       reverse)) < 0)
+            return rc;
+
+        virBufferAsprintf(&buf, "ether type 0x%04x ", ETHERTYPE_REVARP);
+
+        if (HAS_ENTRY_ITEM(&rule->p.arpHdrFilter.dataGratuitousARP) &&
+            rule->p.arpHdrFilter.dataGratuitousARP.u.boolean)
+            return nftablesUnsupported(_("gratuitous ARP"));
+
+        if ((rc = nftablesAddRawMatch(ctx, &buf, 0, 16,
+                                      &rule->p.arpHdrFilter.dataHWType,
+                                      NULL)) < 0 ||
+            (rc = nftablesAddRawMatch(ctx, &buf, 16, 16,
+                                      &rule->p.arpHdrFilter.dataProtocolType,
+                                      NULL)) < 0 ||
+            (rc = nftablesAddRawMatch(ctx, &buf, 48, 16,
+                                      &rule->p.arpHdrFilter.dataOpcode,
+                                      NULL)) < 0 ||
+            (rc = nftablesAddRawMatch(ctx, &buf, reverse ? 144 : 64, 48,
+                                      &rule->p.arpHdrFilter.dataARPSrcMACAddr,
+                                      NULL)) < 0 ||
+            (rc = nftablesAddRawMatch(ctx, &buf, reverse ? 192 : 112, 32,
+                                      &rule->p.arpHdrFilter.dataARPSrcIPAddr,
+                                      &rule->p.arpHdrFilter.dataARPSrcIPMask)) < 0 ||
+            (rc = nftablesAddRawMatch(ctx, &buf, reverse ? 64 : 144, 48,
+                                      &rule->p.arpHdrFilter.dataARPDstMACAddr,
+                                      NULL)) < 0 ||
+            (rc = nftablesAddRawMatch(ctx, &buf, reverse ? 112 : 192, 32,
+                                      &rule->p.arpHdrFilter.dataARPDstIPAddr,
+                                      &rule->p.arpHdrFilter.dataARPDstIPMask)) < 0)
+            return rc;
+        break;
+
+    case VIR_NWFILTER_RULE_PROTOCOL_IP:
+        if ((rc = nftablesHandleEthHdr(ctx, &buf,
+                                       &rule->p.ipHdrFilter.ethHdr,
+                                       reverse)) < 0)
+            return rc;
+
+        virBufferAddLit(&buf, "ether type ip ");
+
+        if ((rc = nftablesAddAddrMatch(ctx, &buf,
+                                       reverse ? "ip daddr" : "ip saddr",
+                                       &rule->p.ipHdrFilter.ipHdr.dataSrcIPAddr,
+                                       &rule->p.ipHdrFilter.ipHdr.dataSrcIPMask)) < 0 ||
+            (rc = nftablesAddAddrMatch(ctx, &buf,
+                                       reverse ? "ip saddr" : "ip daddr",
+                                       &rule->p.ipHdrFilter.ipHdr.dataDstIPAddr,
+                                       &rule->p.ipHdrFilter.ipHdr.dataDstIPMask)) < 0 ||
+            (rc = nftablesAddMatch(ctx, &buf, "ip protocol",
+                                   &rule->p.ipHdrFilter.ipHdr.dataProtocolID,
+                                   false)) < 0 ||
+            (rc = nftablesAddRangeMatch(ctx, &buf,
+                                        reverse ? "th dport" : "th sport",
+                                        &rule->p.ipHdrFilter.portData.dataSrcPortStart,
+                                        &rule->p.ipHdrFilter.portData.dataSrcPortEnd)) < 0 ||
+            (rc = nftablesAddRangeMatch(ctx, &buf,
+                                        reverse ? "th sport" : "th dport",
+                                        &rule->p.ipHdrFilter.portData.dataDstPortStart,
+                                        &rule->p.ipHdrFilter.portData.dataDstPortEnd)) < 0 ||
+            (rc = nftablesAddMatch(ctx, &buf, "ip dscp",
+                                   &rule->p.ipHdrFilter.ipHdr.dataDSCP,
+                                   false)) < 0)
+            return rc;
+        break;
+
+    case VIR_NWFILTER_RULE_PROTOCOL_IPV6:
+        if ((rc = nftablesHandleEthHdr(ctx, &buf,
+                                       &rule->p.ipv6HdrFilter.ethHdr,
+                                       reverse)) < 0)
+            return rc;
+
+        virBufferAddLit(&buf, "ether type ip6 ");
+
+        if ((rc = nftablesAddAddrMatch(ctx, &buf,
+                                       reverse ? "ip6 daddr" : "ip6 saddr",
+                                       &rule->p.ipv6HdrFilter.ipHdr.dataSrcIPAddr,
+                                       &rule->p.ipv6HdrFilter.ipHdr.dataSrcIPMask)) < 0 ||
+            (rc = nftablesAddAddrMatch(ctx, &buf,
+                                       reverse ? "ip6 saddr" : "ip6 daddr",
+                                       &rule->p.ipv6HdrFilter.ipHdr.dataDstIPAddr,
+                                       &rule->p.ipv6HdrFilter.ipHdr.dataDstIPMask)) < 0 ||
+            (rc = nftablesAddMatch(ctx, &buf, "meta l4proto",
+                                   &rule->p.ipv6HdrFilter.ipHdr.dataProtocolID,
+                                   false)) < 0 ||
+            (rc = nftablesAddRangeMatch(ctx, &buf,
+                                        reverse ? "th dport" : "th sport",
+                                        &rule->p.ipv6HdrFilter.portData.dataSrcPortStart,
+                                        &rule->p.ipv6HdrFilter.portData.dataSrcPortEnd)) < 0 ||
+            (rc = nftablesAddRangeMatch(ctx, &buf,
+                                        reverse ? "th sport" : "th dport",
+                                        &rule->p.ipv6HdrFilter.portData.dataDstPortStart,
+                                        &rule->p.ipv6HdrFilter.portData.dataDstPortEnd)) < 0 ||
+            (rc = nftablesHandleIPv6ICMP(ctx, &buf, &rule->p.ipv6HdrFilter)) < 0)
+            return rc;
+        break;
+
+    case VIR_NWFILTER_RULE_PROTOCOL_NONE:
+        break;
+
+    default:
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unexpected rule protocol %1$d"),
+                       rule->prtclType);
+        return -1;
+    }
+
+    virBufferAdd(&buf, nftablesL2Verdict(rule->action), -1);
+
+    nftablesRuleCtxAddCmd(fw, ctx, chain, &buf);
+    return 0;
+}
+
+
+static char *
+nftablesStateMatch(int32_t flags)
+{
+    g_auto(virBuffer) buf = VIR_BUFFER_INITIALIZER;
+    g_autofree char *match = NULL;
+
+    virNWFilterPrintStateMatchFlags(&buf, "", flags, false);
+
+    if (!(match = virBufferContentAndReset(&buf)))
+        return NULL;
+
+    return g_ascii_strdown(match, -1);
+}
+
+
+/*
+ * _nftablesCreateL3RuleInstance:
+ * @fw: the firewall ruleset to add to
+ * @ctx: the rule being instantiated
+ * @chain: the chain to add the rule to
+ * @ipv6: whether this is an IPv6 rule
+ * @directionIn: whether the packets are sent to the VM
+ * @match: optional connection states to match
+ * @defMatch: whether @match is the default one for the direction
+ * @acceptVerdict: the verdict for accepted packets, "return" or "accept"
+ * @maySkipICMP: whether rules matching ICMP types may be left out
+ *
+ * This is the counterpart of _iptablesCreateRuleInstance.
+ *
+ * Returns 0 on success, -1 on error and -2 if the rule has to be
+ * instantiated without anonymous sets.
+ */
+static int
+_nftablesCreateL3RuleInstance(virFirewall *fw,
+                              nftablesRuleCtx *ctx,
+                              const char *chain,
+                              bool ipv6,
+                              bool directionIn,
+                              const char *match,
+                              bool defMatch,
+                              const char *acceptVerdict,
+                              bool maySkipICMP)
+{
+    virNWFilterRuleDef *rule = ctx->rule->def;
+    g_auto(virBuffer) buf = VIR_BUFFER_INITIALIZER;
+    const char *ip = ipv6 ? "ip6" : "ip";
+    const char *l4proto = NULL;
+    const char *icmp = NULL;
+    nwItemDesc *srcMACAddr;
+    ipHdrDataDef *ipHdr;
+    portDataDef *portData = NULL;
+    g_autofree char *field = NULL;
+    const char *verdict;
+    bool skipRule = false;
+    bool skipMatch = false;
+    bool hasICMPType = false;
+    size_t argsStart;
+    int rc;
+
+    nftablesRuleCtxNewCmd(ctx);
+
+    switch ((int)rule->prtclType) {
+    case VIR_NWFILTER_RULE_PROTOCOL_TCP:
+    case VIR_NWFILTER_RULE_PROTOCOL_TCPoIPV6:
+        l4proto = "tcp";
+        srcMACAddr = &rule->p.tcpHdrFilter.dataSrcMACAddr;
+        ipHdr = &rule->p.tcpHdrFilter.ipHdr;
+        portData = &rule->p.tcpHdrFilter.portData;
+        if (HAS_ENTRY_ITEM(&rule->p.tcpHdrFilter.dataTCPOption))
+            return nftablesUnsupported(_("TCP options"));
+        break;
+    case VIR_NWFILTER_RULE_PROTOCOL_UDP:
+    case VIR_NWFILTER_RULE_PROTOCOL_UDPoIPV6:
+        l4proto = "udp";
+        srcMACAddr = &rule->p.udpHdrFilter.dataSrcMACAddr;
+        ipHdr = &rule->p.udpHdrFilter.ipHdr;
+        portData = &rule->p.udpHdrFilter.portData;
+        break;
+    case VIR_NWFILTER_RULE_PROTOCOL_UDPLITE:
+    case VIR_NWFILTER_RULE_PROTOCOL_UDPLITEoIPV6:
+        l4proto = "udplite";
+        srcMACAddr = &rule->p.udpliteHdrFilter.dataSrcMACAddr;
+        ipHdr = &rule->p.udpliteHdrFilter.ipHdr;
+        break;
+    case VIR_NWFILTER_RULE_PROTOCOL_ESP:
+    case VIR_NWFILTER_RULE_PROTOCOL_ESPoIPV6:
+        l4proto = "esp";
+        srcMACAddr = &rule->p.espHdrFilter.dataSrcMACAddr;
+        ipHdr = &rule->p.espHdrFilter.ipHdr;
+        break;
+    case VIR_NWFILTER_RULE_PROTOCOL_AH:
+    case VIR_NWFILTER_RULE_PROTOCOL_AHoIPV6:
+        l4proto = "ah";
+        srcMACAddr = &rule->p.ahHdrFilter.dataSrcMACAddr;
+        ipHdr = &rule->p.ahHdrFilter.ipHdr;
+        break;
+    case VIR_NWFILTER_RULE_PROTOCOL_SCTP:
+    case VIR_NWFILTER_RULE_PROTOCOL_SCTPoIPV6:
+        l4proto = "sctp";
+        srcMACAddr = &rule->p.sctpHdrFilter.dataSrcMACAddr;
+        ipHdr = &rule->p.sctpHdrFilter.ipHdr;
+        portData = &rule->p.sctpHdrFilter.portData;
+        break;
+    case VIR_NWFILTER_RULE_PROTOCOL_ICMP:
+        l4proto = "icmp";
+        icmp = "icmp";
+        srcMACAddr = &rule->p.icmpHdrFilter.dataSrcMACAddr;
+        ipHdr = &rule->p.icmpHdrFilter.ipHdr;
+        break;
+    case VIR_NWFILTER_RULE_PROTOCOL_ICMPV6:
+        l4proto = "ipv6-icmp";
+        icmp = "icmpv6";
+        srcMACAddr = &rule->p.icmpHdrFilter.dataSrcMACAddr;
+        ipHdr = &rule->p.icmpHdrFilter.ipHdr;
+        break;
+    case VIR_NWFILTER_RULE_PROTOCOL_IGMP:
+        l4proto = "igmp";
+        srcMACAddr = &rule->p.igmpHdrFilter.dataSrcMACAddr;
+        ipHdr = &rule->p.igmpHdrFilter.ipHdr;
+        break;
+    case VIR_NWFILTER_RULE_PROTOCOL_ALL:
+    case VIR_NWFILTER_RULE_PROTOCOL_ALLoIPV6:
+        srcMACAddr = &rule->p.allHdrFilter.dataSrcMACAddr;
+        ipHdr = &rule->p.allHdrFilter.ipHdr;
+        break;
+    default:
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unexpected protocol %1$d"),
+                       rule->prtclType);
+        return -1;
+    }
+
+    if (HAS_ENTRY_ITEM(&ipHdr->dataIPSet))
+        return nftablesUnsupported(_("ipsets"));
+
+    /* "ct count" limits the connections matching the rule as a whole
+     * whereas connlimit counts them per source address. Rules limiting
+     * traffic sent to the VM are skipped below, like with iptables. */
+    if (HAS_ENTRY_ITEM(&ipHdr->dataConnlimitAbove) && !directionIn)
+        return nftablesUnsupported(_("connection limits"));
+
+    virBufferAsprintf(&buf, "meta protocol %s ", ip);
+    if (l4proto)
+        virBufferAsprintf(&buf, "meta l4proto %s ", l4proto);
+
+    argsStart = virBufferUse(&buf);
+
+    /* the source MAC address is unknown for packets sent to the VM */
+    if (!directionIn &&
+        (rc = nftablesAddMatch(ctx, &buf, "ether saddr", srcMACAddr, false)) < 0)
+        return rc;
+
+    field = g_strdup_printf("%s %s", ip, directionIn ? "daddr" : "saddr");
+    if (HAS_ENTRY_ITEM(&ipHdr->dataSrcIPAddr)) {
+        if ((rc = nftablesAddAddrMatch(ctx, &buf, field,
+                                       &ipHdr->dataSrcIPAddr,
+                                       &ipHdr->dataSrcIPMask)) < 0)
+            return rc;
+    } else if ((rc = nftablesAddRangeMatch(ctx, &buf, field,
+                                           &ipHdr->dataSrcIPFrom,
+                                           &ipHdr->dataSrcIPTo)) < 0) {
+        return rc;
+    }
+    g_free(field);
+
+    field = g_strdup_printf("%s %s", ip, directionIn ? "saddr" : "daddr");
+    if (HAS_ENTRY_ITEM(&ipHdr->dataDstIPAddr)) {
+        if ((rc = nftablesAddAddrMatch(ctx, &buf, field,
+                                       &ipHdr->dataDstIPAddr,
+                                       &ipHdr->dataDstIPMask)) < 0)
+            return rc;
+    } else if ((rc = nftablesAddRangeMatch(ctx, &buf, field,
+                                           &ipHdr->dataDstIPFrom,
+                                           &ipHdr->dataDstIPTo)) < 0) {
+        return rc;
+    }
+    g_free(field);
+
+    field = g_strdup_printf("%s dscp", ip);
+    if ((rc = nftablesAddMatch(ctx, &buf, field, &ipHdr->dataDSCP, false)) < 0)
+        return rc;
+
+    /* only support for limit in outgoing dir., which was refused above */
+    if (HAS_ENTRY_ITEM(&ipHdr->dataConnlimitAbove))
+        skipRule = true;
+
+    if (l4proto && STREQ(l4proto, "tcp") &&
+        HAS_ENTRY_ITEM(&rule->p.tcpHdrFilter.dataTCPFlags)) {
+        nwItemDesc *flags = &rule->p.tcpHdrFilter.dataTCPFlags;
+
+        virBufferAsprintf(&buf, "tcp flags & 0x%x %s 0x%x ",
+                          flags->u.tcpFlags.mask,
+                          ENTRY_WANT_NEG_SIGN(flags) ? "!=" : "==",
+                          flags->u.tcpFlags.flags);
+    }
+
+    if (portData) {
+        g_autofree char *sport = g_strdup_printf("%s %s", l4proto,
+                                                 directionIn ? "dport" : "sport");
+        g_autofree char *dport = g_strdup_printf("%s %s", l4proto,
+                                                 directionIn ? "sport" : "dport");
+
+        if ((rc = nftablesAddRangeMatch(ctx, &buf, sport,
+                                        &portData->dataSrcPortStart,
+                                        &portData->dataSrcPortEnd)) < 0 ||
+            (rc = nftablesAddRangeMatch(ctx, &buf, dport,
+                                        &portData->dataDstPortStart,
+                                        &portData->dataDstPortEnd)) < 0)
+            return rc;
+    }
+
+    if (icmp && HAS_ENTRY_ITEM(&rule->p.icmpHdrFilter.dataICMPType)) {
+        nwItemDesc *type = &rule->p.icmpHdrFilter.dataICMPType;
+        nwItemDesc *code = &rule->p.icmpHdrFilter.dataICMPCode;
+
+        hasICMPType = true;
+
+        if (maySkipICMP)
+            return 0;
+
+        if (HAS_ENTRY_ITEM(code) && ENTRY_WANT_NEG_SIGN(type)) {
+            g_autofree char *typeStr = NULL;
+            g_autofree char *codeStr = NULL;
+
+            /* the type and code are negated as a whole */
+            if ((rc = nftablesPrintItem(ctx, type, false, true, &typeStr)) < 0 ||
+                (rc = nftablesPrintItem(ctx, code, false, true, &codeStr)) < 0)
+                return rc;
+
+            virBufferAsprintf(&buf, "%s type . %s code != %s . %s ",
+                              icmp, icmp, typeStr, codeStr);
+        } else {
+            g_autofree char *typeField = g_strdup_printf("%s type", icmp);
+            g_autofree char *codeField = g_strdup_printf("%s code", icmp);
+
+            if ((rc = nftablesAddMatch(ctx, &buf, typeField, type, false)) < 0 ||
+                (rc = nftablesAddMatch(ctx, &buf, codeField, code, false)) < 0)
+                return rc;
+        }
+    }
+
+    if ((HAS_ENTRY_ITEM(srcMACAddr) && directionIn &&
+         virBufferUse(&buf) == argsStart) ||
+        skipRule)
+        return 0;
+
+    switch (rule->action) {
+    case VIR_NWFILTER_RULE_ACTION_ACCEPT:
+        verdict = acceptVerdict;
+        break;
+    case VIR_NWFILTER_RULE_ACTION_REJECT:
+        verdict = "reject";
+        skipMatch = defMatch;
+        break;
+    case VIR_NWFILTER_RULE_ACTION_RETURN:
+        verdict = "return";
+        skipMatch = defMatch;
+        break;
+    case VIR_NWFILTER_RULE_ACTION_CONTINUE:
+        verdict = "continue";
+        skipMatch = defMatch;
+        break;
+    case VIR_NWFILTER_RULE_ACTION_DROP:
+    case VIR_NWFILTER_RULE_ACTION_LAST:
+    default:
+        verdict = "drop";
+        skipMatch = defMatch;
+        break;
+    }
+
+    if (match && !skipMatch)
+        virBufferAsprintf(&buf, "ct state %s ", match);
+
+    if (defMatch && match && !skipMatch && !hasICMPType &&
+        rule->tt != VIR_NWFILTER_RULE_DIRECTION_INOUT)
+        virBufferAsprintf(&buf, "ct direction %s ",
+                          directionIn ? "reply" : "original");
+
+    virBufferAdd(&buf, verdict, -1);
+
+    if (nftablesAddComment(&buf, &ipHdr->dataComment) < 0)
+        return -1;
+
+    nftablesRuleCtxAddCmd(fw, ctx, chain, &buf);
+    return 0;
+}
+
+
+/* This is the counterpart of iptablesCreateRuleInstanceStateCtrl */
+static int
+nftablesCreateL3RuleInstanceStateCtrl(virFirewall *fw,
+                                      nftablesRuleCtx *ctx,
+                                      char *const *roots,
+                                      bool ipv6)
+{
+    virNWFilterRuleDef *rule = ctx->rule->def;
+    bool directionIn = false;
+    bool inout = false;
+    g_autofree char *matchState = NULL;
+    int rc;
+
+    if (rule->tt == VIR_NWFILTER_RULE_DIRECTION_IN ||
+        rule->tt == VIR_NWFILTER_RULE_DIRECTION_INOUT) {
+        directionIn = true;
+        inout = (rule->tt == VIR_NWFILTER_RULE_DIRECTION_INOUT);
+    }
+
+    matchState = nftablesStateMatch(rule->flags);
+
+    if (!directionIn || inout) {
+        if ((rc = _nftablesCreateL3RuleInstance(fw, ctx,
+                                                roots[NFTABLES_DIR_FWD_IN],
+                                                ipv6, directionIn,
+                                                matchState, false,
+                                                "return",
+                                                directionIn || inout)) < 0)
+            return rc;
+    }
+
+    if (directionIn) {
+        if ((rc = _nftablesCreateL3RuleInstance(fw, ctx,
+                                                roots[NFTABLES_DIR_FWD_OUT],
+                                                ipv6, !directionIn,
+                                                matchState, false,
+                                                "accept",
+                                                !directionIn || inout)) < 0)
+            return rc;
+    }
+
+    if (!directionIn || inout) {
+        if ((rc = _nftablesCreateL3RuleInstance(fw, ctx,
+                                                roots[NFTABLES_DIR_HOST_IN],
+                                                ipv6, directionIn,
+                                                matchState, false,
+                                                "return",
+                                                directionIn)) < 0)
+            return rc;
+    }
+
+    return 0;
+}
+
+
+/* This is the counterpart of iptablesCreateRuleInstance */
+static int
+nftablesCreateL3RuleInstance(virFirewall *fw,
+                             nftablesRuleCtx *ctx,
+                             char *const *roots,
+                             bool ipv6)
+{
+    virNWFilterRuleDef *rule = ctx->rule->def;
+    bool directionIn = false;
+    bool needState = true;
+    bool inout = false;
+    int rc;
+
+    if (!(rule->flags & RULE_FLAG_NO_STATEMATCH) &&
+         (rule->flags & IPTABLES_STATE_FLAGS))
+        return nftablesCreateL3RuleInstanceStateCtrl(fw, ctx, roots, ipv6);
+
+    if (rule->tt == VIR_NWFILTER_RULE_DIRECTION_IN ||
+        rule->tt == VIR_NWFILTER_RULE_DIRECTION_INOUT) {
+        directionIn = true;
+        inout = (rule->tt == VIR_NWFILTER_RULE_DIRECTION_INOUT);
+        if (inout)
+            needState = false;
+    }
+
+    if ((rule->flags & RULE_FLAG_NO_STATEMATCH))
+        needState = false;
+
+    if ((rc = _nftablesCreateL3RuleInstance(fw, ctx,
+                                            roots[NFTABLES_DIR_FWD_IN],
+                                            ipv6, directionIn,
+                                            !needState ? NULL :
+                                            directionIn ? "established" : "new,established",
+                                            true, "return",
+                                            directionIn || inout)) < 0)
+        return rc;
+
+    if ((rc = _nftablesCreateL3RuleInstance(fw, ctx,
+                                            roots[NFTABLES_DIR_FWD_OUT],
+                                            ipv6, !directionIn,
+                                            !needState ? NULL :
+                                            directionIn ? "new,established" : "established",
+                                            true, "accept",
+                                            !directionIn || inout)) < 0)
+        return rc;
+
+    return _nftablesCreateL3RuleInstance(fw, ctx,
+                                         roots[NFTABLES_DIR_HOST_IN],
+                                         ipv6, directionIn,
+                                         !needState ? NULL :
+                                         directionIn ? "established" : "new,established",
+                                         true, "return",
+                                         directionIn);
+}
+
+
+static int
+nftablesCreateRuleInstance(virFirewall *fw,
+                           nftablesRuleCtx *ctx,
+                           const char *ifname,
+                           nftablesGeneration *gen)
+{
+    virNWFilterRuleInst *inst = ctx->rule;
+    virNWFilterRuleDef *rule = inst->def;
+    bool root = STREQ(inst->chainSuffix,
+                      virNWFilterChainSuffixTypeToString(VIR_NWFILTER_CHAINSUFFIX_ROOT));
+    int rc;
+
+    if (!virNWFilterRuleIsProtocolEthernet(rule)) {
+        if (virNWFilterRuleIsProtocolIPv6(rule))
+            return nftablesCreateL3RuleInstance(fw, ctx, gen->chains, true);
+
+        if (virNWFilterRuleIsProtocolIPv4(rule))
+            return nftablesCreateL3RuleInstance(fw, ctx, gen->chains, false);
+
+        virReportError(VIR_ERR_OPERATION_FAILED,
+                       "%s", _("unexpected protocol type"));
+        return -1;
+    }
+
+    if (rule->tt == VIR_NWFILTER_RULE_DIRECTION_OUT ||
+        rule->tt == VIR_NWFILTER_RULE_DIRECTION_INOUT) {
+        g_autofree char *chain = NULL;
+
+        if (!root)
+            chain = nftablesChainName(ifname, gen->id, NFTABLES_DIR_L2_IN,
+                                      inst->chainSuffix);
+
+        if ((rc = nftablesCreateL2RuleInstance(fw, ctx,
+                                               root ? gen->chains[NFTABLES_DIR_L2_IN] : chain,
+                                               rule->tt == VIR_NWFILTER_RULE_DIRECTION_INOUT)) < 0)
+            return rc;
+    }
+
+    if (rule->tt == VIR_NWFILTER_RULE_DIRECTION_IN ||
+        rule->tt == VIR_NWFILTER_RULE_DIRECTION_INOUT) {
+        g_autofree char *chain = NULL;
+
+        if (!root)
+            chain = nftablesChainName(ifname, gen->id, NFTABLES_DIR_L2_OUT,
+                                      inst->chainSuffix);
+
+        if ((rc = nftablesCreateL2RuleInstance(fw, ctx,
+                                               root ? gen->chains[NFTABLES_DIR_L2_OUT] : chain,
+                                               false)) < 0)
+            return rc;
+    }
+
+    return 0;
+}
+
+
+static int
+nftablesRuleInstIterate(virFirewall *fw,
+                        nftablesRuleCtx *ctx,
+                        const char *ifname,
+                        nftablesGeneration *gen,
+                        virNWFilterVarAccess **varAccess,
+                        size_t nVarAccess)
+{
+    virNWFilterVarCombIter *vciter;
+    virNWFilterVarCombIter *tmp;
+    int rc = 0;
+
+    tmp = vciter = virNWFilterVarCombIterCreate(ctx->rule->vars,
+                                                varAccess, nVarAccess);
+    if (!vciter)
+        return -1;
+
+    do {
+        ctx->vars = tmp;
+        if ((rc = nftablesCreateRuleInstance(fw, ctx, ifname, gen)) < 0)
+            break;
+        tmp = virNWFilterVarCombIterNext(tmp);
+    } while (tmp != NULL);
+
+    ctx->vars = NULL;
+    virNWFilterVarCombIterFree(vciter);
+    return rc;
+}
+
+
+/*
+ * A variable with multiple values that is iterated over independently of
+ * all other variables of the rule can be matched with an anonymous set
+ * holding all of its values, in a single rule.
+ */
+static bool
+nftablesIsSetVariable(virNWFilterRuleInst *rule,
+                      size_t idx)
+{
+    virNWFilterVarAccess *access = rule->def->varAccess[idx];
+    virNWFilterVarValue *value;
+    unsigned int iterId;
+    size_t i;
+
+    if (virNWFilterVarAccessGetType(access) != VIR_NWFILTER_VAR_ACCESS_ITERATOR)
+        return false;
+
+    value = virHashLookup(rule->vars, virNWFilterVarAccessGetVarName(access));
+    if (!value || virNWFilterVarValueGetCardinality(value) < 2)
+        return false;
+
+    iterId = virNWFilterVarAccessGetIterId(access);
+
+    for (i = 0; i < rule->def->nVarAccess; i++) {
+        virNWFilterVarAccess *other = rule->def->varAccess[i];
+
+        if (i != idx &&
+            virNWFilterVarAccessGetType(other) == VIR_NWFILTER_VAR_ACCESS_ITERATOR &&
+            virNWFilterVarAccessGetIterId(other) == iterId)
+            return false;
+    }
+
+    return true;
+}
+
+
+/*
+ * Instantiates @rule for all combinations of the values of its variables.
+ * Where possible, variables are matched with anonymous sets so that a
+ * single rule covers all their values, keeping the number of rules a
+ * packet traverses independent of the size of eg. the list of IP addresses
+ * of the VM.
+ */
+static int
+nftablesRuleInstCommand(virFirewall *fw,
+                        const char *ifname,
+                        nftablesGeneration *gen,
+                        virNWFilterRuleInst *rule)
+{
+    nftablesRuleCtx ctx = { .rule = rule };
+    g_autofree virNWFilterVarAccess **iterVars = NULL;
+    size_t niterVars = 0;
+    size_t i;
+    int rc;
+
+    for (i = 0; i < rule->def->nVarAccess; i++) {
+        virNWFilterVarAccess *access = rule->def->varAccess[i];
+
+        if (nftablesIsSetVariable(rule, i))
+            VIR_APPEND_ELEMENT(ctx.setVars, ctx.nsetVars, access);
+        else
+            VIR_APPEND_ELEMENT(iterVars, niterVars, access);
+    }
+    ctx.setVarUsed = g_new0(bool, ctx.nsetVars + 1);
+
+    rc = nftablesRuleInstIterate(fw, &ctx, ifname, gen, iterVars, niterVars);
+
+    if (rc == -2) {
+        /* start over without sets */
+        for (i = 0; i < ctx.ncmds; i++)
+            virFirewallRemoveCmd(fw, ctx.cmds[i]);
+        g_clear_pointer(&ctx.cmds, g_free);
+        ctx.ncmds = 0;
+        ctx.nsetVars = 0;
+
+        rc = nftablesRuleInstIterate(fw, &ctx, ifname, gen,
+                                     rule->def->varAccess,
+                                     rule->def->nVarAccess);
+    }
+
+    g_free(ctx.setVars);
+    g_free(ctx.setVarUsed);
+    g_free(ctx.cmds);
+
+    if (rc == -2) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("unexpected use of a set in an nftables rule"));
+        return -1;
+    }
+
+    return rc;
+}
+
+
+typedef struct _nftablesSubChain nftablesSubChain;
+struct _nftablesSubChain {
+    virNWFilterChainPriority priority;
+    nftablesDirection dir;
+    const nftablesSubChainProtocol *proto;
+    char *name;
+};
+
+
+static void
+nftablesSubChainFree(nftablesSubChain *sub)
+{
+    if (!sub)
+        return;
+
+    g_free(sub->name);
+    g_free(sub);
+}
+
+
+static int
+nftablesSubChainSort(const void *a,
+                     const void *b,
+                     void *opaque G_GNUC_UNUSED)
+{
+    const nftablesSubChain **suba = (const nftablesSubChain **)a;
+    const nftablesSubChain **subb = (const nftablesSubChain **)b;
+
+    /* priorities are limited to range [-1000, 1000] */
+    return (*suba)->priority - (*subb)->priority;
+}
+
+
+static void
+nftablesGetSubChains(GHashTable *chains,
+                     const char *ifname,
+                     nftablesGeneration *gen,
+                     nftablesDirection dir,
+                     nftablesSubChain ***subs,
+                     size_t *nsubs)
+{
+    g_autofree virHashKeyValuePair *names = NULL;
+    size_t nnames;
+    size_t i;
+    size_t j;
+
+    if (!(names = virHashGetItems(chains, &nnames, true)))
+        return;
+
+    for (i = 0; i < nnames; i++) {
+        nftablesSubChain *sub;
+        char *chain;
+
+        for (j = 0; j < G_N_ELEMENTS(nftablesSubChainProtocols); j++) {
+            if (STRPREFIX(names[i].key, nftablesSubChainProtocols[j].prefix))
+                break;
+        }
+
+        /* the root chain */
+        if (j == G_N_ELEMENTS(nftablesSubChainProtocols))
+            continue;
+
+        sub = g_new0(nftablesSubChain, 1);
+        sub->priority = *(const virNWFilterChainPriority *)names[i].value;
+        sub->dir = dir;
+        sub->proto = &nftablesSubChainProtocols[j];
+        sub->name = nftablesChainName(ifname, gen->id, dir, names[i].key);
+
+        chain = g_strdup(sub->name);
+        VIR_APPEND_ELEMENT(gen->chains, gen->nchains, chain);
+        VIR_APPEND_ELEMENT(*subs, *nsubs, sub);
+    }
+}
+
+
+/*
+ * Consecutive jumps from a root chain to sub chains of protocols with
+ * distinct ethertypes are merged into a lookup in a verdict map.
+ */
+typedef struct _nftablesJumpGroup nftablesJumpGroup;
+struct _nftablesJumpGroup {
+    unsigned int ethertypes[G_N_ELEMENTS(nftablesSubChainProtocols)];
+    const char *chains[G_N_ELEMENTS(nftablesSubChainProtocols)];
+    size_t njumps;
+};
+
+
+static void
+nftablesJumpGroupFlush(virFirewall *fw,
+                       const char *root,
+                       nftablesJumpGroup *group)
+{
+    g_auto(virBuffer) buf = VIR_BUFFER_INITIALIZER;
+    size_t i;
+
+    if (group->njumps == 0)
+        return;
+
+    if (group->njumps == 1) {
+        virBufferAsprintf(&buf, "ether type 0x%04x jump \"%s\"",
+                          group->ethertypes[0], group->chains[0]);
+    } else {
+        virBufferAddLit(&buf, "ether type vmap { ");
+        for (i = 0; i < group->njumps; i++) {
+            if (i > 0)
+                virBufferAddLit(&buf, ", ");
+            virBufferAsprintf(&buf, "0x%04x : jump \"%s\"",
+                              group->ethertypes[i], group->chains[i]);
+        }
+        virBufferAddLit(&buf, " }");
+    }
+
+    nftablesAddRuleFW(fw, root, virBufferCurrentContent(&buf));
+    group->njumps = 0;
+}
+
+
+static void
+nftablesSubChainJumpFW(virFirewall *fw,
+                       nftablesGeneration *gen,
+                       nftablesJumpGroup *groups,
+                       nftablesSubChain *sub)
+{
+    nftablesJumpGroup *group = &groups[sub->dir];
+    const char *root = gen->chains[sub->dir];
+    size_t i;
+
+    if (sub->proto->ethertype == 0) {
+        g_autofree char *rule = NULL;
+
+        nftablesJumpGroupFlush(fw, root, group);
+
+        if (sub->proto->daddr)
+            rule = g_strdup_printf("ether daddr %s jump \"%s\"",
+                                   sub->proto->daddr, sub->name);
+        else
+            rule = g_strdup_printf("jump \"%s\"", sub->name);
+
+        nftablesAddRuleFW(fw, root, rule);
+        return;
+    }
+
+    for (i = 0; i < group->njumps; i++) {
+        if (group->ethertypes[i] == sub->proto->ethertype) {
+            nftablesJumpGroupFlush(fw, root, group);
+            break;
+        }
+    }
+
+    group->ethertypes[group->njumps] = sub->proto->ethertype;
+    group->chains[group->njumps] = sub->name;
+    group->njumps++;
+}
+
+
+/*
+ * Adds the chains of @gen along with the rules to @fw. This does the same
+ * as the ebtables part of ebiptablesApplyNewRules, interleaving the rules
+ * with the jumps to sub chains according to their priorities.
+ */
+static int
+nftablesRenderRulesFW(virFirewall *fw,
+                      const char *ifname,
+                      nftablesGeneration *gen,
+                      virNWFilterRuleInst **rules,
+                      size_t nrules)
+{
+    g_autoptr(GHashTable) chains_in_set = virHashNew(NULL);
+    g_autoptr(GHashTable) chains_out_set = virHashNew(NULL);
+    nftablesSubChain **subs = NULL;
+    size_t nsubs = 0;
+    nftablesJumpGroup groups[NFTABLES_DIR_LAST] = { 0 };
+    const char *root = virNWFilterChainSuffixTypeToString(VIR_NWFILTER_CHAINSUFFIX_ROOT);
+    size_t i;
+    size_t j;
+    int ret = -1;
+
+    /* scan the rules to see which chains need to be created */
+    for (i = 0; i < nrules; i++) {
+        virNWFilterRuleDef *def = rules[i]->def;
+
+        if (!virNWFilterRuleIsProtocolEthernet(def))
+            continue;
+
+        if (def->tt == VIR_NWFILTER_RULE_DIRECTION_OUT ||
+            def->tt == VIR_NWFILTER_RULE_DIRECTION_INOUT) {
+            if (virHashUpdateEntry(chains_in_set, rules[i]->chainSuffix,
+                                   &rules[i]->chainPriority) < 0)
+                goto cleanup;
+        }
+        if (def->tt == VIR_NWFILTER_RULE_DIRECTION_IN ||
+            def->tt == VIR_NWFILTER_RULE_DIRECTION_INOUT) {
+            if (virHashUpdateEntry(chains_out_set, rules[i]->chainSuffix,
+                                   &rules[i]->chainPriority) < 0)
+                goto cleanup;
+        }
+    }
+
+    nftablesGetSubChains(chains_in_set, ifname, gen, NFTABLES_DIR_L2_IN,
+                         &subs, &nsubs);
+    nftablesGetSubChains(chains_out_set, ifname, gen, NFTABLES_DIR_L2_OUT,
+                         &subs, &nsubs);
+
+    if (nsubs > 0) {
+        g_qsort_with_data(subs, nsubs, sizeof(subs[0]),
+                          nftablesSubChainSort, NULL);
+    }
+
+    nftablesCreateChainsFW(fw, gen);
+
+    for (i = 0, j = 0; i < nrules; i++) {
+        virNWFilterRuleDef *def = rules[i]->def;
+
+        if (virNWFilterRuleIsProtocolEthernet(def)) {
+            while (j < nsubs && subs[j]->priority <= rules[i]->priority)
+                nftablesSubChainJumpFW(fw, gen, groups, subs[j++]);
+
+            /* rules of the root chain go between the jumps */
+            if (STREQ(rules[i]->chainSuffix, root)) {
+                if (def->tt == VIR_NWFILTER_RULE_DIRECTION_OUT ||
+                    def->tt == VIR_NWFILTER_RULE_DIRECTION_INOUT)
+                    nftablesJumpGroupFlush(fw, gen->chains[NFTABLES_DIR_L2_IN],
+                                           &groups[NFTABLES_DIR_L2_IN]);
+                if (def->tt == VIR_NWFILTER_RULE_DIRECTION_IN ||
+                    def->tt == VIR_NWFILTER_RULE_DIRECTION_INOUT)
+                    nftablesJumpGroupFlush(fw, gen->chains[NFTABLES_DIR_L2_OUT],
+                                           &groups[NFTABLES_DIR_L2_OUT]);
+            }
+        }
+
+        if (nftablesRuleInstCommand(fw, ifname, gen, rules[i]) < 0)
+            goto cleanup;
+    }
+
+    while (j < nsubs)
+        nftablesSubChainJumpFW(fw, gen, groups, subs[j++]);
+
+    nftablesJumpGroupFlush(fw, gen->chains[NFTABLES_DIR_L2_IN],
+                           &groups[NFTABLES_DIR_L2_IN]);
+    nftablesJumpGroupFlush(fw, gen->chains[NFTABLES_DIR_L2_OUT],
+                           &groups[NFTABLES_DIR_L2_OUT]);
+
+    /* frames falling off the end of an ebtables sub chain are accepted
+     * by its policy rather than returned to the root chain */
+    for (i = 0; i < nsubs; i++)
+        nftablesAddRuleFW(fw, subs[i]->name, "accept");
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; i < nsubs; i++)
+        nftablesSubChainFree(subs[i]);
+    g_free(subs);
+    return ret;
+}
+
+
+static int
+nftablesRuleInstSort(const void *a,
+                     const void *b,
+                     void *opaque G_GNUC_UNUSED)
+{
+    const virNWFilterRuleInst *insta = *(virNWFilterRuleInst * const *)a;
+    const virNWFilterRuleInst *instb = *(virNWFilterRuleInst * const *)b;
+    const char *root = virNWFilterChainSuffixTypeToString(
+                                     VIR_NWFILTER_CHAINSUFFIX_ROOT);
+    bool root_a = STREQ(insta->chainSuffix, root);
+    bool root_b = STREQ(instb->chainSuffix, root);
+
+    /* root chain rules come first, like with ebiptables */
+    if (root_a) {
+        if (!root_b)
+            return -1;
+    } else if (root_b) {
+        return 1;
+    }
+
+    /* priorities are limited to range [-1000, 1000] */
+    return insta->priority - instb->priority;
+}
+
+
+/************************ driver callbacks ************************/
+
+static int
+nftablesApplyNewRules(const char *ifname,
+                      virNWFilterRuleInst **rules,
+                      size_t nrules)
+{
+    g_autoptr(virFirewall) fw = virFirewallNew(VIR_FIREWALL_BACKEND_NFTABLES);
+    g_autoptr(nftablesGeneration) gen = NULL;
+    g_autoptr(nftablesGeneration) old = NULL;
+    nftablesPort *port;
+    size_t i;
+
+    if (nftablesCheckIfname(ifname) < 0 ||
+        nftablesRecover() < 0)
+        return -1;
+
+    if (nrules) {
+        g_qsort_with_data(rules, nrules, sizeof(rules[0]),
+                          nftablesRuleInstSort, NULL);
+    }
+
+    /* increase the priority of rules whose chain has a higher priority,
+     * see ebiptablesApplyNewRules */
+    for (i = 0; i < nrules; i++) {
+        if (rules[i]->chainPriority > rules[i]->priority &&
+            !strstr("root", rules[i]->chainSuffix)) {
+
+             rules[i]->priority = rules[i]->chainPriority;
+        }
+    }
+
+    gen = nftablesGenerationNew(ifname);
+
+    virFirewallStartTransaction(fw, VIR_FIREWALL_TRANSACTION_ATOMIC);
+
+    nftablesSetupInfraFW(fw);
+    nftablesSetupDispatchFW(fw, ifname);
+
+    if (nftablesRenderRulesFW(fw, ifname, gen, rules, nrules) < 0)
+        return -1;
+
+    if (!(port = nftablesPortLookup(ifname, true)))
+        return -1;
+
+    /* rules which were never switched to */
+    if ((old = g_steal_pointer(&port->pending)))
+        nftablesRemoveChainsFW(fw, old->chains, old->nchains);
+
+    /* Without rules in effect the dispatch chains created above are
+     * empty and would let all traffic through, so switch to the new
+     * rules in the same transaction. */
+    if (!port->live) {
+        nftablesLinkGenerationFW(fw, ifname, gen);
+        nftablesRemoveChainsFW(fw, port->stale, port->nstale);
+    }
+
+    if (virFirewallApply(fw) < 0) {
+        nftablesPortRetire(port, &gen);
+        nftablesPortRetire(port, &old);
+        return -1;
+    }
+
+    if (port->live) {
+        port->pending = g_steal_pointer(&gen);
+    } else {
+        nftablesPortClearStale(port);
+        port->live = g_steal_pointer(&gen);
+    }
+    return 0;
+}
+
+
+static int
+nftablesTearNewRules(const char *ifname)
+{
+    g_autoptr(virFirewall) fw = virFirewallNew(VIR_FIREWALL_BACKEND_NFTABLES);
+    g_autoptr(nftablesGeneration) pending = NULL;
+    nftablesPort *port;
+
+    if (nftablesCheckIfname(ifname) < 0 ||
+        nftablesRecover() < 0)
+        return -1;
+
+    if (!(port = nftablesPortLookup(ifname, false)) || !port->pending)
+        return 0;
+
+    pending = g_steal_pointer(&port->pending);
+
+    virFirewallStartTransaction(fw, VIR_FIREWALL_TRANSACTION_ATOMIC);
+
+    nftablesSetupInfraFW(fw);
+    nftablesRemoveChainsFW(fw, pending->chains, pending->nchains);
+
+    if (virFirewallApply(fw) < 0) {
+        nftablesPortRetire(port, &pending);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+nftablesTearOldRules(const char *ifname)
+{
+    g_autoptr(virFirewall) fw = virFirewallNew(VIR_FIREWALL_BACKEND_NFTABLES);
+    nftablesPort *port;
+
+    if (nftablesCheckIfname(ifname) < 0 ||
+        nftablesRecover() < 0)
+        return -1;
+
+    if (!(port = nftablesPortLookup(ifname, false)) || !port->pending)
+        return 0;
+
+    nftablesPortRetire(port, &port->live);
+
+    virFirewallStartTransaction(fw, VIR_FIREWALL_TRANSACTION_ATOMIC);
+
+    nftablesSetupInfraFW(fw);
+    nftablesSetupDispatchFW(fw, ifname);
+    nftablesLinkGenerationFW(fw, ifname, port->pending);
+    nftablesRemoveChainsFW(fw, port->stale, port->nstale);
+
+    if (virFirewallApply(fw) < 0) {
+        nftablesPortRetire(port, &port->pending);
+        return -1;
+    }
+
+    nftablesPortClearStale(port);
+    port->live = g_steal_pointer(&port->pending);
+    return 0;
+}
+
+
+/**
+ * nftablesAllTeardown:
+ * @ifname : the name of the interface to which the rules apply
+ *
+ * Remove all chains that were created for the given interface.
+ *
+ * Returns 0 on success, -1 on failure
+ */
+static int
+nftablesAllTeardown(const char *ifname)
+{
+    g_autoptr(virFirewall) fw = virFirewallNew(VIR_FIREWALL_BACKEND_NFTABLES);
+    g_autoptr(nftablesPort) port = NULL;
+    g_auto(GStrv) chains = NULL;
+    size_t nchains;
+    size_t i;
+
+    if (nftablesCheckIfname(ifname) < 0 ||
+        nftablesRecover() < 0)
+        return -1;
+
+    VIR_WITH_MUTEX_LOCK_GUARD(&nftablesLock) {
+        if (nftablesPorts)
+            port = virHashSteal(nftablesPorts, ifname);
+    }
+
+    if (!port)
+        return 0;
+
+    nftablesPortRetire(port, &port->live);
+    nftablesPortRetire(port, &port->pending);
+
+    /* the dispatch chains go along with all the others */
+    nchains = port->nstale + NFTABLES_DIR_LAST;
+    chains = g_new0(char *, nchains + 1);
+    for (i = 0; i < port->nstale; i++)
+        chains[i] = g_strdup(port->stale[i]);
+    for (i = 0; i < NFTABLES_DIR_LAST; i++)
+        chains[port->nstale + i] = nftablesDispatchChainName(ifname, i);
+
+    virFirewallStartTransaction(fw, VIR_FIREWALL_TRANSACTION_ATOMIC);
+
+    nftablesSetupInfraFW(fw);
+    /* make sure the elements exist so that deleting them cannot fail */
+    nftablesSetupDispatchFW(fw, ifname);
+    nftablesRemoveDispatchFW(fw, ifname);
+    nftablesRemoveChainsFW(fw, chains, nchains);
+
+    if (virFirewallApply(fw) < 0) {
+        VIR_WITH_MUTEX_LOCK_GUARD(&nftablesLock) {
+            if (virHashAddEntry(nftablesPorts, ifname, port) == 0)
+                port = NULL;
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+nftablesCanApplyBasicRules(void)
+{
+    return true;
+}
+
+
+/*
+ * Switches the port over to a new generation holding just @inRules and
+ * @outRules for frames sent by and to the VM. All previous rules are
+ * removed in the same transaction.
+ */
+static int
+nftablesApplyBasicGeneration(const char *ifname,
+                             const char *const *inRules,
+                             const char *const *outRules)
+{
+    g_autoptr(virFirewall) fw = virFirewallNew(VIR_FIREWALL_BACKEND_NFTABLES);
+    g_autoptr(nftablesGeneration) gen = NULL;
+    nftablesPort *port;
+    size_t i;
+
+    if (nftablesCheckIfname(ifname) < 0 ||
+        nftablesRecover() < 0)
+        return -1;
+
+    if (!(port = nftablesPortLookup(ifname, true)))
+        return -1;
+
+    gen = nftablesGenerationNew(ifname);
+
+    nftablesPortRetire(port, &port->live);
+    nftablesPortRetire(port, &port->pending);
+
+    virFirewallStartTransaction(fw, VIR_FIREWALL_TRANSACTION_ATOMIC);
+
+    nftablesSetupInfraFW(fw);
+    nftablesSetupDispatchFW(fw, ifname);
+    nftablesCreateChainsFW(fw, gen);
+
+    for (i = 0; inRules && inRules[i]; i++)
+        nftablesAddRuleFW(fw, gen->chains[NFTABLES_DIR_L2_IN], inRules[i]);
+    for (i = 0; outRules && outRules[i]; i++)
+        nftablesAddRuleFW(fw, gen->chains[NFTABLES_DIR_L2_OUT], outRules[i]);
+
+    nftablesLinkGenerationFW(fw, ifname, gen);
+    nftablesRemoveChainsFW(fw, port->stale, port->nstale);
+
+    if (virFirewallApply(fw) < 0) {
+        nftablesPortRetire(port, &gen);
+        nftablesAllTeardown(ifname);
+        return -1;
+    }
+
+    nftablesPortClearStale(port);
+    port->live = g_steal_pointer(&gen);
+    return 0;
+}
+
+
+/**
+ * nftablesApplyBasicRules
+ *
+ * @ifname: name of the backend-interface to which to apply the rules
+ * @macaddr: MAC address the VM is using in packets sent through the
+ *    interface
+ *
+ * Returns 0 on success, -1 on failure with the rules removed
+ *
+ * Apply basic filtering rules on the given interface
+ * - filtering for MAC address spoofing
+ * - allowing IPv4 & ARP traffic
+ */
+static int
+nftablesApplyBasicRules(const char *ifname,
+                        const virMacAddr *macaddr)
+{
+    char macaddr_str[VIR_MAC_STRING_BUFLEN];
+    g_autofree char *spoofing = NULL;
+
+    const char *inRules[] = {
+        NULL, /* spoofing rule */
+        "ether type ip accept",
+        "ether type arp accept",
+        "drop",
+        NULL
+    };
+
+    virMacAddrFormat(macaddr, macaddr_str);
+    spoofing = g_strdup_printf("ether saddr != %s drop", macaddr_str);
+    inRules[0] = spoofing;
+
+    return nftablesApplyBasicGeneration(ifname, inRules, NULL);
+}
+
+
+/**
+ * nftablesApplyDHCPOnlyRules
+ *
+ * @ifname: name of the backend-interface to which to apply the rules
+ * @macaddr: MAC address the VM is using in packets sent through the
+ *    interface
+ * @dhcpsrvrs: The DHCP server(s) from which the VM may receive traffic
+ *    from; may be NULL
+ * @leaveTemporary: ignored; there are no temporary chain names to keep,
+ *    the rules are switched to right away
+ *
+ * Returns 0 on success, -1 on failure with the rules removed
+ *
+ * Apply filtering rules so that the VM can only send and receive
+ * DHCP traffic and nothing else.
+ */
+static int
+nftablesApplyDHCPOnlyRules(const char *ifname,
+                           const virMacAddr *macaddr,
+                           virNWFilterVarValue *dhcpsrvrs,
+                           bool leaveTemporary G_GNUC_UNUSED)
+{
+    char macaddr_str[VIR_MAC_STRING_BUFLEN];
+    g_autofree char *servers = NULL;
+    g_autofree char *request = NULL;
+    g_autofree char *reply = NULL;
+    const char *inRules[] = { NULL, "drop", NULL };
+    const char *outRules[] = { NULL, "drop", NULL };
+
+    virMacAddrFormat(macaddr, macaddr_str);
+
+    if (dhcpsrvrs && virNWFilterVarValueGetCardinality(dhcpsrvrs) > 0 &&
+        nftablesFormatSet(dhcpsrvrs, "DHCPSERVER", &servers) < 0)
+        return -1;
+
+    request = g_strdup_printf("ether saddr %s ether type ip "
+                              "ip protocol udp udp sport 68 udp dport 67 accept",
+                              macaddr_str);
+    reply = g_strdup_printf("ether daddr { %s, ff:ff:ff:ff:ff:ff } ether type ip "
+                            "%s%s%sip protocol udp udp sport 67 udp dport 68 accept",
+                            macaddr_str,
+                            servers ? "ip saddr " : "",
+                            NULLSTR_EMPTY(servers),
+                            servers ? " " : "");
+
+    inRules[0] = request;
+    outRules[0] = reply;
+
+    return nftablesApplyBasicGeneration(ifname, inRules, outRules);
+}
+
+
+/**
+ * nftablesApplyDropAllRules
+ *
+ * @ifname: name of the backend-interface to which to apply the rules
+ *
+ * Returns 0 on success, -1 on failure with the rules removed
+ *
+ * Apply filtering rules so that the VM cannot receive or send traffic.
+ */
+static int
+nftablesApplyDropAllRules(const char *ifname)
+{
+    const char *rules[] = { "drop", NULL };
+
+    return nftablesApplyBasicGeneration(ifname, rules, rules);
+}
+
+
+static int
+nftablesRemoveBasicRules(const char *ifname)
+{
+    return nftablesAllTeardown(ifname);
+}
+
+
+static int
+nftablesDriverInit(bool privileged)
+{
+    if (!privileged)
+        return 0;
+
+    nftables_driver.flags = TECHDRV_FLAG_INITIALIZED;
+
+    return 0;
+}
+
+
+static void
+nftablesDriverShutdown(void)
+{
+    VIR_LOCK_GUARD lock = virLockGuardLock(&nftablesLock);
+
+    g_clear_pointer(&nftablesPorts, g_hash_table_unref);
+    /* recovery picks up the generations left in the table */
+    nftablesLastGeneration = 0;
+    nftablesRecovered = false;
+    nftables_driver.flags = 0;
+}
+
+
+virNWFilterTechDriver nftables_driver = {
+    .name = NFTABLES_DRIVER_ID,
+    .flags = 0,
+
+    .init     = nftablesDriverInit,
+    .shutdown = nftablesDriverShutdown,
+
+    .applyNewRules       = nftablesApplyNewRules,
+    .tearNewRules        = nftablesTearNewRules,
+    .tearOldRules        = nftablesTearOldRules,
+    .allTeardown         = nftablesAllTeardown,
+
+    .canApplyBasicRules  = nftablesCanApplyBasicRules,
+    .applyBasicRules     = nftablesApplyBasicRules,
+    .applyDHCPOnlyRules  = nftablesApplyDHCPOnlyRules,
+    .applyDropAllRules   = nftablesApplyDropAllRules,
+    .removeBasicRules    = nftablesRemoveBasicRules,
+};
@@ -0,0 +1,13 @@
+/*
+ * nwfilter_nftables_driver.h: nftables driver for nwfilter rules on tap devices
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#pragma once
+
+#include "nwfilter_tech_driver.h"
+
+extern virNWFilterTechDriver nftables_driver;
+
+#define NFTABLES_DRIVER_ID "nftables"
@@ -793,10 +793,13 @@ struct _virQEMUCaps {
     bool kvmSupportsSecureGuest;
 
     char *binary;
+    char *buildID;
     time_t ctime;
     time_t libvirtCtime;
     time_t modDirMtime;
     bool invalidation;
+    /* loaded from the read-only system cache, not formatted */
+    bool preseeded;
 
     virBitmap *flags;
 
@@ -2004,9 +2007,11 @@ virQEMUCaps *virQEMUCapsNewCopy(virQEMUCaps *qemuCaps)
     size_t i;
 
     ret->invalidation = qemuCaps->invalidation;
+    ret->preseeded = qemuCaps->preseeded;
     ret->kvmSupportsNesting = qemuCaps->kvmSupportsNesting;
     ret->kvmSupportsSecureGuest = qemuCaps->kvmSupportsSecureGuest;
 
+    ret->buildID = g_strdup(qemuCaps->buildID);
     ret->ctime = qemuCaps->ctime;
 
     virBitmapFree(ret->flags);
@@ -2071,6 +2076,7 @@ void virQEMUCapsDispose(void *obj)
     g_free(qemuCaps->package);
     g_free(qemuCaps->kernelVersion);
     g_free(qemuCaps->binary);
+    g_free(qemuCaps->buildID);
     g_free(qemuCaps->hostCPUSignature);
 
     g_free(qemuCaps->gicCapabilities);
@@ -4734,6 +4740,7 @@ virQEMUCapsValidateArch(virQEMUCaps *qemuCaps, xmlXPathContextPtr ctxt)
  *
  * <qemuCaps>
  *   <emulator>/some/path</emulator>
+ *   <qemubuildid>0123456789abcdef0123456789abcdef01234567</qemubuildid>
  *   <qemuctime>234235253</qemuctime>
  *   <qemumoddirmtime>234235253</qemumoddirmtime>
  *   <selfctime>234235253</selfctime>
@@ -4773,8 +4780,11 @@ virQEMUCapsLoadCache(virArch hostArch,
                      &qemuCaps->libvirtVersion) < 0)
         return -1;
 
+    /* Pre-seeded caches are generated on a different host so the
+     * timestamp of the libvirt installation can't match. */
     if (!skipInvalidation &&
-        (qemuCaps->libvirtCtime != virGetSelfLastChanged() ||
+        ((!qemuCaps->preseeded &&
+          qemuCaps->libvirtCtime != virGetSelfLastChanged()) ||
          qemuCaps->libvirtVersion != LIBVIR_VERSION_NUMBER)) {
         VIR_DEBUG("Outdated capabilities in %s: libvirt changed "
                   "(%lld vs %lld, %lu vs %lu), stopping load",
@@ -4796,6 +4806,8 @@ virQEMUCapsLoadCache(virArch hostArch,
     }
     qemuCaps->ctime = (time_t)l;
 
+    qemuCaps->buildID = virXPathString("string(./qemubuildid)", ctxt);
+
     if (virXPathLongLong("string(./qemumoddirmtime)", ctxt, &l) == 0)
         qemuCaps->modDirMtime = (time_t)l;
 
@@ -5136,6 +5148,8 @@ virQEMUCapsFormatCache(virQEMUCaps *qemuCaps)
 
     virBufferEscapeString(&buf, "<emulator>%s</emulator>\n",
                           qemuCaps->binary);
+    virBufferEscapeString(&buf, "<qemubuildid>%s</qemubuildid>\n",
+                          qemuCaps->buildID);
     virBufferAsprintf(&buf, "<qemuctime>%llu</qemuctime>\n",
                       (long long)qemuCaps->ctime);
     if (qemuCaps->modDirMtime > 0) {
@@ -5415,7 +5429,9 @@ virQEMUCapsIsValid(void *data,
     if (!qemuCaps->binary)
         return true;
 
-    if (virFileExists(QEMU_MODDIR)) {
+    /* Modules are shipped by the same package as the binary whose
+     * build ID is checked below, the directory timestamp is local. */
+    if (!qemuCaps->preseeded && virFileExists(QEMU_MODDIR)) {
         if (stat(QEMU_MODDIR, &sb) < 0) {
             VIR_DEBUG("Failed to stat QEMU module directory '%s': %s",
                       QEMU_MODDIR,
@@ -5432,7 +5448,8 @@ virQEMUCapsIsValid(void *data,
         }
     }
 
-    if (qemuCaps->libvirtCtime != virGetSelfLastChanged() ||
+    if ((!qemuCaps->preseeded &&
+         qemuCaps->libvirtCtime != virGetSelfLastChanged()) ||
         qemuCaps->libvirtVersion != LIBVIR_VERSION_NUMBER) {
         VIR_DEBUG("Outdated capabilities for '%s': libvirt changed "
                   "(%lld vs %lld, %lu vs %lu)",
@@ -5452,11 +5469,25 @@ virQEMUCapsIsValid(void *data,
     }
 
     if (sb.st_ctime != qemuCaps->ctime) {
-        VIR_DEBUG("Outdated capabilities for '%s': QEMU binary changed "
-                  "(%lld vs %lld)",
-                  qemuCaps->binary,
-                  (long long)sb.st_ctime, (long long)qemuCaps->ctime);
-        return false;
+        g_autofree char *buildID = NULL;
+
+        /* Timestamps differ whenever the same build is installed
+         * again or on a different host, the build ID does not. Once
+         * it matches, remember the new ctime to keep further
+         * checks cheap. */
+        if (!qemuCaps->buildID ||
+            virFileGetBuildID(qemuCaps->binary, &buildID) <= 0 ||
+            STRNEQ(buildID, qemuCaps->buildID)) {
+            virResetLastError();
+            VIR_DEBUG("Outdated capabilities for '%s': QEMU binary changed "
+                      "(%lld vs %lld, build ID '%s' vs '%s')",
+                      qemuCaps->binary,
+                      (long long)sb.st_ctime, (long long)qemuCaps->ctime,
+                      NULLSTR(buildID), NULLSTR(qemuCaps->buildID));
+            return false;
+        }
+
+        qemuCaps->ctime = sb.st_ctime;
     }
 
     if (!virQEMUCapsGuestIsNative(priv->hostArch, qemuCaps->arch)) {
@@ -5876,6 +5907,9 @@ virQEMUCapsNewForBinaryInternal(virArch hostArch,
     }
     qemuCaps->ctime = sb.st_ctime;
 
+    if (virFileGetBuildID(binary, &qemuCaps->buildID) < 0)
+        return NULL;
+
     /* Make sure the binary we are about to try exec'ing exists.
      * Technically we could catch the exec() failure, but that's
      * in a sub-process so it's hard to feed back a useful error.
@@ -5950,8 +5984,11 @@ virQEMUCapsLoadFile(const char *filename,
 {
     g_autoptr(virQEMUCaps) qemuCaps = virQEMUCapsNewBinary(binary);
     virQEMUCapsCachePriv *priv = privData;
+    g_autofree char *dir = g_path_get_dirname(filename);
     int ret;
 
+    qemuCaps->preseeded = STREQ(dir, QEMU_CAPS_SYSTEM_CACHE_DIR);
+
     ret = virQEMUCapsLoadCache(priv->hostArch, qemuCaps, filename, false);
     if (ret < 0)
         return NULL;
@@ -5989,6 +6026,8 @@ virQEMUCapsCacheNew(const char *libDir,
     if (!(cache = virFileCacheNew(capsCacheDir, "xml", &qemuCapsCacheHandlers)))
         goto error;
 
+    virFileCacheSetSystemDir(cache, QEMU_CAPS_SYSTEM_CACHE_DIR);
+
     priv = g_new0(virQEMUCapsCachePriv, 1);
     virFileCacheSetPriv(cache, priv);
 
@@ -259,6 +259,8 @@ virQEMUDriverConfig *virQEMUDriverConfigNew(bool privileged,
 
     cfg->migrationPortMin = QEMU_MIGRATION_PORT_MIN;
     cfg->migrationPortMax = QEMU_MIGRATION_PORT_MAX;
+    cfg->migrationAutoTuneMaxDowntime = 2000;
+    cfg->dirtyRateSampleWindow = 10;
 
     /* For privileged driver, try and find hugetlbfs mounts automatically.
      * Non-privileged driver requires admin to create a dir for the
@@ -963,6 +965,35 @@ virQEMUDriverConfigLoadNetworkEntry(virQEMUDriverConfig *cfg,
         return -1;
     }
 
+    if (virConfGetValueBool(conf, "migration_auto_tune", &cfg->migrationAutoTune) < 0)
+        return -1;
+    if (virConfGetValueUInt(conf, "migration_auto_tune_target_time",
+                            &cfg->migrationAutoTuneTargetTime) < 0)
+        return -1;
+    if (virConfGetValueUInt(conf, "migration_auto_tune_max_downtime",
+                            &cfg->migrationAutoTuneMaxDowntime) < 0)
+        return -1;
+
+    if (virConfGetValueUInt(conf, "max_outgoing_migrations",
+                            &cfg->maxOutgoingMigrations) < 0)
+        return -1;
+    if (virConfGetValueUInt(conf, "migration_bandwidth_budget",
+                            &cfg->migrationBandwidthBudget) < 0)
+        return -1;
+
+    if (virConfGetValueUInt(conf, "dirty_rate_sample_interval",
+                            &cfg->dirtyRateSampleInterval) < 0)
+        return -1;
+    if (virConfGetValueUInt(conf, "dirty_rate_sample_window",
+                            &cfg->dirtyRateSampleWindow) < 0)
+        return -1;
+    if (cfg->dirtyRateSampleWindow == 0) {
+        virReportError(VIR_ERR_CONF_SYNTAX,
+                       _("%1$s: dirty_rate_sample_window must be greater than 0"),
+                       filename);
+        return -1;
+    }
+
     if (virConfGetValueString(conf, "migration_host", &cfg->migrateHost) < 0)
         return -1;
     virStringStripIPv6Brackets(cfg->migrateHost);
@@ -37,6 +37,8 @@
 #include "locking/lock_manager.h"
 #include "qemu_capabilities.h"
 #include "qemu_nbdkit.h"
+#include "qemu_migration_sched.h"
+#include "qemu_dirtyrate.h"
 #include "virclosecallbacks.h"
 #include "virhostdev.h"
 #include "virfile.h"
@@ -232,6 +234,16 @@ struct _virQEMUDriverConfig {
     unsigned int migrationPortMin;
     unsigned int migrationPortMax;
 
+    bool migrationAutoTune;
+    unsigned int migrationAutoTuneTargetTime; /* seconds */
+    unsigned int migrationAutoTuneMaxDowntime; /* milliseconds */
+
+    unsigned int maxOutgoingMigrations;
+    unsigned int migrationBandwidthBudget; /* MiB/s */
+
+    unsigned int dirtyRateSampleInterval; /* seconds */
+    unsigned int dirtyRateSampleWindow;
+
     bool logTimestamp;
     bool stdioLogD;
 
@@ -337,6 +349,12 @@ struct _virQEMUDriver {
     /* Immutable pointer, self-locking APIs */
     virHashAtomic *migrationErrors;
 
+    /* Immutable pointer, self-locking APIs */
+    qemuMigrationScheduler *migrationScheduler;
+
+    /* Immutable pointer, NULL when sampling is disabled */
+    qemuDirtyRateSampler *dirtyRateSampler;
+
     /* Immutable pointer, self-locking APIs */
     virFileCache *nbdkitCapsCache;
 };
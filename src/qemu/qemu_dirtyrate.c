@@ -0,0 +1,371 @@
+/*
+ * qemu_dirtyrate.c: periodic sampling of guest memory dirty rate
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include <config.h>
+
+#include "qemu_dirtyrate.h"
+#include "qemu_domain.h"
+
+#include "virerror.h"
+#include "virlog.h"
+#include "virthread.h"
+#include "virtime.h"
+
+#define VIR_FROM_THIS VIR_FROM_QEMU
+
+VIR_LOG_INIT("qemu.qemu_dirtyrate");
+
+/* Length of each measurement in seconds. The shortest period QEMU accepts
+ * keeps the time during which the guest is being watched to a minimum. */
+#define QEMU_DIRTYRATE_SAMPLE_PERIOD 1
+
+struct _qemuDomainDirtyRateHistory {
+    long long *rates;           /* ring buffer of measured rates in MiB/s */
+    size_t window;              /* capacity of @rates */
+    size_t nrates;              /* number of valid entries in @rates */
+    size_t next;                /* where the next sample is stored */
+    long long lastStartTime;    /* start time of the last recorded measurement */
+};
+
+struct _qemuDirtyRateSampler {
+    virDomainObjList *domains;
+    unsigned int interval;      /* seconds */
+    unsigned int window;
+
+    virMutex lock;
+    virCond cond;
+    bool quit;
+    bool joinable;
+    virThread thread;
+};
+
+
+static qemuDomainDirtyRateHistory *
+qemuDomainDirtyRateHistoryNew(size_t window)
+{
+    qemuDomainDirtyRateHistory *history = g_new0(qemuDomainDirtyRateHistory, 1);
+
+    history->window = MAX(window, 1);
+    history->rates = g_new0(long long, history->window);
+    history->lastStartTime = -1;
+
+    return history;
+}
+
+
+void
+qemuDomainDirtyRateHistoryFree(qemuDomainDirtyRateHistory *history)
+{
+    if (!history)
+        return;
+
+    g_free(history->rates);
+    g_free(history);
+}
+
+
+static void
+qemuDomainDirtyRateHistoryAdd(qemuDomainDirtyRateHistory *history,
+                              long long startTime,
+                              long long rate)
+{
+    /* The same measurement is reported until a new one finishes */
+    if (startTime == history->lastStartTime)
+        return;
+
+    history->lastStartTime = startTime;
+    history->rates[history->next] = rate;
+    history->next = (history->next + 1) % history->window;
+    if (history->nrates < history->window)
+        history->nrates++;
+}
+
+
+/**
+ * qemuDomainDirtyRateHistoryGet:
+ * @history: dirty rate samples of a domain, may be NULL
+ * @average: filled in with the average dirty rate in MiB/s
+ * @peak: filled in with the highest dirty rate in MiB/s
+ *
+ * Summarizes the dirty rate samples collected by the background sampler
+ * within its window. @average and @peak are left untouched when there are
+ * no samples.
+ *
+ * Returns the number of samples @average and @peak were computed from.
+ */
+size_t
+qemuDomainDirtyRateHistoryGet(qemuDomainDirtyRateHistory *history,
+                              long long *average,
+                              long long *peak)
+{
+    long long sum = 0;
+    long long max = 0;
+    size_t i;
+
+    if (!history || history->nrates == 0)
+        return 0;
+
+    for (i = 0; i < history->nrates; i++) {
+        sum += history->rates[i];
+        max = MAX(max, history->rates[i]);
+    }
+
+    *average = sum / (long long) history->nrates;
+    *peak = max;
+
+    return history->nrates;
+}
+
+
+static qemuMonitorDirtyRateCalcMode
+qemuDirtyRateSamplerMode(virDomainObj *vm)
+{
+    qemuDomainObjPrivate *priv = vm->privateData;
+
+    /* Harvesting dirty rings is what KVM does anyway when the feature is
+     * enabled, while dirty-bitmap mode would turn on dirty logging for the
+     * whole guest memory. Page sampling only looks at a small subset of
+     * pages, which makes it the cheapest option otherwise. */
+    if (virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_DIRTYRATE_MODE) &&
+        vm->def->features[VIR_DOMAIN_FEATURE_KVM] == VIR_TRISTATE_SWITCH_ON &&
+        vm->def->kvm_features->features[VIR_DOMAIN_KVM_DIRTY_RING] == VIR_TRISTATE_SWITCH_ON)
+        return QEMU_MONITOR_DIRTYRATE_CALC_MODE_DIRTY_RING;
+
+    return QEMU_MONITOR_DIRTYRATE_CALC_MODE_PAGE_SAMPLING;
+}
+
+
+/*
+ * Records the result of the previous measurement and starts a new one
+ * which will be collected on the next run. Domains which are busy are
+ * skipped rather than waited for.
+ *
+ * A measurement started through virDomainStartDirtyRateCalc is neither
+ * replaced nor recorded. Once it is over its result is left in place for
+ * one more interval so that it can be fetched.
+ */
+static void
+qemuDirtyRateSamplerDomain(qemuDirtyRateSampler *sampler,
+                           virDomainObj *vm)
+{
+    qemuDomainObjPrivate *priv = vm->privateData;
+    qemuMonitorDirtyRateInfo info = { 0 };
+    bool userCalc;
+    int rc;
+
+    virObjectLock(vm);
+
+    if (!virDomainObjIsActive(vm) ||
+        !virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_QUERY_DIRTY_RATE) ||
+        !virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_CALC_DIRTY_RATE))
+        goto cleanup;
+
+    /* Do not compete for the monitor with migration and other long running
+     * jobs, their progress matters more than fresh samples. */
+    if (vm->job->asyncJob != VIR_ASYNC_JOB_NONE)
+        goto cleanup;
+
+    if (virDomainObjBeginJobNowait(vm, VIR_JOB_QUERY) < 0) {
+        virResetLastError();
+        goto cleanup;
+    }
+
+    if (!virDomainObjIsActive(vm))
+        goto endjob;
+
+    userCalc = priv->dirtyRateUserCalc;
+
+    qemuDomainObjEnterMonitor(vm);
+    rc = qemuMonitorQueryDirtyRate(priv->mon, &info);
+    if (rc == 0 && !userCalc &&
+        info.status != VIR_DOMAIN_DIRTYRATE_MEASURING) {
+        rc = qemuMonitorStartDirtyRateCalc(priv->mon,
+                                           QEMU_DIRTYRATE_SAMPLE_PERIOD,
+                                           qemuDirtyRateSamplerMode(vm));
+    }
+    qemuDomainObjExitMonitor(vm);
+
+    if (rc < 0) {
+        VIR_DEBUG("Failed to sample dirty rate of domain %s: %s",
+                  vm->def->name, virGetLastErrorMessage());
+        virResetLastError();
+    }
+
+    if (userCalc && (rc < 0 || info.status == VIR_DOMAIN_DIRTYRATE_MEASURING))
+        goto endjob;
+
+    if (!priv->dirtyRateHistory)
+        priv->dirtyRateHistory = qemuDomainDirtyRateHistoryNew(sampler->window);
+
+    if (userCalc) {
+        /* the next run replaces the result without recording it */
+        priv->dirtyRateHistory->lastStartTime = info.startTime;
+        priv->dirtyRateUserCalc = false;
+    } else if (info.status == VIR_DOMAIN_DIRTYRATE_MEASURED) {
+        qemuDomainDirtyRateHistoryAdd(priv->dirtyRateHistory,
+                                      info.startTime, info.dirtyRate);
+    }
+
+ endjob:
+    virDomainObjEndJob(vm);
+
+ cleanup:
+    virObjectUnlock(vm);
+    g_free(info.rates);
+}
+
+
+static bool
+qemuDirtyRateSamplerQuitting(qemuDirtyRateSampler *sampler)
+{
+    VIR_LOCK_GUARD lock = virLockGuardLock(&sampler->lock);
+
+    return sampler->quit;
+}
+
+
+static void
+qemuDirtyRateSamplerWorker(void *opaque)
+{
+    qemuDirtyRateSampler *sampler = opaque;
+
+    while (true) {
+        virDomainObj **vms = NULL;
+        size_t nvms = 0;
+        unsigned long long deadline;
+        size_t i;
+
+        if (virTimeMillisNow(&deadline) < 0)
+            return;
+        deadline += sampler->interval * 1000ULL;
+
+        VIR_WITH_MUTEX_LOCK_GUARD(&sampler->lock) {
+            while (!sampler->quit) {
+                if (virCondWaitUntil(&sampler->cond, &sampler->lock, deadline) < 0) {
+                    if (errno == ETIMEDOUT)
+                        break;
+
+                    VIR_WARN("Unable to wait on dirty rate sampler condition");
+                    return;
+                }
+            }
+
+            if (sampler->quit)
+                return;
+        }
+
+        virDomainObjListCollectAll(sampler->domains, &vms, &nvms);
+
+        for (i = 0; i < nvms; i++) {
+            if (qemuDirtyRateSamplerQuitting(sampler))
+                break;
+
+            qemuDirtyRateSamplerDomain(sampler, vms[i]);
+        }
+
+        virObjectListFreeCount(vms, nvms);
+    }
+}
+
+
+/**
+ * qemuDirtyRateSamplerNew:
+ * @domains: list of domains to sample
+ * @interval: time between two samples of a domain in seconds
+ * @window: number of samples to keep for each domain
+ *
+ * Starts a thread which measures memory dirty rate of all running domains
+ * every @interval seconds. Summaries of the last @window samples are
+ * available from qemuDomainDirtyRateHistoryGet without any monitor
+ * interaction.
+ *
+ * Returns the new sampler or NULL on error.
+ */
+qemuDirtyRateSampler *
+qemuDirtyRateSamplerNew(virDomainObjList *domains,
+                        unsigned int interval,
+                        unsigned int window)
+{
+    qemuDirtyRateSampler *sampler = g_new0(qemuDirtyRateSampler, 1);
+
+    sampler->domains = virObjectRef(domains);
+    sampler->interval = MAX(interval, QEMU_DIRTYRATE_SAMPLE_PERIOD);
+    sampler->window = window;
+
+    if (virMutexInit(&sampler->lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to initialize dirty rate sampler mutex"));
+        goto error;
+    }
+
+    if (virCondInit(&sampler->cond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to initialize dirty rate sampler condition"));
+        virMutexDestroy(&sampler->lock);
+        goto error;
+    }
+
+    if (virThreadCreateFull(&sampler->thread, true,
+                            qemuDirtyRateSamplerWorker,
+                            "qemu-dirtyrate",
+                            false,
+                            sampler) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create dirty rate sampler thread"));
+        virCondDestroy(&sampler->cond);
+        virMutexDestroy(&sampler->lock);
+        goto error;
+    }
+    sampler->joinable = true;
+
+    return sampler;
+
+ error:
+    virObjectUnref(sampler->domains);
+    g_free(sampler);
+    return NULL;
+}
+
+
+/**
+ * qemuDirtyRateSamplerStop:
+ * @sampler: dirty rate sampler
+ *
+ * Stops sampling and waits for the sampler thread to finish. Must be called
+ * while domain monitors are still working as the thread may be talking to
+ * one of them.
+ */
+void
+qemuDirtyRateSamplerStop(qemuDirtyRateSampler *sampler)
+{
+    if (!sampler)
+        return;
+
+    VIR_WITH_MUTEX_LOCK_GUARD(&sampler->lock) {
+        sampler->quit = true;
+        virCondSignal(&sampler->cond);
+    }
+
+    if (sampler->joinable) {
+        virThreadJoin(&sampler->thread);
+        sampler->joinable = false;
+    }
+}
+
+
+void
+qemuDirtyRateSamplerFree(qemuDirtyRateSampler *sampler)
+{
+    if (!sampler)
+        return;
+
+    qemuDirtyRateSamplerStop(sampler);
+
+    virCondDestroy(&sampler->cond);
+    virMutexDestroy(&sampler->lock);
+    virObjectUnref(sampler->domains);
+    g_free(sampler);
+}
@@ -0,0 +1,33 @@
+/*
+ * qemu_dirtyrate.h: periodic sampling of guest memory dirty rate
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#pragma once
+
+#include "virdomainobjlist.h"
+
+typedef struct _qemuDomainDirtyRateHistory qemuDomainDirtyRateHistory;
+
+void
+qemuDomainDirtyRateHistoryFree(qemuDomainDirtyRateHistory *history);
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(qemuDomainDirtyRateHistory, qemuDomainDirtyRateHistoryFree);
+
+size_t
+qemuDomainDirtyRateHistoryGet(qemuDomainDirtyRateHistory *history,
+                              long long *average,
+                              long long *peak);
+
+typedef struct _qemuDirtyRateSampler qemuDirtyRateSampler;
+
+qemuDirtyRateSampler *
+qemuDirtyRateSamplerNew(virDomainObjList *domains,
+                        unsigned int interval,
+                        unsigned int window);
+
+void
+qemuDirtyRateSamplerStop(qemuDirtyRateSampler *sampler);
+
+void
+qemuDirtyRateSamplerFree(qemuDirtyRateSampler *sampler);
@@ -119,6 +119,7 @@ qemuJobResetPrivate(void *opaque)
     priv->spiceMigrated = false;
     priv->dumpCompleted = false;
     g_clear_pointer(&priv->migParams, qemuMigrationParamsFree);
+    g_clear_pointer(&priv->migScheduler, qemuMigrationSchedulerRelease);
 }
 
 
@@ -1932,6 +1933,9 @@ qemuDomainObjPrivateDataClear(qemuDomainObjPrivate *priv)
 
     virHashRemoveAll(priv->statsSchema);
 
+    g_clear_pointer(&priv->dirtyRateHistory, qemuDomainDirtyRateHistoryFree);
+    priv->dirtyRateUserCalc = false;
+
     g_slist_free_full(g_steal_pointer(&priv->threadContextAliases), g_free);
 
     priv->migrationRecoverSetup = false;
@@ -10821,6 +10825,37 @@ qemuDomainObjWait(virDomainObj *vm)
 }
 
 
+/**
+ * qemuDomainObjWaitUntil:
+ * @vm: domain object
+ * @whenms: absolute time in milliseconds to wait until
+ *
+ * Same as qemuDomainObjWait, but gives up waiting at @whenms.
+ *
+ * Returns:
+ *  0 on successful wait AND VM is guaranteed to be running
+ *  1 when the time ran out AND VM is guaranteed to be running
+ *  -1 on failure to wait or VM was terminated while waiting
+ */
+int
+qemuDomainObjWaitUntil(virDomainObj *vm,
+                       unsigned long long whenms)
+{
+    qemuDomainObjPrivate *priv = vm->privateData;
+    int rc;
+
+    if ((rc = virDomainObjWaitUntil(vm, whenms)) < 0)
+        return -1;
+
+    if (!virDomainObjIsActive(vm) || priv->beingDestroyed) {
+        virReportError(VIR_ERR_OPERATION_FAILED, "%s", _("domain is not running"));
+        return -1;
+    }
+
+    return rc;
+}
+
+
 /**
  * qemuDomainObjIsActive:
  * @vm: domain object
@@ -32,6 +32,7 @@
 #include "qemu_blockjob.h"
 #include "qemu_domainjob.h"
 #include "qemu_conf.h"
+#include "qemu_dirtyrate.h"
 #include "qemu_capabilities.h"
 #include "qemu_migration_params.h"
 #include "qemu_nbdkit.h"
@@ -255,6 +256,11 @@ struct _qemuDomainObjPrivate {
 
     GHashTable *statsSchema; /* (name, data) pair for stats */
 
+    /* recent samples taken by the background dirty rate sampler */
+    qemuDomainDirtyRateHistory *dirtyRateHistory;
+    /* the last dirty rate calculation was started by the user */
+    bool dirtyRateUserCalc;
+
     /* Info on dummy process for schedCore. A short lived process used only
      * briefly when starting a guest. Don't save/parse into XML. */
     pid_t schedCoreChildPID;
@@ -584,6 +590,8 @@ struct _qemuDomainJobPrivate {
                                          * deleting snapshot */
     qemuMigrationParams *migParams;
     GSList *migTempBitmaps;  /* temporary block dirty bitmaps - qemuDomainJobPrivateMigrateTempBitmap */
+    qemuMigrationScheduler *migScheduler; /* scheduler which admitted the
+                                           * outgoing migration */
 };
 
 int qemuDomainObjStartWorker(virDomainObj *dom);
@@ -1119,6 +1127,10 @@ qemuDomainRemoveLogs(virQEMUDriver *driver,
 int
 qemuDomainObjWait(virDomainObj *vm)
     G_GNUC_WARN_UNUSED_RESULT;
+int
+qemuDomainObjWaitUntil(virDomainObj *vm,
+                       unsigned long long whenms)
+    G_GNUC_WARN_UNUSED_RESULT;
 bool
 qemuDomainObjIsActive(virDomainObj *vm);
 
@@ -273,6 +273,12 @@ qemuDomainMigrationJobDataToParams(virDomainJobData *jobData,
                                 jobData->timeElapsed) < 0)
         goto error;
 
+    if (priv->queuePosition > 0 &&
+        virTypedParamsAddULLong(&par, &npar, &maxpar,
+                                VIR_DOMAIN_JOB_QUEUE_POSITION,
+                                priv->queuePosition) < 0)
+        goto error;
+
     if (jobData->timeDeltaSet &&
         jobData->timeElapsed > jobData->timeDelta &&
         virTypedParamsAddULLong(&par, &npar, &maxpar,
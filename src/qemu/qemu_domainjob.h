@@ -55,6 +55,10 @@ struct _qemuDomainJobDataPrivate {
         qemuMonitorDumpStats dump;
         qemuDomainBackupStats backup;
     } stats;
+    /* When migration stats were last fetched from QEMU, in ms */
+    unsigned long long statsTime;
+    /* Position of a migration waiting for other migrations to finish */
+    size_t queuePosition;
     qemuDomainMirrorStats mirrorStats;
 };
 
@@ -723,6 +723,9 @@ qemuStateInitialize(bool privileged,
     if (qemuMigrationDstErrorInit(qemu_driver) < 0)
         goto error;
 
+    if (!(qemu_driver->migrationScheduler = qemuMigrationSchedulerNew()))
+        goto error;
+
     if (privileged) {
         g_autofree char *channeldir = NULL;
 
@@ -902,6 +905,12 @@ qemuStateInitialize(bool privileged,
 
     qemuProcessReconnectAll(qemu_driver);
 
+    if (cfg->dirtyRateSampleInterval > 0 &&
+        !(qemu_driver->dirtyRateSampler = qemuDirtyRateSamplerNew(qemu_driver->domains,
+                                                                  cfg->dirtyRateSampleInterval,
+                                                                  cfg->dirtyRateSampleWindow)))
+        goto error;
+
     autostartCfg = (virDomainDriverAutoStartConfig) {
         .stateDir = cfg->stateDir,
         .callback = qemuAutostartDomain,
@@ -1002,6 +1011,7 @@ qemuDomainObjStopWorkerIter(virDomainObj *vm,
 static int
 qemuStateShutdownWait(void)
 {
+    qemuDirtyRateSamplerStop(qemu_driver->dirtyRateSampler);
     virDomainObjListForEach(qemu_driver->domains, false,
                             qemuDomainObjStopWorkerIter, NULL);
     virThreadPoolDrain(qemu_driver->workerPool);
@@ -1022,6 +1032,8 @@ qemuStateCleanup(void)
 
     virThreadPoolFree(qemu_driver->workerPool);
     virObjectUnref(qemu_driver->migrationErrors);
+    qemuMigrationSchedulerFree(qemu_driver->migrationScheduler);
+    qemuDirtyRateSamplerFree(qemu_driver->dirtyRateSampler);
     virLockManagerPluginUnref(qemu_driver->lockManager);
     virSysinfoDefFree(qemu_driver->hostsysinfo);
     virPortAllocatorRangeFree(qemu_driver->migrationPorts);
@@ -1242,36 +1254,6 @@ static char *qemuConnectGetCapabilities(virConnectPtr conn) {
 }
 
 
-static int
-qemuGetSchedstatDelay(unsigned long long *cpudelay,
-                      pid_t pid,
-                      pid_t tid)
-{
-    g_autofree char *path = NULL;
-    g_autofree char *buf = NULL;
-
-    if (tid)
-        path = g_strdup_printf("/proc/%d/task/%d/schedstat", (int)pid, (int)tid);
-    else
-        path = g_strdup_printf("/proc/%d/schedstat", (int)pid);
-
-    /* This file might not exist (needs CONFIG_SCHED_INFO) */
-    if (!virFileExists(path))
-        return 0;
-
-    if (virFileReadAll(path, 1024, &buf) < 0)
-        return -1;
-
-    if (sscanf(buf, "%*u %llu", cpudelay) != 1) {
-        virReportError(VIR_ERR_INTERNAL_ERROR,
-                       _("Unable to parse schedstat info at '%1$s'"),
-                       path);
-        return -1;
-    }
-
-    return 0;
-}
-
 static int
 qemuDomainHelperGetVcpus(virDomainObj *vm,
                          virVcpuInfoPtr info,
@@ -1281,6 +1263,9 @@ qemuDomainHelperGetVcpus(virDomainObj *vm,
                          unsigned char *cpumaps,
                          int maplen)
 {
+    g_autofree virProcessTaskStats *stats = NULL;
+    unsigned int statsFlags = 0;
+    size_t nstats = 0;
     size_t ncpuinfo = 0;
     size_t i;
 
@@ -1299,6 +1284,27 @@ qemuDomainHelperGetVcpus(virDomainObj *vm,
     if (cpumaps)
         memset(cpumaps, 0, sizeof(*cpumaps) * maxinfo);
 
+    if (cpuwait)
+        statsFlags |= VIR_PROCESS_TASK_STATS_WAIT;
+    if (cpudelay)
+        statsFlags |= VIR_PROCESS_TASK_STATS_DELAY;
+
+    /* Gather the per-thread statistics of all online vCPUs in one go
+     * rather than querying /proc separately for every single value */
+    if (info || statsFlags) {
+        stats = g_new0(virProcessTaskStats, maxinfo);
+
+        for (i = 0; i < virDomainDefGetVcpusMax(vm->def) && nstats < maxinfo; i++) {
+            if (!virDomainDefGetVcpu(vm->def, i)->online)
+                continue;
+
+            stats[nstats++].tid = qemuDomainGetVcpuPid(vm, i);
+        }
+
+        if (virProcessGetTaskStats(vm->pid, stats, nstats, statsFlags) < 0)
+            return -1;
+    }
+
     for (i = 0; i < virDomainDefGetVcpusMax(vm->def) && ncpuinfo < maxinfo; i++) {
         virDomainVcpuDef *vcpu = virDomainDefGetVcpu(vm->def, i);
         pid_t vcpupid = qemuDomainGetVcpuPid(vm, i);
@@ -1310,15 +1316,8 @@ qemuDomainHelperGetVcpus(virDomainObj *vm,
         if (info) {
             vcpuinfo->number = i;
             vcpuinfo->state = VIR_VCPU_RUNNING;
-
-            if (virProcessGetStatInfo(&vcpuinfo->cpuTime,
-                                      NULL, NULL,
-                                      &vcpuinfo->cpu, NULL,
-                                      vm->pid, vcpupid) < 0) {
-                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                               _("cannot get vCPU placement & pCPU time"));
-                return -1;
-            }
+            vcpuinfo->cpuTime = stats[ncpuinfo].cpuTime;
+            vcpuinfo->cpu = stats[ncpuinfo].lastCpu;
         }
 
         if (cpumaps) {
@@ -1331,15 +1330,11 @@ qemuDomainHelperGetVcpus(virDomainObj *vm,
             virBitmapToDataBuf(map, cpumap, maplen);
         }
 
-        if (cpuwait) {
-            if (virProcessGetSchedInfo(&(cpuwait[ncpuinfo]), vm->pid, vcpupid) < 0)
-                return -1;
-        }
+        if (cpuwait)
+            cpuwait[ncpuinfo] = stats[ncpuinfo].cpuWait;
 
-        if (cpudelay) {
-            if (qemuGetSchedstatDelay(&(cpudelay[ncpuinfo]), vm->pid, vcpupid) < 0)
-                return -1;
-        }
+        if (cpudelay)
+            cpudelay[ncpuinfo] = stats[ncpuinfo].cpuDelay;
 
         ncpuinfo++;
     }
@@ -12084,8 +12079,8 @@ qemuDomainGetJobInfoMigrationStats(virDomainObj *vm,
     case VIR_DOMAIN_JOB_STATUS_PAUSED:
     case VIR_DOMAIN_JOB_STATUS_POSTCOPY_PAUSED:
     case VIR_DOMAIN_JOB_STATUS_POSTCOPY_RECOVER:
-        if (qemuMigrationAnyFetchStats(vm, VIR_ASYNC_JOB_NONE,
-                                       jobData, NULL) < 0)
+        if (qemuMigrationAnyFetchStatsCached(vm, VIR_ASYNC_JOB_NONE,
+                                             jobData) < 0)
             return -1;
         break;
 
@@ -16729,10 +16724,19 @@ qemuConnectGetDomainCapabilities(virConnectPtr conn,
 }
 
 
+/* Host wide data gathered at most once per qemuConnectGetAllDomainStats()
+ * call and shared by all domains it reports on. */
+typedef struct _qemuDomainStatsHostData qemuDomainStatsHostData;
+struct _qemuDomainStatsHostData {
+    virNetDevTapStatsSnapshot *ifaces;
+};
+
+
 static void
 qemuDomainGetStatsState(virQEMUDriver *driver G_GNUC_UNUSED,
                         virDomainObj *dom,
                         virTypedParamList *params,
+                        qemuDomainStatsHostData *host G_GNUC_UNUSED,
                         unsigned int privflags G_GNUC_UNUSED)
 {
     virTypedParamListAddInt(params, dom->state.state,
@@ -17133,6 +17137,7 @@ static void
 qemuDomainGetStatsCpu(virQEMUDriver *driver,
                       virDomainObj *dom,
                       virTypedParamList *params,
+                      qemuDomainStatsHostData *host G_GNUC_UNUSED,
                       unsigned int privflags)
 {
     qemuDomainObjPrivate *priv = dom->privateData;
@@ -17153,6 +17158,7 @@ static void
 qemuDomainGetStatsMemory(virQEMUDriver *driver,
                          virDomainObj *dom,
                          virTypedParamList *params,
+                         qemuDomainStatsHostData *host G_GNUC_UNUSED,
                          unsigned int privflags G_GNUC_UNUSED)
 
 {
@@ -17164,6 +17170,7 @@ static void
 qemuDomainGetStatsBalloon(virQEMUDriver *driver G_GNUC_UNUSED,
                           virDomainObj *dom,
                           virTypedParamList *params,
+                          qemuDomainStatsHostData *host G_GNUC_UNUSED,
                           unsigned int privflags)
 {
     virDomainMemoryStatStruct stats[VIR_DOMAIN_MEMORY_STAT_NR];
@@ -17277,6 +17284,7 @@ static void
 qemuDomainGetStatsVcpu(virQEMUDriver *driver G_GNUC_UNUSED,
                        virDomainObj *dom,
                        virTypedParamList *params,
+                       qemuDomainStatsHostData *host G_GNUC_UNUSED,
                        unsigned int privflags)
 {
     virDomainVcpuDef *vcpu;
@@ -17374,6 +17382,7 @@ static void
 qemuDomainGetStatsInterface(virQEMUDriver *driver G_GNUC_UNUSED,
                             virDomainObj *dom,
                             virTypedParamList *params,
+                            qemuDomainStatsHostData *host,
                             unsigned int privflags G_GNUC_UNUSED)
 {
     size_t i;
@@ -17399,13 +17408,14 @@ qemuDomainGetStatsInterface(virQEMUDriver *driver G_GNUC_UNUSED,
                                    VIR_DOMAIN_STATS_NET_PREFIX "%zu" VIR_DOMAIN_STATS_NET_SUFFIX_NAME, i);
 
         if (actualType == VIR_DOMAIN_NET_TYPE_VHOSTUSER) {
-            if (virNetDevOpenvswitchInterfaceStats(net->ifname, &tmp) < 0) {
+            if (virNetDevTapStatsSnapshotOpenvswitchStats(host->ifaces,
+                                                          net->ifname, &tmp) < 0) {
                 virResetLastError();
                 continue;
             }
         } else {
-            if (virNetDevTapInterfaceStats(net->ifname, &tmp,
-                                           !virDomainNetTypeSharesHostView(net)) < 0) {
+            if (virNetDevTapStatsSnapshotInterfaceStats(host->ifaces, net->ifname, &tmp,
+                                                        !virDomainNetTypeSharesHostView(net)) < 0) {
                 virResetLastError();
                 continue;
             }
@@ -17703,6 +17713,7 @@ static void
 qemuDomainGetStatsBlock(virQEMUDriver *driver,
                         virDomainObj *dom,
                         virTypedParamList *params,
+                        qemuDomainStatsHostData *host G_GNUC_UNUSED,
                         unsigned int privflags)
 {
     size_t i;
@@ -17744,6 +17755,7 @@ static void
 qemuDomainGetStatsIOThread(virQEMUDriver *driver G_GNUC_UNUSED,
                            virDomainObj *dom,
                            virTypedParamList *params,
+                           qemuDomainStatsHostData *host G_GNUC_UNUSED,
                            unsigned int privflags)
 {
     size_t i;
@@ -17835,6 +17847,7 @@ static void
 qemuDomainGetStatsPerf(virQEMUDriver *driver G_GNUC_UNUSED,
                        virDomainObj *dom,
                        virTypedParamList *params,
+                       qemuDomainStatsHostData *host G_GNUC_UNUSED,
                        unsigned int privflags G_GNUC_UNUSED)
 {
     size_t i;
@@ -17853,13 +17866,33 @@ static void
 qemuDomainGetStatsDirtyRate(virQEMUDriver *driver G_GNUC_UNUSED,
                             virDomainObj *dom,
                             virTypedParamList *params,
+                            qemuDomainStatsHostData *host G_GNUC_UNUSED,
                             unsigned int privflags)
 {
     qemuDomainObjPrivate *priv = dom->privateData;
     qemuMonitorDirtyRateInfo info;
+    long long average;
+    long long peak;
+    size_t nsamples;
     int rv;
 
-    if (!HAVE_JOB(privflags) || !virDomainObjIsActive(dom))
+    if (!virDomainObjIsActive(dom))
+        return;
+
+    /* Samples collected in the background are available even when the
+     * monitor can't be used right now */
+    nsamples = qemuDomainDirtyRateHistoryGet(priv->dirtyRateHistory,
+                                             &average, &peak);
+    if (nsamples > 0) {
+        virTypedParamListAddULLong(params, nsamples,
+                                   VIR_DOMAIN_STATS_DIRTYRATE_SAMPLES);
+        virTypedParamListAddLLong(params, average,
+                                  VIR_DOMAIN_STATS_DIRTYRATE_AVERAGE_MEGABYTES_PER_SECOND);
+        virTypedParamListAddLLong(params, peak,
+                                  VIR_DOMAIN_STATS_DIRTYRATE_PEAK_MEGABYTES_PER_SECOND);
+    }
+
+    if (!HAVE_JOB(privflags))
         return;
 
     qemuDomainObjEnterMonitor(dom);
@@ -17901,6 +17934,7 @@ static void
 qemuDomainGetStatsVm(virQEMUDriver *driver G_GNUC_UNUSED,
                      virDomainObj *dom,
                      virTypedParamList *params,
+                     qemuDomainStatsHostData *host G_GNUC_UNUSED,
                      unsigned int privflags)
 {
     qemuDomainObjPrivate *priv = dom->privateData;
@@ -17933,6 +17967,7 @@ typedef void
 (*qemuDomainGetStatsFunc)(virQEMUDriver *driver,
                           virDomainObj *dom,
                           virTypedParamList *list,
+                          qemuDomainStatsHostData *host,
                           unsigned int flags);
 
 struct qemuDomainGetStatsWorker {
@@ -18032,6 +18067,7 @@ static int
 qemuDomainGetStats(virConnectPtr conn,
                    virDomainObj *dom,
                    unsigned int stats,
+                   qemuDomainStatsHostData *host,
                    virDomainStatsRecordPtr *record,
                    unsigned int flags)
 {
@@ -18043,7 +18079,8 @@ qemuDomainGetStats(virConnectPtr conn,
 
     for (i = 0; qemuDomainGetStatsWorkers[i].func; i++) {
         if (stats & qemuDomainGetStatsWorkers[i].stats) {
-            qemuDomainGetStatsWorkers[i].func(conn->privateData, dom, params, flags);
+            qemuDomainGetStatsWorkers[i].func(conn->privateData, dom, params,
+                                              host, flags);
         }
     }
 
@@ -18074,6 +18111,8 @@ qemuConnectGetAllDomainStats(virConnectPtr conn,
     virDomainObj **vms = NULL;
     size_t nvms;
     virDomainStatsRecordPtr *tmpstats = NULL;
+    g_autoptr(virNetDevTapStatsSnapshot) ifaces = virNetDevTapStatsSnapshotNew();
+    qemuDomainStatsHostData host = { .ifaces = ifaces };
     bool enforce = !!(flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS);
     int nstats = 0;
     size_t i;
@@ -18139,7 +18178,7 @@ qemuConnectGetAllDomainStats(virConnectPtr conn,
         }
         /* else: without a job it's still possible to gather some data */
 
-        rc = qemuDomainGetStats(conn, vm, requestedStats, &tmp, domflags);
+        rc = qemuDomainGetStats(conn, vm, requestedStats, &host, &tmp, domflags);
 
         if (HAVE_JOB(domflags))
             virDomainObjEndJob(vm);
@@ -20003,6 +20042,10 @@ qemuDomainStartDirtyRateCalc(virDomainPtr dom,
 
     qemuDomainObjExitMonitor(vm);
 
+    /* keep the background sampler off this measurement */
+    if (ret == 0)
+        priv->dirtyRateUserCalc = true;
+
  endjob:
     virDomainObjEndJob(vm);
 
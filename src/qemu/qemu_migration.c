@@ -26,8 +26,12 @@
 #include <poll.h>
 
 #include "qemu_migration.h"
+#define LIBVIRT_QEMU_MIGRATIONPRIV_H_ALLOW
+#include "qemu_migrationpriv.h"
 #include "qemu_migration_cookie.h"
 #include "qemu_migration_params.h"
+#include "qemu_migration_sched.h"
+#include "qemu_migration_tune.h"
 #include "qemu_monitor.h"
 #include "qemu_domain.h"
 #include "qemu_process.h"
@@ -807,6 +811,9 @@ qemuMigrationNBDReportMirrorError(qemuBlockJobData *job,
 /**
  * qemuMigrationSrcNBDStorageCopyReady:
  * @vm: domain
+ * @asyncJob: current async job
+ * @notReadyCount: if non-NULL, filled in with the number of mirrors which
+ *                 are not ready yet
  *
  * Check the status of all drives copied via qemuMigrationSrcNBDStorageCopy.
  * Any pending block job events for the mirrored disks will be processed.
@@ -817,7 +824,8 @@ qemuMigrationNBDReportMirrorError(qemuBlockJobData *job,
  */
 static int
 qemuMigrationSrcNBDStorageCopyReady(virDomainObj *vm,
-                                    virDomainAsyncJob asyncJob)
+                                    virDomainAsyncJob asyncJob,
+                                    size_t *notReadyCount)
 {
     size_t i;
     size_t notReady = 0;
@@ -849,6 +857,9 @@ qemuMigrationSrcNBDStorageCopyReady(virDomainObj *vm,
         virObjectUnref(job);
     }
 
+    if (notReadyCount)
+        *notReadyCount = notReady;
+
     if (notReady) {
         VIR_DEBUG("Waiting for %zu disk mirrors to get ready", notReady);
         return 0;
@@ -1279,6 +1290,160 @@ qemuMigrationSrcNBDStorageCopyOne(virDomainObj *vm,
 }
 
 
+/* Part of the bandwidth limit split evenly among all disk mirrors so that
+ * even mirrors which already converged can keep up with guest writes, in %.
+ * The rest is split in proportion to the amount of data left to copy. */
+#define QEMU_MIGRATION_NBD_FAIR_SHARE 25
+
+/**
+ * qemuMigrationSrcNBDShareBandwidth:
+ * @speed: total bandwidth in bytes/s
+ * @remaining: number of bytes each mirror still needs to copy
+ * @speeds: filled in with bandwidth in bytes/s for each mirror
+ * @n: number of mirrors
+ *
+ * Splits @speed among @n disk mirrors so that all of them converge at
+ * roughly the same time instead of competing for the whole bandwidth.
+ */
+static void
+qemuMigrationSrcNBDShareBandwidth(unsigned long long speed,
+                                  const unsigned long long *remaining,
+                                  unsigned long long *speeds,
+                                  size_t n)
+{
+    unsigned long long fair = speed / 100 * QEMU_MIGRATION_NBD_FAIR_SHARE / n;
+    unsigned long long proportional = speed - fair * n;
+    double sum = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        sum += remaining[i];
+
+    for (i = 0; i < n; i++) {
+        if (sum > 0)
+            speeds[i] = fair + proportional * (remaining[i] / sum);
+        else
+            speeds[i] = fair + proportional / n;
+
+        /* QEMU treats 0 as unlimited */
+        speeds[i] = MAX(speeds[i], 1);
+    }
+}
+
+
+/**
+ * qemuMigrationSrcNBDStorageCopyBalance:
+ * @vm: domain
+ * @asyncJob: current async job
+ * @speed: total bandwidth in bytes/s available for all disk mirrors
+ *
+ * Redistributes @speed among running disk mirrors according to the amount
+ * of data each of them still needs to copy. Aggregated progress of all
+ * mirrors in the current job statistics is updated as well.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+qemuMigrationSrcNBDStorageCopyBalance(virDomainObj *vm,
+                                      virDomainAsyncJob asyncJob,
+                                      unsigned long long speed)
+{
+    qemuDomainObjPrivate *priv = vm->privateData;
+    qemuDomainJobDataPrivate *privJob = vm->job->current->privateData;
+    g_autoptr(GHashTable) blockinfo = NULL;
+    g_autofree qemuMonitorBlockJobInfo **info = NULL;
+    g_auto(GStrv) jobnames = NULL;
+    g_autofree unsigned long long *remaining = NULL;
+    g_autofree unsigned long long *speeds = NULL;
+    size_t n = 0;
+    size_t i;
+    int rc = 0;
+
+    if (qemuDomainObjEnterMonitorAsync(vm, asyncJob) < 0)
+        return -1;
+
+    blockinfo = qemuMonitorGetAllBlockJobInfo(priv->mon, false);
+
+    qemuDomainObjExitMonitor(vm);
+    if (!blockinfo)
+        return -1;
+
+    info = g_new0(qemuMonitorBlockJobInfo *, vm->def->ndisks);
+    jobnames = g_new0(char *, vm->def->ndisks + 1);
+    remaining = g_new0(unsigned long long, vm->def->ndisks);
+    speeds = g_new0(unsigned long long, vm->def->ndisks);
+
+    memset(&privJob->mirrorStats, 0, sizeof(privJob->mirrorStats));
+
+    for (i = 0; i < vm->def->ndisks; i++) {
+        virDomainDiskDef *disk = vm->def->disks[i];
+        qemuDomainDiskPrivate *diskPriv = QEMU_DOMAIN_DISK_PRIVATE(disk);
+        qemuMonitorBlockJobInfo *data;
+
+        if (!diskPriv->migrating ||
+            !diskPriv->blockjob ||
+            !(data = virHashLookup(blockinfo, disk->info.alias)))
+            continue;
+
+        privJob->mirrorStats.transferred += data->cur;
+        privJob->mirrorStats.total += data->end;
+
+        info[n] = data;
+        jobnames[n] = g_strdup(diskPriv->blockjob->name);
+        remaining[n] = data->end > data->cur ? data->end - data->cur : 0;
+        n++;
+    }
+
+    if (speed == 0 || n == 0)
+        return 0;
+
+    qemuMigrationSrcNBDShareBandwidth(speed, remaining, speeds, n);
+
+    if (qemuDomainObjEnterMonitorAsync(vm, asyncJob) < 0)
+        return -1;
+
+    for (i = 0; i < n; i++) {
+        if (info[i]->bandwidth == speeds[i])
+            continue;
+
+        VIR_DEBUG("Setting speed of mirror job '%s' to %llu B/s (%llu bytes left)",
+                  jobnames[i], speeds[i], remaining[i]);
+
+        if ((rc = qemuMonitorBlockJobSetSpeed(priv->mon, jobnames[i],
+                                              speeds[i])) < 0)
+            break;
+    }
+
+    qemuDomainObjExitMonitor(vm);
+
+    return rc;
+}
+
+
+typedef struct _qemuMigrationNBDCopyDisk qemuMigrationNBDCopyDisk;
+struct _qemuMigrationNBDCopyDisk {
+    virDomainDiskDef *disk;
+    unsigned long long capacity;
+};
+
+
+static int
+qemuMigrationNBDCopyDiskSortOrder(const void *a,
+                                  const void *b,
+                                  void *opaque G_GNUC_UNUSED)
+{
+    const qemuMigrationNBDCopyDisk *da = a;
+    const qemuMigrationNBDCopyDisk *db = b;
+
+    /* biggest disks first */
+    if (da->capacity > db->capacity)
+        return -1;
+    if (da->capacity < db->capacity)
+        return 1;
+    return 0;
+}
+
+
 /**
  * qemuMigrationSrcNBDStorageCopy:
  * @driver: qemu driver
@@ -1289,6 +1454,8 @@ qemuMigrationSrcNBDStorageCopyOne(virDomainObj *vm,
  *
  * Migrate non-shared storage using the NBD protocol to the server running
  * inside the qemu process on dst and wait until the copy converges.
+ * Mirrors of bigger disks are started first and @speed is shared by all
+ * mirrors rather than applied to each of them separately.
  * On failure, the caller is expected to call qemuMigrationSrcNBDCopyCancel
  * to stop all running copy operations.
  *
@@ -1313,10 +1480,18 @@ qemuMigrationSrcNBDStorageCopy(virQEMUDriver *driver,
     int port;
     size_t i;
     unsigned long long mirror_speed = speed;
+    unsigned long long share_speed = 0;
     bool mirror_shallow = flags & VIR_MIGRATE_NON_SHARED_INC;
     int rv;
     g_autoptr(virQEMUDriverConfig) cfg = virQEMUDriverGetConfig(driver);
     g_autoptr(virURI) uri = NULL;
+    g_autoptr(GHashTable) nodedata = NULL;
+    g_autofree qemuMigrationNBDCopyDisk *disks = NULL;
+    g_autofree unsigned long long *capacities = NULL;
+    g_autofree unsigned long long *speeds = NULL;
+    size_t ndisks = 0;
+    size_t notReady = 0;
+    size_t lastNotReady;
     const char *socket = NULL;
 
     VIR_DEBUG("Starting drive mirrors for domain %s", vm->def->name);
@@ -1329,6 +1504,10 @@ qemuMigrationSrcNBDStorageCopy(virQEMUDriver *driver,
     }
     mirror_speed <<= 20;
 
+    /* There's nothing to share when migration bandwidth is unlimited */
+    if (speed < QEMU_DOMAIN_MIG_BANDWIDTH_MAX)
+        share_speed = mirror_speed;
+
     /* If qemu doesn't support overriding of TLS hostname for NBD connections
      * we won't attempt it */
     if (!virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_BLOCKDEV_NBD_TLS_HOSTNAME))
@@ -1372,20 +1551,53 @@ qemuMigrationSrcNBDStorageCopy(virQEMUDriver *driver,
         }
     }
 
+    if (!(nodedata = qemuBlockGetNamedNodeData(vm, VIR_ASYNC_JOB_MIGRATION_OUT)))
+        return -1;
+
+    disks = g_new0(qemuMigrationNBDCopyDisk, vm->def->ndisks);
+
     for (i = 0; i < vm->def->ndisks; i++) {
         virDomainDiskDef *disk = vm->def->disks[i];
-        bool detect_zeroes = false;
+        qemuBlockNamedNodeData *entry;
 
         /* check whether disk should be migrated */
         if (!qemuMigrationAnyCopyDisk(disk, migrate_disks))
             continue;
 
+        disks[ndisks].disk = disk;
+        if ((entry = virHashLookup(nodedata, qemuDomainDiskGetTopNodename(disk))))
+            disks[ndisks].capacity = entry->capacity;
+        ndisks++;
+    }
+
+    if (ndisks == 0)
+        return 0;
+
+    g_qsort_with_data(disks, ndisks, sizeof(*disks),
+                      qemuMigrationNBDCopyDiskSortOrder, NULL);
+
+    capacities = g_new0(unsigned long long, ndisks);
+    speeds = g_new0(unsigned long long, ndisks);
+    for (i = 0; i < ndisks; i++)
+        capacities[i] = disks[i].capacity;
+
+    if (share_speed > 0) {
+        qemuMigrationSrcNBDShareBandwidth(share_speed, capacities, speeds, ndisks);
+    } else {
+        for (i = 0; i < ndisks; i++)
+            speeds[i] = mirror_speed;
+    }
+
+    for (i = 0; i < ndisks; i++) {
+        virDomainDiskDef *disk = disks[i].disk;
+        bool detect_zeroes = false;
+
         if (migrate_disks_detect_zeroes)
             detect_zeroes = g_strv_contains(migrate_disks_detect_zeroes, disk->dst);
 
         if (qemuMigrationSrcNBDStorageCopyOne(vm, disk, host, port,
                                               socket,
-                                              mirror_speed, mirror_shallow,
+                                              speeds[i], mirror_shallow,
                                               tlsAlias, tlsHostname, detect_zeroes,
                                               flags) < 0)
             return -1;
@@ -1396,10 +1608,21 @@ qemuMigrationSrcNBDStorageCopy(virQEMUDriver *driver,
         }
     }
 
-    while ((rv = qemuMigrationSrcNBDStorageCopyReady(vm, VIR_ASYNC_JOB_MIGRATION_OUT)) != 1) {
+    lastNotReady = ndisks;
+
+    while ((rv = qemuMigrationSrcNBDStorageCopyReady(vm, VIR_ASYNC_JOB_MIGRATION_OUT,
+                                                     &notReady)) != 1) {
         if (rv < 0)
             return -1;
 
+        /* Give bandwidth freed by mirrors which got ready to the others */
+        if (notReady != lastNotReady) {
+            if (qemuMigrationSrcNBDStorageCopyBalance(vm, VIR_ASYNC_JOB_MIGRATION_OUT,
+                                                      share_speed) < 0)
+                return -1;
+            lastNotReady = notReady;
+        }
+
         if (vm->job->abortJob) {
             vm->job->current->status = VIR_DOMAIN_JOB_STATUS_CANCELED;
             virReportError(VIR_ERR_OPERATION_ABORTED, _("%1$s: %2$s"),
@@ -1418,6 +1641,12 @@ qemuMigrationSrcNBDStorageCopy(virQEMUDriver *driver,
             return -1;
     }
 
+    /* All mirrors only need to keep up with guest writes now */
+    if (share_speed > 0 &&
+        qemuMigrationSrcNBDStorageCopyBalance(vm, VIR_ASYNC_JOB_MIGRATION_OUT,
+                                              share_speed) < 0)
+        return -1;
+
     qemuMigrationSrcFetchMirrorStats(vm, VIR_ASYNC_JOB_MIGRATION_OUT,
                                      vm->job->current);
     return 0;
@@ -1984,6 +2213,71 @@ qemuMigrationAnyFetchStats(virDomainObj *vm,
         return -1;
 
     privJob->stats.mig = stats;
+    if (virTimeMillisNow(&privJob->statsTime) < 0)
+        privJob->statsTime = 0;
+
+    return 0;
+}
+
+
+/* Migration statistics younger than this are shared by all callers, in ms */
+#define QEMU_MIGRATION_STATS_MAX_AGE 500
+
+/**
+ * qemuMigrationAnyFetchStatsCached:
+ * @vm: domain object
+ * @asyncJob: current async job
+ * @jobData: copy of the current job data
+ *
+ * Like qemuMigrationAnyFetchStats, but statistics fetched less than
+ * QEMU_MIGRATION_STATS_MAX_AGE milliseconds ago by anyone, including the
+ * thread running the migration, are reused. Fresh statistics are stored
+ * in the current job so that concurrent monitoring clients do not have to
+ * query QEMU over and over again. The migration status itself is always
+ * kept up to date by MIGRATION events.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuMigrationAnyFetchStatsCached(virDomainObj *vm,
+                                 virDomainAsyncJob asyncJob,
+                                 virDomainJobData *jobData)
+{
+    qemuDomainJobDataPrivate *privJob = jobData->privateData;
+    qemuDomainJobDataPrivate *privCur;
+    unsigned long long now;
+    int status;
+
+    if (vm->job->current &&
+        virTimeMillisNow(&now) == 0) {
+        privCur = vm->job->current->privateData;
+
+        if (privCur->statsType == privJob->statsType &&
+            privCur->statsTime > 0 &&
+            privCur->statsTime <= now &&
+            now - privCur->statsTime < QEMU_MIGRATION_STATS_MAX_AGE) {
+            privJob->stats.mig = privCur->stats.mig;
+            privJob->statsTime = privCur->statsTime;
+            return 0;
+        }
+    }
+
+    if (qemuMigrationAnyFetchStats(vm, asyncJob, jobData, NULL) < 0)
+        return -1;
+
+    /* The job might have finished while we were talking to QEMU */
+    if (!vm->job->current)
+        return 0;
+
+    privCur = vm->job->current->privateData;
+    if (privCur->statsType != privJob->statsType)
+        return 0;
+
+    /* An event might have changed the status in the meantime */
+    status = privCur->stats.mig.status;
+    privCur->stats.mig = privJob->stats.mig;
+    privCur->stats.mig.status = status;
+    privCur->statsTime = privJob->statsTime;
 
     return 0;
 }
@@ -2105,7 +2399,7 @@ qemuMigrationAnyCompleted(virDomainObj *vm,
 
     /* This flag should only be set when run on src host */
     if (flags & QEMU_MIGRATION_COMPLETED_CHECK_STORAGE &&
-        qemuMigrationSrcNBDStorageCopyReady(vm, asyncJob) < 0)
+        qemuMigrationSrcNBDStorageCopyReady(vm, asyncJob, NULL) < 0)
         goto error;
 
     if (flags & QEMU_MIGRATION_COMPLETED_ABORT_ON_ERROR &&
@@ -2190,16 +2484,137 @@ qemuMigrationAnyCompleted(virDomainObj *vm,
 }
 
 
+/* Feeds current migration statistics to @tuner and applies any parameters
+ * it comes up with. The statistics are fetched into a copy of the current
+ * job data so that the migration status, which is updated by MIGRATION
+ * events while we are talking to QEMU, is not overwritten. Returns 0 on
+ * success, -1 on error. */
+static int
+qemuMigrationSrcTune(virDomainObj *vm,
+                     virDomainAsyncJob asyncJob,
+                     qemuMigrationTuner *tuner)
+{
+    g_autoptr(virDomainJobData) jobData = virDomainJobDataCopy(vm->job->current);
+    qemuDomainJobDataPrivate *privJob = jobData->privateData;
+    g_autoptr(qemuMigrationParams) migParams = NULL;
+
+    if (qemuMigrationAnyFetchStats(vm, asyncJob, jobData, NULL) < 0)
+        return -1;
+
+    if (qemuMigrationTunerUpdate(tuner, &privJob->stats.mig, &migParams) < 0)
+        return -1;
+
+    if (!migParams)
+        return 0;
+
+    return qemuMigrationParamsUpdate(vm, asyncJob, migParams);
+}
+
+
+/* Waits until the host-wide limit of outgoing migrations allows @vm to start
+ * migrating. The slot is held by the migration job and it is released once
+ * the job ends (see qemuJobResetPrivate). */
+static int
+qemuMigrationSrcAdmit(virQEMUDriver *driver,
+                      virDomainObj *vm)
+{
+    g_autoptr(virQEMUDriverConfig) cfg = virQEMUDriverGetConfig(driver);
+    qemuDomainJobPrivate *jobPriv = vm->job->privateData;
+
+    if (jobPriv->migScheduler)
+        return 0;
+
+    if (qemuMigrationSchedulerAdmit(driver->migrationScheduler, vm,
+                                    cfg->maxOutgoingMigrations,
+                                    virDomainDefGetMemoryTotal(vm->def)) < 0)
+        return -1;
+
+    jobPriv->migScheduler = driver->migrationScheduler;
+    return 0;
+}
+
+
+/* Returns @userBandwidth (MiB/s) or the share of the host-wide migration
+ * bandwidth budget, whichever is lower. */
+static unsigned long
+qemuMigrationSrcGetBandwidthShare(virQEMUDriver *driver,
+                                  unsigned long userBandwidth)
+{
+    g_autoptr(virQEMUDriverConfig) cfg = virQEMUDriverGetConfig(driver);
+    unsigned long long share;
+
+    share = qemuMigrationSchedulerShare(driver->migrationScheduler,
+                                        cfg->migrationBandwidthBudget);
+    if (share > 0 && share < userBandwidth)
+        return MAX(share, 1);
+
+    return userBandwidth;
+}
+
+
+/* Updates bandwidth of a running migration according to
+ * qemuMigrationSrcGetBandwidthShare. The current limit set by the user
+ * (priv->migMaxBandwidth) is re-read every time since it may be changed
+ * by virDomainMigrateSetMaxSpeed, which also applies it directly. The
+ * limit used last time is kept in @userBandwidth and the bandwidth the
+ * migration is running with in @bandwidth. Returns 0 on success, -1 on
+ * error. */
+static int
+qemuMigrationSrcShareBandwidth(virDomainObj *vm,
+                               virDomainAsyncJob asyncJob,
+                               unsigned long *userBandwidth,
+                               unsigned long *bandwidth,
+                               qemuMigrationTuner *tuner)
+{
+    qemuDomainObjPrivate *priv = vm->privateData;
+    g_autoptr(qemuMigrationParams) migParams = NULL;
+    unsigned long share;
+
+    share = qemuMigrationSrcGetBandwidthShare(priv->driver,
+                                              priv->migMaxBandwidth);
+
+    if (share == *bandwidth && priv->migMaxBandwidth == *userBandwidth)
+        return 0;
+
+    VIR_DEBUG("Changing migration bandwidth of domain %s from %lu to %lu MiB/s "
+              "(limit %lu MiB/s)",
+              vm->def->name, *bandwidth, share, priv->migMaxBandwidth);
+    *userBandwidth = priv->migMaxBandwidth;
+    *bandwidth = share;
+
+    /* The tuner never exceeds the limit and applies it itself */
+    if (tuner) {
+        qemuMigrationTunerSetMaxBandwidth(tuner, share * 1024ULL * 1024);
+        return 0;
+    }
+
+    migParams = qemuMigrationParamsNew();
+    if (qemuMigrationParamsSetULL(migParams, QEMU_MIGRATION_PARAM_MAX_BANDWIDTH,
+                                  share * 1024ULL * 1024) < 0)
+        return -1;
+
+    return qemuMigrationParamsUpdate(vm, asyncJob, migParams);
+}
+
+
 /* Returns 0 on success, -2 when migration needs to be cancelled, or -1 when
- * QEMU reports failed migration.
+ * QEMU reports failed migration. When @bandwidth (the bandwidth in MiB/s
+ * migration was started with) is non-NULL, migration bandwidth is
+ * periodically adjusted to the current share of the host-wide migration
+ * bandwidth budget.
  */
-static int
+int
 qemuMigrationSrcWaitForCompletion(virDomainObj *vm,
                                   virDomainAsyncJob asyncJob,
                                   virConnectPtr dconn,
-                                  unsigned int flags)
+                                  unsigned int flags,
+                                  qemuMigrationTuner *tuner,
+                                  unsigned long *bandwidth)
 {
+    qemuDomainObjPrivate *priv = vm->privateData;
     virDomainJobData *jobData = vm->job->current;
+    unsigned long userBandwidth = priv->migMaxBandwidth;
+    unsigned long long next = 0;
     int rv;
 
     jobData->status = VIR_DOMAIN_JOB_STATUS_MIGRATING;
@@ -2208,7 +2623,49 @@ qemuMigrationSrcWaitForCompletion(virDomainObj *vm,
         if (rv < 0)
             return rv;
 
-        if (qemuDomainObjWait(vm) < 0) {
+        if (tuner || bandwidth) {
+            unsigned long long now;
+
+            if (virTimeMillisNow(&now) < 0)
+                return -2;
+
+            if (now >= next) {
+                bool polled = next > 0;
+
+                if (next > 0 && bandwidth &&
+                    qemuMigrationSrcShareBandwidth(vm, asyncJob, &userBandwidth,
+                                                   bandwidth, tuner) < 0) {
+                    VIR_WARN("Failed to update migration bandwidth of domain %s: %s",
+                             vm->def->name, virGetLastErrorMessage());
+                    virResetLastError();
+                    bandwidth = NULL;
+                    continue;
+                }
+
+                if (next > 0 && tuner &&
+                    qemuMigrationSrcTune(vm, asyncJob, tuner) < 0) {
+                    VIR_WARN("Failed to tune migration of domain %s, "
+                             "disabling migration tuning: %s",
+                             vm->def->name, virGetLastErrorMessage());
+                    virResetLastError();
+                    tuner = NULL;
+                    continue;
+                }
+                next = now + QEMU_MIGRATION_TUNE_INTERVAL;
+
+                /* The domain was unlocked while we were talking to QEMU and
+                 * the wakeup of a MIGRATION event processed meanwhile is
+                 * gone, check the status before going to sleep. */
+                if (polled)
+                    continue;
+            }
+
+            rv = qemuDomainObjWaitUntil(vm, next);
+        } else {
+            rv = qemuDomainObjWait(vm);
+        }
+
+        if (rv < 0) {
             if (qemuDomainObjIsActive(vm))
                 jobData->status = VIR_DOMAIN_JOB_STATUS_FAILED;
             return -2;
@@ -2867,6 +3324,13 @@ qemuMigrationSrcBeginPhase(virQEMUDriver *driver,
          vm->newDef && !qemuDomainVcpuHotplugIsInOrder(vm->newDef)))
         cookieFlags |= QEMU_MIGRATION_COOKIE_CPU_HOTPLUG;
 
+    /* Wait for other outgoing migrations if there are too many of them before
+     * the destination is asked to start QEMU in the Prepare phase. */
+    if (vm->job->asyncJob == VIR_ASYNC_JOB_MIGRATION_OUT &&
+        !(flags & VIR_MIGRATE_OFFLINE) &&
+        qemuMigrationSrcAdmit(driver, vm) < 0)
+        return NULL;
+
     return qemuMigrationSrcBeginXML(vm, xmlin,
                                     cookieout, cookieoutlen, cookieFlags,
                                     migrate_disks, flags);
@@ -4887,6 +5351,53 @@ qemuMigrationSrcCancel(virDomainObj *vm,
 }
 
 
+/* Creates a tuner for an outgoing migration if enabled in qemu.conf. */
+static qemuMigrationTuner *
+qemuMigrationSrcNewTuner(virQEMUDriver *driver,
+                         virDomainObj *vm,
+                         qemuMigrationParams *migParams,
+                         unsigned int flags)
+{
+    g_autoptr(virQEMUDriverConfig) cfg = virQEMUDriverGetConfig(driver);
+    qemuDomainObjPrivate *priv = vm->privateData;
+    qemuDomainJobPrivate *jobPriv = vm->job->privateData;
+    unsigned long long maxBandwidth = priv->migMaxBandwidth * 1024ULL * 1024;
+    unsigned long long downtime = 300;
+    int throttleIncrement = 10;
+
+    if (!cfg->migrationAutoTune)
+        return NULL;
+
+    if (qemuMigrationParamsGetULL(migParams,
+                                  QEMU_MIGRATION_PARAM_DOWNTIME_LIMIT,
+                                  &downtime) != 0 &&
+        jobPriv->migParams)
+        ignore_value(qemuMigrationParamsGetULL(jobPriv->migParams,
+                                               QEMU_MIGRATION_PARAM_DOWNTIME_LIMIT,
+                                               &downtime));
+
+    if (qemuMigrationParamsGetInt(migParams,
+                                  QEMU_MIGRATION_PARAM_THROTTLE_INCREMENT,
+                                  &throttleIncrement) != 0 &&
+        jobPriv->migParams)
+        ignore_value(qemuMigrationParamsGetInt(jobPriv->migParams,
+                                               QEMU_MIGRATION_PARAM_THROTTLE_INCREMENT,
+                                               &throttleIncrement));
+
+    VIR_DEBUG("Tuning migration of domain %s: target=%us max downtime=%ums "
+              "bandwidth=%lluB/s downtime=%llums throttle increment=%d%%",
+              vm->def->name, cfg->migrationAutoTuneTargetTime,
+              cfg->migrationAutoTuneMaxDowntime, maxBandwidth, downtime,
+              throttleIncrement);
+
+    return qemuMigrationTunerNew(cfg->migrationAutoTuneTargetTime * 1000ULL,
+                                 cfg->migrationAutoTuneMaxDowntime,
+                                 maxBandwidth, downtime,
+                                 !!(flags & VIR_MIGRATE_AUTO_CONVERGE),
+                                 throttleIncrement);
+}
+
+
 static int
 qemuMigrationSrcRun(virQEMUDriver *driver,
                     virDomainObj *vm,
@@ -4919,6 +5430,10 @@ qemuMigrationSrcRun(virQEMUDriver *driver,
     bool cancel = false;
     unsigned int waitFlags;
     g_autoptr(virDomainDef) persistDef = NULL;
+    g_autoptr(qemuMigrationTuner) tuner = NULL;
+    g_autoptr(virQEMUDriverConfig) cfg = virQEMUDriverGetConfig(driver);
+    bool shareBandwidth = cfg->migrationBandwidthBudget > 0;
+    unsigned long bandwidth;
     int rc;
 
     if (resource > 0)
@@ -4968,6 +5483,15 @@ qemuMigrationSrcRun(virQEMUDriver *driver,
         }
     }
 
+    /* Migrations started without change protection were not admitted in
+     * the Begin phase, wait for other outgoing migrations here. */
+    if (qemuMigrationSrcAdmit(driver, vm) < 0)
+        goto error;
+
+    bandwidth = priv->migMaxBandwidth;
+    if (shareBandwidth)
+        bandwidth = qemuMigrationSrcGetBandwidthShare(driver, bandwidth);
+
     mig = qemuMigrationCookieParse(driver, vm, vm->def, priv->origname,
                                    priv->qemuCaps,
                                    cookiein, cookieinlen,
@@ -5012,7 +5536,7 @@ qemuMigrationSrcRun(virQEMUDriver *driver,
     }
 
     if (qemuMigrationParamsSetULL(migParams, QEMU_MIGRATION_PARAM_MAX_BANDWIDTH,
-                                  priv->migMaxBandwidth * 1024 * 1024) < 0)
+                                  bandwidth * 1024 * 1024) < 0)
         goto error;
 
     if (qemuMigrationParamsApply(vm, VIR_ASYNC_JOB_MIGRATION_OUT,
@@ -5055,7 +5579,7 @@ qemuMigrationSrcRun(virQEMUDriver *driver,
 
         if (qemuMigrationSrcNBDStorageCopy(driver, vm, mig,
                                            host,
-                                           priv->migMaxBandwidth,
+                                           bandwidth,
                                            migrate_disks,
                                            migrate_disks_detect_zeroes,
                                            dconn, tlsAlias, tlsHostname,
@@ -5116,8 +5640,15 @@ qemuMigrationSrcRun(virQEMUDriver *driver,
     if (flags & VIR_MIGRATE_POSTCOPY)
         waitFlags |= QEMU_MIGRATION_COMPLETED_POSTCOPY;
 
+    if (!(flags & VIR_MIGRATE_POSTCOPY))
+        tuner = qemuMigrationSrcNewTuner(driver, vm, migParams, flags);
+
+    if (tuner && bandwidth != priv->migMaxBandwidth)
+        qemuMigrationTunerSetMaxBandwidth(tuner, bandwidth * 1024ULL * 1024);
+
     rc = qemuMigrationSrcWaitForCompletion(vm, VIR_ASYNC_JOB_MIGRATION_OUT,
-                                           dconn, waitFlags);
+                                           dconn, waitFlags, tuner,
+                                           shareBandwidth ? &bandwidth : NULL);
     if (rc == -2)
         goto error;
 
@@ -5158,7 +5689,7 @@ qemuMigrationSrcRun(virQEMUDriver *driver,
 
         rc = qemuMigrationSrcWaitForCompletion(vm,
                                                VIR_ASYNC_JOB_MIGRATION_OUT,
-                                               dconn, waitFlags);
+                                               dconn, waitFlags, NULL, NULL);
         if (rc == -2)
             goto error;
 
@@ -5292,7 +5823,8 @@ qemuMigrationSrcResume(virDomainObj *vm,
     if (priv->migrationRecoverSetup) {
         VIR_DEBUG("Waiting for post-copy recovery to start");
         if (qemuMigrationSrcWaitForCompletion(vm, VIR_ASYNC_JOB_MIGRATION_OUT, dconn,
-                                              QEMU_MIRGATION_COMPLETED_RECOVERY) < 0)
+                                              QEMU_MIRGATION_COMPLETED_RECOVERY,
+                                              NULL, NULL) < 0)
             return -1;
     } else {
         VIR_WARN("QEMU is too old, we may report a failure in post-copy phase even though the migration may be running just fine");
@@ -7275,7 +7807,7 @@ qemuMigrationSrcToFile(virQEMUDriver *driver, virDomainObj *vm,
     if (rc < 0)
         goto cleanup;
 
-    rc = qemuMigrationSrcWaitForCompletion(vm, asyncJob, NULL, 0);
+    rc = qemuMigrationSrcWaitForCompletion(vm, asyncJob, NULL, 0, NULL, NULL);
 
     if (rc < 0) {
         if (rc == -2) {
@@ -261,6 +261,11 @@ qemuMigrationAnyFetchStats(virDomainObj *vm,
                            virDomainJobData *jobData,
                            char **error);
 
+int
+qemuMigrationAnyFetchStatsCached(virDomainObj *vm,
+                                 virDomainAsyncJob asyncJob,
+                                 virDomainJobData *jobData);
+
 int
 qemuMigrationDstErrorInit(virQEMUDriver *driver);
 
@@ -1125,6 +1125,36 @@ qemuMigrationParamsApply(virDomainObj *vm,
 }
 
 
+/**
+ * qemuMigrationParamsUpdate:
+ * @vm: domain object
+ * @asyncJob: migration job
+ * @migParams: migration parameters to send to QEMU
+ *
+ * Send parameters stored in @migParams to QEMU while migration is already
+ * running. Unlike qemuMigrationParamsApply, migration capabilities are never
+ * touched since QEMU only allows them to be changed before migration starts.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int
+qemuMigrationParamsUpdate(virDomainObj *vm,
+                          int asyncJob,
+                          qemuMigrationParams *migParams)
+{
+    int rc;
+
+    if (qemuDomainObjEnterMonitorAsync(vm, asyncJob) < 0)
+        return -1;
+
+    rc = qemuMigrationParamsApplyValues(vm, migParams, false);
+
+    qemuDomainObjExitMonitor(vm);
+
+    return rc;
+}
+
+
 /**
  * qemuMigrationParamsSetString:
  * @migrParams: migration parameter object
@@ -1347,6 +1377,41 @@ qemuMigrationParamsSetULL(qemuMigrationParams *migParams,
 }
 
 
+int
+qemuMigrationParamsSetInt(qemuMigrationParams *migParams,
+                          qemuMigrationParam param,
+                          int value)
+{
+    if (qemuMigrationParamsCheckType(param, QEMU_MIGRATION_PARAM_TYPE_INT) < 0)
+        return -1;
+
+    migParams->params[param].value.i = value;
+    migParams->params[param].set = true;
+    return 0;
+}
+
+
+/**
+ * Returns -1 on error,
+ *          0 on success,
+ *          1 if the parameter is not supported by QEMU.
+ */
+int
+qemuMigrationParamsGetInt(qemuMigrationParams *migParams,
+                          qemuMigrationParam param,
+                          int *value)
+{
+    if (qemuMigrationParamsCheckType(param, QEMU_MIGRATION_PARAM_TYPE_INT) < 0)
+        return -1;
+
+    if (!migParams->params[param].set)
+        return 1;
+
+    *value = migParams->params[param].value.i;
+    return 0;
+}
+
+
 /**
  * Returns -1 on error,
  *          0 on success,
@@ -114,6 +114,11 @@ qemuMigrationParamsApply(virDomainObj *vm,
                          qemuMigrationParams *migParams,
                          unsigned int apiFlags);
 
+int
+qemuMigrationParamsUpdate(virDomainObj *vm,
+                          int asyncJob,
+                          qemuMigrationParams *migParams);
+
 int
 qemuMigrationParamsEnableTLS(virQEMUDriver *driver,
                              virDomainObj *vm,
@@ -140,6 +145,16 @@ qemuMigrationParamsSetULL(qemuMigrationParams *migParams,
                           qemuMigrationParam param,
                           unsigned long long value);
 
+int
+qemuMigrationParamsSetInt(qemuMigrationParams *migParams,
+                          qemuMigrationParam param,
+                          int value);
+
+int
+qemuMigrationParamsGetInt(qemuMigrationParams *migParams,
+                          qemuMigrationParam param,
+                          int *value);
+
 int
 qemuMigrationParamsGetULL(qemuMigrationParams *migParams,
                           qemuMigrationParam param,
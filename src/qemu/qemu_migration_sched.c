@@ -0,0 +1,279 @@
+/*
+ * qemu_migration_sched.c: host-wide scheduling of outgoing migrations
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include <config.h>
+
+#include "qemu_migration_sched.h"
+#include "qemu_domain.h"
+
+#include "viralloc.h"
+#include "virerror.h"
+#include "virlog.h"
+#include "virthread.h"
+#include "virtime.h"
+
+#define VIR_FROM_THIS VIR_FROM_QEMU
+
+VIR_LOG_INIT("qemu.qemu_migration_sched");
+
+/* How often queued migrations recheck their position and whether they
+ * were aborted, in milliseconds */
+#define QEMU_MIGRATION_SCHED_RECHECK 1000
+
+typedef struct _qemuMigrationSchedEntry qemuMigrationSchedEntry;
+struct _qemuMigrationSchedEntry {
+    virDomainObj *vm;
+    unsigned long long priority;
+    unsigned long long seq;
+};
+
+struct _qemuMigrationScheduler {
+    virMutex lock;
+
+    /* Number of migrations which were admitted and not released yet */
+    size_t running;
+
+    /* Migrations waiting to be admitted, in arrival order */
+    qemuMigrationSchedEntry *queue;
+    size_t nqueue;
+    unsigned long long seq;
+};
+
+
+qemuMigrationScheduler *
+qemuMigrationSchedulerNew(void)
+{
+    g_autofree qemuMigrationScheduler *sched = g_new0(qemuMigrationScheduler, 1);
+
+    if (virMutexInit(&sched->lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to initialize migration scheduler mutex"));
+        return NULL;
+    }
+
+    return g_steal_pointer(&sched);
+}
+
+
+void
+qemuMigrationSchedulerFree(qemuMigrationScheduler *sched)
+{
+    if (!sched)
+        return;
+
+    virMutexDestroy(&sched->lock);
+    g_free(sched->queue);
+    g_free(sched);
+}
+
+
+static bool
+qemuMigrationSchedEntryBefore(const qemuMigrationSchedEntry *a,
+                              const qemuMigrationSchedEntry *b)
+{
+    if (a->priority != b->priority)
+        return a->priority < b->priority;
+
+    return a->seq < b->seq;
+}
+
+
+/* Returns the index of the queued migration which should run next.
+ * Must be called with @sched locked and a non-empty queue. */
+static size_t
+qemuMigrationSchedulerNext(qemuMigrationScheduler *sched)
+{
+    size_t next = 0;
+    size_t i;
+
+    for (i = 1; i < sched->nqueue; i++) {
+        if (qemuMigrationSchedEntryBefore(&sched->queue[i], &sched->queue[next]))
+            next = i;
+    }
+
+    return next;
+}
+
+
+/* Wakes up the queued migration which should run next if there's a free
+ * slot for it. Must be called with @sched locked. */
+static void
+qemuMigrationSchedulerWakeNext(qemuMigrationScheduler *sched,
+                               unsigned int maxRunning)
+{
+    if (sched->nqueue == 0 ||
+        (maxRunning > 0 && sched->running >= maxRunning))
+        return;
+
+    virDomainObjBroadcast(sched->queue[qemuMigrationSchedulerNext(sched)].vm);
+}
+
+
+static ssize_t
+qemuMigrationSchedulerFind(qemuMigrationScheduler *sched,
+                           unsigned long long seq)
+{
+    size_t i;
+
+    for (i = 0; i < sched->nqueue; i++) {
+        if (sched->queue[i].seq == seq)
+            return i;
+    }
+
+    return -1;
+}
+
+
+static void
+qemuMigrationSchedulerDequeue(qemuMigrationScheduler *sched,
+                              unsigned long long seq)
+{
+    ssize_t idx = qemuMigrationSchedulerFind(sched, seq);
+
+    if (idx < 0)
+        return;
+
+    virObjectUnref(sched->queue[idx].vm);
+    VIR_DELETE_ELEMENT(sched->queue, idx, sched->nqueue);
+}
+
+
+/**
+ * qemuMigrationSchedulerAdmit:
+ * @sched: migration scheduler
+ * @vm: domain which is about to be migrated, locked, with an active
+ *      outgoing migration job
+ * @maxRunning: maximum number of concurrent outgoing migrations, 0 for
+ *              unlimited
+ * @priority: migrations with lower value are admitted first
+ *
+ * Waits until @vm is allowed to start migrating. While waiting, @vm is
+ * unlocked and its position in the queue is reported in the current job
+ * statistics. Every successful call must be paired with
+ * qemuMigrationSchedulerRelease once migration is over.
+ *
+ * Returns 0 when migration can start, -1 when the job was aborted or the
+ * domain died while waiting.
+ */
+int
+qemuMigrationSchedulerAdmit(qemuMigrationScheduler *sched,
+                            virDomainObj *vm,
+                            unsigned int maxRunning,
+                            unsigned long long priority)
+{
+    qemuDomainJobDataPrivate *privJob = vm->job->current->privateData;
+    qemuMigrationSchedEntry entry = { 0 };
+    unsigned long long seq;
+    unsigned long long now;
+
+    VIR_WITH_MUTEX_LOCK_GUARD(&sched->lock) {
+        if (sched->nqueue == 0 &&
+            (maxRunning == 0 || sched->running < maxRunning)) {
+            sched->running++;
+            return 0;
+        }
+
+        seq = sched->seq++;
+        entry.vm = virObjectRef(vm);
+        entry.priority = priority;
+        entry.seq = seq;
+        VIR_APPEND_ELEMENT(sched->queue, sched->nqueue, entry);
+    }
+
+    VIR_DEBUG("Migration of domain %s queued with priority %llu",
+              vm->def->name, priority);
+
+    while (true) {
+        size_t position = 1;
+        size_t i;
+
+        VIR_WITH_MUTEX_LOCK_GUARD(&sched->lock) {
+            qemuMigrationSchedEntry *self;
+
+            self = &sched->queue[qemuMigrationSchedulerFind(sched, seq)];
+
+            for (i = 0; i < sched->nqueue; i++) {
+                if (qemuMigrationSchedEntryBefore(&sched->queue[i], self))
+                    position++;
+            }
+
+            if (position == 1 &&
+                (maxRunning == 0 || sched->running < maxRunning)) {
+                qemuMigrationSchedulerDequeue(sched, seq);
+                sched->running++;
+                qemuMigrationSchedulerWakeNext(sched, maxRunning);
+                position = 0;
+            }
+        }
+
+        privJob->queuePosition = position;
+        if (position == 0) {
+            VIR_DEBUG("Migration of domain %s admitted", vm->def->name);
+            return 0;
+        }
+
+        if (vm->job->abortJob) {
+            vm->job->current->status = VIR_DOMAIN_JOB_STATUS_CANCELED;
+            virReportError(VIR_ERR_OPERATION_ABORTED, _("%1$s: %2$s"),
+                           virDomainAsyncJobTypeToString(vm->job->asyncJob),
+                           _("canceled by client"));
+            break;
+        }
+
+        if (virTimeMillisNow(&now) < 0 ||
+            qemuDomainObjWaitUntil(vm, now + QEMU_MIGRATION_SCHED_RECHECK) < 0)
+            break;
+    }
+
+    VIR_WITH_MUTEX_LOCK_GUARD(&sched->lock) {
+        qemuMigrationSchedulerDequeue(sched, seq);
+        qemuMigrationSchedulerWakeNext(sched, maxRunning);
+    }
+    privJob->queuePosition = 0;
+
+    return -1;
+}
+
+
+/**
+ * qemuMigrationSchedulerRelease:
+ * @sched: migration scheduler
+ *
+ * Frees the slot taken by a migration admitted by qemuMigrationSchedulerAdmit
+ * and lets the next queued migration start.
+ */
+void
+qemuMigrationSchedulerRelease(qemuMigrationScheduler *sched)
+{
+    VIR_LOCK_GUARD lock = virLockGuardLock(&sched->lock);
+
+    if (sched->running > 0)
+        sched->running--;
+
+    /* The woken up migration checks the current limit itself */
+    qemuMigrationSchedulerWakeNext(sched, 0);
+}
+
+
+/**
+ * qemuMigrationSchedulerShare:
+ * @sched: migration scheduler
+ * @budget: total bandwidth for all outgoing migrations
+ *
+ * Returns the part of @budget each running migration may use or 0 if
+ * @budget is 0 (unlimited).
+ */
+unsigned long long
+qemuMigrationSchedulerShare(qemuMigrationScheduler *sched,
+                            unsigned long long budget)
+{
+    VIR_LOCK_GUARD lock = virLockGuardLock(&sched->lock);
+
+    if (budget == 0)
+        return 0;
+
+    return budget / MAX(sched->running, 1);
+}
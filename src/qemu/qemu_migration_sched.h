@@ -0,0 +1,30 @@
+/*
+ * qemu_migration_sched.h: host-wide scheduling of outgoing migrations
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#pragma once
+
+#include "domain_conf.h"
+
+typedef struct _qemuMigrationScheduler qemuMigrationScheduler;
+
+qemuMigrationScheduler *
+qemuMigrationSchedulerNew(void);
+
+void
+qemuMigrationSchedulerFree(qemuMigrationScheduler *sched);
+
+int
+qemuMigrationSchedulerAdmit(qemuMigrationScheduler *sched,
+                            virDomainObj *vm,
+                            unsigned int maxRunning,
+                            unsigned long long priority);
+
+void
+qemuMigrationSchedulerRelease(qemuMigrationScheduler *sched);
+
+unsigned long long
+qemuMigrationSchedulerShare(qemuMigrationScheduler *sched,
+                            unsigned long long budget);
@@ -0,0 +1,272 @@
+/*
+ * qemu_migration_tune.c: adaptive tuning of running migrations
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include <config.h>
+
+#include "qemu_migration_tune.h"
+
+#include "virlog.h"
+
+#define VIR_FROM_THIS VIR_FROM_QEMU
+
+VIR_LOG_INIT("qemu.qemu_migration_tune");
+
+/* Extra bandwidth on top of what is needed to hit the target time, in % */
+#define QEMU_MIGRATION_TUNE_HEADROOM 25
+
+/* Never slow migration down below this rate, in bytes per second */
+#define QEMU_MIGRATION_TUNE_MIN_BANDWIDTH (32ULL * 1024 * 1024)
+
+/* Bandwidth changes smaller than this are not worth sending to QEMU, in % */
+#define QEMU_MIGRATION_TUNE_BANDWIDTH_HYSTERESIS 10
+
+/* How fast and how far cpu-throttle-increment may be raised, in % */
+#define QEMU_MIGRATION_TUNE_THROTTLE_STEP 10
+#define QEMU_MIGRATION_TUNE_THROTTLE_MAX 50
+
+#define QEMU_MIGRATION_TUNE_DEFAULT_PAGE_SIZE 4096
+
+struct _qemuMigrationTuner {
+    /* Limits given by the user or host configuration */
+    unsigned long long targetTime;      /* ms, 0 when there is no target */
+    unsigned long long maxDowntime;     /* ms */
+    unsigned long long maxBandwidth;    /* bytes/s */
+    bool autoConverge;
+    int minThrottleIncrement;           /* % */
+
+    /* Values currently used by QEMU */
+    unsigned long long bandwidth;       /* bytes/s */
+    unsigned long long downtime;        /* ms */
+    int throttleIncrement;              /* % */
+
+    /* Previous sample */
+    bool sampled;
+    unsigned long long lastTime;        /* ms */
+    unsigned long long lastTransferred; /* bytes */
+};
+
+
+/**
+ * qemuMigrationTunerNew:
+ * @targetTime: total migration time to aim for in milliseconds, 0 if
+ *              migration should just converge as soon as possible
+ * @maxDowntime: the highest downtime limit the tuner may set
+ * @maxBandwidth: the highest bandwidth in bytes/s the tuner may set
+ * @downtime: downtime limit used when migration starts
+ * @autoConverge: whether auto-converge capability is enabled
+ * @throttleIncrement: cpu-throttle-increment used when migration starts
+ *
+ * Creates a controller which watches statistics of a running outgoing
+ * migration and adjusts migration parameters so that it converges within
+ * @targetTime without using more bandwidth than necessary. The initial
+ * values are never undercut, the tuner only relaxes them up to the given
+ * limits when migration does not make enough progress.
+ */
+qemuMigrationTuner *
+qemuMigrationTunerNew(unsigned long long targetTime,
+                      unsigned long long maxDowntime,
+                      unsigned long long maxBandwidth,
+                      unsigned long long downtime,
+                      bool autoConverge,
+                      int throttleIncrement)
+{
+    qemuMigrationTuner *tuner = g_new0(qemuMigrationTuner, 1);
+
+    tuner->targetTime = targetTime;
+    tuner->maxDowntime = MAX(maxDowntime, downtime);
+    tuner->maxBandwidth = maxBandwidth;
+    tuner->autoConverge = autoConverge;
+    tuner->minThrottleIncrement = throttleIncrement;
+
+    tuner->bandwidth = maxBandwidth;
+    tuner->downtime = downtime;
+    tuner->throttleIncrement = throttleIncrement;
+
+    return tuner;
+}
+
+
+void
+qemuMigrationTunerFree(qemuMigrationTuner *tuner)
+{
+    g_free(tuner);
+}
+
+
+/**
+ * qemuMigrationTunerSetMaxBandwidth:
+ * @tuner: migration tuner
+ * @maxBandwidth: the highest bandwidth in bytes/s the tuner may set
+ *
+ * Changes the bandwidth limit of a running migration. The new limit is
+ * applied by the next qemuMigrationTunerUpdate call.
+ */
+void
+qemuMigrationTunerSetMaxBandwidth(qemuMigrationTuner *tuner,
+                                  unsigned long long maxBandwidth)
+{
+    tuner->maxBandwidth = maxBandwidth;
+
+    /* Make sure the next update sends the new value to QEMU */
+    if (tuner->bandwidth > maxBandwidth)
+        tuner->bandwidth = ULLONG_MAX;
+}
+
+
+static bool
+qemuMigrationTunerBandwidthDiffers(unsigned long long old,
+                                   unsigned long long new)
+{
+    unsigned long long diff = old > new ? old - new : new - old;
+
+    return diff > old / 100 * QEMU_MIGRATION_TUNE_BANDWIDTH_HYSTERESIS;
+}
+
+
+/**
+ * qemuMigrationTunerUpdate:
+ * @tuner: migration tuner
+ * @stats: current migration statistics
+ * @params: filled in with parameters to apply
+ *
+ * Feeds @stats to @tuner, which is supposed to happen roughly every
+ * QEMU_MIGRATION_TUNE_INTERVAL milliseconds. When migration parameters
+ * should be changed, @params is set to a new object with just the changed
+ * values, otherwise it is set to NULL.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuMigrationTunerUpdate(qemuMigrationTuner *tuner,
+                         const qemuMonitorMigrationStats *stats,
+                         qemuMigrationParams **params)
+{
+    g_autoptr(qemuMigrationParams) migParams = NULL;
+    unsigned long long pageSize = stats->ram_page_size;
+    unsigned long long elapsed = stats->total_time;
+    unsigned long long remaining = stats->ram_remaining;
+    unsigned long long dirty;
+    unsigned long long rate;
+    unsigned long long need = ULLONG_MAX;
+    unsigned long long bandwidth;
+    unsigned long long downtime = tuner->downtime;
+    int throttleIncrement = tuner->throttleIncrement;
+    bool struggling;
+    bool changed = false;
+
+    *params = NULL;
+
+    /* There's nothing to tune before migration starts, in post-copy,
+     * or once migration is switching over. */
+    if (stats->status != QEMU_MONITOR_MIGRATION_STATUS_ACTIVE)
+        return 0;
+
+    if (tuner->sampled &&
+        elapsed < tuner->lastTime + QEMU_MIGRATION_TUNE_INTERVAL / 2)
+        return 0;
+
+    if (!tuner->sampled ||
+        stats->ram_transferred < tuner->lastTransferred ||
+        elapsed <= tuner->lastTime) {
+        tuner->sampled = true;
+        tuner->lastTime = elapsed;
+        tuner->lastTransferred = stats->ram_transferred;
+        return 0;
+    }
+
+    rate = (stats->ram_transferred - tuner->lastTransferred) * 1000 /
+           (elapsed - tuner->lastTime);
+    tuner->lastTime = elapsed;
+    tuner->lastTransferred = stats->ram_transferred;
+
+    if (rate == 0)
+        return 0;
+
+    if (pageSize == 0)
+        pageSize = QEMU_MIGRATION_TUNE_DEFAULT_PAGE_SIZE;
+    dirty = stats->ram_dirty_rate * pageSize;
+
+    /* Transfer rate needed to send everything that is left, and all pages
+     * dirtied in the meantime, before the target time. */
+    if (tuner->targetTime > elapsed)
+        need = dirty + remaining * 1000 / (tuner->targetTime - elapsed);
+
+    if (need == ULLONG_MAX) {
+        bandwidth = tuner->maxBandwidth;
+    } else {
+        bandwidth = need + need / 100 * QEMU_MIGRATION_TUNE_HEADROOM;
+        bandwidth = MAX(bandwidth, QEMU_MIGRATION_TUNE_MIN_BANDWIDTH);
+        bandwidth = MIN(bandwidth, tuner->maxBandwidth);
+    }
+
+    /* Migration cannot keep up with the guest or it doesn't reach the rate
+     * it is allowed to use and thus won't finish in time. */
+    struggling = rate <= dirty ||
+                 (tuner->targetTime && need == ULLONG_MAX) ||
+                 (need != ULLONG_MAX && rate < need && tuner->bandwidth >= need);
+
+    if (struggling) {
+        if (tuner->autoConverge) {
+            throttleIncrement = MIN(throttleIncrement + QEMU_MIGRATION_TUNE_THROTTLE_STEP,
+                                    MAX(QEMU_MIGRATION_TUNE_THROTTLE_MAX,
+                                        tuner->minThrottleIncrement));
+        }
+
+        if (downtime < tuner->maxDowntime) {
+            /* Downtime needed for QEMU to switch over right now */
+            unsigned long long required = remaining * 1000 / rate;
+
+            if (required <= tuner->maxDowntime)
+                downtime = MAX(downtime, required + required / 4);
+            else
+                downtime *= 2;
+
+            downtime = MIN(downtime, tuner->maxDowntime);
+        }
+    } else if (tuner->autoConverge && rate > 2 * dirty) {
+        throttleIncrement = MAX(throttleIncrement - QEMU_MIGRATION_TUNE_THROTTLE_STEP,
+                                tuner->minThrottleIncrement);
+    }
+
+    VIR_DEBUG("elapsed=%llums remaining=%llu rate=%llu dirty=%llu need=%llu "
+              "struggling=%d bandwidth=%llu downtime=%llu throttle=%d",
+              elapsed, remaining, rate, dirty, need, struggling,
+              bandwidth, downtime, throttleIncrement);
+
+    migParams = qemuMigrationParamsNew();
+
+    if (qemuMigrationTunerBandwidthDiffers(tuner->bandwidth, bandwidth)) {
+        if (qemuMigrationParamsSetULL(migParams,
+                                      QEMU_MIGRATION_PARAM_MAX_BANDWIDTH,
+                                      bandwidth) < 0)
+            return -1;
+        tuner->bandwidth = bandwidth;
+        changed = true;
+    }
+
+    if (downtime != tuner->downtime) {
+        if (qemuMigrationParamsSetULL(migParams,
+                                      QEMU_MIGRATION_PARAM_DOWNTIME_LIMIT,
+                                      downtime) < 0)
+            return -1;
+        tuner->downtime = downtime;
+        changed = true;
+    }
+
+    if (throttleIncrement != tuner->throttleIncrement) {
+        if (qemuMigrationParamsSetInt(migParams,
+                                      QEMU_MIGRATION_PARAM_THROTTLE_INCREMENT,
+                                      throttleIncrement) < 0)
+            return -1;
+        tuner->throttleIncrement = throttleIncrement;
+        changed = true;
+    }
+
+    if (changed)
+        *params = g_steal_pointer(&migParams);
+
+    return 0;
+}
@@ -0,0 +1,36 @@
+/*
+ * qemu_migration_tune.h: adaptive tuning of running migrations
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#pragma once
+
+#include "qemu_migration_params.h"
+#include "qemu_monitor.h"
+
+/* How often migration statistics are sampled, in milliseconds */
+#define QEMU_MIGRATION_TUNE_INTERVAL 1000
+
+typedef struct _qemuMigrationTuner qemuMigrationTuner;
+
+qemuMigrationTuner *
+qemuMigrationTunerNew(unsigned long long targetTime,
+                      unsigned long long maxDowntime,
+                      unsigned long long maxBandwidth,
+                      unsigned long long downtime,
+                      bool autoConverge,
+                      int throttleIncrement);
+
+void
+qemuMigrationTunerFree(qemuMigrationTuner *tuner);
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(qemuMigrationTuner, qemuMigrationTunerFree);
+
+void
+qemuMigrationTunerSetMaxBandwidth(qemuMigrationTuner *tuner,
+                                  unsigned long long maxBandwidth);
+
+int
+qemuMigrationTunerUpdate(qemuMigrationTuner *tuner,
+                         const qemuMonitorMigrationStats *stats,
+                         qemuMigrationParams **params);
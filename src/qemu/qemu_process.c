@@ -1479,7 +1479,7 @@ qemuProcessHandleSpiceMigrated(qemuMonitor *mon G_GNUC_UNUSED,
 }
 
 
-static void
+void
 qemuProcessHandleMigrationStatus(qemuMonitor *mon G_GNUC_UNUSED,
                                  virDomainObj *vm,
                                  int status)
@@ -1622,6 +1622,15 @@ qemuProcessHandleMigrationPass(qemuMonitor *mon G_GNUC_UNUSED,
         goto cleanup;
     }
 
+    /* Keep the iteration counter of cached statistics up to date */
+    if (vm->job->current) {
+        qemuDomainJobDataPrivate *privJob = vm->job->current->privateData;
+
+        if (privJob->statsType == QEMU_DOMAIN_JOB_STATS_TYPE_MIGRATION &&
+            pass > 0)
+            privJob->stats.mig.ram_iteration = pass;
+    }
+
     virObjectEventStateQueue(priv->driver->domainEventState,
                          virDomainEventMigrationIterationNewFromObj(vm, pass));
 
@@ -36,4 +36,8 @@ void qemuProcessHandleDeviceDeleted(qemuMonitor *mon,
                                     virDomainObj *vm,
                                     const char *devAlias);
 
+void qemuProcessHandleMigrationStatus(qemuMonitor *mon,
+                                      virDomainObj *vm,
+                                      int status);
+
 int qemuProcessQMPInitMonitor(qemuMonitor *mon);
@@ -972,6 +972,13 @@ int main(int argc, char **argv) {
         goto cleanup;
     }
 
+    /* The log thread has to be started in the final daemon process */
+    if (config->log_async &&
+        virLogSetAsync(true) < 0) {
+        ret = VIR_DAEMON_ERR_INIT;
+        goto cleanup;
+    }
+
     /* Ensure the rundir exists (on tmpfs on some systems) */
     if (privileged) {
         run_dir = g_strdup(RUNSTATEDIR "/libvirt");
@@ -1224,5 +1231,8 @@ int main(int argc, char **argv) {
     VIR_FREE(remote_config_file);
     daemonConfigFree(config);
 
+    /* Write out messages still queued */
+    virLogSetAsync(false);
+
     return ret;
 }
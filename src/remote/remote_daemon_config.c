@@ -366,6 +366,8 @@ daemonConfigLoadOptions(struct daemonConfig *data,
         return -1;
     if (virConfGetValueString(conf, "log_outputs", &data->log_outputs) < 0)
         return -1;
+    if (virConfGetValueBool(conf, "log_async", &data->log_async) < 0)
+        return -1;
 
     if (virConfGetValueInt(conf, "keepalive_interval", &data->keepalive_interval) < 0)
         return -1;
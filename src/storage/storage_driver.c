@@ -81,13 +81,29 @@ storagePoolRefreshFailCleanup(virStorageBackend *backend,
 }
 
 
+/*
+ * With VIR_STORAGE_POOL_REFRESH_INCREMENTAL in @flags the volumes from
+ * the previous refresh are handed to the backend which may reuse the
+ * ones that didn't change instead of probing them again. Backends not
+ * supporting that simply rebuild the whole list.
+ */
 static int
 storagePoolRefreshImpl(virStorageBackend *backend,
                        virStoragePoolObj *obj,
-                       const char *stateFile)
+                       const char *stateFile,
+                       unsigned int flags)
 {
-    virStoragePoolObjClearVols(obj);
-    if (backend->refreshPool(obj) < 0) {
+    int rc;
+
+    if (flags & VIR_STORAGE_POOL_REFRESH_INCREMENTAL)
+        virStoragePoolObjStashVols(obj);
+    else
+        virStoragePoolObjClearVols(obj);
+
+    rc = backend->refreshPool(obj);
+    virStoragePoolObjClearStashedVols(obj);
+
+    if (rc < 0) {
         storagePoolRefreshFailCleanup(backend, obj, stateFile);
         return -1;
     }
@@ -151,7 +167,7 @@ storagePoolUpdateStateCallback(virStoragePoolObj *obj,
      * continue with other pools.
      */
     if (active &&
-        storagePoolRefreshImpl(backend, obj, stateFile) < 0) {
+        storagePoolRefreshImpl(backend, obj, stateFile, 0) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Failed to restart storage pool '%1$s': %2$s"),
                        def->name, virGetLastErrorMessage());
@@ -209,7 +225,7 @@ storageDriverAutostartCallback(virStoragePoolObj *obj,
 
     if (!stateFile ||
         virStoragePoolSaveState(stateFile, def) < 0 ||
-        storagePoolRefreshImpl(backend, obj, stateFile) < 0) {
+        storagePoolRefreshImpl(backend, obj, stateFile, 0) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("Failed to autostart storage pool '%1$s': %2$s"),
                        def->name, virGetLastErrorMessage());
@@ -758,7 +774,7 @@ storagePoolCreateXML(virConnectPtr conn,
 
     if (!stateFile ||
         virStoragePoolSaveState(stateFile, def) < 0 ||
-        storagePoolRefreshImpl(backend, obj, stateFile) < 0) {
+        storagePoolRefreshImpl(backend, obj, stateFile, 0) < 0) {
         goto error;
     }
 
@@ -968,7 +984,7 @@ storagePoolCreate(virStoragePoolPtr pool,
 
     if (!stateFile ||
         virStoragePoolSaveState(stateFile, def) < 0 ||
-        storagePoolRefreshImpl(backend, obj, stateFile) < 0) {
+        storagePoolRefreshImpl(backend, obj, stateFile, 0) < 0) {
         goto cleanup;
     }
 
@@ -1205,7 +1221,7 @@ storagePoolRefresh(virStoragePoolPtr pool,
     int ret = -1;
     virObjectEvent *event = NULL;
 
-    virCheckFlags(0, -1);
+    virCheckFlags(VIR_STORAGE_POOL_REFRESH_INCREMENTAL, -1);
 
     if (!(obj = storagePoolObjFindByUUID(pool->uuid, pool->name)))
         goto cleanup;
@@ -1238,7 +1254,7 @@ storagePoolRefresh(virStoragePoolPtr pool,
     }
 
     stateFile = virFileBuildPath(driver->stateDir, def->name, ".xml");
-    if (storagePoolRefreshImpl(backend, obj, stateFile) < 0) {
+    if (storagePoolRefreshImpl(backend, obj, stateFile, flags) < 0) {
         event = virStoragePoolEventLifecycleNew(def->name,
                                                 def->uuid,
                                                 VIR_STORAGE_POOL_EVENT_STOPPED,
@@ -2326,7 +2342,10 @@ virStorageVolPoolRefreshThread(void *opaque)
     if (!(backend = virStorageBackendForType(def->type)))
         goto cleanup;
 
-    if (storagePoolRefreshImpl(backend, obj, NULL) < 0)
+    /* Only the volume the stream was working with is expected to
+     * change, no need to probe the others again. */
+    if (storagePoolRefreshImpl(backend, obj, NULL,
+                               VIR_STORAGE_POOL_REFRESH_INCREMENTAL) < 0)
         VIR_DEBUG("Failed to refresh storage pool");
 
     event = virStoragePoolEventRefreshNew(def->name, def->uuid);
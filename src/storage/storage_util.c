@@ -63,6 +63,7 @@
 #include "virfdstream.h"
 #include "virutil.h"
 #include "virsecureerase.h"
+#include "virthread.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
@@ -114,6 +115,118 @@ reflinkCloneFile(int dest_fd G_GNUC_UNUSED,
 #endif
 
 
+#if WITH_COPY_FILE_RANGE
+/*
+ * Copy data sections of @inputfd to @fd using copy_file_range(). This
+ * lets the kernel pick the cheapest way of copying: sharing extents on
+ * reflink capable filesystems (btrfs, XFS), server side copy on NFS
+ * 4.2 or at least an in-kernel copy that doesn't bounce the data
+ * through userspace. Holes in the input are skipped, so the output
+ * has to be sparse capable.
+ *
+ * Returns 0 on success, 1 if copy_file_range() can't be used for the
+ * files (the positions in both files are left unchanged), -1 on error.
+ */
+static int
+storageBackendCopyFileRange(virStorageVolDef *vol,
+                            virStorageVolDef *inputvol,
+                            int inputfd,
+                            int fd,
+                            unsigned long long *total)
+{
+    unsigned long long remain = *total;
+    bool copied = false;
+    off_t instart;
+    off_t outstart;
+
+    if ((instart = lseek(inputfd, 0, SEEK_CUR)) < 0 ||
+        (outstart = lseek(fd, 0, SEEK_CUR)) < 0)
+        return 1;
+
+    while (remain > 0) {
+        int inData;
+        long long len;
+
+        if (virFileInData(inputfd, &inData, &len) < 0)
+            return -1;
+
+        /* end of file */
+        if (len == 0)
+            break;
+
+        if ((unsigned long long)len > remain)
+            len = remain;
+
+        if (!inData) {
+            if (lseek(inputfd, len, SEEK_CUR) < 0 ||
+                lseek(fd, len, SEEK_CUR) < 0) {
+                virReportSystemError(errno,
+                                     _("cannot extend file '%1$s'"),
+                                     vol->target.path);
+                return -1;
+            }
+            remain -= len;
+            continue;
+        }
+
+        while (len > 0) {
+            ssize_t got = copy_file_range(inputfd, NULL, fd, NULL, len, 0);
+
+            if (got < 0) {
+                if (errno == EINTR)
+                    continue;
+
+                if (!copied &&
+                    (errno == EXDEV || errno == ENOSYS ||
+                     errno == EOPNOTSUPP || errno == EINVAL)) {
+                    VIR_DEBUG("copy_file_range from '%s' to '%s' not supported: %s",
+                              inputvol->target.path, vol->target.path,
+                              g_strerror(errno));
+
+                    if (lseek(inputfd, instart, SEEK_SET) < 0 ||
+                        lseek(fd, outstart, SEEK_SET) < 0) {
+                        virReportSystemError(errno,
+                                             _("cannot seek in file '%1$s'"),
+                                             vol->target.path);
+                        return -1;
+                    }
+                    return 1;
+                }
+
+                virReportSystemError(errno,
+                                     _("failed to copy from '%1$s' to '%2$s'"),
+                                     inputvol->target.path, vol->target.path);
+                return -1;
+            }
+
+            /* input shrunk under our hands */
+            if (got == 0) {
+                *total = remain;
+                return 0;
+            }
+
+            copied = true;
+            len -= got;
+            remain -= got;
+        }
+    }
+
+    *total = remain;
+    return 0;
+}
+#else /* !WITH_COPY_FILE_RANGE */
+static int
+storageBackendCopyFileRange(virStorageVolDef *vol G_GNUC_UNUSED,
+                            virStorageVolDef *inputvol G_GNUC_UNUSED,
+                            int inputfd G_GNUC_UNUSED,
+                            int fd G_GNUC_UNUSED,
+                            unsigned long long *total G_GNUC_UNUSED)
+{
+    return 1;
+}
+#endif /* !WITH_COPY_FILE_RANGE */
+
+
 static int ATTRIBUTE_NONNULL(2)
 virStorageBackendCopyToFD(virStorageVolDef *vol,
                           virStorageVolDef *inputvol,
@@ -163,6 +276,27 @@ virStorageBackendCopyToFD(virStorageVolDef *vol,
         }
     }
 
+    /* Holes are skipped by copy_file_range based copying so use it
+     * only if the output doesn't need to be fully allocated. */
+    if (want_sparse) {
+        int rc;
+
+        if ((rc = storageBackendCopyFileRange(vol, inputvol, inputfd,
+                                              fd, total)) < 0)
+            return -1;
+
+        if (rc == 0) {
+            VIR_DEBUG("Copied '%s' to '%s' using copy_file_range",
+                      inputvol->target.path, vol->target.path);
+            amtread = 0;
+        }
+    }
+
+    if (amtread != 0) {
+        VIR_DEBUG("Copying '%s' to '%s' using read/write",
+                  inputvol->target.path, vol->target.path);
+    }
+
     while (amtread != 0) {
         int amtleft;
 
@@ -2551,18 +2685,124 @@ storageBackendVolZeroSparseFileLocal(const char *path,
 }
 
 
+/* Size of a single write when zeroing a volume. */
+#define VIR_STORAGE_WIPE_BUFLEN (1024 * 1024)
+
+/* Maximum number of threads zeroing distinct parts of a volume and
+ * the minimum amount of data each of them gets. */
+#define VIR_STORAGE_WIPE_WORKERS 4
+#define VIR_STORAGE_WIPE_WORKER_MIN_LEN (256ULL * 1024 * 1024)
+
+typedef struct _virStorageBackendWipeJob virStorageBackendWipeJob;
+struct _virStorageBackendWipeJob {
+    int fd;
+    const char *zeroes;
+    off_t start;
+    unsigned long long len;
+
+    /* failure details, reported by the caller */
+    int err;
+    off_t errOffset;
+};
+
+
+static void
+storageBackendWipeWorker(void *opaque)
+{
+    virStorageBackendWipeJob *job = opaque;
+    unsigned long long remaining = job->len;
+    off_t offset = job->start;
+
+    while (remaining > 0) {
+        size_t write_size = MIN(VIR_STORAGE_WIPE_BUFLEN, remaining);
+        ssize_t written = pwrite(job->fd, job->zeroes, write_size, offset);
+
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            job->err = errno;
+            job->errOffset = offset;
+            return;
+        }
+
+        if (written == 0) {
+            job->err = ENOSPC;
+            job->errOffset = offset;
+            return;
+        }
+
+        offset += written;
+        remaining -= written;
+    }
+}
+
+
+/*
+ * Let the kernel (and possibly the device itself) zero out the range
+ * of a block device. Unlike discard, BLKZEROOUT guarantees that
+ * subsequent reads return zeroes.
+ *
+ * Returns 0 on success, 1 if not supported, -1 on error.
+ */
+#if defined(__linux__) && defined(BLKZEROOUT)
+static int
+storageBackendWipeZeroOut(const char *path,
+                          int fd,
+                          const struct stat *st,
+                          off_t start,
+                          unsigned long long len)
+{
+    uint64_t range[2] = { start, len };
+
+    if (!S_ISBLK(st->st_mode) ||
+        start % 512 != 0 || len % 512 != 0)
+        return 1;
+
+    if (ioctl(fd, BLKZEROOUT, range) < 0) {
+        if (errno == ENOTTY || errno == EOPNOTSUPP || errno == EINVAL) {
+            VIR_DEBUG("BLKZEROOUT not supported for '%s': %s",
+                      path, g_strerror(errno));
+            return 1;
+        }
+
+        virReportSystemError(errno,
+                             _("Failed to zero out %1$llu bytes of storage volume with path '%2$s'"),
+                             len, path);
+        return -1;
+    }
+
+    VIR_DEBUG("Zeroed out %llu bytes of '%s' using BLKZEROOUT", len, path);
+    return 0;
+}
+#else /* !(__linux__ && BLKZEROOUT) */
+static int
+storageBackendWipeZeroOut(const char *path G_GNUC_UNUSED,
+                          int fd G_GNUC_UNUSED,
+                          const struct stat *st G_GNUC_UNUSED,
+                          off_t start G_GNUC_UNUSED,
+                          unsigned long long len G_GNUC_UNUSED)
+{
+    return 1;
+}
+#endif /* !(__linux__ && BLKZEROOUT) */
+
+
 static int
 storageBackendWipeLocal(const char *path,
                         int fd,
+                        const struct stat *st,
                         unsigned long long wipe_len,
-                        size_t writebuf_length,
                         bool zero_end)
 {
-    unsigned long long remaining = 0;
+    g_autofree char *zeroes = NULL;
+    g_autofree virStorageBackendWipeJob *jobs = NULL;
+    g_autofree virThread *workers = NULL;
+    size_t njobs;
+    size_t nstarted = 0;
+    unsigned long long chunk;
     off_t size;
-    g_autofree char *writebuf = NULL;
-
-    writebuf = g_new0(char, writebuf_length);
+    size_t i;
+    int rc;
 
     if (!zero_end) {
         if ((size = lseek(fd, 0, SEEK_SET)) < 0) {
@@ -2582,20 +2822,54 @@ storageBackendWipeLocal(const char *path,
 
     VIR_DEBUG("wiping start: %zd len: %llu", (ssize_t)size, wipe_len);
 
-    remaining = wipe_len;
-    while (remaining > 0) {
-        size_t write_size = MIN(writebuf_length, remaining);
-        int written = safewrite(fd, writebuf, write_size);
+    if ((rc = storageBackendWipeZeroOut(path, fd, st, size, wipe_len)) < 0)
+        return -1;
 
-        if (written < 0) {
-            virReportSystemError(errno,
-                                 _("Failed to write %1$zu bytes to storage volume with path '%2$s'"),
-                                 write_size, path);
+    if (rc == 1) {
+        /* Split the volume into a few large parts zeroed in parallel,
+         * each part being a multiple of the write size. */
+        njobs = MIN(VIR_STORAGE_WIPE_WORKERS,
+                    MAX(1, wipe_len / VIR_STORAGE_WIPE_WORKER_MIN_LEN));
+        chunk = VIR_ROUND_UP(VIR_DIV_UP(wipe_len, njobs), VIR_STORAGE_WIPE_BUFLEN);
 
-            return -1;
+        zeroes = g_new0(char, VIR_STORAGE_WIPE_BUFLEN);
+        jobs = g_new0(virStorageBackendWipeJob, njobs);
+        workers = g_new0(virThread, njobs);
+
+        for (i = 0; i < njobs; i++) {
+            unsigned long long done = chunk * i;
+
+            jobs[i].fd = fd;
+            jobs[i].zeroes = zeroes;
+            jobs[i].start = size + done;
+            jobs[i].len = done < wipe_len ? MIN(chunk, wipe_len - done) : 0;
         }
 
-        remaining -= written;
+        /* The first part is done by this thread. */
+        for (nstarted = 1; nstarted < njobs; nstarted++) {
+            if (virThreadCreateFull(&workers[nstarted], true,
+                                    storageBackendWipeWorker,
+                                    "vol-wipe", false, &jobs[nstarted]) < 0)
+                break;
+        }
+
+        storageBackendWipeWorker(&jobs[0]);
+
+        for (i = 1; i < nstarted; i++)
+            virThreadJoin(&workers[i]);
+
+        /* Finish parts of the threads we failed to start. */
+        for (i = nstarted; i < njobs; i++)
+            storageBackendWipeWorker(&jobs[i]);
+
+        for (i = 0; i < njobs; i++) {
+            if (jobs[i].err) {
+                virReportSystemError(jobs[i].err,
+                                     _("Failed to write to storage volume with path '%1$s' at offset %2$llu"),
+                                     path, (unsigned long long)jobs[i].errOffset);
+                return -1;
+            }
+        }
     }
 
     if (virFileDataSync(fd) < 0) {
@@ -2688,8 +2962,7 @@ storageBackendVolWipeLocalFile(const char *path,
     if (S_ISREG(st.st_mode) && st.st_blocks < (st.st_size / DEV_BSIZE))
         return storageBackendVolZeroSparseFileLocal(path, st.st_size, fd);
 
-    return storageBackendWipeLocal(path, fd, allocation, st.st_blksize,
-                                   zero_end);
+    return storageBackendWipeLocal(path, fd, &st, allocation, zero_end);
 }
 
 
@@ -3519,9 +3792,160 @@ virStorageBackendRefreshVolTargetUpdate(virStorageVolDef *vol)
 }
 
 
+/* Upper bound on the number of threads probing volumes of a local
+ * pool in parallel. Probing is dominated by I/O latency, especially
+ * on network filesystems, so this may exceed the number of CPUs. */
+#define VIR_STORAGE_BACKEND_REFRESH_WORKERS 16
+
+typedef struct _virStorageBackendRefreshJob virStorageBackendRefreshJob;
+struct _virStorageBackendRefreshJob {
+    virMutex lock;
+    virStorageVolDef **vols;
+    int *rcs;
+    size_t nvols;
+    size_t next;
+    virErrorPtr err;
+};
+
+
+static void
+virStorageBackendRefreshWorker(void *opaque)
+{
+    virStorageBackendRefreshJob *job = opaque;
+
+    while (true) {
+        size_t i;
+        int rc;
+
+        virMutexLock(&job->lock);
+        if (job->err || job->next == job->nvols) {
+            virMutexUnlock(&job->lock);
+            return;
+        }
+        i = job->next++;
+        virMutexUnlock(&job->lock);
+
+        rc = virStorageBackendRefreshVolTargetUpdate(job->vols[i]);
+        job->rcs[i] = rc;
+
+        if (rc == -1) {
+            virMutexLock(&job->lock);
+            if (!job->err)
+                job->err = virSaveLastError();
+            virMutexUnlock(&job->lock);
+        }
+    }
+}
+
+
+/*
+ * Probe all volumes in @vols using a bounded number of threads. The
+ * result of virStorageBackendRefreshVolTargetUpdate() for each volume
+ * is stored in @rcs. On failure the error of the first volume that
+ * failed is reported.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+virStorageBackendRefreshVolTargets(virStorageVolDef **vols,
+                                   int *rcs,
+                                   size_t nvols)
+{
+    virStorageBackendRefreshJob job = { .vols = vols, .rcs = rcs, .nvols = nvols };
+    size_t nworkers = MIN(nvols, VIR_STORAGE_BACKEND_REFRESH_WORKERS);
+    g_autofree virThread *workers = NULL;
+    size_t nstarted = 0;
+    size_t i;
+
+    if (nworkers <= 1) {
+        for (i = 0; i < nvols; i++) {
+            if ((rcs[i] = virStorageBackendRefreshVolTargetUpdate(vols[i])) == -1)
+                return -1;
+        }
+        return 0;
+    }
+
+    if (virMutexInit(&job.lock) < 0) {
+        virReportSystemError(errno, "%s", _("unable to init mutex"));
+        return -1;
+    }
+
+    workers = g_new0(virThread, nworkers);
+
+    for (nstarted = 0; nstarted < nworkers; nstarted++) {
+        if (virThreadCreateFull(&workers[nstarted], true,
+                                virStorageBackendRefreshWorker,
+                                "pool-refresh", false, &job) < 0)
+            break;
+    }
+
+    /* Whatever was not picked up by the threads (if we failed to
+     * create any) is processed here. */
+    if (nstarted < nworkers) {
+        VIR_WARN("Started only %zu out of %zu volume probing threads",
+                 nstarted, nworkers);
+        virStorageBackendRefreshWorker(&job);
+    }
+
+    for (i = 0; i < nstarted; i++)
+        virThreadJoin(&workers[i]);
+
+    virMutexDestroy(&job.lock);
+
+    if (job.err) {
+        virSetError(job.err);
+        virFreeError(job.err);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Check whether the volume definition @vol from the previous refresh
+ * still describes the file it was probed from. Volumes are re-probed
+ * only if their modification or status change time or their size
+ * differs from what was seen previously. Since the status change time
+ * is updated by renames and by writes, any replaced or modified file
+ * is caught.
+ */
+static bool
+virStorageBackendVolUnchanged(virStorageVolDef *vol)
+{
+    struct stat sb;
+
+    if (!vol->target.timestamps)
+        return false;
+
+    if (stat(vol->target.path, &sb) < 0)
+        return false;
+
+    if (!S_ISREG(sb.st_mode) ||
+        (unsigned long long)sb.st_size != vol->target.physical)
+        return false;
+
+#ifdef __APPLE__
+    return sb.st_mtimespec.tv_sec == vol->target.timestamps->mtime.tv_sec &&
+        sb.st_mtimespec.tv_nsec == vol->target.timestamps->mtime.tv_nsec &&
+        sb.st_ctimespec.tv_sec == vol->target.timestamps->ctime.tv_sec &&
+        sb.st_ctimespec.tv_nsec == vol->target.timestamps->ctime.tv_nsec;
+#else /* ! __APPLE__ */
+    return sb.st_mtim.tv_sec == vol->target.timestamps->mtime.tv_sec &&
+        sb.st_mtim.tv_nsec == vol->target.timestamps->mtime.tv_nsec &&
+        sb.st_ctim.tv_sec == vol->target.timestamps->ctime.tv_sec &&
+        sb.st_ctim.tv_nsec == vol->target.timestamps->ctime.tv_nsec;
+#endif /* ! __APPLE__ */
+}
+
+
 /**
  * Iterate over the pool's directory and enumerate all disk images
  * within it. This is non-recursive.
+ *
+ * The images are probed in parallel. If the pool's volumes were
+ * stashed by virStoragePoolObjStashVols() (incremental refresh), the
+ * volumes whose files didn't change are reused without probing.
  */
 int
 virStorageBackendRefreshLocal(virStoragePoolObj *pool)
@@ -3535,19 +3959,34 @@ virStorageBackendRefreshLocal(virStoragePoolObj *pool)
     g_autoptr(virStorageVolDef) vol = NULL;
     VIR_AUTOCLOSE fd = -1;
     g_autoptr(virStorageSource) target = NULL;
+    virStorageVolDef **probe = NULL;
+    size_t nprobe = 0;
+    g_autofree int *rcs = NULL;
+    size_t nreused = 0;
+    size_t i;
+    int ret = -1;
 
     if (virDirOpen(&dir, def->target.path) < 0)
         return -1;
 
     while ((direrr = virDirRead(dir, &ent, def->target.path)) > 0) {
-        int err;
-
         if (virStringHasControlChars(ent->d_name)) {
             VIR_WARN("Ignoring file '%s' with control characters under '%s'",
                      ent->d_name, def->target.path);
             continue;
         }
 
+        if ((vol = virStoragePoolObjTakeStashedVol(pool, ent->d_name))) {
+            if (virStorageBackendVolUnchanged(vol)) {
+                if (virStoragePoolObjAddVol(pool, vol) < 0)
+                    goto cleanup;
+                vol = NULL;
+                nreused++;
+                continue;
+            }
+            g_clear_pointer(&vol, virStorageVolDefFree);
+        }
+
         vol = g_new0(virStorageVolDef, 1);
 
         vol->name = g_strdup(ent->d_name);
@@ -3557,22 +3996,29 @@ virStorageBackendRefreshLocal(virStoragePoolObj *pool)
 
         vol->key = g_strdup(vol->target.path);
 
-        if ((err = virStorageBackendRefreshVolTargetUpdate(vol)) < 0) {
-            if (err == -2) {
-                /* Silently ignore non-regular files,
-                 * eg 'lost+found', dangling symbolic link */
-                g_clear_pointer(&vol, virStorageVolDefFree);
-                continue;
-            }
-            return -1;
-        }
-
-        if (virStoragePoolObjAddVol(pool, vol) < 0)
-            return -1;
-        vol = NULL;
+        VIR_APPEND_ELEMENT(probe, nprobe, vol);
     }
     if (direrr < 0)
-        return -1;
+        goto cleanup;
+
+    VIR_DEBUG("Probing %zu volumes of pool '%s', reused %zu",
+              nprobe, def->name, nreused);
+
+    rcs = g_new0(int, nprobe);
+
+    if (virStorageBackendRefreshVolTargets(probe, rcs, nprobe) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nprobe; i++) {
+        /* Silently ignore non-regular files,
+         * eg 'lost+found', dangling symbolic link */
+        if (rcs[i] == -2)
+            continue;
+
+        if (virStoragePoolObjAddVol(pool, probe[i]) < 0)
+            goto cleanup;
+        probe[i] = NULL;
+    }
 
     target = virStorageSourceNew();
 
@@ -3580,25 +4026,25 @@ virStorageBackendRefreshLocal(virStoragePoolObj *pool)
         virReportSystemError(errno,
                              _("cannot open path '%1$s'"),
                              def->target.path);
-        return -1;
+        goto cleanup;
     }
 
     if (fstat(fd, &statbuf) < 0) {
         virReportSystemError(errno,
                              _("cannot stat path '%1$s'"),
                              def->target.path);
-        return -1;
+        goto cleanup;
     }
 
     if (virStorageBackendUpdateVolTargetInfoFD(target, fd, &statbuf) < 0)
-        return -1;
+        goto cleanup;
 
     /* VolTargetInfoFD doesn't update capacity correctly for the pool case */
     if (statvfs(def->target.path, &sb) < 0) {
         virReportSystemError(errno,
                              _("cannot statvfs path '%1$s'"),
                              def->target.path);
-        return -1;
+        goto cleanup;
     }
 
     def->capacity = ((unsigned long long)sb.f_frsize *
@@ -3613,7 +4059,13 @@ virStorageBackendRefreshLocal(virStoragePoolObj *pool)
     VIR_FREE(def->target.perms.label);
     def->target.perms.label = g_strdup(target->perms->label);
 
-    return 0;
+    ret = 0;
+
+ cleanup:
+    for (i = 0; i < nprobe; i++)
+        virStorageVolDefFree(probe[i]);
+    g_free(probe);
+    return ret;
 }
 
 
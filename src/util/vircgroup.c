@@ -513,6 +513,161 @@ virCgroupSetValueDBus(const char *unitName,
 }
 
 
+/* Files which are read every time statistics of a domain are collected.
+ * Their file descriptors are kept open for the lifetime of the virCgroup
+ * so that each sample costs a single pread() rather than a path lookup,
+ * open, read and close. */
+static const char *virCgroupStatFileKeys[] = {
+    "cpu.stat",
+    "cpuacct.stat",
+    "cpuacct.usage",
+    "cpuacct.usage_percpu",
+    "memory.stat",
+    "io.stat",
+    "blkio.throttle.io_service_bytes",
+    "blkio.throttle.io_serviced",
+};
+
+
+static virCgroup *
+virCgroupAlloc(void)
+{
+    virCgroup *group = g_new0(virCgroup, 1);
+
+    if (virMutexInit(&group->statLock) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("unable to init cgroup mutex"));
+        g_free(group);
+        return NULL;
+    }
+
+    return group;
+}
+
+
+static void
+virCgroupStatFilesClear(virCgroup *group)
+{
+    size_t i;
+
+    for (i = 0; i < group->nstatFiles; i++)
+        VIR_FORCE_CLOSE(group->statFiles[i].fd);
+
+    g_clear_pointer(&group->statFiles, g_free);
+    group->nstatFiles = 0;
+}
+
+
+static int
+virCgroupStatFileRead(virCgroupStatFile *file,
+                      char **value)
+{
+    size_t len = file->buflen ? file->buflen : 4096;
+
+    while (true) {
+        g_autofree char *buf = g_new(char, len);
+        ssize_t got;
+
+        /* Reading a cgroup file from offset 0 makes the kernel generate
+         * the contents afresh, there is no need to reopen it. */
+        if ((got = pread(file->fd, buf, len, 0)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        if ((size_t) got < len) {
+            /* Terminated with '\n' has sometimes harmful effects to the caller */
+            if (got > 0 && buf[got - 1] == '\n')
+                got--;
+            buf[got] = '\0';
+
+            file->buflen = len;
+            *value = g_steal_pointer(&buf);
+            return 0;
+        }
+
+        if (len >= 1024 * 1024) {
+            errno = EFBIG;
+            return -1;
+        }
+        len *= 2;
+    }
+}
+
+
+static const char *
+virCgroupStatFileKey(const char *key)
+{
+    size_t i;
+
+    for (i = 0; i < G_N_ELEMENTS(virCgroupStatFileKeys); i++) {
+        if (STREQ(key, virCgroupStatFileKeys[i]))
+            return virCgroupStatFileKeys[i];
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Read @statKey, which must come from virCgroupStatFileKeys, through the
+ * file descriptor cached in @group, opening it on first use.
+ */
+static int
+virCgroupGetValueCached(virCgroup *group,
+                        int controller,
+                        const char *statKey,
+                        char **value)
+{
+    VIR_LOCK_GUARD lock = virLockGuardLock(&group->statLock);
+    g_autofree char *keypath = NULL;
+    virCgroupStatFile *file = NULL;
+    size_t i;
+
+    for (i = 0; i < group->nstatFiles; i++) {
+        if (group->statFiles[i].controller == controller &&
+            group->statFiles[i].key == statKey) {
+            file = &group->statFiles[i];
+            break;
+        }
+    }
+
+    if (file) {
+        if (virCgroupStatFileRead(file, value) == 0)
+            return 0;
+
+        /* The cgroup might have been removed and created again since the
+         * file was opened, retry with a fresh file descriptor. */
+        VIR_FORCE_CLOSE(file->fd);
+    } else {
+        virCgroupStatFile newFile = {
+            .controller = controller,
+            .key = statKey,
+            .fd = -1,
+        };
+
+        VIR_APPEND_ELEMENT(group->statFiles, group->nstatFiles, newFile);
+        file = &group->statFiles[group->nstatFiles - 1];
+    }
+
+    if (virCgroupPathOfController(group, controller, statKey, &keypath) < 0)
+        return -1;
+
+    VIR_DEBUG("Get value %s", keypath);
+
+    if ((file->fd = open(keypath, O_RDONLY | O_CLOEXEC)) < 0 ||
+        virCgroupStatFileRead(file, value) < 0) {
+        virReportSystemError(errno,
+                             _("Unable to read from '%1$s'"), keypath);
+        VIR_FORCE_CLOSE(file->fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+
 int
 virCgroupSetValueRaw(const char *path,
                      const char *value)
@@ -583,6 +738,10 @@ virCgroupGetValueStr(virCgroup *group,
                      char **value)
 {
     g_autofree char *keypath = NULL;
+    const char *statKey;
+
+    if ((statKey = virCgroupStatFileKey(key)))
+        return virCgroupGetValueCached(group, controller, statKey, value);
 
     if (virCgroupPathOfController(group, controller, key, &keypath) < 0)
         return -1;
@@ -591,6 +750,63 @@ virCgroupGetValueStr(virCgroup *group,
 }
 
 
+/**
+ * virCgroupParseFlatKeyed:
+ * @str: contents of a flat keyed file such as memory.stat
+ * @file: name of the file, used for error messages
+ * @keys: NULL terminated list of keys to look up
+ * @values: one value for each of @keys
+ *
+ * Parses "key value" lines in place. The value of every key from @keys
+ * found in @str is stored into the corresponding element of @values,
+ * values of keys which are not present are left untouched.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virCgroupParseFlatKeyed(const char *str,
+                        const char *file,
+                        const char *const *keys,
+                        unsigned long long *values)
+{
+    const char *line = str;
+
+    while (line && *line) {
+        const char *eol = strchr(line, '\n');
+        const char *sep = strchr(line, ' ');
+        char *end = NULL;
+        size_t keylen;
+        size_t i;
+
+        if (!sep || (eol && sep > eol)) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Cannot parse '%1$s' cgroup file."), file);
+            return -1;
+        }
+        keylen = sep - line;
+
+        for (i = 0; keys[i]; i++) {
+            if (strlen(keys[i]) != keylen ||
+                memcmp(line, keys[i], keylen) != 0)
+                continue;
+
+            if (virStrToLong_ull(sep + 1, &end, 10, &values[i]) < 0 ||
+                (*end != '\n' && *end != '\0')) {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("Unable to parse '%1$s' value in '%2$s' cgroup file"),
+                               keys[i], file);
+                return -1;
+            }
+            break;
+        }
+
+        line = eol ? eol + 1 : NULL;
+    }
+
+    return 0;
+}
+
+
 int
 virCgroupGetValueForBlkDev(const char *str,
                            const char *path,
@@ -744,7 +960,8 @@ virCgroupNew(const char *path,
               path, controllers, group);
 
     *group = NULL;
-    newGroup = g_new0(virCgroup, 1);
+    if (!(newGroup = virCgroupAlloc()))
+        return -1;
 
     if (virCgroupSetBackends(newGroup) < 0)
         return -1;
@@ -890,11 +1107,14 @@ virCgroupNewFromParent(virCgroup *parent,
                        int controllers,
                        virCgroup **group)
 {
-    g_autoptr(virCgroup) new = g_new0(virCgroup, 1);
+    g_autoptr(virCgroup) new = NULL;
 
     VIR_DEBUG("parent=%p path=%s controllers=%d group=%p",
               parent, path, controllers, group);
 
+    if (!(new = virCgroupAlloc()))
+        return -1;
+
     if (virCgroupSetBackends(new) < 0)
         return -1;
 
@@ -1151,11 +1371,14 @@ virCgroupNewDetect(pid_t pid,
                    int controllers,
                    virCgroup **group)
 {
-    g_autoptr(virCgroup) new = g_new0(virCgroup, 1);
+    g_autoptr(virCgroup) new = NULL;
 
     VIR_DEBUG("pid=%lld controllers=%d group=%p",
               (long long) pid, controllers, group);
 
+    if (!(new = virCgroupAlloc()))
+        return -1;
+
     if (virCgroupSetBackends(new) < 0)
         return -1;
 
@@ -2631,6 +2854,10 @@ virCgroupRemove(virCgroup *group)
 {
     size_t i;
 
+    VIR_WITH_MUTEX_LOCK_GUARD(&group->statLock) {
+        virCgroupStatFilesClear(group);
+    }
+
     for (i = 0; i < VIR_CGROUP_BACKEND_TYPE_LAST; i++) {
         if (group->backends[i]) {
             int rc = group->backends[i]->remove(group);
@@ -3830,6 +4057,11 @@ virCgroupFree(virCgroup *group)
     g_free(group->unified.placement);
     g_free(group->unitName);
 
+    for (i = 0; i < group->nstatFiles; i++)
+        VIR_FORCE_CLOSE(group->statFiles[i].fd);
+    g_free(group->statFiles);
+    virMutexDestroy(&group->statLock);
+
     virCgroupFree(group->nested);
 
     g_free(group);
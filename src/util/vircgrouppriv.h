@@ -27,6 +27,7 @@
 
 #include "vircgroup.h"
 #include "vircgroupbackend.h"
+#include "virthread.h"
 
 struct _virCgroupV1Controller {
     int type;
@@ -56,6 +57,15 @@ struct _virCgroupV2Controller {
 };
 typedef struct _virCgroupV2Controller virCgroupV2Controller;
 
+/* Open file descriptor of a frequently polled statistics file */
+struct _virCgroupStatFile {
+    int controller;
+    const char *key;
+    int fd;
+    size_t buflen; /* size of the buffer which fit the last read */
+};
+typedef struct _virCgroupStatFile virCgroupStatFile;
+
 struct _virCgroup {
     virCgroupBackend *backends[VIR_CGROUP_BACKEND_TYPE_LAST];
 
@@ -64,6 +74,10 @@ struct _virCgroup {
 
     char *unitName;
     virCgroup *nested;
+
+    virMutex statLock; /* protects @statFiles */
+    virCgroupStatFile *statFiles;
+    size_t nstatFiles;
 };
 
 #define virCgroupGetNested(cgroup) \
@@ -109,6 +123,11 @@ int virCgroupGetValueI64(virCgroup *group,
                          const char *key,
                          long long int *value);
 
+int virCgroupParseFlatKeyed(const char *str,
+                            const char *file,
+                            const char *const *keys,
+                            unsigned long long *values);
+
 int virCgroupPartitionEscape(char **path);
 
 char *virCgroupGetBlockDevString(const char *path);
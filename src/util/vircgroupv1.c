@@ -1565,13 +1565,11 @@ virCgroupV1GetMemoryStat(virCgroup *group,
                          unsigned long long *unevictable)
 {
     g_autofree char *stat = NULL;
-    char *line = NULL;
-    unsigned long long cacheVal = 0;
-    unsigned long long activeAnonVal = 0;
-    unsigned long long inactiveAnonVal = 0;
-    unsigned long long activeFileVal = 0;
-    unsigned long long inactiveFileVal = 0;
-    unsigned long long unevictableVal = 0;
+    const char *const keys[] = {
+        "cache", "active_anon", "inactive_anon",
+        "active_file", "inactive_file", "unevictable", NULL
+    };
+    unsigned long long values[G_N_ELEMENTS(keys) - 1] = { 0 };
 
     if (virCgroupGetValueStr(group,
                              VIR_CGROUP_CONTROLLER_MEMORY,
@@ -1580,51 +1578,15 @@ virCgroupV1GetMemoryStat(virCgroup *group,
         return -1;
     }
 
-    line = stat;
-
-    while (*line) {
-        char *newLine = strchr(line, '\n');
-        char *valueStr = strchr(line, ' ');
-        unsigned long long value;
-
-        if (newLine)
-            *newLine = '\0';
-
-        if (!valueStr) {
-            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                           _("Cannot parse 'memory.stat' cgroup file."));
-            return -1;
-        }
-        *valueStr = '\0';
-
-        if (virStrToLong_ull(valueStr + 1, NULL, 10, &value) < 0)
-            return -1;
-
-        if (STREQ(line, "cache"))
-            cacheVal = value >> 10;
-        else if (STREQ(line, "active_anon"))
-            activeAnonVal = value >> 10;
-        else if (STREQ(line, "inactive_anon"))
-            inactiveAnonVal = value >> 10;
-        else if (STREQ(line, "active_file"))
-            activeFileVal = value >> 10;
-        else if (STREQ(line, "inactive_file"))
-            inactiveFileVal = value >> 10;
-        else if (STREQ(line, "unevictable"))
-            unevictableVal = value >> 10;
-
-        if (newLine)
-            line = newLine + 1;
-        else
-            break;
-    }
+    if (virCgroupParseFlatKeyed(stat, "memory.stat", keys, values) < 0)
+        return -1;
 
-    *cache = cacheVal;
-    *activeAnon = activeAnonVal;
-    *inactiveAnon = inactiveAnonVal;
-    *activeFile = activeFileVal;
-    *inactiveFile = inactiveFileVal;
-    *unevictable = unevictableVal;
+    *cache = values[0] >> 10;
+    *activeAnon = values[1] >> 10;
+    *inactiveAnon = values[2] >> 10;
+    *activeFile = values[3] >> 10;
+    *inactiveFile = values[4] >> 10;
+    *unevictable = values[5] >> 10;
 
     return 0;
 }
@@ -46,6 +46,16 @@
 VIR_LOG_INIT("fdstream");
 
 #ifndef WIN32
+/* Size of the data chunks the I/O helper thread reads from or writes
+ * to the file. Large chunks keep the number of syscalls and messages
+ * per transferred byte low. */
+# define VIR_FDSTREAM_BUFLEN (1024 * 1024)
+
+/* How many messages the reading I/O helper thread is allowed to queue
+ * ahead of the stream consumer. This lets reading from disk overlap
+ * with sending the data to the client. */
+# define VIR_FDSTREAM_QUEUE_MAX 8
+
 typedef enum {
     VIR_FDSTREAM_MSG_TYPE_DATA,
     VIR_FDSTREAM_MSG_TYPE_HOLE,
@@ -106,6 +116,7 @@ struct virFDStreamData {
     bool threadAbort;
     bool threadDoRead;
     virFDStreamMsg *msg;
+    size_t nmsgs;
 };
 
 static virClass *virFDStreamDataClass;
@@ -148,7 +159,8 @@ virFDStreamMsgQueuePush(virFDStreamData *fdst,
         tmp = &(*tmp)->next;
 
     *tmp = g_steal_pointer(msg);
-    virCondSignal(&fdst->threadCond);
+    fdst->nmsgs++;
+    virCondBroadcast(&fdst->threadCond);
 
     if (safewrite(fd, &c, sizeof(c)) != sizeof(c)) {
         virReportSystemError(errno,
@@ -171,9 +183,10 @@ virFDStreamMsgQueuePop(virFDStreamData *fdst,
 
     if (tmp) {
         fdst->msg = g_steal_pointer(&tmp->next);
+        fdst->nmsgs--;
     }
 
-    virCondSignal(&fdst->threadCond);
+    virCondBroadcast(&fdst->threadCond);
 
     if (saferead(fd, &c, sizeof(c)) != sizeof(c)) {
         virReportSystemError(errno,
@@ -445,7 +458,13 @@ virFDStreamThreadDoRead(virFDStreamData *fdst,
             inData = 1;
             sectionLen = 1 * 1024 * 1024;
         } else {
-            if (virFileInData(fdin, &inData, &sectionLen) < 0)
+            int rc;
+
+            virObjectUnlock(fdst);
+            rc = virFileInData(fdin, &inData, &sectionLen);
+            virObjectLock(fdst);
+
+            if (rc < 0)
                 return -1;
         }
 
@@ -482,9 +501,17 @@ virFDStreamThreadDoRead(virFDStreamData *fdst,
             buflen > *dataLen)
             buflen = *dataLen;
 
-        buf = g_new0(char, buflen);
+        /* Every byte handed over is read from @fdin, no need to
+         * clear the buffer. */
+        buf = g_new(char, buflen);
 
-        if ((got = saferead(fdin, buf, buflen)) < 0) {
+        /* Only this thread touches @fdin so there's no need to keep
+         * the stream locked while waiting for the disk. */
+        virObjectUnlock(fdst);
+        got = saferead(fdin, buf, buflen);
+        virObjectLock(fdst);
+
+        if (got < 0) {
             virReportSystemError(errno,
                                  _("Unable to read %1$s"),
                                  fdinname);
@@ -519,9 +546,14 @@ virFDStreamThreadDoWrite(virFDStreamData *fdst,
 
     switch (msg->type) {
     case VIR_FDSTREAM_MSG_TYPE_DATA:
+        /* The queue head is consumed only by this thread, others just
+         * append new messages, so it's safe to unlock the stream while
+         * waiting for the disk. */
+        virObjectUnlock(fdst);
         got = safewrite(fdout,
                         msg->stream.data.buf + msg->stream.data.offset,
                         msg->stream.data.len - msg->stream.data.offset);
+        virObjectLock(fdst);
         if (got < 0) {
             virReportSystemError(errno,
                                  _("Unable to write %1$s"),
@@ -599,6 +631,19 @@ virFDStreamThreadDoWrite(virFDStreamData *fdst,
 }
 
 
+/* The reading thread may run ahead of the consumer by up to
+ * VIR_FDSTREAM_QUEUE_MAX messages, the writing one waits for data. */
+static bool
+virFDStreamThreadMustWait(virFDStreamData *fdst,
+                          bool doRead)
+{
+    if (doRead)
+        return fdst->nmsgs >= VIR_FDSTREAM_QUEUE_MAX;
+
+    return !fdst->msg;
+}
+
+
 static void
 virFDStreamThread(void *opaque)
 {
@@ -613,7 +658,7 @@ virFDStreamThread(void *opaque)
     char *fdoutname = data->fdoutname;
     virFDStreamData *fdst = st->privateData;
     bool doRead = fdst->threadDoRead;
-    size_t buflen = 256 * 1024;
+    size_t buflen = VIR_FDSTREAM_BUFLEN;
     size_t total = 0;
     size_t dataLen = 0;
 
@@ -623,7 +668,7 @@ virFDStreamThread(void *opaque)
     while (1) {
         ssize_t got;
 
-        while (doRead == (fdst->msg != NULL) &&
+        while (virFDStreamThreadMustWait(fdst, doRead) &&
                !fdst->threadQuit) {
             if (virCondWait(&fdst->threadCond, &fdst->parent.lock)) {
                 virReportSystemError(errno, "%s",
@@ -664,6 +709,8 @@ virFDStreamThread(void *opaque)
 
  cleanup:
     fdst->threadQuit = true;
+    /* wake up anybody waiting for a message that won't come */
+    virCondBroadcast(&fdst->threadCond);
     virObjectUnlock(fdst);
     virFDStreamDataDisposed = false;
     virObjectUnref(fdst);
@@ -688,7 +735,7 @@ virFDStreamJoinWorker(virFDStreamData *fdst,
 
     fdst->threadAbort = streamAbort;
     fdst->threadQuit = true;
-    virCondSignal(&fdst->threadCond);
+    virCondBroadcast(&fdst->threadCond);
 
     /* Give the thread a chance to lock the FD stream object. */
     virObjectUnlock(fdst);
@@ -824,8 +871,6 @@ static int virFDStreamWrite(virStreamPtr st, const char *bytes, size_t nbytes)
     }
 
     if (fdst->thread) {
-        char *buf;
-
         if (fdst->threadQuit || fdst->threadErr) {
 
             /* virStreamSend will virResetLastError possibly set
@@ -838,11 +883,8 @@ static int virFDStreamWrite(virStreamPtr st, const char *bytes, size_t nbytes)
         }
 
         msg = g_new0(virFDStreamMsg, 1);
-        buf = g_new0(char, nbytes);
-
-        memcpy(buf, bytes, nbytes);
         msg->type = VIR_FDSTREAM_MSG_TYPE_DATA;
-        msg->stream.data.buf = buf;
+        msg->stream.data.buf = g_memdup(bytes, nbytes);
         msg->stream.data.len = nbytes;
 
         virFDStreamMsgQueuePush(fdst, &msg, fdst->fd, "pipe");
@@ -874,6 +916,23 @@ static int virFDStreamWrite(virStreamPtr st, const char *bytes, size_t nbytes)
 }
 
 
+/* The I/O helper thread does its reads without holding the stream
+ * lock, so wait for it to queue a message instead of spinning. */
+static int
+virFDStreamWaitMsg(virFDStreamData *fdst)
+{
+    virCondBroadcast(&fdst->threadCond);
+
+    if (virCondWait(&fdst->threadCond, &fdst->parent.lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("failed to wait on condition"));
+        return -1;
+    }
+
+    return 0;
+}
+
+
 static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
 {
     virFDStreamData *fdst = st->privateData;
@@ -920,10 +979,8 @@ static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
                     ret = 0;
                 }
                 goto cleanup;
-            } else {
-                virObjectUnlock(fdst);
-                virCondSignal(&fdst->threadCond);
-                virObjectLock(fdst);
+            } else if (virFDStreamWaitMsg(fdst) < 0) {
+                goto cleanup;
             }
         }
 
@@ -1083,10 +1140,8 @@ virFDStreamInData(virStreamPtr st,
                 *inData = *length = 0;
                 ret = 0;
                 goto cleanup;
-            } else {
-                virObjectUnlock(fdst);
-                virCondSignal(&fdst->threadCond);
-                virObjectLock(fdst);
+            } else if (virFDStreamWaitMsg(fdst) < 0) {
+                goto cleanup;
             }
         }
 
@@ -56,6 +56,9 @@
 #if WITH_SYS_SYSCALL_H
 # include <sys/syscall.h>
 #endif
+#ifdef WITH_ELF_H
+# include <elf.h>
+#endif
 #if WITH_LIBACL
 # include <sys/acl.h>
 #endif
@@ -1662,6 +1665,177 @@ virFileReadBufQuiet(const char *file, char *buf, int len)
     return sz;
 }
 
+#ifdef WITH_ELF_H
+/* Upper bound on the size of a PT_NOTE segment we are willing
+ * to read while looking for the build ID note. */
+# define VIR_FILE_BUILD_ID_NOTE_MAX (64 * 1024)
+
+static int
+virFileFindBuildIDNote(const char *notes,
+                       size_t len,
+                       char **buildid)
+{
+    size_t off = 0;
+
+    while (off + sizeof(Elf32_Nhdr) <= len) {
+        Elf32_Nhdr nhdr;
+        size_t namesz;
+        size_t descsz;
+        const char *name;
+        const unsigned char *desc;
+        size_t i;
+
+        memcpy(&nhdr, notes + off, sizeof(nhdr));
+        off += sizeof(nhdr);
+
+        namesz = VIR_ROUND_UP(nhdr.n_namesz, 4);
+        descsz = VIR_ROUND_UP(nhdr.n_descsz, 4);
+
+        if (namesz > len - off ||
+            descsz > len - off - namesz)
+            return 0;
+
+        name = notes + off;
+        desc = (const unsigned char *) notes + off + namesz;
+        off += namesz + descsz;
+
+        if (nhdr.n_type != NT_GNU_BUILD_ID ||
+            nhdr.n_namesz != sizeof(ELF_NOTE_GNU) ||
+            memcmp(name, ELF_NOTE_GNU, sizeof(ELF_NOTE_GNU)) != 0 ||
+            nhdr.n_descsz == 0)
+            continue;
+
+        *buildid = g_new0(char, nhdr.n_descsz * 2 + 1);
+        for (i = 0; i < nhdr.n_descsz; i++)
+            g_snprintf(*buildid + i * 2, 3, "%02x", desc[i]);
+
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * virFileGetBuildID:
+ * @path: path to an ELF binary
+ * @buildid: filled with the hex encoded build ID
+ *
+ * Looks up the GNU build ID note of the ELF binary @path.  The
+ * build ID is derived from the contents of the binary by the
+ * linker, so unlike timestamps it is identical for every copy of
+ * the same build, regardless of when or where it was installed.
+ * Only binaries matching the host's byte order are inspected.
+ *
+ * Returns 1 if a build ID was found, 0 if @path is not an ELF
+ * binary or has no build ID, -1 on error with error reported.
+ */
+int
+virFileGetBuildID(const char *path,
+                  char **buildid)
+{
+    VIR_AUTOCLOSE fd = -1;
+    unsigned char ident[EI_NIDENT];
+    off_t phoff;
+    size_t phnum;
+    size_t phentsize;
+    size_t i;
+
+    *buildid = NULL;
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        virReportSystemError(errno, _("Failed to open file '%1$s'"), path);
+        return -1;
+    }
+
+    if (pread(fd, ident, sizeof(ident), 0) != sizeof(ident) ||
+        memcmp(ident, ELFMAG, SELFMAG) != 0)
+        return 0;
+
+# if G_BYTE_ORDER == G_LITTLE_ENDIAN
+    if (ident[EI_DATA] != ELFDATA2LSB)
+        return 0;
+# else
+    if (ident[EI_DATA] != ELFDATA2MSB)
+        return 0;
+# endif
+
+    if (ident[EI_CLASS] == ELFCLASS64) {
+        Elf64_Ehdr ehdr;
+
+        if (pread(fd, &ehdr, sizeof(ehdr), 0) != sizeof(ehdr))
+            return 0;
+        phoff = ehdr.e_phoff;
+        phnum = ehdr.e_phnum;
+        phentsize = ehdr.e_phentsize;
+        if (phentsize < sizeof(Elf64_Phdr))
+            return 0;
+    } else if (ident[EI_CLASS] == ELFCLASS32) {
+        Elf32_Ehdr ehdr;
+
+        if (pread(fd, &ehdr, sizeof(ehdr), 0) != sizeof(ehdr))
+            return 0;
+        phoff = ehdr.e_phoff;
+        phnum = ehdr.e_phnum;
+        phentsize = ehdr.e_phentsize;
+        if (phentsize < sizeof(Elf32_Phdr))
+            return 0;
+    } else {
+        return 0;
+    }
+
+    for (i = 0; i < phnum; i++) {
+        off_t noteoff;
+        size_t notelen;
+        g_autofree char *notes = NULL;
+        ssize_t got;
+
+        if (ident[EI_CLASS] == ELFCLASS64) {
+            Elf64_Phdr phdr;
+
+            if (pread(fd, &phdr, sizeof(phdr),
+                      phoff + i * phentsize) != sizeof(phdr))
+                return 0;
+            if (phdr.p_type != PT_NOTE)
+                continue;
+            noteoff = phdr.p_offset;
+            notelen = phdr.p_filesz;
+        } else {
+            Elf32_Phdr phdr;
+
+            if (pread(fd, &phdr, sizeof(phdr),
+                      phoff + i * phentsize) != sizeof(phdr))
+                return 0;
+            if (phdr.p_type != PT_NOTE)
+                continue;
+            noteoff = phdr.p_offset;
+            notelen = phdr.p_filesz;
+        }
+
+        notelen = MIN(notelen, VIR_FILE_BUILD_ID_NOTE_MAX);
+        notes = g_new0(char, notelen);
+
+        if ((got = pread(fd, notes, notelen, noteoff)) < 0) {
+            virReportSystemError(errno, _("Failed to read file '%1$s'"), path);
+            return -1;
+        }
+
+        if (virFileFindBuildIDNote(notes, got, buildid) > 0)
+            return 1;
+    }
+
+    return 0;
+}
+#else /* !WITH_ELF_H */
+int
+virFileGetBuildID(const char *path G_GNUC_UNUSED,
+                  char **buildid)
+{
+    *buildid = NULL;
+    return 0;
+}
+#endif /* !WITH_ELF_H */
+
 /* Truncate @path and write @str to it.  If @mode is 0, ensure that
    @path exists; otherwise, use @mode if @path must be created.
    Return 0 for success, nonzero for failure.
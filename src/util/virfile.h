@@ -173,6 +173,9 @@ int virFileReadAllQuiet(const char *path, int maxlen, char **buf)
 int virFileReadBufQuiet(const char *file, char *buf, int len)
     G_GNUC_WARN_UNUSED_RESULT ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
 
+int virFileGetBuildID(const char *path, char **buildid)
+    G_GNUC_WARN_UNUSED_RESULT ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
 int virFileWriteStr(const char *path, const char *str, mode_t mode)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) G_GNUC_WARN_UNUSED_RESULT;
 
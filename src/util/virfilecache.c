@@ -48,6 +48,7 @@ struct _virFileCache {
     GHashTable *table;
 
     char *dir;
+    char *sysdir;
     char *suffix;
 
     void *priv;
@@ -73,6 +74,7 @@ virFileCacheDispose(void *obj)
     virFileCache *cache = obj;
 
     g_free(cache->dir);
+    g_free(cache->sysdir);
     g_free(cache->suffix);
 
     g_clear_pointer(&cache->table, g_hash_table_unref);
@@ -95,8 +97,9 @@ VIR_ONCE_GLOBAL_INIT(virFileCache);
 
 
 static char *
-virFileCacheGetFileName(virFileCache *cache,
-                        const char *name)
+virFileCacheGetFileNameInDir(virFileCache *cache,
+                             const char *dir,
+                             const char *name)
 {
     g_autofree char *namehash = NULL;
     g_auto(virBuffer) buf = VIR_BUFFER_INITIALIZER;
@@ -104,6 +107,19 @@ virFileCacheGetFileName(virFileCache *cache,
     if (virCryptoHashString(VIR_CRYPTO_HASH_SHA256, name, &namehash) < 0)
         return NULL;
 
+    virBufferAsprintf(&buf, "%s/%s", dir, namehash);
+
+    if (cache->suffix)
+        virBufferAsprintf(&buf, ".%s", cache->suffix);
+
+    return virBufferContentAndReset(&buf);
+}
+
+
+static char *
+virFileCacheGetFileName(virFileCache *cache,
+                        const char *name)
+{
     if (g_mkdir_with_parents(cache->dir, 0777) < 0) {
         virReportSystemError(errno,
                              _("Unable to create directory '%1$s'"),
@@ -111,12 +127,58 @@ virFileCacheGetFileName(virFileCache *cache,
         return NULL;
     }
 
-    virBufferAsprintf(&buf, "%s/%s", cache->dir, namehash);
+    return virFileCacheGetFileNameInDir(cache, cache->dir, name);
+}
+
 
-    if (cache->suffix)
-        virBufferAsprintf(&buf, ".%s", cache->suffix);
+/*
+ * Try to load @name from the read-only system cache directory.  The
+ * directory is never written to, so stale or unusable entries are
+ * simply ignored and the regular cache directory is consulted next.
+ *
+ * Returns 1 if valid data was loaded, 0 if there is no usable data.
+ */
+static int
+virFileCacheLoadSystem(virFileCache *cache,
+                       const char *name,
+                       void **data)
+{
+    g_autofree char *file = NULL;
+    void *loadData = NULL;
+    bool outdated = false;
 
-    return virBufferContentAndReset(&buf);
+    *data = NULL;
+
+    if (!cache->sysdir)
+        return 0;
+
+    if (!(file = virFileCacheGetFileNameInDir(cache, cache->sysdir, name))) {
+        virResetLastError();
+        return 0;
+    }
+
+    if (!virFileExists(file))
+        return 0;
+
+    if (!(loadData = cache->handlers.loadFile(file, name, cache->priv, &outdated))) {
+        if (!outdated) {
+            VIR_WARN("Failed to load system cached data from '%s' for '%s': %s",
+                     file, name, virGetLastErrorMessage());
+            virResetLastError();
+        }
+        return 0;
+    }
+
+    if (!cache->handlers.isValid(loadData, cache->priv)) {
+        VIR_DEBUG("Unusable system cached data '%s' for '%s'", file, name);
+        g_object_unref(loadData);
+        return 0;
+    }
+
+    VIR_DEBUG("Loaded system cached data '%s' for '%s'", file, name);
+
+    *data = loadData;
+    return 1;
 }
 
 
@@ -132,6 +194,9 @@ virFileCacheLoad(virFileCache *cache,
 
     *data = NULL;
 
+    if (virFileCacheLoadSystem(cache, name, data) > 0)
+        return 1;
+
     if (!(file = virFileCacheGetFileName(cache, name)))
         return ret;
 
@@ -383,6 +448,31 @@ virFileCacheSetPriv(virFileCache *cache,
 }
 
 
+/**
+ * virFileCacheSetSystemDir:
+ * @cache: existing cache object
+ * @dir: read-only directory with pre-seeded cache files or NULL
+ *
+ * Sets a directory with cache files generated ahead of time, for
+ * example while building a package.  It uses the same file naming
+ * as the cache directory and is consulted first when looking up
+ * data that is not in memory yet.  Data loaded from @dir is never
+ * written back and files in @dir are never removed, entries which
+ * are not valid on this host are ignored.
+ */
+void
+virFileCacheSetSystemDir(virFileCache *cache,
+                         const char *dir)
+{
+    virObjectLock(cache);
+
+    g_free(cache->sysdir);
+    cache->sysdir = g_strdup(dir);
+
+    virObjectUnlock(cache);
+}
+
+
 /**
  * virFileCacheInsertData:
  * @cache: existing cache object
@@ -131,6 +131,10 @@ void
 virFileCacheSetPriv(virFileCache *cache,
                     void *priv);
 
+void
+virFileCacheSetSystemDir(virFileCache *cache,
+                         const char *dir);
+
 int
 virFileCacheInsertData(virFileCache *cache,
                        const char *name,
@@ -661,6 +661,115 @@ virFirewallCmdIptablesApply(virFirewall *firewall,
 #define VIR_NFTABLES_ARG_IS_CREATE(arg) \
     (STREQ(arg, "insert") || STREQ(arg, "add") || STREQ(arg, "create"))
 
+/*
+ * Decides whether a rollback command has to be created for @fwCmd once
+ * it succeeds. If so, @cmdIdx is set to the index of the command verb
+ * and @objectType to the type of the created object.
+ */
+static bool
+virFirewallCmdNftablesNeedRollback(virFirewall *firewall,
+                                   virFirewallCmd *fwCmd,
+                                   size_t *cmdIdx,
+                                   const char **objectType)
+{
+    size_t i;
+
+    if (fwCmd->layer == VIR_FIREWALL_LAYER_TC ||
+        !(virFirewallTransactionGetFlags(firewall) & VIR_FIREWALL_TRANSACTION_AUTO_ROLLBACK) ||
+        fwCmd->argsLen <= 1)
+        return false;
+
+    /* skip any leading options to get to command verb */
+    for (i = 0; i < fwCmd->argsLen - 1; i++) {
+        if (fwCmd->args[i][0] != '-')
+            break;
+    }
+
+    if (i + 1 >= fwCmd->argsLen ||
+        !VIR_NFTABLES_ARG_IS_CREATE(fwCmd->args[i]))
+        return false;
+
+    /* we currently only handle auto-rollback for rules,
+     * chains, and tables, and those all can be "rolled
+     * back" by a delete command using the handle that is
+     * returned when "-ae" is added to the add/insert
+     * command.
+     */
+    if (STRNEQ(fwCmd->args[i + 1], "rule") &&
+        STRNEQ(fwCmd->args[i + 1], "chain") &&
+        STRNEQ(fwCmd->args[i + 1], "table"))
+        return false;
+
+    *cmdIdx = i;
+    *objectType = fwCmd->args[i + 1];
+    return true;
+}
+
+
+/*
+ * Parses the handle from "# handle n" in @str, which is a line of nft
+ * output produced with "-ae".
+ */
+static char *
+virFirewallNftablesParseHandle(const char *str)
+{
+    const char *handleStart;
+    size_t handleLen;
+
+    if (!str || !(handleStart = strstr(str, "# handle ")))
+        return NULL;
+
+    handleStart += 9; /* move past "# handle " */
+    if (!(handleLen = strspn(handleStart, "0123456789")))
+        return NULL;
+
+    return g_strdup_printf("%.*s", (int)handleLen, handleStart);
+}
+
+
+static void
+virFirewallCmdNftablesAddRollback(virFirewall *firewall,
+                                  virFirewallCmd *fwCmd,
+                                  size_t cmdIdx,
+                                  const char *objectType,
+                                  const char *handleStr)
+{
+    virFirewallCmd *rollback = virFirewallAddRollbackCmd(firewall, fwCmd->layer, NULL);
+    g_autofree char *rollbackStr = NULL;
+
+    /* The rollback command is created from the original command like this:
+     *
+     * 1) skip any leading options
+     * 2) replace add/insert with delete
+     * 3) keep the type of item being added (rule/chain/table)
+     * 4) keep the class (ip/ip6/inet)
+     * 5) for chain/rule, keep the table name
+     * 6) for rule, keep the chain name
+     * 7) add "handle n" where "n" is parsed from the
+     *    stdout of the original nft command
+     */
+    virFirewallCmdAddArgList(firewall, rollback, "delete", objectType,
+                             fwCmd->args[cmdIdx + 2], /* ip/ip6/inet */
+                             NULL);
+
+    if (STREQ_NULLABLE(objectType, "rule") ||
+        STREQ_NULLABLE(objectType, "chain")) {
+        /* include table name in command */
+        virFirewallCmdAddArg(firewall, rollback, fwCmd->args[cmdIdx + 3]);
+    }
+
+    if (STREQ_NULLABLE(objectType, "rule")) {
+        /* include chain name in command */
+        virFirewallCmdAddArg(firewall, rollback, fwCmd->args[cmdIdx + 4]);
+    }
+
+    virFirewallCmdAddArgList(firewall, rollback, "handle", handleStr, NULL);
+
+    rollbackStr = virFirewallCmdToString(NFT, rollback);
+    VIR_DEBUG("Recording Rollback command '%s'", NULLSTR(rollbackStr));
+}
+
+
 static int
 virFirewallCmdNftablesApply(virFirewall *firewall G_GNUC_UNUSED,
                             virFirewallCmd *fwCmd,
@@ -688,37 +797,13 @@ virFirewallCmdNftablesApply(virFirewall *firewall G_GNUC_UNUSED,
 
         cmd = virCommandNew(NFT);
 
-        if ((virFirewallTransactionGetFlags(firewall) & VIR_FIREWALL_TRANSACTION_AUTO_ROLLBACK) &&
-            fwCmd->argsLen > 1) {
-            /* skip any leading options to get to command verb */
-            for (i = 0; i < fwCmd->argsLen - 1; i++) {
-                if (fwCmd->args[i][0] != '-')
-                    break;
-            }
-
-            if (i + 1 < fwCmd->argsLen &&
-                VIR_NFTABLES_ARG_IS_CREATE(fwCmd->args[i])) {
-
-                cmdIdx = i;
-                objectType = fwCmd->args[i + 1];
-
-                /* we currently only handle auto-rollback for rules,
-                 * chains, and tables, and those all can be "rolled
-                 * back" by a delete command using the handle that is
-                 * returned when "-ae" is added to the add/insert
-                 * command.
-                 */
-                if (STREQ_NULLABLE(objectType, "rule") ||
-                    STREQ_NULLABLE(objectType, "chain") ||
-                    STREQ_NULLABLE(objectType, "table")) {
-
-                    needRollback = true;
-                    /* this option to nft instructs it to add the
-                     * "handle" of the created object to stdout
-                     */
-                    virCommandAddArg(cmd, "-ae");
-                }
-            }
+        if (virFirewallCmdNftablesNeedRollback(firewall, fwCmd,
+                                               &cmdIdx, &objectType)) {
+            needRollback = true;
+            /* this option to nft instructs it to add the
+             * "handle" of the created object to stdout
+             */
+            virCommandAddArg(cmd, "-ae");
         }
 
     }
@@ -758,62 +843,187 @@ virFirewallCmdNftablesApply(virFirewall *firewall G_GNUC_UNUSED,
     }
 
     if (needRollback) {
-        virFirewallCmd *rollback = virFirewallAddRollbackCmd(firewall, fwCmd->layer, NULL);
-        const char *handleStart = NULL;
-        size_t handleLen = 0;
         g_autofree char *handleStr = NULL;
-        g_autofree char *rollbackStr = NULL;
 
         /* Search for "# handle n" in stdout of the nft add command -
          * that is the handle of the table/rule/chain that will later
          * need to be deleted.
          */
-
-        if ((handleStart = strstr(*output, "# handle "))) {
-            handleStart += 9; /* move past "# handle " */
-            handleLen = strspn(handleStart, "0123456789");
-        }
-
-        if (!handleLen) {
+        if (!(handleStr = virFirewallNftablesParseHandle(*output))) {
             virReportError(VIR_ERR_INTERNAL_ERROR,
                            _("couldn't register rollback command - command '%1$s' had no valid handle in output ('%2$s')"),
                            NULLSTR(cmdStr), NULLSTR(*output));
             return -1;
         }
 
-        handleStr = g_strdup_printf("%.*s", (int)handleLen, handleStart);
-
-        /* The rollback command is created from the original command like this:
-         *
-         * 1) skip any leading options
-         * 2) replace add/insert with delete
-         * 3) keep the type of item being added (rule/chain/table)
-         * 4) keep the class (ip/ip6/inet)
-         * 5) for chain/rule, keep the table name
-         * 6) for rule, keep the chain name
-         * 7) add "handle n" where "n" is parsed from the
-         *    stdout of the original nft command
-         */
-        virFirewallCmdAddArgList(firewall, rollback, "delete", objectType,
-                                 fwCmd->args[cmdIdx + 2], /* ip/ip6/inet */
-                                 NULL);
-
-        if (STREQ_NULLABLE(objectType, "rule") ||
-            STREQ_NULLABLE(objectType, "chain")) {
-            /* include table name in command */
-            virFirewallCmdAddArg(firewall, rollback, fwCmd->args[cmdIdx + 3]);
+        virFirewallCmdNftablesAddRollback(firewall, fwCmd, cmdIdx,
+                                          objectType, handleStr);
+    }
+    return 0;
+}
+
+
+/*
+ * Commands which can be passed to a single nft process as a script.
+ * Queries and tc commands need to be run on their own.
+ */
+static bool
+virFirewallCmdNftablesCanBatch(virFirewall *firewall,
+                               virFirewallCmd *fwCmd)
+{
+    size_t i;
+
+    if (virFirewallGetBackend(firewall) != VIR_FIREWALL_BACKEND_NFTABLES ||
+        fwCmd->layer == VIR_FIREWALL_LAYER_TC ||
+        fwCmd->queryCB ||
+        fwCmd->argsLen == 0 ||
+        fwCmd->args[0][0] == '-' ||
+        STREQ(fwCmd->args[0], "list"))
+        return false;
+
+    /* nft joins its arguments with spaces anyway, but a line break
+     * would split the command in a script */
+    for (i = 0; i < fwCmd->argsLen; i++) {
+        if (strchr(fwCmd->args[i], '\n'))
+            return false;
+    }
+
+    return true;
+}
+
+
+/*
+ * Checks whether @line of "nft -ae" output echoes the object created by
+ * @fwCmd. Inserted rules are echoed as added ones.
+ */
+static bool
+virFirewallCmdNftablesEchoMatches(virFirewallCmd *fwCmd,
+                                  size_t cmdIdx,
+                                  const char *objectType,
+                                  const char *line)
+{
+    g_auto(GStrv) tokens = g_strsplit(line, " ", 6);
+    size_t ntokens = g_strv_length(tokens);
+
+    if (ntokens < 4 ||
+        !VIR_NFTABLES_ARG_IS_CREATE(tokens[0]) ||
+        STRNEQ(tokens[1], objectType) ||
+        STRNEQ(tokens[2], fwCmd->args[cmdIdx + 2]) ||
+        STRNEQ(tokens[3], fwCmd->args[cmdIdx + 3]))
+        return false;
+
+    if (STREQ(objectType, "rule") &&
+        (ntokens < 5 || STRNEQ(tokens[4], fwCmd->args[cmdIdx + 4])))
+        return false;
+
+    return true;
+}
+
+
+/*
+ * Applies @fwCmds in one nft process, which handles them as a single
+ * transaction: either all of them succeed, or none of them is applied.
+ *
+ * Returns 0 on success, 1 if the commands failed and need to be applied
+ * one by one to find out which one is at fault and whether its error may
+ * be ignored, and -1 on error. With VIR_FIREWALL_TRANSACTION_ATOMIC a
+ * failure of the commands is an error.
+ */
+static int
+virFirewallApplyNftablesBatch(virFirewall *firewall,
+                              virFirewallCmd **fwCmds,
+                              size_t ncmds)
+{
+    g_auto(virBuffer) buf = VIR_BUFFER_INITIALIZER;
+    g_autoptr(virCommand) cmd = virCommandNew(NFT);
+    g_autofree char *script = NULL;
+    g_autofree char *output = NULL;
+    g_autofree char *error = NULL;
+    g_auto(GStrv) lines = NULL;
+    bool needRollback = false;
+    size_t cmdIdx = 0;
+    const char *objectType = NULL;
+    size_t line = 0;
+    size_t i;
+    size_t j;
+    int status;
+
+    for (i = 0; i < ncmds; i++) {
+        if (virFirewallCmdNftablesNeedRollback(firewall, fwCmds[i],
+                                               &cmdIdx, &objectType))
+            needRollback = true;
+
+        for (j = 0; j < fwCmds[i]->argsLen; j++) {
+            if (j > 0)
+                virBufferAddChar(&buf, ' ');
+            virBufferAdd(&buf, fwCmds[i]->args[j], -1);
+        }
+        virBufferAddChar(&buf, '\n');
+    }
+
+    /* "-ae" makes nft echo each created object along with its handle */
+    if (needRollback)
+        virCommandAddArg(cmd, "-ae");
+    virCommandAddArgList(cmd, "-f", "-", NULL);
+
+    script = virBufferContentAndReset(&buf);
+    VIR_INFO("Applying %zu firewall commands:\n%s", ncmds, script);
+
+    virCommandSetInputBuffer(cmd, script);
+    virCommandSetOutputBuffer(cmd, &output);
+    virCommandSetErrorBuffer(cmd, &error);
+
+    if (virCommandRun(cmd, &status) < 0)
+        return -1;
+
+    if (status != 0) {
+        if (virFirewallTransactionGetFlags(firewall) &
+            VIR_FIREWALL_TRANSACTION_ATOMIC) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Failed to apply firewall commands: %1$s"),
+                           NULLSTR(error));
+            return -1;
         }
 
-        if (STREQ_NULLABLE(objectType, "rule")) {
-            /* include chain name in command */
-            virFirewallCmdAddArg(firewall, rollback, fwCmd->args[cmdIdx + 4]);
+        VIR_DEBUG("Firewall commands failed, applying them one by one: %s",
+                  NULLSTR(error));
+        return 1;
+    }
+
+    if (!needRollback)
+        return 0;
+
+    lines = g_strsplit(NULLSTR_EMPTY(output), "\n", -1);
+
+    for (i = 0; i < ncmds; i++) {
+        g_autofree char *handleStr = NULL;
+
+        if (!virFirewallCmdNftablesNeedRollback(firewall, fwCmds[i],
+                                                &cmdIdx, &objectType))
+            continue;
+
+        /* Objects are echoed in the order they were created */
+        for (; lines[line]; line++) {
+            if (virFirewallCmdNftablesEchoMatches(fwCmds[i], cmdIdx, objectType,
+                                                  lines[line]) &&
+                (handleStr = virFirewallNftablesParseHandle(lines[line])))
+                break;
         }
 
-        virFirewallCmdAddArgList(firewall, rollback, "handle", handleStr, NULL);
+        if (!handleStr) {
+            g_autofree char *cmdStr = virFirewallCmdToString(NFT, fwCmds[i]);
 
-        rollbackStr = virFirewallCmdToString(NFT, rollback);
-        VIR_DEBUG("Recording Rollback command '%s'", NULLSTR(rollbackStr));
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("couldn't register rollback command - command '%1$s' had no valid handle in output ('%2$s')"),
+                           NULLSTR(cmdStr), NULLSTR(output));
+            return -1;
+        }
+
+        virFirewallCmdNftablesAddRollback(firewall, fwCmds[i], cmdIdx,
+                                          objectType, handleStr);
+        line++;
     }
+
     return 0;
 }
 
@@ -885,9 +1095,42 @@ virFirewallApplyGroup(virFirewall *firewall,
              firewall, group, group->actionFlags);
     firewall->currentGroup = idx;
     group->addingRollback = false;
-    for (i = 0; i < group->naction; i++) {
+
+    /* NB: query callbacks may append commands to the group while
+     * it is being applied */
+    i = 0;
+    while (i < group->naction) {
+        size_t nbatch = 0;
+        size_t j;
+
+        while (i + nbatch < group->naction &&
+               virFirewallCmdNftablesCanBatch(firewall, group->action[i + nbatch]))
+            nbatch++;
+
+        if (nbatch > 1) {
+            int rc = virFirewallApplyNftablesBatch(firewall, group->action + i,
+                                                   nbatch);
+
+            if (rc < 0)
+                return -1;
+
+            if (rc == 0) {
+                i += nbatch;
+                continue;
+            }
+
+            /* Nothing was applied, go through the commands one by one */
+            for (j = 0; j < nbatch; j++) {
+                if (virFirewallApplyCmd(firewall, group->action[i + j]) < 0)
+                    return -1;
+            }
+            i += nbatch;
+            continue;
+        }
+
         if (virFirewallApplyCmd(firewall, group->action[i]) < 0)
             return -1;
+        i++;
     }
     return 0;
 }
@@ -126,6 +126,9 @@ typedef enum {
     VIR_FIREWALL_TRANSACTION_IGNORE_ERRORS = (1 << 0),
     /* Set to auto-add a rollback rule for each rule that is applied */
     VIR_FIREWALL_TRANSACTION_AUTO_ROLLBACK = (1 << 1),
+    /* Fail right away if a batch of nftables commands fails rather than
+     * applying them one by one, so that they take effect all or none */
+    VIR_FIREWALL_TRANSACTION_ATOMIC = (1 << 2),
 } virFirewallTransactionFlags;
 
 void virFirewallStartTransaction(virFirewall *firewall,
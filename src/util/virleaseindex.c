@@ -0,0 +1,257 @@
+/*
+ * virleaseindex.c: hashed index of DHCP leases and MAC maps
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include <config.h>
+
+#include "virleaseindex.h"
+#include "viralloc.h"
+#include "virerror.h"
+#include "virfile.h"
+
+#define VIR_FROM_THIS VIR_FROM_NETWORK
+
+/* Minimal number of buckets, the table is kept at most half full */
+#define VIR_LEASE_INDEX_MIN_BUCKETS 16
+
+typedef struct _virLeaseIndexItem virLeaseIndexItem;
+struct _virLeaseIndexItem {
+    virLeaseIndexKeyType type;
+    char *key;
+    char *value;
+    long long expirytime;
+};
+
+struct _virLeaseIndex {
+    virLeaseIndexItem *items;
+    size_t nitems;
+};
+
+typedef struct _virLeaseIndexData virLeaseIndexData;
+struct _virLeaseIndexData {
+    virLeaseIndexHeader header;
+    uint32_t *buckets;
+    virLeaseIndexEntry *entries;
+    GByteArray *strings;
+};
+
+
+virLeaseIndex *
+virLeaseIndexNew(void)
+{
+    return g_new0(virLeaseIndex, 1);
+}
+
+
+void
+virLeaseIndexFree(virLeaseIndex *idx)
+{
+    size_t i;
+
+    if (!idx)
+        return;
+
+    for (i = 0; i < idx->nitems; i++) {
+        g_free(idx->items[i].key);
+        g_free(idx->items[i].value);
+    }
+    g_free(idx->items);
+    g_free(idx);
+}
+
+
+/**
+ * virLeaseIndexAdd:
+ * @idx: index
+ * @type: what @key is
+ * @key: key to look @value up by
+ * @value: value (IP or MAC address)
+ * @expirytime: expiry time of the lease, or 0
+ *
+ * Add an entry to @idx. Multiple entries can share the same key.
+ */
+void
+virLeaseIndexAdd(virLeaseIndex *idx,
+                 virLeaseIndexKeyType type,
+                 const char *key,
+                 const char *value,
+                 long long expirytime)
+{
+    virLeaseIndexItem item = {
+        .type = type,
+        .key = g_strdup(key),
+        .value = g_strdup(value),
+        .expirytime = expirytime,
+    };
+
+    VIR_APPEND_ELEMENT(idx->items, idx->nitems, item);
+}
+
+
+/**
+ * virLeaseIndexAddLeases:
+ * @idx: index
+ * @leases: JSON array of leases, as stored in the custom lease file
+ *
+ * Add each lease in @leases to @idx, under both its hostname and its
+ * MAC address (whichever are known).
+ *
+ * Returns 0 on success, -1 otherwise (with error reported).
+ */
+int
+virLeaseIndexAddLeases(virLeaseIndex *idx,
+                       virJSONValue *leases)
+{
+    size_t i;
+
+    for (i = 0; i < virJSONValueArraySize(leases); i++) {
+        virJSONValue *lease = virJSONValueArrayGet(leases, i);
+        const char *ip = virJSONValueObjectGetString(lease, "ip-address");
+        const char *hostname = virJSONValueObjectGetString(lease, "hostname");
+        const char *mac = virJSONValueObjectGetString(lease, "mac-address");
+        long long expirytime = 0;
+
+        if (!ip)
+            continue;
+
+        if (virJSONValueObjectGetNumberLong(lease, "expiry-time", &expirytime) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("failed to parse json"));
+            return -1;
+        }
+
+        if (hostname)
+            virLeaseIndexAdd(idx, VIR_LEASE_INDEX_KEY_HOSTNAME,
+                             hostname, ip, expirytime);
+        if (mac)
+            virLeaseIndexAdd(idx, VIR_LEASE_INDEX_KEY_MAC,
+                             mac, ip, expirytime);
+    }
+
+    return 0;
+}
+
+
+/**
+ * virLeaseIndexFileName:
+ * @source: file being indexed
+ *
+ * Returns the name of the index of @source.
+ */
+char *
+virLeaseIndexFileName(const char *source)
+{
+    return g_strdup_printf("%s" VIR_LEASE_INDEX_SUFFIX, source);
+}
+
+
+static uint32_t
+virLeaseIndexAddString(GByteArray *strings,
+                       const char *str)
+{
+    uint32_t off = strings->len;
+
+    g_byte_array_append(strings, (const guint8 *) str, strlen(str) + 1);
+    return off;
+}
+
+
+static int
+virLeaseIndexWriteHelper(int fd,
+                         const char *path,
+                         const void *opaque)
+{
+    const virLeaseIndexData *data = opaque;
+
+    if (safewrite(fd, &data->header, sizeof(data->header)) < 0 ||
+        safewrite(fd, data->buckets,
+                  sizeof(*data->buckets) * data->header.nbuckets) < 0 ||
+        safewrite(fd, data->entries,
+                  sizeof(*data->entries) * data->header.nentries) < 0 ||
+        safewrite(fd, data->strings->data, data->strings->len) < 0) {
+        virReportSystemError(errno,
+                             _("cannot write data to file '%1$s'"),
+                             path);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * virLeaseIndexWrite:
+ * @idx: index
+ * @source: file @idx was built from
+ *
+ * Atomically replace the index of @source with @idx. This must be
+ * called after @source was written, as the index is tied to its
+ * current inode number, size and modification time.
+ *
+ * Returns 0 on success, -1 otherwise (with error reported).
+ */
+int
+virLeaseIndexWrite(virLeaseIndex *idx,
+                   const char *source)
+{
+    g_autofree char *path = virLeaseIndexFileName(source);
+    g_autofree uint32_t *buckets = NULL;
+    g_autofree virLeaseIndexEntry *entries = NULL;
+    g_autoptr(GByteArray) strings = g_byte_array_new();
+    virLeaseIndexData data = { 0 };
+    size_t nbuckets = VIR_LEASE_INDEX_MIN_BUCKETS;
+    struct stat sb;
+    size_t i;
+
+    if (stat(source, &sb) < 0) {
+        virReportSystemError(errno, _("cannot stat file '%1$s'"), source);
+        return -1;
+    }
+
+    while (nbuckets < idx->nitems * 2)
+        nbuckets *= 2;
+
+    buckets = g_new0(uint32_t, nbuckets);
+    entries = g_new0(virLeaseIndexEntry, idx->nitems);
+
+    /* Offset 0 is an empty string, which also makes sure the string
+     * table is never empty and always ends with a NUL byte. */
+    virLeaseIndexAddString(strings, "");
+
+    for (i = 0; i < idx->nitems; i++) {
+        virLeaseIndexItem *item = &idx->items[i];
+        virLeaseIndexEntry *entry = &entries[i];
+
+        entry->hash = virLeaseIndexHash(item->type, item->key);
+        entry->type = item->type;
+        entry->key = virLeaseIndexAddString(strings, item->key);
+        entry->value = virLeaseIndexAddString(strings, item->value);
+        entry->expirytime = item->expirytime;
+    }
+
+    /* Entries are prepended to their buckets, go backwards so that
+     * lookups return them in the order they were added. */
+    for (i = idx->nitems; i > 0; i--) {
+        virLeaseIndexEntry *entry = &entries[i - 1];
+        uint32_t bucket = entry->hash & (nbuckets - 1);
+
+        entry->next = buckets[bucket];
+        buckets[bucket] = i;
+    }
+
+    memcpy(data.header.magic, VIR_LEASE_INDEX_MAGIC,
+           sizeof(data.header.magic));
+    data.header.nbuckets = nbuckets;
+    data.header.nentries = idx->nitems;
+    data.header.sourceIno = sb.st_ino;
+    data.header.sourceSize = sb.st_size;
+    data.header.sourceMtime = virLeaseIndexMtime(&sb);
+    data.buckets = buckets;
+    data.entries = entries;
+    data.strings = strings;
+
+    return virFileRewrite(path, 0644, -1, -1,
+                          virLeaseIndexWriteHelper, &data);
+}
@@ -0,0 +1,119 @@
+/*
+ * virleaseindex.h: hashed index of DHCP leases and MAC maps
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#pragma once
+
+/* This part of the header describes the on-disk layout of the index
+ * and is shared with the NSS module, which must not depend on glib or
+ * on anything else from libvirt. */
+#include <stdint.h>
+#include <sys/stat.h>
+
+/**
+ * An index is written next to each dnsmasq lease status file and MAC
+ * map file, with VIR_LEASE_INDEX_SUFFIX appended to its name, so that
+ * the NSS module can look up a host in O(1) without parsing JSON.
+ *
+ * The file is in host byte order and consists of a header, an array of
+ * @nbuckets bucket heads, an array of @nentries entries and a table of
+ * NUL terminated strings filling the rest of the file. The index is
+ * only valid as long as the file it was built from is the same, i.e.
+ * its inode number, size and modification time still match, anything
+ * else must fall back to parsing the file.
+ */
+#define VIR_LEASE_INDEX_MAGIC "LVLIDX01"
+#define VIR_LEASE_INDEX_SUFFIX ".idx"
+
+typedef enum {
+    VIR_LEASE_INDEX_KEY_HOSTNAME = 1, /* lease hostname -> IP address */
+    VIR_LEASE_INDEX_KEY_MAC,          /* lease MAC address -> IP address */
+    VIR_LEASE_INDEX_KEY_DOMAIN,       /* domain name -> MAC address */
+} virLeaseIndexKeyType;
+
+typedef struct _virLeaseIndexHeader virLeaseIndexHeader;
+struct _virLeaseIndexHeader {
+    char magic[8];
+    uint32_t nbuckets;      /* power of two */
+    uint32_t nentries;
+    uint64_t sourceIno;
+    uint64_t sourceSize;
+    int64_t sourceMtime;    /* in nanoseconds */
+};
+
+typedef struct _virLeaseIndexEntry virLeaseIndexEntry;
+struct _virLeaseIndexEntry {
+    uint32_t hash;
+    uint32_t next;          /* next entry in the bucket + 1, or 0. Entries
+                             * only link to ones following them. */
+    uint32_t type;          /* virLeaseIndexKeyType */
+    uint32_t key;           /* offset of the key in the string table */
+    uint32_t value;         /* offset of the value in the string table */
+    uint32_t padding;
+    int64_t expirytime;     /* lease expiry time, 0 if none */
+};
+
+static inline int64_t
+virLeaseIndexMtime(const struct stat *sb)
+{
+#ifdef __APPLE__
+    return sb->st_mtimespec.tv_sec * 1000000000LL + sb->st_mtimespec.tv_nsec;
+#else /* ! __APPLE__ */
+    return sb->st_mtim.tv_sec * 1000000000LL + sb->st_mtim.tv_nsec;
+#endif /* ! __APPLE__ */
+}
+
+/* Keys are hashed case insensitively, since hostnames are compared
+ * that way. Bucket heads hold the index of the first entry + 1. */
+static inline uint32_t
+virLeaseIndexHash(uint32_t type,
+                  const char *key)
+{
+    uint32_t hash = 2166136261U ^ type;
+
+    for (; *key; key++) {
+        unsigned char c = *key;
+
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+
+        hash = (hash ^ c) * 16777619U;
+    }
+
+    return hash;
+}
+
+
+#ifndef LIBVIRT_NSS
+# include "internal.h"
+# include "virjson.h"
+
+typedef struct _virLeaseIndex virLeaseIndex;
+
+virLeaseIndex *
+virLeaseIndexNew(void);
+
+void
+virLeaseIndexFree(virLeaseIndex *idx);
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(virLeaseIndex, virLeaseIndexFree);
+
+void
+virLeaseIndexAdd(virLeaseIndex *idx,
+                 virLeaseIndexKeyType type,
+                 const char *key,
+                 const char *value,
+                 long long expirytime);
+
+int
+virLeaseIndexAddLeases(virLeaseIndex *idx,
+                       virJSONValue *leases);
+
+char *
+virLeaseIndexFileName(const char *source);
+
+int
+virLeaseIndexWrite(virLeaseIndex *idx,
+                   const char *source);
+#endif /* !LIBVIRT_NSS */
@@ -479,73 +479,497 @@ virLogSourceUpdate(virLogSource *source)
 }
 
 
-/**
- * virLogVMessage:
- * @source: where is that message coming from
- * @priority: the priority level
- * @filename: file where the message was emitted
- * @linenr: line where the message was emitted
- * @funcname: the function emitting the (debug) message
- * @metadata: NULL or metadata array, terminated by an item with NULL key
- * @fmt: the string format
- * @vargs: format args
+/*
+ * Asynchronous logging
  *
- * Call the libvirt logger with some information. Based on the configuration
- * the message may be stored, sent to output or just discarded
+ * Once enabled, each thread queues its messages into its own ring buffer
+ * and a dedicated thread passes them to the outputs. Threads emitting
+ * messages thus never wait for each other nor for slow outputs. When a
+ * ring is full, the message is dropped and the number of dropped messages
+ * is reported by the log thread later on.
  */
+#define VIR_LOG_RING_SIZE 1024 /* must be a power of two */
+
+typedef struct _virLogRecord virLogRecord;
+struct _virLogRecord {
+    virLogSource *source;
+    virLogPriority priority;
+    const char *filename;
+    int linenr;
+    const char *funcname;
+    char timestamp[VIR_TIME_STRING_BUFLEN];
+    struct _virLogMetadata *metadata;
+    char *str;
+    char *msg;
+};
+
+typedef struct _virLogRing virLogRing;
+struct _virLogRing {
+    virLogRecord *records[VIR_LOG_RING_SIZE];
+    unsigned int head;      /* next slot to fill, advanced by the owner thread */
+    unsigned int tail;      /* next slot to drain, advanced by the log thread */
+    unsigned int dropped;   /* messages lost because the ring was full */
+    unsigned long long thread;
+    int orphaned;           /* set once the owner thread exits */
+};
+
+/* Protects the list of rings and whether the log thread is running. It is
+ * never held while messages are passed to the outputs. */
+static virMutex virLogRingsMutex = VIR_MUTEX_INITIALIZER;
+static virThreadLocal virLogRingLocal;
+static bool virLogAsyncInitialized;
+static virLogRing **virLogRings;
+static size_t virLogNbRings;
+
+/* Protects waking up and stopping the log thread */
+static virMutex virLogThreadMutex = VIR_MUTEX_INITIALIZER;
+static virCond virLogThreadCond;
+
+static virThread virLogThread;
+static bool virLogThreadRunning;
+static bool virLogThreadQuit;
+static int virLogThreadSleeping;
+
+static int virLogAsync;
+static int virLogAsyncWriters;
+static pid_t virLogAsyncPid;
+
+static void virLogDispatch(virLogSource *source,
+                           virLogPriority priority,
+                           const char *filename,
+                           int linenr,
+                           const char *funcname,
+                           const char *timestamp,
+                           struct _virLogMetadata *metadata,
+                           const char *str,
+                           const char *msg);
+
+
 static void
-G_GNUC_PRINTF(7, 0)
-virLogVMessage(virLogSource *source,
+virLogRecordFree(virLogRecord *rec)
+{
+    size_t i;
+
+    if (!rec)
+        return;
+
+    for (i = 0; rec->metadata && rec->metadata[i].key; i++) {
+        g_free((char *)rec->metadata[i].key);
+        g_free((char *)rec->metadata[i].s);
+    }
+    g_free(rec->metadata);
+    g_free(rec->str);
+    g_free(rec->msg);
+    g_free(rec);
+}
+
+
+static void
+virLogRingFree(virLogRing *ring)
+{
+    while (ring->tail != ring->head) {
+        virLogRecordFree(ring->records[ring->tail % VIR_LOG_RING_SIZE]);
+        ring->tail++;
+    }
+
+    g_free(ring);
+}
+
+
+/* Called when a thread owning a ring exits */
+static void
+virLogRingRelease(void *opaque)
+{
+    virLogRing *ring = opaque;
+    VIR_LOCK_GUARD lock = virLockGuardLock(&virLogRingsMutex);
+    size_t i;
+
+    /* The log thread frees the ring once it passes the remaining
+     * messages to the outputs */
+    if (virLogThreadRunning) {
+        g_atomic_int_set(&ring->orphaned, 1);
+        return;
+    }
+
+    for (i = 0; i < virLogNbRings; i++) {
+        if (virLogRings[i] == ring) {
+            VIR_DELETE_ELEMENT(virLogRings, i, virLogNbRings);
+            break;
+        }
+    }
+
+    virLogRingFree(ring);
+}
+
+
+static virLogRing *
+virLogRingGet(void)
+{
+    virLogRing *ring = virThreadLocalGet(&virLogRingLocal);
+
+    if (ring)
+        return ring;
+
+    ring = g_new0(virLogRing, 1);
+    ring->thread = virThreadSelfID();
+
+    if (virThreadLocalSet(&virLogRingLocal, ring) < 0) {
+        g_free(ring);
+        return NULL;
+    }
+
+    VIR_WITH_MUTEX_LOCK_GUARD(&virLogRingsMutex) {
+        VIR_APPEND_ELEMENT(virLogRings, virLogNbRings, ring);
+    }
+
+    return ring;
+}
+
+
+static bool
+virLogRingPush(virLogSource *source,
                virLogPriority priority,
                const char *filename,
                int linenr,
                const char *funcname,
+               const char *timestamp,
                struct _virLogMetadata *metadata,
-               const char *fmt,
-               va_list vargs)
+               char **str,
+               char **msg)
 {
-    static bool logInitMessageStderr = true;
-    g_autofree char *str = NULL;
-    g_autofree char *msg = NULL;
-    char timestamp[VIR_TIME_STRING_BUFLEN];
+    virLogRing *ring;
+    virLogRecord *rec;
+    unsigned int head;
+    size_t nmetadata = 0;
     size_t i;
-    int saved_errno = errno;
 
-    if (virLogInitialize() < 0)
-        return;
+    if (!(ring = virLogRingGet()))
+        return false;
 
-    if (fmt == NULL)
-        return;
+    head = ring->head;
+    if (head - (unsigned int)g_atomic_int_get(&ring->tail) == VIR_LOG_RING_SIZE) {
+        g_atomic_int_inc(&ring->dropped);
+        g_clear_pointer(str, g_free);
+        g_clear_pointer(msg, g_free);
+        return true;
+    }
 
-    /*
-     * 3 intentionally non-thread safe variable reads.
-     * Since writes to the variable are serialized on
-     * virLogLock, worst case result is a log message
-     * is accidentally dropped or emitted, if another
-     * thread is updating log filter list concurrently
-     * with a log message emission.
-     */
-    if (source->serial < virLogFiltersSerial)
-        virLogSourceUpdate(source);
-    if (priority < source->priority)
-        goto cleanup;
+    rec = g_new0(virLogRecord, 1);
+    rec->source = source;
+    rec->priority = priority;
+    rec->filename = filename;
+    rec->linenr = linenr;
+    rec->funcname = funcname;
+    virStrcpyStatic(rec->timestamp, timestamp);
+    rec->str = g_steal_pointer(str);
+    rec->msg = g_steal_pointer(msg);
+
+    /* Metadata usually lives on the caller's stack */
+    if (metadata) {
+        while (metadata[nmetadata].key)
+            nmetadata++;
 
-    /*
-     * serialize the error message, add level and timestamp
-     */
-    str = g_strdup_vprintf(fmt, vargs);
+        rec->metadata = g_new0(struct _virLogMetadata, nmetadata + 1);
+        for (i = 0; i < nmetadata; i++) {
+            rec->metadata[i].key = g_strdup(metadata[i].key);
+            rec->metadata[i].s = g_strdup(metadata[i].s);
+            rec->metadata[i].iv = metadata[i].iv;
+        }
+    }
 
-    virLogFormatString(&msg, linenr, funcname, priority, str);
+    ring->records[head % VIR_LOG_RING_SIZE] = rec;
+    g_atomic_int_set(&ring->head, head + 1);
+
+    /* The log thread announces it is going to sleep before checking the
+     * rings for the last time, so either it sees the new message or we
+     * see it sleeping. */
+    if (g_atomic_int_get(&virLogThreadSleeping)) {
+        VIR_WITH_MUTEX_LOCK_GUARD(&virLogThreadMutex) {
+            virCondSignal(&virLogThreadCond);
+        }
+    }
+
+    return true;
+}
 
-    if (virTimeStringNowRaw(timestamp) < 0)
-        timestamp[0] = '\0';
+
+/*
+ * Queues a message for the log thread, stealing @str and @msg.
+ *
+ * Returns false if asynchronous logging is not in use and the caller
+ * has to pass the message to the outputs itself.
+ */
+static bool
+virLogQueueMessage(virLogSource *source,
+                   virLogPriority priority,
+                   const char *filename,
+                   int linenr,
+                   const char *funcname,
+                   const char *timestamp,
+                   struct _virLogMetadata *metadata,
+                   char **str,
+                   char **msg)
+{
+    bool ret = false;
+
+    /* virLogSetAsync waits for the messages being queued by threads which
+     * still see asynchronous logging enabled before draining the rings
+     * for the last time */
+    g_atomic_int_inc(&virLogAsyncWriters);
+
+    /* The log thread does not exist in forked children */
+    if (g_atomic_int_get(&virLogAsync) &&
+        virLogAsyncPid == getpid())
+        ret = virLogRingPush(source, priority, filename, linenr, funcname,
+                             timestamp, metadata, str, msg);
+
+    g_atomic_int_add(&virLogAsyncWriters, -1);
+
+    return ret;
+}
+
+
+/*
+ * Passes queued messages to the outputs and frees rings of threads which
+ * no longer exist. Only the log thread, or virLogSetAsync once the log
+ * thread is gone, drains the rings.
+ *
+ * Returns the number of messages processed.
+ */
+static size_t
+virLogDrainRings(void)
+{
+    g_autofree virLogRing **rings = NULL;
+    size_t nrings = 0;
+    size_t processed = 0;
+    size_t i;
+
+    /* Rings are only freed here while the log thread is running, so the
+     * snapshot can be used without holding the lock and threads creating
+     * their rings don't wait for the outputs. */
+    VIR_WITH_MUTEX_LOCK_GUARD(&virLogRingsMutex) {
+        rings = g_new0(virLogRing *, virLogNbRings + 1);
+        nrings = virLogNbRings;
+        for (i = 0; i < nrings; i++)
+            rings[i] = virLogRings[i];
+    }
 
     virLogLock();
 
-    /*
-     * Push the message to the outputs defined, if none exist then
-     * use stderr.
-     */
+    for (i = 0; i < nrings; i++) {
+        virLogRing *ring = rings[i];
+        unsigned int head = g_atomic_int_get(&ring->head);
+        unsigned int tail = ring->tail;
+        unsigned int dropped;
+
+        for (; tail != head; tail++) {
+            virLogRecord *rec = ring->records[tail % VIR_LOG_RING_SIZE];
+
+            virLogDispatch(rec->source, rec->priority,
+                           rec->filename, rec->linenr, rec->funcname,
+                           rec->timestamp, rec->metadata,
+                           rec->str, rec->msg);
+            virLogRecordFree(rec);
+            processed++;
+        }
+        g_atomic_int_set(&ring->tail, tail);
+
+        if ((dropped = g_atomic_int_and(&ring->dropped, 0)) > 0) {
+            g_autofree char *str = NULL;
+            g_autofree char *msg = NULL;
+            char timestamp[VIR_TIME_STRING_BUFLEN];
+
+            str = g_strdup_printf("%u log messages of thread %llu were dropped",
+                                  dropped, ring->thread);
+            virLogFormatString(&msg, __LINE__, __func__, VIR_LOG_WARN, str);
+            if (virTimeStringNowRaw(timestamp) < 0)
+                timestamp[0] = '\0';
+
+            virLogDispatch(&virLogSelf, VIR_LOG_WARN,
+                           __FILE__, __LINE__, __func__,
+                           timestamp, NULL, str, msg);
+            processed++;
+        }
+    }
+
+    virLogUnlock();
+
+    VIR_WITH_MUTEX_LOCK_GUARD(&virLogRingsMutex) {
+        i = 0;
+        while (i < virLogNbRings) {
+            virLogRing *ring = virLogRings[i];
+
+            if (g_atomic_int_get(&ring->orphaned) &&
+                ring->tail == g_atomic_int_get(&ring->head) &&
+                g_atomic_int_get(&ring->dropped) == 0) {
+                VIR_DELETE_ELEMENT(virLogRings, i, virLogNbRings);
+                virLogRingFree(ring);
+                continue;
+            }
+
+            i++;
+        }
+    }
+
+    return processed;
+}
+
+
+/* Whether there are messages the log thread did not pick up yet */
+static bool
+virLogRingsPending(void)
+{
+    VIR_LOCK_GUARD lock = virLockGuardLock(&virLogRingsMutex);
+    size_t i;
+
+    for (i = 0; i < virLogNbRings; i++) {
+        virLogRing *ring = virLogRings[i];
+
+        if (g_atomic_int_get(&ring->head) != g_atomic_int_get(&ring->tail) ||
+            g_atomic_int_get(&ring->dropped) > 0)
+            return true;
+    }
+
+    return false;
+}
+
+
+static void
+virLogThreadWorker(void *opaque G_GNUC_UNUSED)
+{
+    bool quit = false;
+
+    while (!quit) {
+        if (virLogDrainRings() > 0)
+            continue;
+
+        virMutexLock(&virLogThreadMutex);
+
+        g_atomic_int_set(&virLogThreadSleeping, 1);
+
+        if (!virLogThreadQuit &&
+            !virLogRingsPending() &&
+            virCondWait(&virLogThreadCond, &virLogThreadMutex) < 0)
+            quit = true;
+
+        g_atomic_int_set(&virLogThreadSleeping, 0);
+
+        if (virLogThreadQuit)
+            quit = true;
+
+        virMutexUnlock(&virLogThreadMutex);
+    }
+
+    virLogDrainRings();
+}
+
+
+/**
+ * virLogSetAsync:
+ * @async: whether messages should be passed to outputs asynchronously
+ *
+ * Enables or disables asynchronous logging. When enabled, threads only
+ * queue their messages and a dedicated thread passes them to the outputs,
+ * so that slow outputs or verbose filters don't serialize the callers.
+ * Queued messages are lost if the process crashes. Disabling asynchronous
+ * logging passes all queued messages to the outputs before returning.
+ *
+ * Asynchronous logging must be enabled after the process daemonizes as
+ * the log thread does not survive fork().
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virLogSetAsync(bool async)
+{
+    if (virLogInitialize() < 0)
+        return -1;
+
+    if (async) {
+        VIR_LOCK_GUARD lock = virLockGuardLock(&virLogRingsMutex);
+
+        if (virLogThreadRunning)
+            return 0;
+
+        if (!virLogAsyncInitialized) {
+            if (virCondInit(&virLogThreadCond) < 0) {
+                virReportSystemError(errno, "%s",
+                                     _("Unable to initialize log thread condition"));
+                return -1;
+            }
+
+            if (virThreadLocalInit(&virLogRingLocal, virLogRingRelease) < 0) {
+                virReportSystemError(errno, "%s",
+                                     _("Unable to initialize log thread local storage"));
+                virCondDestroy(&virLogThreadCond);
+                return -1;
+            }
+
+            virLogAsyncInitialized = true;
+        }
+
+        virLogThreadQuit = false;
+        if (virThreadCreateFull(&virLogThread, true, virLogThreadWorker,
+                                "log-writer", false, NULL) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to create log thread"));
+            return -1;
+        }
+
+        virLogThreadRunning = true;
+        virLogAsyncPid = getpid();
+        g_atomic_int_set(&virLogAsync, 1);
+        return 0;
+    }
+
+    VIR_WITH_MUTEX_LOCK_GUARD(&virLogRingsMutex) {
+        if (!virLogThreadRunning)
+            return 0;
+    }
+
+    g_atomic_int_set(&virLogAsync, 0);
+
+    /* Threads which checked virLogAsync before it was cleared may still
+     * be queueing their messages */
+    while (g_atomic_int_get(&virLogAsyncWriters) > 0)
+        g_thread_yield();
+
+    VIR_WITH_MUTEX_LOCK_GUARD(&virLogThreadMutex) {
+        virLogThreadQuit = true;
+        virCondSignal(&virLogThreadCond);
+    }
+
+    virThreadJoin(&virLogThread);
+
+    /* Pick up messages queued while the thread was finishing */
+    virLogDrainRings();
+
+    VIR_WITH_MUTEX_LOCK_GUARD(&virLogRingsMutex) {
+        virLogThreadRunning = false;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Push the message to the outputs defined, if none exist then
+ * use stderr. Must be called with virLogLock held.
+ */
+static void
+virLogDispatch(virLogSource *source,
+               virLogPriority priority,
+               const char *filename,
+               int linenr,
+               const char *funcname,
+               const char *timestamp,
+               struct _virLogMetadata *metadata,
+               const char *str,
+               const char *msg)
+{
+    static bool logInitMessageStderr = true;
+    size_t i;
+
     for (i = 0; i < virLogNbOutputs; i++) {
         if (priority >= virLogOutputs[i]->priority) {
             if (virLogOutputs[i]->logInitMessage) {
@@ -600,6 +1024,75 @@ virLogVMessage(virLogSource *source,
                          timestamp, metadata,
                          str, msg, (void *) STDERR_FILENO);
     }
+}
+
+
+/**
+ * virLogVMessage:
+ * @source: where is that message coming from
+ * @priority: the priority level
+ * @filename: file where the message was emitted
+ * @linenr: line where the message was emitted
+ * @funcname: the function emitting the (debug) message
+ * @metadata: NULL or metadata array, terminated by an item with NULL key
+ * @fmt: the string format
+ * @vargs: format args
+ *
+ * Call the libvirt logger with some information. Based on the configuration
+ * the message may be stored, sent to output or just discarded
+ */
+static void
+G_GNUC_PRINTF(7, 0)
+virLogVMessage(virLogSource *source,
+               virLogPriority priority,
+               const char *filename,
+               int linenr,
+               const char *funcname,
+               struct _virLogMetadata *metadata,
+               const char *fmt,
+               va_list vargs)
+{
+    g_autofree char *str = NULL;
+    g_autofree char *msg = NULL;
+    char timestamp[VIR_TIME_STRING_BUFLEN];
+    int saved_errno = errno;
+
+    if (virLogInitialize() < 0)
+        return;
+
+    if (fmt == NULL)
+        return;
+
+    /*
+     * 3 intentionally non-thread safe variable reads.
+     * Since writes to the variable are serialized on
+     * virLogLock, worst case result is a log message
+     * is accidentally dropped or emitted, if another
+     * thread is updating log filter list concurrently
+     * with a log message emission.
+     */
+    if (source->serial < virLogFiltersSerial)
+        virLogSourceUpdate(source);
+    if (priority < source->priority)
+        goto cleanup;
+
+    /*
+     * serialize the error message, add level and timestamp
+     */
+    str = g_strdup_vprintf(fmt, vargs);
+
+    virLogFormatString(&msg, linenr, funcname, priority, str);
+
+    if (virTimeStringNowRaw(timestamp) < 0)
+        timestamp[0] = '\0';
+
+    if (virLogQueueMessage(source, priority, filename, linenr, funcname,
+                           timestamp, metadata, &str, &msg))
+        goto cleanup;
+
+    virLogLock();
+    virLogDispatch(source, priority, filename, linenr, funcname,
+                   timestamp, metadata, str, msg);
     virLogUnlock();
 
  cleanup:
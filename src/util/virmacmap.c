@@ -26,6 +26,7 @@
 #include "virjson.h"
 #include "virfile.h"
 #include "virhash.h"
+#include "virleaseindex.h"
 
 #define VIR_FROM_THIS VIR_FROM_NETWORK
 
@@ -243,6 +244,28 @@ virMacMapDumpStrLocked(virMacMap *mgr,
 }
 
 
+static int
+virMacMapWriteIndexLocked(virMacMap *mgr,
+                          const char *file)
+{
+    g_autoptr(virLeaseIndex) idx = virLeaseIndexNew();
+    GHashTableIter htitr;
+    void *key;
+    void *value;
+
+    g_hash_table_iter_init(&htitr, mgr->macs);
+    while (g_hash_table_iter_next(&htitr, &key, &value)) {
+        GSList *next;
+
+        for (next = value; next; next = next->next)
+            virLeaseIndexAdd(idx, VIR_LEASE_INDEX_KEY_DOMAIN,
+                             key, next->data, 0);
+    }
+
+    return virLeaseIndexWrite(idx, file);
+}
+
+
 static int
 virMacMapWriteFileLocked(virMacMap *mgr,
                          const char *file)
@@ -255,6 +278,14 @@ virMacMapWriteFileLocked(virMacMap *mgr,
     if (virFileRewriteStr(file, 0644, str) < 0)
         return -1;
 
+    /* The index is only a shortcut for the NSS module, which parses
+     * @file whenever the index is missing or stale. */
+    if (virMacMapWriteIndexLocked(mgr, file) < 0) {
+        VIR_WARN("Unable to write index of %s: %s",
+                 file, virGetLastErrorMessage());
+        virResetLastError();
+    }
+
     return 0;
 }
 
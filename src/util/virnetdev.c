@@ -33,6 +33,7 @@
 #include "virstring.h"
 #include "virutil.h"
 #include "virjson.h"
+#include "virhash.h"
 
 #ifndef WIN32
 # include <sys/ioctl.h>
@@ -952,6 +953,225 @@ virNetDevGetMaster(const char *ifname G_GNUC_UNUSED,
 #endif /* defined(WITH_LIBNL) */
 
 
+#if defined(WITH_LIBNL)
+static struct nl_msg *
+virNetDevSetupLinkMsg(const char *ifname,
+                      unsigned int change,
+                      unsigned int flags)
+{
+    g_autoptr(virNetlinkMsg) nl_msg = virNetlinkMsgNew(RTM_NEWLINK, 0);
+    struct ifinfomsg ifinfo = {
+        .ifi_family = AF_UNSPEC,
+        .ifi_change = change,
+        .ifi_flags = flags,
+    };
+
+    if (nlmsg_append(nl_msg, &ifinfo, sizeof(ifinfo), NLMSG_ALIGNTO) < 0 ||
+        nla_put_string(nl_msg, IFLA_IFNAME, ifname) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("allocated netlink buffer is too small"));
+        return NULL;
+    }
+
+    return g_steal_pointer(&nl_msg);
+}
+
+
+/**
+ * virNetDevSetupLinks:
+ * @links: array of link changes
+ * @nlinks: number of items in @links
+ *
+ * Apply all changes of each link (MAC address, MTU, bridge to attach
+ * to and link state) with one RTM_NEWLINK request per link, sent to
+ * the kernel together for all @links. Bringing a link up takes a
+ * second request, sent for all links together once the first ones
+ * succeed.
+ *
+ * The kernel applies the MAC address and MTU before attaching the link
+ * to the bridge, so the bridge never sees the link with its original
+ * MAC address or MTU. It would bring the link up before attaching it
+ * though, hence the second request.
+ *
+ * Returns 0 on success, -1 on failure (with error reported)
+ */
+int
+virNetDevSetupLinks(const virNetDevLinkSetup *links,
+                    size_t nlinks)
+{
+    g_autofree struct nl_msg **msgs = g_new0(struct nl_msg *, nlinks);
+    g_autofree struct nl_msg **upMsgs = g_new0(struct nl_msg *, nlinks);
+    g_autofree const char **upNames = g_new0(const char *, nlinks);
+    g_autofree int *errors = g_new0(int, nlinks);
+    size_t nupMsgs = 0;
+    int ret = -1;
+    size_t i;
+
+    for (i = 0; i < nlinks; i++) {
+        const virNetDevLinkSetup *link = &links[i];
+        unsigned int change = 0;
+        int master = 0;
+
+        if (link->master && virNetDevGetIndex(link->master, &master) < 0)
+            goto cleanup;
+
+        /* taking the link down can't hurt before it's attached */
+        if (link->online == VIR_TRISTATE_BOOL_NO)
+            change = IFF_UP;
+
+        if (!(msgs[i] = virNetDevSetupLinkMsg(link->ifname, change, 0)))
+            goto cleanup;
+
+        if ((link->mac &&
+             nla_put(msgs[i], IFLA_ADDRESS, VIR_MAC_BUFLEN, link->mac->addr) < 0) ||
+            (link->mtu &&
+             nla_put_u32(msgs[i], IFLA_MTU, link->mtu) < 0) ||
+            (master &&
+             nla_put_u32(msgs[i], IFLA_MASTER, master) < 0)) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("allocated netlink buffer is too small"));
+            goto cleanup;
+        }
+
+        if (link->online == VIR_TRISTATE_BOOL_YES) {
+            if (!(upMsgs[nupMsgs] = virNetDevSetupLinkMsg(link->ifname,
+                                                          IFF_UP, IFF_UP)))
+                goto cleanup;
+            upNames[nupMsgs++] = link->ifname;
+        }
+    }
+
+    if (virNetlinkCommandBatch(msgs, nlinks, errors, NETLINK_ROUTE) < 0)
+        goto cleanup;
+
+    for (i = 0; i < nlinks; i++) {
+        if (errors[i] < 0) {
+            virReportSystemError(-errors[i],
+                                 _("Unable to set up interface %1$s"),
+                                 links[i].ifname);
+            goto cleanup;
+        }
+    }
+
+    if (nupMsgs > 0) {
+        if (virNetlinkCommandBatch(upMsgs, nupMsgs, errors, NETLINK_ROUTE) < 0)
+            goto cleanup;
+
+        for (i = 0; i < nupMsgs; i++) {
+            if (errors[i] < 0) {
+                virReportSystemError(-errors[i],
+                                     _("Unable to set interface %1$s online"),
+                                     upNames[i]);
+                goto cleanup;
+            }
+        }
+    }
+
+    ret = 0;
+ cleanup:
+    for (i = 0; i < nlinks; i++) {
+        nlmsg_free(msgs[i]);
+        nlmsg_free(upMsgs[i]);
+    }
+    return ret;
+}
+
+#else
+
+int
+virNetDevSetupLinks(const virNetDevLinkSetup *links G_GNUC_UNUSED,
+                    size_t nlinks G_GNUC_UNUSED)
+{
+    virReportSystemError(ENOSYS, "%s",
+                         _("Unable to set up interfaces through netlink on this platform"));
+    return -1;
+}
+
+#endif /* defined(WITH_LIBNL) */
+
+
+#if defined(WITH_LIBNL)
+static int
+virNetDevGetAllLinkStatsCallback(struct nlmsghdr *resp,
+                                 void *opaque)
+{
+    GHashTable *links = opaque;
+    struct nlattr *tb[IFLA_MAX + 1] = { NULL };
+    struct rtnl_link_stats64 link = { 0 };
+    virDomainInterfaceStatsPtr stats;
+    size_t len;
+
+    if (resp->nlmsg_type != RTM_NEWLINK)
+        return 0;
+
+    if (nlmsg_parse(resp, sizeof(struct ifinfomsg), tb, IFLA_MAX, NULL) < 0 ||
+        !tb[IFLA_IFNAME] || !tb[IFLA_STATS64])
+        return 0;
+
+    /* the attribute is only guaranteed to be 4 byte aligned */
+    len = nla_len(tb[IFLA_STATS64]);
+    memcpy(&link, nla_data(tb[IFLA_STATS64]), MIN(sizeof(link), len));
+
+    /* same as reported by /proc/net/dev */
+    stats = g_new0(virDomainInterfaceStatsStruct, 1);
+    stats->rx_bytes = link.rx_bytes;
+    stats->rx_packets = link.rx_packets;
+    stats->rx_errs = link.rx_errors;
+    stats->rx_drop = link.rx_dropped + link.rx_missed_errors;
+    stats->tx_bytes = link.tx_bytes;
+    stats->tx_packets = link.tx_packets;
+    stats->tx_errs = link.tx_errors;
+    stats->tx_drop = link.tx_dropped;
+
+    g_hash_table_insert(links, g_strdup(nla_data(tb[IFLA_IFNAME])), stats);
+    return 0;
+}
+
+
+/**
+ * virNetDevGetAllLinkStats:
+ *
+ * Fetch RX/TX statistics of all links on the host with a single
+ * RTM_GETLINK dump. The statistics are from the host's point of view.
+ *
+ * Returns a hash table of virDomainInterfaceStatsStruct keyed by
+ * interface name, or NULL on error (with error reported).
+ */
+GHashTable *
+virNetDevGetAllLinkStats(void)
+{
+    g_autoptr(GHashTable) links = virHashNew(g_free);
+    g_autoptr(virNetlinkMsg) nl_msg = NULL;
+    struct ifinfomsg ifinfo = { .ifi_family = AF_UNSPEC };
+
+    nl_msg = virNetlinkMsgNew(RTM_GETLINK, NLM_F_REQUEST | NLM_F_DUMP);
+
+    if (nlmsg_append(nl_msg, &ifinfo, sizeof(ifinfo), NLMSG_ALIGNTO) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("allocated netlink buffer is too small"));
+        return NULL;
+    }
+
+    if (virNetlinkDumpCommand(nl_msg, virNetDevGetAllLinkStatsCallback,
+                              0, 0, NETLINK_ROUTE, 0, links) < 0)
+        return NULL;
+
+    return g_steal_pointer(&links);
+}
+
+#else
+
+GHashTable *
+virNetDevGetAllLinkStats(void)
+{
+    virReportSystemError(ENOSYS, "%s",
+                         _("Unable to get link statistics through netlink on this platform"));
+    return NULL;
+}
+
+#endif /* defined(WITH_LIBNL) */
+
+
 #if __linux__
 int virNetDevGetVLanID(const char *ifname, int *vlanid)
 {
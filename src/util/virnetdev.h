@@ -206,7 +206,8 @@ int virNetDevSetName(const char *ifname, const char *newifname)
 char *virNetDevGetName(int ifindex)
     G_GNUC_WARN_UNUSED_RESULT;
 int virNetDevGetIndex(const char *ifname, int *ifindex)
-    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) G_GNUC_WARN_UNUSED_RESULT;
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) G_GNUC_WARN_UNUSED_RESULT
+    G_NO_INLINE;
 
 int virNetDevGetVLanID(const char *ifname, int *vlanid)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) G_GNUC_WARN_UNUSED_RESULT;
@@ -214,9 +215,25 @@ int virNetDevGetVLanID(const char *ifname, int *vlanid)
 int virNetDevGetMaster(const char *ifname, char **master)
    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) G_GNUC_WARN_UNUSED_RESULT;
 
+typedef struct _virNetDevLinkSetup virNetDevLinkSetup;
+struct _virNetDevLinkSetup {
+    const char *ifname;
+    const virMacAddr *mac;  /* MAC address to set, or NULL */
+    unsigned int mtu;       /* MTU to set, or 0 */
+    const char *master;     /* bridge to attach the link to, or NULL */
+    virTristateBool online; /* link state to set, or ABSENT */
+};
+
+int virNetDevSetupLinks(const virNetDevLinkSetup *links,
+                        size_t nlinks)
+    G_GNUC_WARN_UNUSED_RESULT;
+
+GHashTable *virNetDevGetAllLinkStats(void)
+    G_GNUC_WARN_UNUSED_RESULT;
+
 int virNetDevValidateConfig(const char *ifname,
                             const virMacAddr *macaddr, int ifindex)
-    ATTRIBUTE_NONNULL(1) G_GNUC_WARN_UNUSED_RESULT;
+    ATTRIBUTE_NONNULL(1) G_GNUC_WARN_UNUSED_RESULT G_NO_INLINE;
 
 int virNetDevIsVirtualFunction(const char *ifname)
     ATTRIBUTE_NONNULL(1) G_GNUC_WARN_UNUSED_RESULT;
@@ -19,11 +19,21 @@
 #include <config.h>
 #include <unistd.h>
 
+#if defined(WITH_LIBNL)
+# include <linux/if_ether.h>
+# include <linux/pkt_cls.h>
+# include <linux/pkt_sched.h>
+# include <linux/rtnetlink.h>
+#endif
+
 #include "virnetdevbandwidth.h"
 #include "vircommand.h"
 #include "viralloc.h"
+#include "virbuffer.h"
 #include "virerror.h"
 #include "virlog.h"
+#include "virnetdev.h"
+#include "virnetlink.h"
 #include "virutil.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
@@ -41,9 +51,8 @@ virNetDevBandwidthFree(virNetDevBandwidth *def)
     g_free(def);
 }
 
-static void
-virNetDevBandwidthCmdAddOptimalQuantum(virCommand *cmd,
-                                       const virNetDevBandwidthRate *rate)
+static unsigned long long
+virNetDevBandwidthOptimalQuantum(const virNetDevBandwidthRate *rate)
 {
     const unsigned long long mtu = 1500;
     const unsigned long long r2q_limit = UINT32_MAX;
@@ -66,18 +75,672 @@ virNetDevBandwidthCmdAddOptimalQuantum(virCommand *cmd,
     if (r2q > r2q_limit)
         r2q = r2q_limit;
 
-    virCommandAddArg(cmd, "quantum");
-    virCommandAddArgFormat(cmd, "%llu", r2q);
+    return r2q;
 }
 
+
+typedef enum {
+    /* failure of the operation is not fatal */
+    VIR_NETDEV_BANDWIDTH_TC_IGNORE_ERROR = (1 << 0),
+    /* the qdisc 1: might have been added by someone else already */
+    VIR_NETDEV_BANDWIDTH_TC_IF_MISSING = (1 << 1),
+} virNetDevBandwidthTCOpFlags;
+
+typedef struct _virNetDevBandwidthTCOp virNetDevBandwidthTCOp;
+struct _virNetDevBandwidthTCOp {
+    unsigned int flags; /* bitwise-OR of virNetDevBandwidthTCOpFlags */
+    GPtrArray *args;    /* the same operation as tc(8) arguments */
+    struct nl_msg *msg; /* rtnetlink request, if netlink is used */
+};
+
+/* A list of traffic control operations on one interface which is
+ * applied at once, either as rtnetlink requests sent together or, if
+ * netlink is not available, by running tc(8) for each of them. */
+typedef struct _virNetDevBandwidthTC virNetDevBandwidthTC;
+struct _virNetDevBandwidthTC {
+    const char *ifname;
+    int ifindex;
+    bool netlink;
+
+    size_t nops;
+    virNetDevBandwidthTCOp *ops;
+};
+
+
 /**
- * virNetDevBandwidthManipulateFilter:
- * @ifname: interface to operate on
- * @ifmac_ptr: MAC of the interface to create filter over
- * @id: filter ID
- * @class_id: where to place traffic
- * @remove_old: whether to remove the filter
- * @create_new: whether to create the filter
+ * virNetDevBandwidthUseNetlink:
+ *
+ * Whether traffic control is set up through rtnetlink rather than by
+ * running tc(8). Tests mock this to compare the operations against
+ * their tc(8) equivalents.
+ */
+bool
+virNetDevBandwidthUseNetlink(void)
+{
+#if defined(WITH_LIBNL)
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+static void
+virNetDevBandwidthTCFree(virNetDevBandwidthTC *tc)
+{
+    size_t i;
+
+    if (!tc)
+        return;
+
+    for (i = 0; i < tc->nops; i++) {
+        g_ptr_array_unref(tc->ops[i].args);
+#if defined(WITH_LIBNL)
+        nlmsg_free(tc->ops[i].msg);
+#endif
+    }
+
+    g_free(tc->ops);
+    g_free(tc);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(virNetDevBandwidthTC, virNetDevBandwidthTCFree);
+
+
+static virNetDevBandwidthTC *
+virNetDevBandwidthTCNew(const char *ifname)
+{
+    g_autoptr(virNetDevBandwidthTC) tc = g_new0(virNetDevBandwidthTC, 1);
+
+    tc->ifname = ifname;
+    tc->netlink = virNetDevBandwidthUseNetlink();
+
+    if (tc->netlink &&
+        virNetDevGetIndex(ifname, &tc->ifindex) < 0)
+        return NULL;
+
+    return g_steal_pointer(&tc);
+}
+
+
+static virNetDevBandwidthTCOp *
+virNetDevBandwidthTCAddOp(virNetDevBandwidthTC *tc,
+                          unsigned int flags,
+                          ...)
+{
+    virNetDevBandwidthTCOp *op;
+    va_list list;
+    const char *arg;
+
+    VIR_EXPAND_N(tc->ops, tc->nops, 1);
+    op = &tc->ops[tc->nops - 1];
+
+    op->flags = flags;
+    op->args = g_ptr_array_new_with_free_func(g_free);
+
+    va_start(list, flags);
+    while ((arg = va_arg(list, const char *)))
+        g_ptr_array_add(op->args, g_strdup(arg));
+    va_end(list);
+
+    return op;
+}
+
+
+static void
+virNetDevBandwidthTCOpAddArgList(virNetDevBandwidthTCOp *op,
+                                 ...)
+{
+    va_list list;
+    const char *arg;
+
+    va_start(list, op);
+    while ((arg = va_arg(list, const char *)))
+        g_ptr_array_add(op->args, g_strdup(arg));
+    va_end(list);
+}
+
+
+#if defined(WITH_LIBNL)
+
+/* The packet scheduler clock of the kernel ticks every 64ns, which
+ * is what tc(8) reads from /proc/net/psched as well. */
+# define VIR_NETDEV_BANDWIDTH_TICKS_PER_USEC (1000.0 / 64)
+
+/* tc(8) uses the clock resolution as HZ, which is 1ns with hrtimers */
+# define VIR_NETDEV_BANDWIDTH_HZ 1000000000ULL
+
+# define VIR_NETDEV_BANDWIDTH_HTB_MTU 1600
+# define VIR_NETDEV_BANDWIDTH_POLICE_MTU (64 * 1024)
+
+static char *
+virNetDevBandwidthTCOpFormat(virNetDevBandwidthTCOp *op)
+{
+    g_auto(virBuffer) buf = VIR_BUFFER_INITIALIZER;
+    size_t i;
+
+    virBufferAddLit(&buf, "tc");
+    for (i = 0; i < op->args->len; i++)
+        virBufferAsprintf(&buf, " %s", (const char *) g_ptr_array_index(op->args, i));
+
+    return virBufferContentAndReset(&buf);
+}
+
+
+/* Time to send @size bytes at @rate bytes per second, in scheduler
+ * ticks. Rounded the same way tc(8) does it. */
+static unsigned int
+virNetDevBandwidthXmitTime(unsigned long long rate,
+                           unsigned long long size)
+{
+    double usec = 1000000.0 * size / rate;
+    double ticks;
+
+    if (usec >= UINT_MAX)
+        return UINT_MAX;
+
+    ticks = (unsigned int) usec * VIR_NETDEV_BANDWIDTH_TICKS_PER_USEC;
+    if (ticks >= UINT_MAX)
+        return UINT_MAX;
+
+    return (unsigned int) ticks;
+}
+
+
+static void
+virNetDevBandwidthRateSpec(struct tc_ratespec *spec,
+                           uint32_t *rtab,
+                           unsigned long long rate,
+                           unsigned int mtu)
+{
+    unsigned int cell_log = 0;
+    size_t i;
+
+    while ((mtu >> cell_log) > 255)
+        cell_log++;
+
+    for (i = 0; i < 256; i++)
+        rtab[i] = virNetDevBandwidthXmitTime(rate, (i + 1) << cell_log);
+
+    spec->rate = MIN(rate, UINT32_MAX);
+    spec->cell_log = cell_log;
+    spec->cell_align = -1;
+    spec->linklayer = TC_LINKLAYER_ETHERNET;
+}
+
+
+static struct nl_msg *
+virNetDevBandwidthTCMsgNew(virNetDevBandwidthTC *tc,
+                           int type,
+                           int flags,
+                           uint32_t parent,
+                           uint32_t handle,
+                           uint32_t info,
+                           const char *kind)
+{
+    struct tcmsg tcm = {
+        .tcm_family = AF_UNSPEC,
+        .tcm_ifindex = tc->ifindex,
+        .tcm_parent = parent,
+        .tcm_handle = handle,
+        .tcm_info = info,
+    };
+    g_autoptr(virNetlinkMsg) msg = virNetlinkMsgNew(type, flags);
+
+    if (nlmsg_append(msg, &tcm, sizeof(tcm), NLMSG_ALIGNTO) < 0 ||
+        (kind && nla_put_string(msg, TCA_KIND, kind) < 0)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("allocated netlink buffer is too small"));
+        return NULL;
+    }
+
+    return g_steal_pointer(&msg);
+}
+
+
+static int
+virNetDevBandwidthTCPutU32Sel(struct nl_msg *msg,
+                              const struct tc_u32_key *keys,
+                              size_t nkeys)
+{
+    size_t len = sizeof(struct tc_u32_sel) + nkeys * sizeof(*keys);
+    g_autofree struct tc_u32_sel *sel = g_malloc0(len);
+
+    sel->flags = TC_U32_TERMINAL;
+    sel->nkeys = nkeys;
+    memcpy(sel->keys, keys, nkeys * sizeof(*keys));
+
+    return nla_put(msg, TCA_U32_SEL, len, sel);
+}
+
+#endif /* WITH_LIBNL */
+
+
+/**
+ * virNetDevBandwidthTCDelQdisc:
+ * @tc: operations list
+ * @id: major number of the qdisc handle, 0 for the root qdisc and
+ *      0xffff for the ingress qdisc
+ *
+ * Delete a qdisc. Failure is not fatal.
+ */
+static int
+virNetDevBandwidthTCDelQdisc(virNetDevBandwidthTC *tc,
+                             unsigned int id)
+{
+    virNetDevBandwidthTCOp *op;
+    g_autofree char *qdisc_id = NULL;
+
+    op = virNetDevBandwidthTCAddOp(tc, VIR_NETDEV_BANDWIDTH_TC_IGNORE_ERROR,
+                                   "qdisc", "del", "dev", tc->ifname, NULL);
+    if (id == 0) {
+        virNetDevBandwidthTCOpAddArgList(op, "root", NULL);
+    } else if (id == 0xffff) {
+        virNetDevBandwidthTCOpAddArgList(op, "ingress", NULL);
+    } else {
+        qdisc_id = g_strdup_printf("%x:", id);
+        virNetDevBandwidthTCOpAddArgList(op, "handle", qdisc_id, NULL);
+    }
+
+#if defined(WITH_LIBNL)
+    if (tc->netlink) {
+        uint32_t parent = 0;
+
+        if (id == 0)
+            parent = TC_H_ROOT;
+        else if (id == 0xffff)
+            parent = TC_H_INGRESS;
+
+        if (!(op->msg = virNetDevBandwidthTCMsgNew(tc, RTM_DELQDISC, 0, parent,
+                                                   parent ? 0 : id << 16,
+                                                   0, NULL)))
+            return -1;
+    }
+#endif
+
+    return 0;
+}
+
+
+/**
+ * virNetDevBandwidthTCAddRootQdisc:
+ * @tc: operations list
+ * @defcls: minor number of the default class
+ *
+ * Add the root HTB qdisc with handle 1:, unless it already exists.
+ */
+static int
+virNetDevBandwidthTCAddRootQdisc(virNetDevBandwidthTC *tc,
+                                 unsigned int defcls)
+{
+    virNetDevBandwidthTCOp *op;
+    g_autofree char *defcls_str = g_strdup_printf("%x", defcls);
+
+    op = virNetDevBandwidthTCAddOp(tc, VIR_NETDEV_BANDWIDTH_TC_IF_MISSING,
+                                   "qdisc", "add", "dev", tc->ifname, "root",
+                                   "handle", "1:", "htb", "default",
+                                   defcls_str, NULL);
+
+#if defined(WITH_LIBNL)
+    if (tc->netlink) {
+        struct tc_htb_glob glob = {
+            .version = 3,
+            .rate2quantum = 10,
+            .defcls = defcls,
+        };
+        struct nlattr *options;
+
+        if (!(op->msg = virNetDevBandwidthTCMsgNew(tc, RTM_NEWQDISC,
+                                                   NLM_F_CREATE | NLM_F_EXCL,
+                                                   TC_H_ROOT, 1 << 16, 0, "htb")))
+            return -1;
+
+        if (!(options = nla_nest_start(op->msg, TCA_OPTIONS)) ||
+            nla_put(op->msg, TCA_HTB_INIT, sizeof(glob), &glob) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("allocated netlink buffer is too small"));
+            return -1;
+        }
+        nla_nest_end(op->msg, options);
+    }
+#endif
+
+    return 0;
+}
+
+
+/**
+ * virNetDevBandwidthTCAddSFQ:
+ * @tc: operations list
+ * @parent: minor number of the parent class 1:@parent
+ * @id: major number of the new qdisc handle
+ *
+ * Add a SFQ qdisc under an HTB class.
+ */
+static int
+virNetDevBandwidthTCAddSFQ(virNetDevBandwidthTC *tc,
+                           unsigned int parent,
+                           unsigned int id)
+{
+    virNetDevBandwidthTCOp *op;
+    g_autofree char *class_id = g_strdup_printf("1:%x", parent);
+    g_autofree char *qdisc_id = g_strdup_printf("%x:", id);
+
+    op = virNetDevBandwidthTCAddOp(tc, 0,
+                                   "qdisc", "add", "dev", tc->ifname,
+                                   "parent", class_id, "handle", qdisc_id,
+                                   "sfq", "perturb", "10", NULL);
+
+#if defined(WITH_LIBNL)
+    if (tc->netlink) {
+        struct tc_sfq_qopt qopt = { .perturb_period = 10 };
+
+        if (!(op->msg = virNetDevBandwidthTCMsgNew(tc, RTM_NEWQDISC,
+                                                   NLM_F_CREATE | NLM_F_EXCL,
+                                                   TC_H_MAKE(1 << 16, parent),
+                                                   id << 16, 0, "sfq")))
+            return -1;
+
+        if (nla_put(op->msg, TCA_OPTIONS, sizeof(qopt), &qopt) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("allocated netlink buffer is too small"));
+            return -1;
+        }
+    }
+#endif
+
+    return 0;
+}
+
+
+/**
+ * virNetDevBandwidthTCAddIngress:
+ * @tc: operations list
+ *
+ * Add the ingress qdisc.
+ */
+static int
+virNetDevBandwidthTCAddIngress(virNetDevBandwidthTC *tc)
+{
+    virNetDevBandwidthTCOp *op;
+
+    op = virNetDevBandwidthTCAddOp(tc, 0,
+                                   "qdisc", "add", "dev", tc->ifname,
+                                   "ingress", NULL);
+
+#if defined(WITH_LIBNL)
+    if (tc->netlink &&
+        !(op->msg = virNetDevBandwidthTCMsgNew(tc, RTM_NEWQDISC,
+                                               NLM_F_CREATE | NLM_F_EXCL,
+                                               TC_H_INGRESS,
+                                               TC_H_MAKE(TC_H_INGRESS, 0),
+                                               0, "ingress")))
+        return -1;
+#endif
+
+    return 0;
+}
+
+
+/**
+ * virNetDevBandwidthTCClass:
+ * @tc: operations list
+ * @change: whether to change an existing class rather than adding one
+ * @parent: minor number of the parent class 1:@parent (0 for the
+ *          qdisc 1: itself), ignored if @change is true
+ * @id: minor number of the class 1:@id
+ * @rate: guaranteed rate in kilobytes per second
+ * @ceil: maximum rate in kilobytes per second, 0 for @rate
+ * @burst: burst size in kibibytes, 0 for the default
+ * @quantum: quantum in bytes
+ *
+ * Add or change an HTB class.
+ */
+static int
+virNetDevBandwidthTCClass(virNetDevBandwidthTC *tc,
+                          bool change,
+                          unsigned int parent,
+                          unsigned int id,
+                          unsigned long long rate,
+                          unsigned long long ceil,
+                          unsigned long long burst,
+                          unsigned long long quantum)
+{
+    virNetDevBandwidthTCOp *op;
+    g_autofree char *parent_id = NULL;
+    g_autofree char *class_id = g_strdup_printf("1:%x", id);
+    g_autofree char *rate_str = g_strdup_printf("%llukbps", rate);
+    g_autofree char *ceil_str = NULL;
+    g_autofree char *burst_str = NULL;
+    g_autofree char *quantum_str = g_strdup_printf("%llu", quantum);
+
+    if (change) {
+        op = virNetDevBandwidthTCAddOp(tc, 0,
+                                       "class", "change", "dev", tc->ifname,
+                                       NULL);
+    } else {
+        if (parent)
+            parent_id = g_strdup_printf("1:%x", parent);
+        else
+            parent_id = g_strdup("1:");
+
+        op = virNetDevBandwidthTCAddOp(tc, 0,
+                                       "class", "add", "dev", tc->ifname,
+                                       "parent", parent_id, NULL);
+    }
+
+    virNetDevBandwidthTCOpAddArgList(op, "classid", class_id, "htb",
+                                     "rate", rate_str, NULL);
+    if (ceil) {
+        ceil_str = g_strdup_printf("%llukbps", ceil);
+        virNetDevBandwidthTCOpAddArgList(op, "ceil", ceil_str, NULL);
+    }
+    if (burst) {
+        burst_str = g_strdup_printf("%llukb", burst);
+        virNetDevBandwidthTCOpAddArgList(op, "burst", burst_str, NULL);
+    }
+    virNetDevBandwidthTCOpAddArgList(op, "quantum", quantum_str, NULL);
+
+#if defined(WITH_LIBNL)
+    if (tc->netlink) {
+        /* tc(8) takes kbps as 1000 bytes and kb as 1024 bytes */
+        uint64_t rate64 = rate * 1000;
+        uint64_t ceil64 = (ceil ? ceil : rate) * 1000;
+        unsigned long long buffer;
+        unsigned long long cbuffer;
+        struct tc_htb_opt opt = { .quantum = quantum };
+        uint32_t rtab[256];
+        uint32_t ctab[256];
+        struct nlattr *options;
+
+        if (burst)
+            buffer = MIN(burst * 1024, UINT_MAX);
+        else
+            buffer = rate64 / VIR_NETDEV_BANDWIDTH_HZ + VIR_NETDEV_BANDWIDTH_HTB_MTU;
+        cbuffer = ceil64 / VIR_NETDEV_BANDWIDTH_HZ + VIR_NETDEV_BANDWIDTH_HTB_MTU;
+
+        virNetDevBandwidthRateSpec(&opt.rate, rtab, rate64,
+                                   VIR_NETDEV_BANDWIDTH_HTB_MTU);
+        virNetDevBandwidthRateSpec(&opt.ceil, ctab, ceil64,
+                                   VIR_NETDEV_BANDWIDTH_HTB_MTU);
+        opt.buffer = virNetDevBandwidthXmitTime(rate64, buffer);
+        opt.cbuffer = virNetDevBandwidthXmitTime(ceil64, cbuffer);
+
+        if (!(op->msg = virNetDevBandwidthTCMsgNew(tc, RTM_NEWTCLASS,
+                                                   change ? 0 : NLM_F_CREATE | NLM_F_EXCL,
+                                                   change ? 0 : TC_H_MAKE(1 << 16, parent),
+                                                   TC_H_MAKE(1 << 16, id),
+                                                   0, "htb")))
+            return -1;
+
+        if (!(options = nla_nest_start(op->msg, TCA_OPTIONS)) ||
+            (rate64 > UINT32_MAX &&
+             nla_put_u64(op->msg, TCA_HTB_RATE64, rate64) < 0) ||
+            (ceil64 > UINT32_MAX &&
+             nla_put_u64(op->msg, TCA_HTB_CEIL64, ceil64) < 0) ||
+            nla_put(op->msg, TCA_HTB_PARMS, sizeof(opt), &opt) < 0 ||
+            nla_put(op->msg, TCA_HTB_RTAB, sizeof(rtab), rtab) < 0 ||
+            nla_put(op->msg, TCA_HTB_CTAB, sizeof(ctab), ctab) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("allocated netlink buffer is too small"));
+            return -1;
+        }
+        nla_nest_end(op->msg, options);
+    }
+#endif
+
+    return 0;
+}
+
+
+/**
+ * virNetDevBandwidthTCDelClass:
+ * @tc: operations list
+ * @id: minor number of the class 1:@id
+ *
+ * Delete an HTB class. Failure is not fatal.
+ */
+static int
+virNetDevBandwidthTCDelClass(virNetDevBandwidthTC *tc,
+                             unsigned int id)
+{
+    virNetDevBandwidthTCOp *op;
+    g_autofree char *class_id = g_strdup_printf("1:%x", id);
+
+    op = virNetDevBandwidthTCAddOp(tc, VIR_NETDEV_BANDWIDTH_TC_IGNORE_ERROR,
+                                   "class", "del", "dev", tc->ifname,
+                                   "classid", class_id, NULL);
+
+#if defined(WITH_LIBNL)
+    if (tc->netlink &&
+        !(op->msg = virNetDevBandwidthTCMsgNew(tc, RTM_DELTCLASS, 0, 0,
+                                               TC_H_MAKE(1 << 16, id),
+                                               0, NULL)))
+        return -1;
+#endif
+
+    return 0;
+}
+
+
+/**
+ * virNetDevBandwidthTCAddFwFilter:
+ * @tc: operations list
+ *
+ * Add the filter placing traffic marked with 1 into the class 1.
+ */
+static int
+virNetDevBandwidthTCAddFwFilter(virNetDevBandwidthTC *tc)
+{
+    virNetDevBandwidthTCOp *op;
+
+    op = virNetDevBandwidthTCAddOp(tc, 0,
+                                   "filter", "add", "dev", tc->ifname,
+                                   "parent", "1:0", "protocol", "all",
+                                   "prio", "1", "handle", "1", "fw",
+                                   "flowid", "1", NULL);
+
+#if defined(WITH_LIBNL)
+    if (tc->netlink) {
+        struct nlattr *options;
+
+        if (!(op->msg = virNetDevBandwidthTCMsgNew(tc, RTM_NEWTFILTER,
+                                                   NLM_F_CREATE | NLM_F_EXCL,
+                                                   1 << 16, 1,
+                                                   TC_H_MAKE(1 << 16, g_htons(ETH_P_ALL)),
+                                                   "fw")))
+            return -1;
+
+        if (!(options = nla_nest_start(op->msg, TCA_OPTIONS)) ||
+            nla_put_u32(op->msg, TCA_FW_CLASSID, 1) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("allocated netlink buffer is too small"));
+            return -1;
+        }
+        nla_nest_end(op->msg, options);
+    }
+#endif
+
+    return 0;
+}
+
+
+/**
+ * virNetDevBandwidthTCAddPoliceFilter:
+ * @tc: operations list
+ * @rate: rate in kilobytes per second
+ * @burst: burst size in kibibytes
+ *
+ * Add the filter policing all ingress traffic to @rate.
+ */
+static int
+virNetDevBandwidthTCAddPoliceFilter(virNetDevBandwidthTC *tc,
+                                    unsigned long long rate,
+                                    unsigned long long burst)
+{
+    virNetDevBandwidthTCOp *op;
+    g_autofree char *rate_str = g_strdup_printf("%llukbps", rate);
+    g_autofree char *burst_str = g_strdup_printf("%llukb", burst);
+
+    /* Set filter to match all ingress traffic */
+    op = virNetDevBandwidthTCAddOp(tc, 0,
+                                   "filter", "add", "dev", tc->ifname,
+                                   "parent", "ffff:", "protocol", "all",
+                                   "u32", "match", "u32", "0", "0",
+                                   "police", "rate", rate_str,
+                                   "burst", burst_str, "mtu", "64kb",
+                                   "drop", "flowid", ":1", NULL);
+
+#if defined(WITH_LIBNL)
+    if (tc->netlink) {
+        uint64_t rate64 = rate * 1000;
+        struct tc_police police = {
+            .action = TC_POLICE_SHOT,
+            .mtu = VIR_NETDEV_BANDWIDTH_POLICE_MTU,
+        };
+        struct tc_u32_key key = { 0 };
+        uint32_t rtab[256];
+        struct nlattr *options;
+        struct nlattr *pol;
+
+        virNetDevBandwidthRateSpec(&police.rate, rtab, rate64,
+                                   VIR_NETDEV_BANDWIDTH_POLICE_MTU);
+        police.burst = virNetDevBandwidthXmitTime(rate64,
+                                                  MIN(burst * 1024, UINT_MAX));
+
+        if (!(op->msg = virNetDevBandwidthTCMsgNew(tc, RTM_NEWTFILTER,
+                                                   NLM_F_CREATE | NLM_F_EXCL,
+                                                   TC_H_MAKE(TC_H_INGRESS, 0), 0,
+                                                   g_htons(ETH_P_ALL), "u32")))
+            return -1;
+
+        if (!(options = nla_nest_start(op->msg, TCA_OPTIONS)) ||
+            nla_put_u32(op->msg, TCA_U32_CLASSID, TC_H_MAKE(0, 1)) < 0 ||
+            virNetDevBandwidthTCPutU32Sel(op->msg, &key, 1) < 0 ||
+            !(pol = nla_nest_start(op->msg, TCA_U32_POLICE)) ||
+            nla_put(op->msg, TCA_POLICE_TBF, sizeof(police), &police) < 0 ||
+            nla_put(op->msg, TCA_POLICE_RATE, sizeof(rtab), rtab) < 0 ||
+            (rate64 > UINT32_MAX &&
+             nla_put_u64(op->msg, TCA_POLICE_RATE64, rate64) < 0)) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("allocated netlink buffer is too small"));
+            return -1;
+        }
+        nla_nest_end(op->msg, pol);
+        nla_nest_end(op->msg, options);
+    }
+#endif
+
+    return 0;
+}
+
+
+/**
+ * virNetDevBandwidthTCMacFilter:
+ * @tc: operations list
+ * @ifmac_ptr: MAC of the interface to create filter over, or NULL to
+ *             delete the filter instead
+ * @id: filter ID, traffic is placed into the class 1:@id
  *
  * TC filters are as crucial for traffic shaping as QDiscs. While
  * QDiscs act like black boxes deciding which packets should be
@@ -87,85 +750,236 @@ virNetDevBandwidthCmdAddOptimalQuantum(virCommand *cmd,
  * bridge) and filter the traffic into QDiscs based on the
  * originating vNET device.
  *
- * Long story short, @ifname is the interface where the filter
- * should be created. The @ifmac_ptr is the MAC address for which
- * the filter should be created (usually different to the MAC
- * address of @ifname). Then, like everything - even filters have
- * an @id which should be unique (per @ifname). And @class_id
- * tells into which QDisc should filter place the traffic.
+ * The @ifmac_ptr is the MAC address for which the filter should
+ * be created (usually different to the MAC address of the
+ * interface of @tc). Then, like everything - even filters have
+ * an @id which should be unique (per interface).
  *
- * This function can be used for both, removing stale filter
- * (@remove_old set to true) and creating new one (@create_new
- * set to true). Both at once for the same price!
+ * Deleting a filter is never fatal.
  *
  * Returns: 0 on success,
  *         -1 otherwise (with error reported).
  */
-static int ATTRIBUTE_NONNULL(1)
-virNetDevBandwidthManipulateFilter(const char *ifname,
-                                   const virMacAddr *ifmac_ptr,
-                                   unsigned int id,
-                                   const char *class_id,
-                                   bool remove_old,
-                                   bool create_new)
-{
-    int ret = -1;
+static int
+virNetDevBandwidthTCMacFilter(virNetDevBandwidthTC *tc,
+                              const virMacAddr *ifmac_ptr,
+                              unsigned int id)
+{
+    virNetDevBandwidthTCOp *op;
     g_autofree char *filter_id = NULL;
-    unsigned char ifmac[VIR_MAC_BUFLEN];
-    char *mac[2] = {NULL, NULL};
-
-    if (!(remove_old || create_new)) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("filter creation API error"));
-        goto cleanup;
-    }
+    g_autofree char *class_id = NULL;
+    unsigned char ifmac[VIR_MAC_BUFLEN] = { 0 };
+    g_autofree char *mac0 = NULL;
+    g_autofree char *mac1 = NULL;
 
     /* u32 filters must have 800:: prefix. Don't ask. Furthermore, handles
      * start at 800. Therefore, we want the filter ID to look like this:
      *   800::(800 + id) */
     filter_id = g_strdup_printf("800::%u", 800 + id);
 
-    if (remove_old) {
-        g_autoptr(virCommand) cmd = virCommandNew(TC);
-        int cmd_ret = 0;
-
-        virCommandAddArgList(cmd, "filter", "del", "dev", ifname,
-                             "prio", "2", "handle",  filter_id, "u32", NULL);
-
-        if (virCommandRun(cmd, &cmd_ret) < 0)
-            goto cleanup;
-
-    }
-
-    if (create_new) {
-        g_autoptr(virCommand) cmd = virCommandNew(TC);
+    if (!ifmac_ptr) {
+        op = virNetDevBandwidthTCAddOp(tc, VIR_NETDEV_BANDWIDTH_TC_IGNORE_ERROR,
+                                       "filter", "del", "dev", tc->ifname,
+                                       "prio", "2", "handle", filter_id,
+                                       "u32", NULL);
+    } else {
         virMacAddrGetRaw(ifmac_ptr, ifmac);
 
-        mac[0] = g_strdup_printf("0x%02x%02x%02x%02x", ifmac[2],
-                                 ifmac[3], ifmac[4], ifmac[5]);
-        mac[1] = g_strdup_printf("0x%02x%02x", ifmac[0], ifmac[1]);
+        class_id = g_strdup_printf("1:%x", id);
+        mac0 = g_strdup_printf("0x%02x%02x%02x%02x", ifmac[2],
+                               ifmac[3], ifmac[4], ifmac[5]);
+        mac1 = g_strdup_printf("0x%02x%02x", ifmac[0], ifmac[1]);
 
         /* Okay, this not nice. But since libvirt does not necessarily track
          * interface IP address(es), and tc fw filter simply refuse to use
          * ebtables marks, we need to use u32 selector to match MAC address.
          * If libvirt will ever know something, remove this FIXME
          */
-        virCommandAddArgList(cmd, "filter", "add", "dev", ifname, "protocol", "ip",
-                             "prio", "2", "handle", filter_id, "u32",
-                             "match", "u16", "0x0800", "0xffff", "at", "-2",
-                             "match", "u32", mac[0], "0xffffffff", "at", "-12",
-                             "match", "u16", mac[1], "0xffff", "at", "-14",
-                             "flowid", class_id, NULL);
+        op = virNetDevBandwidthTCAddOp(tc, 0,
+                                       "filter", "add", "dev", tc->ifname,
+                                       "protocol", "ip", "prio", "2",
+                                       "handle", filter_id, "u32",
+                                       "match", "u16", "0x0800", "0xffff", "at", "-2",
+                                       "match", "u32", mac0, "0xffffffff", "at", "-12",
+                                       "match", "u16", mac1, "0xffff", "at", "-14",
+                                       "flowid", class_id, NULL);
+    }
+
+#if defined(WITH_LIBNL)
+    if (tc->netlink) {
+        /* tc(8) reads the node ID of "800::%u" as a hexadecimal number */
+        unsigned long long nodeid = g_ascii_strtoull(filter_id + 5, NULL, 16);
+        uint32_t handle = (0x800U << 20) | nodeid;
+        struct nlattr *options;
+
+        if (nodeid >= 0x1000) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Invalid filter ID %1$u"), id);
+            return -1;
+        }
+
+        if (!ifmac_ptr) {
+            if (!(op->msg = virNetDevBandwidthTCMsgNew(tc, RTM_DELTFILTER, 0,
+                                                       0, handle,
+                                                       TC_H_MAKE(2 << 16, 0),
+                                                       "u32")))
+                return -1;
+        } else {
+            /* The u16 matches at -2 and -14 are the lower halves of the
+             * 32 bit words at -4 and -16 */
+            struct tc_u32_key keys[] = {
+                { .val = g_htonl(0x0800), .mask = g_htonl(0xffff), .off = -4 },
+                { .val = g_htonl((uint32_t)ifmac[2] << 24 | ifmac[3] << 16 |
+                                 ifmac[4] << 8 | ifmac[5]),
+                  .mask = 0xffffffff, .off = -12 },
+                { .val = g_htonl(ifmac[0] << 8 | ifmac[1]),
+                  .mask = g_htonl(0xffff), .off = -16 },
+            };
+
+            if (!(op->msg = virNetDevBandwidthTCMsgNew(tc, RTM_NEWTFILTER,
+                                                       NLM_F_CREATE | NLM_F_EXCL,
+                                                       0, handle,
+                                                       TC_H_MAKE(2 << 16, g_htons(ETH_P_IP)),
+                                                       "u32")))
+                return -1;
+
+            if (!(options = nla_nest_start(op->msg, TCA_OPTIONS)) ||
+                nla_put_u32(op->msg, TCA_U32_CLASSID, TC_H_MAKE(1 << 16, id)) < 0 ||
+                virNetDevBandwidthTCPutU32Sel(op->msg, keys, G_N_ELEMENTS(keys)) < 0) {
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("allocated netlink buffer is too small"));
+                return -1;
+            }
+            nla_nest_end(op->msg, options);
+        }
+    }
+#endif
+
+    return 0;
+}
+
+
+static int
+virNetDevBandwidthTCRunCommands(virNetDevBandwidthTC *tc)
+{
+    size_t i;
+
+    for (i = 0; i < tc->nops; i++) {
+        virNetDevBandwidthTCOp *op = &tc->ops[i];
+        g_autoptr(virCommand) cmd = NULL;
+        int status = 0;
+        size_t j;
+
+        if (op->flags & VIR_NETDEV_BANDWIDTH_TC_IF_MISSING) {
+            g_autoptr(virCommand) testCmd = NULL;
+            g_autofree char *testResult = NULL;
+
+            /* first check it the qdisc with handle 1: was already added for
+             * this interface by someone else
+             */
+            testCmd = virCommandNew(TC);
+            virCommandAddArgList(testCmd, "qdisc", "show", "dev", tc->ifname,
+                                 "handle", "1:", NULL);
+            virCommandSetOutputBuffer(testCmd, &testResult);
+
+            if (virCommandRun(testCmd, NULL) < 0)
+                return -1;
+
+            /* output will be something like: "qdisc htb 1: root refcnt ..."
+             * if the qdisc was already added. We just search for "qdisc" and
+             * " 1: " anywhere in the output to allow for tc changing its
+             * output format.
+             */
+            if (testResult && strstr(testResult, "qdisc") && strstr(testResult, " 1: "))
+                continue;
+        }
+
+        cmd = virCommandNew(TC);
+        for (j = 0; j < op->args->len; j++)
+            virCommandAddArg(cmd, g_ptr_array_index(op->args, j));
+
+        /* Failing to remove something is not fatal, so that as
+         * much as possible gets removed */
+        if (virCommandRun(cmd,
+                          op->flags & VIR_NETDEV_BANDWIDTH_TC_IGNORE_ERROR ?
+                          &status : NULL) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * virNetDevBandwidthTCRun:
+ * @tc: operations list
+ *
+ * Apply all operations of @tc. With netlink, all the requests are
+ * sent to the kernel at once, which processes them in order. Unlike
+ * when running tc(8), operations after a failed one are still
+ * applied.
+ *
+ * Returns 0 on success, -1 otherwise (with error reported).
+ */
+static int
+virNetDevBandwidthTCRun(virNetDevBandwidthTC *tc)
+{
+#if defined(WITH_LIBNL)
+    g_autofree struct nl_msg **msgs = NULL;
+    g_autofree int *errors = NULL;
+    size_t i;
+
+    if (!tc->netlink)
+        return virNetDevBandwidthTCRunCommands(tc);
+
+    msgs = g_new0(struct nl_msg *, tc->nops);
+    errors = g_new0(int, tc->nops);
+
+    for (i = 0; i < tc->nops; i++)
+        msgs[i] = tc->ops[i].msg;
+
+    if (virNetlinkCommandBatch(msgs, tc->nops, errors, NETLINK_ROUTE) < 0)
+        return -1;
+
+    for (i = 0; i < tc->nops; i++) {
+        virNetDevBandwidthTCOp *op = &tc->ops[i];
+        g_autofree char *cmdstr = NULL;
+
+        if (errors[i] == 0)
+            continue;
+
+        cmdstr = virNetDevBandwidthTCOpFormat(op);
+
+        /* An HTB qdisc 1: already added by someone else is fine, any
+         * other root qdisc makes adding classes to 1: fail later. */
+        if (op->flags & VIR_NETDEV_BANDWIDTH_TC_IGNORE_ERROR ||
+            (op->flags & VIR_NETDEV_BANDWIDTH_TC_IF_MISSING &&
+             errors[i] == -EEXIST)) {
+            VIR_DEBUG("Ignoring failure of '%s': %s",
+                      cmdstr, g_strerror(-errors[i]));
+            continue;
+        }
 
-        if (virCommandRun(cmd, NULL) < 0)
-            goto cleanup;
+        virReportSystemError(-errors[i],
+                             _("Unable to apply '%1$s'"), cmdstr);
+        return -1;
     }
 
-    ret = 0;
- cleanup:
-    VIR_FREE(mac[1]);
-    VIR_FREE(mac[0]);
-    return ret;
+    return 0;
+#else
+    return virNetDevBandwidthTCRunCommands(tc);
+#endif
+}
+
+
+static int
+virNetDevBandwidthTCClear(virNetDevBandwidthTC *tc)
+{
+    if (virNetDevBandwidthTCDelQdisc(tc, 0) < 0 ||
+        virNetDevBandwidthTCDelQdisc(tc, 0xffff) < 0)
+        return -1;
+
+    return 0;
 }
 
 
@@ -218,19 +1032,14 @@ virNetDevBandwidthSet(const char *ifname,
                       const virNetDevBandwidth *bandwidth,
                       unsigned int flags)
 {
-    int ret = -1;
+    g_autoptr(virNetDevBandwidthTC) tc = NULL;
     virNetDevBandwidthRate *rx = NULL; /* From domain POV */
     virNetDevBandwidthRate *tx = NULL; /* From domain POV */
-    virCommand *cmd = NULL;
-    char *average = NULL;
-    char *peak = NULL;
-    char *burst = NULL;
     bool hierarchical_class = flags & VIR_NETDEV_BANDWIDTH_SET_HIERARCHICAL_CLASS;
 
     if (!bandwidth) {
         /* nothing to be enabled */
-        ret = 0;
-        goto cleanup;
+        return 0;
     }
 
     if (geteuid() != 0) {
@@ -253,21 +1062,21 @@ virNetDevBandwidthSet(const char *ifname,
         tx = bandwidth->out;
     }
 
+    if (!(tc = virNetDevBandwidthTCNew(ifname)))
+        return -1;
+
     /* Only if the caller requests, clear everything including root
      * qdisc and all filters before adding everything.
      */
-    if (flags & VIR_NETDEV_BANDWIDTH_SET_CLEAR_ALL)
-        virNetDevBandwidthClear(ifname);
+    if (flags & VIR_NETDEV_BANDWIDTH_SET_CLEAR_ALL &&
+        virNetDevBandwidthTCClear(tc) < 0)
+        return -1;
 
     if (tx && tx->average) {
-        average = g_strdup_printf("%llukbps", tx->average);
-        if (tx->peak)
-            peak = g_strdup_printf("%llukbps", tx->peak);
-        if (tx->burst)
-            burst = g_strdup_printf("%llukb", tx->burst);
+        unsigned long long quantum = virNetDevBandwidthOptimalQuantum(tx);
 
-        if (virNetDevBandWidthAddTxFilterParentQdisc(ifname, hierarchical_class) < 0)
-            goto cleanup;
+        if (virNetDevBandwidthTCAddRootQdisc(tc, hierarchical_class ? 2 : 1) < 0)
+            return -1;
 
         /* If we are creating a hierarchical class, all non guaranteed traffic
          * goes to the 1:2 class which will adjust 'rate' dynamically as NICs
@@ -332,99 +1141,38 @@ virNetDevBandwidthSet(const char *ifname,
          * This description is rather long, but it is still a good idea to read
          * it before you dig into the code.
          */
-        if (hierarchical_class) {
-            virCommandFree(cmd);
-            cmd = virCommandNew(TC);
-            virCommandAddArgList(cmd, "class", "add", "dev", ifname, "parent",
-                                 "1:", "classid", "1:1", "htb", "rate", average,
-                                 "ceil", peak ? peak : average, NULL);
-            virNetDevBandwidthCmdAddOptimalQuantum(cmd, tx);
-            if (virCommandRun(cmd, NULL) < 0)
-                goto cleanup;
-        }
-        virCommandFree(cmd);
-        cmd = virCommandNew(TC);
-        virCommandAddArgList(cmd, "class", "add", "dev", ifname, "parent",
-                             hierarchical_class ? "1:1" : "1:", "classid",
-                             hierarchical_class ? "1:2" : "1:1", "htb",
-                             "rate", average, NULL);
-
-        if (peak)
-            virCommandAddArgList(cmd, "ceil", peak, NULL);
-        if (burst)
-            virCommandAddArgList(cmd, "burst", burst, NULL);
-
-        virNetDevBandwidthCmdAddOptimalQuantum(cmd, tx);
-        if (virCommandRun(cmd, NULL) < 0)
-            goto cleanup;
-
-        virCommandFree(cmd);
-        cmd = virCommandNew(TC);
-        virCommandAddArgList(cmd, "qdisc", "add", "dev", ifname, "parent",
-                             hierarchical_class ? "1:2" : "1:1",
-                             "handle", "2:", "sfq", "perturb",
-                             "10", NULL);
-
-        if (virCommandRun(cmd, NULL) < 0)
-            goto cleanup;
-
-        virCommandFree(cmd);
-        cmd = virCommandNew(TC);
-        virCommandAddArgList(cmd, "filter", "add", "dev", ifname, "parent",
-                             "1:0", "protocol", "all", "prio", "1", "handle",
-                             "1", "fw", "flowid", "1", NULL);
-
-        if (virCommandRun(cmd, NULL) < 0)
-            goto cleanup;
-
-        VIR_FREE(average);
-        VIR_FREE(peak);
-        VIR_FREE(burst);
+        if (hierarchical_class &&
+            virNetDevBandwidthTCClass(tc, false, 0, 1, tx->average,
+                                      tx->peak ? tx->peak : tx->average,
+                                      0, quantum) < 0)
+            return -1;
+
+        if (virNetDevBandwidthTCClass(tc, false,
+                                      hierarchical_class ? 1 : 0,
+                                      hierarchical_class ? 2 : 1,
+                                      tx->average, tx->peak, tx->burst,
+                                      quantum) < 0 ||
+            virNetDevBandwidthTCAddSFQ(tc, hierarchical_class ? 2 : 1, 2) < 0 ||
+            virNetDevBandwidthTCAddFwFilter(tc) < 0)
+            return -1;
     }
 
     if (rx) {
-        average = g_strdup_printf("%llukbps", rx->average);
+        unsigned long long burst = rx->burst;
 
-        if (rx->burst) {
-            burst = g_strdup_printf("%llukb", rx->burst);
-        } else {
+        if (!burst) {
             /* Internally, tc uses uint to store burst size (in bytes).
              * Therefore, the largest value we can set is UINT_MAX bytes.
              * We're outputting the vale in KiB though. */
-            unsigned long long avg = MIN(rx->average, UINT_MAX / 1024);
-
-            burst = g_strdup_printf("%llukb", avg);
+            burst = MIN(rx->average, UINT_MAX / 1024);
         }
 
-        virCommandFree(cmd);
-        cmd = virCommandNew(TC);
-            virCommandAddArgList(cmd, "qdisc", "add", "dev", ifname,
-                                 "ingress", NULL);
-
-        if (virCommandRun(cmd, NULL) < 0)
-            goto cleanup;
-
-        virCommandFree(cmd);
-        cmd = virCommandNew(TC);
-        /* Set filter to match all ingress traffic */
-        virCommandAddArgList(cmd, "filter", "add", "dev", ifname, "parent",
-                             "ffff:", "protocol", "all", "u32", "match", "u32",
-                             "0", "0", "police", "rate", average,
-                             "burst", burst, "mtu", "64kb", "drop", "flowid",
-                             ":1", NULL);
-
-        if (virCommandRun(cmd, NULL) < 0)
-            goto cleanup;
+        if (virNetDevBandwidthTCAddIngress(tc) < 0 ||
+            virNetDevBandwidthTCAddPoliceFilter(tc, rx->average, burst) < 0)
+            return -1;
     }
 
-    ret = 0;
-
- cleanup:
-    virCommandFree(cmd);
-    VIR_FREE(average);
-    VIR_FREE(peak);
-    VIR_FREE(burst);
-    return ret;
+    return virNetDevBandwidthTCRun(tc);
 }
 
 /**
@@ -440,27 +1188,20 @@ virNetDevBandwidthSet(const char *ifname,
 int
 virNetDevBandwidthClear(const char *ifname)
 {
-    int ret = 0;
-    int dummy; /* for ignoring the exit status */
-    g_autoptr(virCommand) rootcmd = NULL;
-    g_autoptr(virCommand) ingresscmd = NULL;
+    g_autoptr(virNetDevBandwidthTC) tc = NULL;
 
     if (!ifname)
        return 0;
 
-    rootcmd = virCommandNew(TC);
-    virCommandAddArgList(rootcmd, "qdisc", "del", "dev", ifname, "root", NULL);
-
-    if (virCommandRun(rootcmd, &dummy) < 0)
-        ret = -1;
-
-    ingresscmd = virCommandNew(TC);
-    virCommandAddArgList(ingresscmd, "qdisc",  "del", "dev", ifname, "ingress", NULL);
+    /* nothing to clear on an interface which is gone already */
+    if (virNetDevBandwidthUseNetlink() && virNetDevExists(ifname) == 0)
+        return 0;
 
-    if (virCommandRun(ingresscmd, &dummy) < 0)
-        ret = -1;
+    if (!(tc = virNetDevBandwidthTCNew(ifname)) ||
+        virNetDevBandwidthTCClear(tc) < 0)
+        return -1;
 
-    return ret;
+    return virNetDevBandwidthTCRun(tc);
 }
 
 /*
@@ -564,12 +1305,7 @@ virNetDevBandwidthPlug(const char *brname,
                        virNetDevBandwidth *bandwidth,
                        unsigned int id)
 {
-    g_autoptr(virCommand) cmd1 = NULL;
-    g_autoptr(virCommand) cmd2 = NULL;
-    g_autofree char *class_id = NULL;
-    g_autofree char *qdisc_id = NULL;
-    g_autofree char *floor = NULL;
-    g_autofree char *ceil = NULL;
+    g_autoptr(virNetDevBandwidthTC) tc = NULL;
     char ifmacStr[VIR_MAC_STRING_BUFLEN];
 
     if (id <= 2) {
@@ -586,35 +1322,17 @@ virNetDevBandwidthPlug(const char *brname,
         return -1;
     }
 
-    class_id = g_strdup_printf("1:%x", id);
-    qdisc_id = g_strdup_printf("%x:", id);
-    floor = g_strdup_printf("%llukbps", bandwidth->in->floor);
-    ceil = g_strdup_printf("%llukbps", net_bandwidth->in->peak ?
-                           net_bandwidth->in->peak :
-                           net_bandwidth->in->average);
-
-    cmd1 = virCommandNew(TC);
-    virCommandAddArgList(cmd1, "class", "add", "dev", brname, "parent", "1:1",
-                         "classid", class_id, "htb", "rate", floor,
-                         "ceil", ceil, NULL);
-    virNetDevBandwidthCmdAddOptimalQuantum(cmd1, bandwidth->in);
-
-    if (virCommandRun(cmd1, NULL) < 0)
-        return -1;
-
-    cmd2 = virCommandNew(TC);
-    virCommandAddArgList(cmd2, "qdisc", "add", "dev", brname, "parent",
-                         class_id, "handle", qdisc_id, "sfq", "perturb",
-                         "10", NULL);
-
-    if (virCommandRun(cmd2, NULL) < 0)
-        return -1;
-
-    if (virNetDevBandwidthManipulateFilter(brname, ifmac_ptr, id,
-                                           class_id, false, true) < 0)
+    if (!(tc = virNetDevBandwidthTCNew(brname)) ||
+        virNetDevBandwidthTCClass(tc, false, 1, id, bandwidth->in->floor,
+                                  net_bandwidth->in->peak ?
+                                  net_bandwidth->in->peak :
+                                  net_bandwidth->in->average,
+                                  0, virNetDevBandwidthOptimalQuantum(bandwidth->in)) < 0 ||
+        virNetDevBandwidthTCAddSFQ(tc, id, id) < 0 ||
+        virNetDevBandwidthTCMacFilter(tc, ifmac_ptr, id) < 0)
         return -1;
 
-    return 0;
+    return virNetDevBandwidthTCRun(tc);
 }
 
 /*
@@ -630,41 +1348,22 @@ int
 virNetDevBandwidthUnplug(const char *brname,
                          unsigned int id)
 {
-    int cmd_ret = 0;
-    g_autoptr(virCommand) cmd1 = NULL;
-    g_autoptr(virCommand) cmd2 = NULL;
-    g_autofree char *class_id = NULL;
-    g_autofree char *qdisc_id = NULL;
+    g_autoptr(virNetDevBandwidthTC) tc = NULL;
 
     if (id <= 2) {
         virReportError(VIR_ERR_INTERNAL_ERROR, _("Invalid class ID %1$d"), id);
         return -1;
     }
 
-    class_id = g_strdup_printf("1:%x", id);
-    qdisc_id = g_strdup_printf("%x:", id);
-
-    cmd1 = virCommandNew(TC);
-    virCommandAddArgList(cmd1, "qdisc", "del", "dev", brname,
-                         "handle", qdisc_id, NULL);
-
     /* Don't threat tc errors as fatal, but
      * try to remove as much as possible */
-    if (virCommandRun(cmd1, &cmd_ret) < 0)
-        return -1;
-
-    if (virNetDevBandwidthManipulateFilter(brname, NULL, id,
-                                           NULL, true, false) < 0)
-        return -1;
-
-    cmd2 = virCommandNew(TC);
-    virCommandAddArgList(cmd2, "class", "del", "dev", brname,
-                         "classid", class_id, NULL);
-
-    if (virCommandRun(cmd2, &cmd_ret) < 0)
+    if (!(tc = virNetDevBandwidthTCNew(brname)) ||
+        virNetDevBandwidthTCDelQdisc(tc, id) < 0 ||
+        virNetDevBandwidthTCMacFilter(tc, NULL, id) < 0 ||
+        virNetDevBandwidthTCDelClass(tc, id) < 0)
         return -1;
 
-    return 0;
+    return virNetDevBandwidthTCRun(tc);
 }
 
 /**
@@ -687,24 +1386,17 @@ virNetDevBandwidthUpdateRate(const char *ifname,
                              virNetDevBandwidth *bandwidth,
                              unsigned long long new_rate)
 {
-    g_autoptr(virCommand) cmd = NULL;
-    g_autofree char *class_id = NULL;
-    g_autofree char *rate = NULL;
-    g_autofree char *ceil = NULL;
-
-    class_id = g_strdup_printf("1:%x", id);
-    rate = g_strdup_printf("%llukbps", new_rate);
-    ceil = g_strdup_printf("%llukbps", bandwidth->in->peak ?
-                           bandwidth->in->peak :
-                           bandwidth->in->average);
-
-    cmd = virCommandNew(TC);
-    virCommandAddArgList(cmd, "class", "change", "dev", ifname,
-                         "classid", class_id, "htb", "rate", rate,
-                         "ceil", ceil, NULL);
-    virNetDevBandwidthCmdAddOptimalQuantum(cmd, bandwidth->in);
+    g_autoptr(virNetDevBandwidthTC) tc = NULL;
+
+    if (!(tc = virNetDevBandwidthTCNew(ifname)) ||
+        virNetDevBandwidthTCClass(tc, true, 0, id, new_rate,
+                                  bandwidth->in->peak ?
+                                  bandwidth->in->peak :
+                                  bandwidth->in->average,
+                                  0, virNetDevBandwidthOptimalQuantum(bandwidth->in)) < 0)
+        return -1;
 
-    return virCommandRun(cmd, NULL);
+    return virNetDevBandwidthTCRun(tc);
 }
 
 /**
@@ -729,19 +1421,14 @@ virNetDevBandwidthUpdateFilter(const char *ifname,
                                const virMacAddr *ifmac_ptr,
                                unsigned int id)
 {
-    int ret = -1;
-    char *class_id = NULL;
-
-    class_id = g_strdup_printf("1:%x", id);
+    g_autoptr(virNetDevBandwidthTC) tc = NULL;
 
-    if (virNetDevBandwidthManipulateFilter(ifname, ifmac_ptr, id,
-                                           class_id, true, true) < 0)
-        goto cleanup;
+    if (!(tc = virNetDevBandwidthTCNew(ifname)) ||
+        virNetDevBandwidthTCMacFilter(tc, NULL, id) < 0 ||
+        virNetDevBandwidthTCMacFilter(tc, ifmac_ptr, id) < 0)
+        return -1;
 
-    ret = 0;
- cleanup:
-    VIR_FREE(class_id);
-    return ret;
+    return virNetDevBandwidthTCRun(tc);
 }
 
 
@@ -757,8 +1444,9 @@ virNetDevBandwidthUpdateFilter(const char *ifname,
  * /proc/sys/net/core/default_qdisc) with different qdisc.
  *
  * Returns: 0 on success,
- *         -1 if failed to exec tc (with error reported)
- *         -2 if tc failed (with no error reported)
+ *         -1 if failed to exec tc or to talk to the kernel (with
+ *            error reported)
+ *         -2 if setting the qdisc failed (with no error reported)
  */
 int
 virNetDevBandwidthSetRootQDisc(const char *ifname,
@@ -769,9 +1457,30 @@ virNetDevBandwidthSetRootQDisc(const char *ifname,
     g_autofree char *errbuf = NULL;
     int status;
 
-    /* Ideally, we would have a netlink implementation and just
-     * call it here.  But honestly, I tried and failed miserably.
-     * Fallback to spawning tc. */
+#if defined(WITH_LIBNL)
+    if (virNetDevBandwidthUseNetlink()) {
+        g_autoptr(virNetDevBandwidthTC) tc = NULL;
+        g_autoptr(virNetlinkMsg) msg = NULL;
+        int error = 0;
+
+        if (!(tc = virNetDevBandwidthTCNew(ifname)) ||
+            !(msg = virNetDevBandwidthTCMsgNew(tc, RTM_NEWQDISC,
+                                               NLM_F_CREATE | NLM_F_EXCL,
+                                               TC_H_ROOT, 0, 0, qdisc)))
+            return -1;
+
+        if (virNetlinkCommandBatch(&msg, 1, &error, NETLINK_ROUTE) < 0)
+            return -1;
+
+        if (error < 0) {
+            VIR_DEBUG("Setting qdisc failed: %s", g_strerror(-error));
+            return -2;
+        }
+
+        return 0;
+    }
+#endif
+
     cmd = virCommandNewArgList(TC, "qdisc", "add", "dev", ifname,
                                "root", "handle", "0:", qdisc,
                                NULL);
@@ -805,35 +1514,14 @@ int
 virNetDevBandWidthAddTxFilterParentQdisc(const char *ifname,
                                          bool hierarchical_class)
 {
-    g_autoptr(virCommand) testCmd = NULL;
-    g_autofree char *testResult = NULL;
+    g_autoptr(virNetDevBandwidthTC) tc = g_new0(virNetDevBandwidthTC, 1);
 
-    /* first check it the qdisc with handle 1: was already added for
-     * this interface by someone else
-     */
-    testCmd = virCommandNew(TC);
-    virCommandAddArgList(testCmd, "qdisc", "show", "dev", ifname,
-                         "handle", "1:", NULL);
-    virCommandSetOutputBuffer(testCmd, &testResult);
+    /* The caller adds its filters by running tc right after this, so
+     * there's nothing to be saved by using netlink here. */
+    tc->ifname = ifname;
 
-    if (virCommandRun(testCmd, NULL) < 0)
+    if (virNetDevBandwidthTCAddRootQdisc(tc, hierarchical_class ? 2 : 1) < 0)
         return -1;
 
-    /* output will be something like: "qdisc htb 1: root refcnt ..."
-     * if the qdisc was already added. We just search for "qdisc" and
-     * " 1: " anywhere in the output to allow for tc changing its
-     * output format.
-     */
-    if (!(testResult && strstr(testResult, "qdisc") && strstr(testResult, " 1: "))) {
-        /* didn't find qdisc in output, so we need to add one */
-        g_autoptr(virCommand) addCmd = virCommandNew(TC);
-
-        virCommandAddArgList(addCmd, "qdisc", "add", "dev", ifname, "root",
-                             "handle", "1:", "htb", "default",
-                             hierarchical_class ? "2" : "1", NULL);
-
-        return virCommandRun(addCmd, NULL);
-    }
-
-    return 0;
+    return virNetDevBandwidthTCRunCommands(tc);
 }
@@ -87,3 +87,6 @@ int virNetDevBandwidthSetRootQDisc(const char *ifname,
 
 int virNetDevBandWidthAddTxFilterParentQdisc(const char *ifname,
                                              bool hierarchical_class);
+
+bool virNetDevBandwidthUseNetlink(void)
+    G_NO_INLINE;
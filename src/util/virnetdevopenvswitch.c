@@ -29,6 +29,7 @@
 #include "virstring.h"
 #include "virlog.h"
 #include "virjson.h"
+#include "virhash.h"
 #include "virfile.h"
 #include "virutil.h"
 
@@ -296,29 +297,18 @@ int virNetDevOpenvswitchSetMigrateData(char *migrate, const char *ifname)
 }
 
 
-/**
- * virNetDevOpenvswitchInterfaceParseStats:
- * @json: Input string in JSON format
- * @stats: parsed stats
- *
- * For given input string @json parse interface statistics and store them into
- * @stats.
- *
- * Returns: 0 on success,
- *         -1 otherwise (with error reported).
- */
-int
-virNetDevOpenvswitchInterfaceParseStats(const char *json,
-                                        virDomainInterfaceStatsPtr stats)
+/* Fill @stats from an OVS ["map", [[key, value], ...]] statistics column */
+static int
+virNetDevOpenvswitchInterfaceParseStatsMap(virJSONValue *jsonStats,
+                                           virDomainInterfaceStatsPtr stats)
 {
-    g_autoptr(virJSONValue) jsonStats = NULL;
     virJSONValue *jsonMap = NULL;
     size_t i;
 
     stats->rx_bytes = stats->rx_packets = stats->rx_errs = stats->rx_drop = -1;
     stats->tx_bytes = stats->tx_packets = stats->tx_errs = stats->tx_drop = -1;
 
-    if (!(jsonStats = virJSONValueFromString(json)) ||
+    if (!jsonStats ||
         !virJSONValueIsArray(jsonStats) ||
         !(jsonMap = virJSONValueArrayGet(jsonStats, 1))) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -369,6 +359,49 @@ virNetDevOpenvswitchInterfaceParseStats(const char *json,
     return 0;
 }
 
+
+static bool
+virNetDevOpenvswitchInterfaceStatsEmpty(virDomainInterfaceStatsPtr stats)
+{
+    return stats->rx_bytes == -1 &&
+           stats->rx_packets == -1 &&
+           stats->rx_errs == -1 &&
+           stats->rx_drop == -1 &&
+           stats->tx_bytes == -1 &&
+           stats->tx_packets == -1 &&
+           stats->tx_errs == -1 &&
+           stats->tx_drop == -1;
+}
+
+
+/**
+ * virNetDevOpenvswitchInterfaceParseStats:
+ * @json: Input string in JSON format
+ * @stats: parsed stats
+ *
+ * For given input string @json parse interface statistics and store them into
+ * @stats.
+ *
+ * Returns: 0 on success,
+ *         -1 otherwise (with error reported).
+ */
+int
+virNetDevOpenvswitchInterfaceParseStats(const char *json,
+                                        virDomainInterfaceStatsPtr stats)
+{
+    g_autoptr(virJSONValue) jsonStats = NULL;
+
+    if (!(jsonStats = virJSONValueFromString(json))) {
+        stats->rx_bytes = stats->rx_packets = stats->rx_errs = stats->rx_drop = -1;
+        stats->tx_bytes = stats->tx_packets = stats->tx_errs = stats->tx_drop = -1;
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Unable to parse ovs-vsctl output"));
+        return -1;
+    }
+
+    return virNetDevOpenvswitchInterfaceParseStatsMap(jsonStats, stats);
+}
+
 /**
  * virNetDevOpenvswitchInterfaceStats:
  * @ifname: the name of the interface
@@ -411,14 +444,7 @@ virNetDevOpenvswitchInterfaceStats(const char *ifname,
     if (virNetDevOpenvswitchInterfaceParseStats(output, stats) < 0)
         return -1;
 
-    if (stats->rx_bytes == -1 &&
-        stats->rx_packets == -1 &&
-        stats->rx_errs == -1 &&
-        stats->rx_drop == -1 &&
-        stats->tx_bytes == -1 &&
-        stats->tx_packets == -1 &&
-        stats->tx_errs == -1 &&
-        stats->tx_drop == -1) {
+    if (virNetDevOpenvswitchInterfaceStatsEmpty(stats)) {
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                        _("Interface doesn't have any statistics"));
         return -1;
@@ -428,6 +454,79 @@ virNetDevOpenvswitchInterfaceStats(const char *ifname,
 }
 
 
+/**
+ * virNetDevOpenvswitchInterfaceStatsAll:
+ *
+ * Retrieves the stats of all OVS interfaces with a single ovs-vsctl
+ * call. Interfaces without any statistics are left out.
+ *
+ * Returns a hash table of virDomainInterfaceStatsStruct keyed by
+ * interface name, or NULL in case of failure (with error reported).
+ */
+GHashTable *
+virNetDevOpenvswitchInterfaceStatsAll(void)
+{
+    g_autofree char *errbuf = NULL;
+    g_autoptr(virCommand) cmd = virNetDevOpenvswitchCreateCmd(&errbuf);
+    g_autofree char *output = NULL;
+    g_autoptr(virJSONValue) json = NULL;
+    g_autoptr(GHashTable) ifaces = virHashNew(g_free);
+    virJSONValue *rows;
+    size_t i;
+
+    virCommandAddArgList(cmd, "--format=json", "--columns=name,statistics",
+                         "list", "Interface", NULL);
+    virCommandSetOutputBuffer(cmd, &output);
+
+    /* The above command returns a JSON object, for instance:
+     *    {"data":[["vnet0",["map",[["collisions",0],["rx_bytes",0],...]]],
+     *             ["vnet1",["map",[...]]]],
+     *     "headings":["name","statistics"]}
+     */
+
+    if (virCommandRun(cmd, NULL) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Unable to list OVS interfaces: %1$s"),
+                       NULLSTR(errbuf));
+        return NULL;
+    }
+
+    if (!(json = virJSONValueFromString(output)) ||
+        !(rows = virJSONValueObjectGetArray(json, "data"))) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("Unable to parse ovs-vsctl output"));
+        return NULL;
+    }
+
+    for (i = 0; i < virJSONValueArraySize(rows); i++) {
+        virJSONValue *row = virJSONValueArrayGet(rows, i);
+        g_autofree virDomainInterfaceStatsPtr stats = NULL;
+        virJSONValue *jsonName;
+        const char *name;
+
+        if (!(jsonName = virJSONValueArrayGet(row, 0)) ||
+            !(name = virJSONValueGetString(jsonName))) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Malformed ovs-vsctl output"));
+            return NULL;
+        }
+
+        stats = g_new0(virDomainInterfaceStatsStruct, 1);
+
+        if (virNetDevOpenvswitchInterfaceParseStatsMap(virJSONValueArrayGet(row, 1),
+                                                       stats) < 0)
+            return NULL;
+
+        if (virNetDevOpenvswitchInterfaceStatsEmpty(stats))
+            continue;
+
+        g_hash_table_insert(ifaces, g_strdup(name), g_steal_pointer(&stats));
+    }
+
+    return g_steal_pointer(&ifaces);
+}
+
+
 /**
  * virNetDevOpenvswitchInterfaceGetMaster:
  * @ifname: name of interface we're interested in
@@ -58,6 +58,9 @@ int virNetDevOpenvswitchInterfaceStats(const char *ifname,
                                        virDomainInterfaceStatsPtr stats)
     ATTRIBUTE_NONNULL(1) G_GNUC_WARN_UNUSED_RESULT;
 
+GHashTable *virNetDevOpenvswitchInterfaceStatsAll(void)
+    G_GNUC_WARN_UNUSED_RESULT;
+
 int
 virNetDevOpenvswitchMaybeUnescapeReply(char *reply)
     ATTRIBUTE_NONNULL(1) G_GNUC_WARN_UNUSED_RESULT;
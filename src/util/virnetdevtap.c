@@ -574,6 +574,58 @@ virNetDevTapReattachBridge(const char *tapname,
 }
 
 
+#if defined(WITH_LIBNL)
+static int
+virNetDevTapSetupBridgePort(const char *tapname,
+                            const char *brname,
+                            const virMacAddr *tapmac,
+                            virTristateBool isolatedPort,
+                            unsigned int mtu,
+                            unsigned int *actualMTU,
+                            unsigned int flags)
+{
+    virNetDevLinkSetup link = {
+        .ifname = tapname,
+        .mac = tapmac,
+        .mtu = mtu,
+        .master = brname,
+        .online = (flags & VIR_NETDEV_TAP_CREATE_IFUP) ?
+                  VIR_TRISTATE_BOOL_YES : VIR_TRISTATE_BOOL_NO,
+    };
+
+    /* Just like in virNetDevTapAttachBridge, a tap device without MTU
+     * of its own takes the MTU of the bridge, so that attaching it
+     * doesn't change the bridge's MTU. */
+    if (mtu == 0) {
+        int brMTU = virNetDevGetMTU(brname);
+
+        if (brMTU < 0)
+            return -1;
+
+        link.mtu = brMTU;
+    }
+
+    if (virNetDevSetupLinks(&link, 1) < 0)
+        return -1;
+
+    if (actualMTU)
+        *actualMTU = link.mtu;
+
+    if (isolatedPort == VIR_TRISTATE_BOOL_YES &&
+        virNetDevBridgePortSetIsolated(brname, tapname, true) < 0) {
+        virErrorPtr err;
+
+        virErrorPreserveLast(&err);
+        ignore_value(virNetDevBridgeRemovePort(brname, tapname));
+        virErrorRestore(&err);
+        return -1;
+    }
+
+    return 0;
+}
+#endif /* defined(WITH_LIBNL) */
+
+
 /**
  * virNetDevTapCreateInBridgePort:
  * @brname: the bridge name
@@ -623,6 +675,7 @@ int virNetDevTapCreateInBridgePort(const char *brname,
                                    unsigned int flags)
 {
     virMacAddr tapmac;
+    bool linkSetup = false;
     size_t i;
 
     if (virNetDevTapCreate(ifname, tunpath, tapfd, tapfdSize, flags) < 0)
@@ -650,17 +703,34 @@ int virNetDevTapCreateInBridgePort(const char *brname,
             tapmac.addr[0] = 0xFE;
     }
 
-    if (virNetDevSetMAC(*ifname, &tapmac) < 0)
-        goto error;
+#if defined(WITH_LIBNL)
+    /* A port of a plain Linux host bridge without VLANs can have its
+     * MAC address, MTU and bridge set up with a single netlink request,
+     * and be brought up with another, rather than one round-trip to
+     * the kernel each.
+     */
+    if (!virtPortProfile && !virtVlan) {
+        if (virNetDevTapSetupBridgePort(*ifname, brname, &tapmac, isolatedPort,
+                                        mtu, actualMTU, flags) < 0)
+            goto error;
 
-    if (virNetDevTapAttachBridge(*ifname, brname, macaddr, vmuuid,
-                                 virtPortProfile, virtVlan,
-                                 isolatedPort, mtu, actualMTU) < 0) {
-        goto error;
+        linkSetup = true;
     }
+#endif /* defined(WITH_LIBNL) */
 
-    if (virNetDevSetOnline(*ifname, !!(flags & VIR_NETDEV_TAP_CREATE_IFUP)) < 0)
-        goto error;
+    if (!linkSetup) {
+        if (virNetDevSetMAC(*ifname, &tapmac) < 0)
+            goto error;
+
+        if (virNetDevTapAttachBridge(*ifname, brname, macaddr, vmuuid,
+                                     virtPortProfile, virtVlan,
+                                     isolatedPort, mtu, actualMTU) < 0) {
+            goto error;
+        }
+
+        if (virNetDevSetOnline(*ifname, !!(flags & VIR_NETDEV_TAP_CREATE_IFUP)) < 0)
+            goto error;
+    }
 
     if (virNetDevSetCoalesce(*ifname, coalesce, false) < 0)
         goto error;
@@ -857,3 +927,129 @@ virNetDevTapInterfaceStats(const char *ifname G_GNUC_UNUSED,
 }
 
 #endif /* __linux__ */
+
+
+struct _virNetDevTapStatsSnapshot {
+    GHashTable *links;  /* host view stats of all links, by name */
+    bool linksFailed;
+    GHashTable *ovs;    /* domain view stats of OVS interfaces, by name */
+    bool ovsFailed;
+};
+
+
+/**
+ * virNetDevTapStatsSnapshotNew:
+ *
+ * Create an empty snapshot of interface statistics. Statistics of all
+ * interfaces of a kind are fetched at once the first time an interface
+ * of that kind is looked up in the snapshot, so that querying many
+ * interfaces costs about as much as querying a single one.
+ */
+virNetDevTapStatsSnapshot *
+virNetDevTapStatsSnapshotNew(void)
+{
+    return g_new0(virNetDevTapStatsSnapshot, 1);
+}
+
+
+void
+virNetDevTapStatsSnapshotFree(virNetDevTapStatsSnapshot *snapshot)
+{
+    if (!snapshot)
+        return;
+
+    g_clear_pointer(&snapshot->links, g_hash_table_unref);
+    g_clear_pointer(&snapshot->ovs, g_hash_table_unref);
+    g_free(snapshot);
+}
+
+
+/**
+ * virNetDevTapStatsSnapshotInterfaceStats:
+ * @snapshot: snapshot of interface statistics
+ * @ifname: interface
+ * @stats: where to store statistics
+ * @swapped: whether to swap RX/TX fields
+ *
+ * Same as virNetDevTapInterfaceStats(), except the statistics are
+ * looked up in @snapshot. If the statistics of all links can't be
+ * fetched at once or @ifname is missing from them, this falls back to
+ * virNetDevTapInterfaceStats().
+ *
+ * Returns 0 on success, -1 otherwise (with error reported).
+ */
+int
+virNetDevTapStatsSnapshotInterfaceStats(virNetDevTapStatsSnapshot *snapshot,
+                                        const char *ifname,
+                                        virDomainInterfaceStatsPtr stats,
+                                        bool swapped)
+{
+    virDomainInterfaceStatsPtr link;
+
+    if (!snapshot->links && !snapshot->linksFailed) {
+        if (!(snapshot->links = virNetDevGetAllLinkStats())) {
+            VIR_DEBUG("Unable to get statistics of all links: %s",
+                      virGetLastErrorMessage());
+            virResetLastError();
+            snapshot->linksFailed = true;
+        }
+    }
+
+    /* the interface might have been created after the snapshot was taken */
+    if (!snapshot->links ||
+        !(link = g_hash_table_lookup(snapshot->links, ifname)))
+        return virNetDevTapInterfaceStats(ifname, stats, swapped);
+
+    if (swapped) {
+        stats->rx_bytes = link->tx_bytes;
+        stats->rx_packets = link->tx_packets;
+        stats->rx_errs = link->tx_errs;
+        stats->rx_drop = link->tx_drop;
+        stats->tx_bytes = link->rx_bytes;
+        stats->tx_packets = link->rx_packets;
+        stats->tx_errs = link->rx_errs;
+        stats->tx_drop = link->rx_drop;
+    } else {
+        *stats = *link;
+    }
+
+    return 0;
+}
+
+
+/**
+ * virNetDevTapStatsSnapshotOpenvswitchStats:
+ * @snapshot: snapshot of interface statistics
+ * @ifname: OVS interface
+ * @stats: where to store statistics
+ *
+ * Same as virNetDevOpenvswitchInterfaceStats(), except the statistics
+ * are looked up in @snapshot. If the statistics of all OVS interfaces
+ * can't be fetched at once or @ifname is missing from them, this falls
+ * back to virNetDevOpenvswitchInterfaceStats().
+ *
+ * Returns 0 on success, -1 otherwise (with error reported).
+ */
+int
+virNetDevTapStatsSnapshotOpenvswitchStats(virNetDevTapStatsSnapshot *snapshot,
+                                          const char *ifname,
+                                          virDomainInterfaceStatsPtr stats)
+{
+    virDomainInterfaceStatsPtr iface;
+
+    if (!snapshot->ovs && !snapshot->ovsFailed) {
+        if (!(snapshot->ovs = virNetDevOpenvswitchInterfaceStatsAll())) {
+            VIR_DEBUG("Unable to get statistics of all OVS interfaces: %s",
+                      virGetLastErrorMessage());
+            virResetLastError();
+            snapshot->ovsFailed = true;
+        }
+    }
+
+    if (!snapshot->ovs ||
+        !(iface = g_hash_table_lookup(snapshot->ovs, ifname)))
+        return virNetDevOpenvswitchInterfaceStats(ifname, stats);
+
+    *stats = *iface;
+    return 0;
+}
@@ -108,3 +108,20 @@ int virNetDevTapInterfaceStats(const char *ifname,
                                virDomainInterfaceStatsPtr stats,
                                bool swapped)
     G_GNUC_WARN_UNUSED_RESULT;
+
+typedef struct _virNetDevTapStatsSnapshot virNetDevTapStatsSnapshot;
+
+virNetDevTapStatsSnapshot *virNetDevTapStatsSnapshotNew(void);
+void virNetDevTapStatsSnapshotFree(virNetDevTapStatsSnapshot *snapshot);
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(virNetDevTapStatsSnapshot, virNetDevTapStatsSnapshotFree);
+
+int virNetDevTapStatsSnapshotInterfaceStats(virNetDevTapStatsSnapshot *snapshot,
+                                            const char *ifname,
+                                            virDomainInterfaceStatsPtr stats,
+                                            bool swapped)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) G_GNUC_WARN_UNUSED_RESULT;
+
+int virNetDevTapStatsSnapshotOpenvswitchStats(virNetDevTapStatsSnapshot *snapshot,
+                                              const char *ifname,
+                                              virDomainInterfaceStatsPtr stats)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) G_GNUC_WARN_UNUSED_RESULT;
@@ -355,6 +355,158 @@ int virNetlinkCommand(struct nl_msg *nl_msg,
 }
 
 
+/* Stay well below the default socket send buffer */
+# define NETLINK_BATCH_MAX_LEN (32 * 1024)
+
+static int
+virNetlinkBatchRecvAcks(virNetlinkHandle *nlhandle,
+                        size_t first,
+                        size_t last,
+                        int *errors)
+{
+    size_t acked = 0;
+    int fd = nl_socket_get_fd(nlhandle);
+
+    while (acked < last - first) {
+        g_autofree struct nlmsghdr *resp = NULL;
+        struct sockaddr_nl nladdr = { 0 };
+        struct pollfd fds[1] = { { .fd = fd, .events = POLLIN } };
+        struct nlmsghdr *msg;
+        struct nlmsgerr *err;
+        int len;
+        int n;
+
+        n = poll(fds, G_N_ELEMENTS(fds), NETLINK_ACK_TIMEOUT_S);
+        if (n < 0) {
+            virReportSystemError(errno, "%s", _("error in poll call"));
+            return -1;
+        }
+        if (n == 0) {
+            virReportSystemError(ETIMEDOUT, "%s",
+                                 _("no valid netlink response was received"));
+            return -1;
+        }
+
+        len = nl_recv(nlhandle, &nladdr, (unsigned char **)&resp, NULL);
+        if (len <= 0) {
+            virReportSystemError(errno, "%s", _("nl_recv failed"));
+            return -1;
+        }
+
+        VIR_WARNINGS_NO_CAST_ALIGN
+        for (msg = resp; NLMSG_OK(msg, len); msg = NLMSG_NEXT(msg, len)) {
+            VIR_WARNINGS_RESET
+            if (msg->nlmsg_type != NLMSG_ERROR)
+                continue;
+
+            if (msg->nlmsg_len < NLMSG_LENGTH(sizeof(*err))) {
+                virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("malformed netlink response message"));
+                return -1;
+            }
+
+            /* sequence numbers are the request index plus one */
+            if (msg->nlmsg_seq <= first || msg->nlmsg_seq > last)
+                continue;
+
+            err = (struct nlmsgerr *) NLMSG_DATA(msg);
+            errors[msg->nlmsg_seq - 1] = err->error;
+            acked++;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * virNetlinkCommandBatch:
+ * @msgs:     array of netlink requests
+ * @nmsgs:    number of requests in @msgs
+ * @errors:   array of @nmsgs integers receiving the result of each request
+ * @protocol: netlink protocol
+ *
+ * Send all @msgs over a single netlink socket, packing as many of
+ * them as fit into each sendmsg() call, and wait for the
+ * acknowledgement of every one of them. The kernel processes the
+ * requests in order and a failing request does not stop the ones
+ * after it. The result of each request (0 or -errno) is stored at
+ * the same index of @errors.
+ *
+ * Returns 0 if all requests were acknowledged, whether they succeeded
+ * or not, -1 otherwise (with error reported).
+ */
+int
+virNetlinkCommandBatch(struct nl_msg **msgs,
+                       size_t nmsgs,
+                       int *errors,
+                       unsigned int protocol)
+{
+    g_autoptr(virNetlinkHandle) nlhandle = NULL;
+    g_autoptr(GByteArray) buf = NULL;
+    uint32_t portid;
+    size_t next = 0;
+# ifdef NETLINK_CAP_ACK
+    int one = 1;
+# endif
+
+    if (nmsgs == 0)
+        return 0;
+
+    if (protocol >= MAX_LINKS) {
+        virReportSystemError(EINVAL,
+                             _("invalid protocol argument: %1$d"), protocol);
+        return -1;
+    }
+
+    if (!(nlhandle = virNetlinkCreateSocket(protocol)))
+        return -1;
+
+# ifdef NETLINK_CAP_ACK
+    /* Don't have errors echo whole requests back. Not knowing this
+     * option only costs some receive buffer space. */
+    ignore_value(setsockopt(nl_socket_get_fd(nlhandle), SOL_NETLINK,
+                            NETLINK_CAP_ACK, &one, sizeof(one)));
+# endif
+
+    portid = nl_socket_get_local_port(nlhandle);
+    buf = g_byte_array_sized_new(NETLINK_BATCH_MAX_LEN);
+
+    while (next < nmsgs) {
+        size_t first = next;
+
+        g_byte_array_set_size(buf, 0);
+
+        for (; next < nmsgs; next++) {
+            struct nlmsghdr *hdr = nlmsg_hdr(msgs[next]);
+            size_t len = NLMSG_ALIGN(hdr->nlmsg_len);
+
+            if (next > first && buf->len + len > NETLINK_BATCH_MAX_LEN)
+                break;
+
+            hdr->nlmsg_flags |= NLM_F_REQUEST | NLM_F_ACK;
+            hdr->nlmsg_seq = next + 1;
+            hdr->nlmsg_pid = portid;
+            errors[next] = 0;
+
+            g_byte_array_append(buf, (const guint8 *)hdr, hdr->nlmsg_len);
+            g_byte_array_set_size(buf, NLMSG_ALIGN(buf->len));
+        }
+
+        if (nl_sendto(nlhandle, buf->data, buf->len) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("cannot send to netlink socket"));
+            return -1;
+        }
+
+        if (virNetlinkBatchRecvAcks(nlhandle, first, next, errors) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
 /**
  * virNetlinkTalk:
  * @ifname: name of the link
@@ -1297,6 +1449,16 @@ int virNetlinkCommand(struct nl_msg *nl_msg G_GNUC_UNUSED,
     return -1;
 }
 
+int
+virNetlinkCommandBatch(struct nl_msg **msgs G_GNUC_UNUSED,
+                       size_t nmsgs G_GNUC_UNUSED,
+                       int *errors G_GNUC_UNUSED,
+                       unsigned int protocol G_GNUC_UNUSED)
+{
+    virReportError(VIR_ERR_INTERNAL_ERROR, "%s", _(unsupported));
+    return -1;
+}
+
 int
 virNetlinkDumpCommand(struct nl_msg *nl_msg G_GNUC_UNUSED,
                       virNetlinkDumpCallback callback G_GNUC_UNUSED,
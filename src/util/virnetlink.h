@@ -51,6 +51,12 @@ int virNetlinkCommand(struct nl_msg *nl_msg,
                       uint32_t src_pid, uint32_t dst_pid,
                       unsigned int protocol, unsigned int groups);
 
+int virNetlinkCommandBatch(struct nl_msg **msgs,
+                           size_t nmsgs,
+                           int *errors,
+                           unsigned int protocol)
+    G_NO_INLINE;
+
 typedef int (*virNetlinkDumpCallback)(struct nlmsghdr *resp,
                                       void *data);
 
@@ -58,7 +64,8 @@ int virNetlinkDumpCommand(struct nl_msg *nl_msg,
                           virNetlinkDumpCallback callback,
                           uint32_t src_pid, uint32_t dst_pid,
                           unsigned int protocol, unsigned int groups,
-                          void *opaque);
+                          void *opaque)
+    G_NO_INLINE;
 
 typedef struct _virNetlinkNewLinkData virNetlinkNewLinkData;
 struct _virNetlinkNewLinkData {
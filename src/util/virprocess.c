@@ -1813,6 +1813,61 @@ virProcessGetStatInfo(unsigned long long *cpuTime,
     return 0;
 }
 
+/*
+ * Parse the contents of /proc/.../sched and extract the total time the
+ * task spent waiting on a runqueue. The buffer is modified in place.
+ */
+static int
+virProcessParseSchedWait(char *data,
+                         unsigned long long *cpuWait)
+{
+    char *line = data;
+    double val;
+
+    *cpuWait = 0;
+
+    while (line && *line) {
+        char *eol = strchr(line, '\n');
+
+        if (eol)
+            *eol = '\0';
+
+        /* Needs CONFIG_SCHEDSTATS. The second check is the name used before
+         * kernel commit ceeadb83aea2, the third one is the old name the kernel
+         * used in past */
+        if (STRPREFIX(line, "wait_sum") ||
+            STRPREFIX(line, "se.statistics.wait_sum") ||
+            STRPREFIX(line, "se.wait_sum")) {
+            const char *value = strchr(line, ':');
+
+            if (!value) {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("Missing separator in sched info '%1$s'"),
+                               line);
+                return -1;
+            }
+            value++;
+            while (*value == ' ')
+                value++;
+
+            if (virStrToDouble(value, NULL, &val) < 0) {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("Unable to parse sched info value '%1$s'"),
+                               value);
+                return -1;
+            }
+
+            *cpuWait = (unsigned long long) (val * 1000000);
+            break;
+        }
+
+        line = eol ? eol + 1 : NULL;
+    }
+
+    return 0;
+}
+
+
 int
 virProcessGetSchedInfo(unsigned long long *cpuWait,
                        pid_t pid,
@@ -1820,9 +1875,6 @@ virProcessGetSchedInfo(unsigned long long *cpuWait,
 {
     g_autofree char *proc = NULL;
     g_autofree char *data = NULL;
-    g_auto(GStrv) lines = NULL;
-    size_t i;
-    double val;
 
     *cpuWait = 0;
 
@@ -1841,42 +1893,195 @@ virProcessGetSchedInfo(unsigned long long *cpuWait,
     if (virFileReadAll(proc, (1 << 16), &data) < 0)
         return -1;
 
-    lines = g_strsplit(data, "\n", 0);
-    if (!lines)
+    return virProcessParseSchedWait(data, cpuWait);
+}
+
+
+/* Large enough for any of stat, sched and schedstat of a single task */
+# define VIR_PROCESS_TASK_STATS_BUFLEN (1 << 16)
+
+/*
+ * Parse /proc/.../stat of a task in place, without splitting it into
+ * individual strings as virProcessGetStat() does.
+ */
+static int
+virProcessParseTaskStat(char *buf,
+                        unsigned long long *utime,
+                        unsigned long long *stime,
+                        int *cpu)
+{
+    char *p = strrchr(buf, ')');
+    char *end = NULL;
+    size_t field;
+
+    if (!p || p[1] != ' ')
         return -1;
+    p += 2;
 
-    for (i = 0; lines[i] != NULL; i++) {
-        const char *line = lines[i];
+    for (field = VIR_PROCESS_STAT_STATE;
+         field <= VIR_PROCESS_STAT_PROCESSOR;
+         field++) {
+        if (!p || !*p)
+            return -1;
 
-        /* Needs CONFIG_SCHEDSTATS. The second check is the name used before
-         * kernel commit ceeadb83aea2, the third one is the old name the kernel
-         * used in past */
-        if (STRPREFIX(line, "wait_sum") ||
-            STRPREFIX(line, "se.statistics.wait_sum") ||
-            STRPREFIX(line, "se.wait_sum")) {
-            line = strchr(line, ':');
-            if (!line) {
-                virReportError(VIR_ERR_INTERNAL_ERROR,
-                               _("Missing separator in sched info '%1$s'"),
-                               lines[i]);
+        switch (field) {
+        case VIR_PROCESS_STAT_UTIME:
+            if (virStrToLong_ullp(p, &end, 10, utime) < 0)
                 return -1;
-            }
-            line++;
-            while (*line == ' ')
-                line++;
+            break;
+        case VIR_PROCESS_STAT_STIME:
+            if (virStrToLong_ullp(p, &end, 10, stime) < 0)
+                return -1;
+            break;
+        case VIR_PROCESS_STAT_PROCESSOR:
+            if (virStrToLong_i(p, &end, 10, cpu) < 0)
+                return -1;
+            break;
+        default:
+            break;
+        }
+
+        if ((p = strchr(p, ' ')))
+            p++;
+    }
+
+    return 0;
+}
+
+
+/* As in virProcessGetStatInfo(), a @tid of 0 refers to the whole
+ * process rather than to one of its tasks. */
+static char *
+virProcessTaskPath(pid_t pid,
+                   pid_t tid,
+                   const char *name)
+{
+    if (tid)
+        return g_strdup_printf("/proc/%d/task/%d/%s", (int) pid, (int) tid, name);
+
+    return g_strdup_printf("/proc/%d/%s", (int) pid, name);
+}
+
+
+/* Read a per-task /proc file into @buf. The file is not guaranteed to
+ * exist, in which case 0 is returned. If it is missing for the first
+ * task, the kernel does not provide it at all and @available is cleared
+ * so that it is not looked for again. */
+static int
+virProcessReadTaskFile(pid_t pid,
+                       pid_t tid,
+                       const char *name,
+                       bool first,
+                       bool *available,
+                       char *buf)
+{
+    g_autofree char *path = virProcessTaskPath(pid, tid, name);
+    int rc;
+
+    if (access(path, R_OK) < 0) {
+        if (first)
+            *available = false;
+        return 0;
+    }
+
+    if ((rc = virFileReadBufQuiet(path, buf, VIR_PROCESS_TASK_STATS_BUFLEN)) < 0) {
+        virReportSystemError(-rc, _("Failed to read file '%1$s'"), path);
+        return -1;
+    }
+
+    return 1;
+}
+
+
+/**
+ * virProcessGetTaskStats:
+ * @pid: process ID
+ * @stats: array of tasks to query, with @tid filled in (0 for @pid itself)
+ * @nstats: number of elements in @stats
+ * @flags: bitwise-OR of virProcessTaskStatsFlags
+ *
+ * Collect CPU time, last CPU and, depending on @flags, runqueue wait and
+ * delay of many threads of @pid at once. Compared to calling
+ * virProcessGetStatInfo() and virProcessGetSchedInfo() for every thread
+ * this shares one read buffer across all tasks, does not split the stat
+ * line into strings and probes for the optional sched/schedstat files
+ * just once.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virProcessGetTaskStats(pid_t pid,
+                       virProcessTaskStats *stats,
+                       size_t nstats,
+                       unsigned int flags)
+{
+    const unsigned long long jiff2nsec = 1000ull * 1000ull * 1000ull /
+                                         (unsigned long long) sysconf(_SC_CLK_TCK);
+    bool wantWait = !!(flags & VIR_PROCESS_TASK_STATS_WAIT);
+    bool wantDelay = !!(flags & VIR_PROCESS_TASK_STATS_DELAY);
+    g_autofree char *buf = NULL;
+    size_t i;
+    int rc;
 
-            if (virStrToDouble(line, NULL, &val) < 0) {
+    virCheckFlags(VIR_PROCESS_TASK_STATS_WAIT |
+                  VIR_PROCESS_TASK_STATS_DELAY, -1);
+
+    if (nstats == 0)
+        return 0;
+
+    buf = g_new0(char, VIR_PROCESS_TASK_STATS_BUFLEN);
+
+    for (i = 0; i < nstats; i++) {
+        virProcessTaskStats *st = stats + i;
+        unsigned long long utime = 0;
+        unsigned long long stime = 0;
+        g_autofree char *path = NULL;
+
+        st->cpuTime = 0;
+        st->lastCpu = 0;
+        st->cpuWait = 0;
+        st->cpuDelay = 0;
+
+        path = virProcessTaskPath(pid, st->tid, "stat");
+
+        /* Same as virProcessGetStatInfo(), a task we can't parse is
+         * reported with neutral values rather than failing everything */
+        if (virFileReadBufQuiet(path, buf, VIR_PROCESS_TASK_STATS_BUFLEN) < 0 ||
+            virProcessParseTaskStat(buf, &utime, &stime, &st->lastCpu) < 0) {
+            VIR_WARN("cannot parse status data of task %d/%d",
+                     (int) pid, (int) st->tid);
+        }
+        st->cpuTime = (utime + stime) * jiff2nsec;
+
+        /* Needs CONFIG_SCHED_DEBUG */
+        if (wantWait) {
+            if ((rc = virProcessReadTaskFile(pid, st->tid, "sched", i == 0,
+                                             &wantWait, buf)) < 0)
+                return -1;
+
+            if (rc > 0 &&
+                virProcessParseSchedWait(buf, &st->cpuWait) < 0)
+                return -1;
+        }
+
+        /* Needs CONFIG_SCHED_INFO */
+        if (wantDelay) {
+            if ((rc = virProcessReadTaskFile(pid, st->tid, "schedstat", i == 0,
+                                             &wantDelay, buf)) < 0)
+                return -1;
+
+            if (rc > 0 &&
+                sscanf(buf, "%*u %llu", &st->cpuDelay) != 1) {
                 virReportError(VIR_ERR_INTERNAL_ERROR,
-                               _("Unable to parse sched info value '%1$s'"),
-                               line);
+                               _("Unable to parse schedstat info of task %1$d/%2$d"),
+                               (int) pid, (int) st->tid);
                 return -1;
             }
-
-            *cpuWait = (unsigned long long) (val * 1000000);
-            break;
         }
     }
 
+    VIR_DEBUG("Got stats for %zu tasks of %d", nstats, (int) pid);
+
     return 0;
 }
 
@@ -1918,6 +2123,29 @@ virProcessGetSchedInfo(unsigned long long *cpuWait,
 
     return 0;
 }
+
+int
+virProcessGetTaskStats(pid_t pid G_GNUC_UNUSED,
+                       virProcessTaskStats *stats,
+                       size_t nstats,
+                       unsigned int flags)
+{
+    size_t i;
+
+    virCheckFlags(VIR_PROCESS_TASK_STATS_WAIT |
+                  VIR_PROCESS_TASK_STATS_DELAY, -1);
+
+    /* We don't have a way to collect this information on non-Linux
+     * platforms, so just report neutral values */
+    for (i = 0; i < nstats; i++) {
+        stats[i].cpuTime = 0;
+        stats[i].lastCpu = 0;
+        stats[i].cpuWait = 0;
+        stats[i].cpuDelay = 0;
+    }
+
+    return 0;
+}
 #endif /* __linux__ */
 
 #ifdef __linux__
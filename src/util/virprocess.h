@@ -206,6 +206,26 @@ int virProcessGetSchedInfo(unsigned long long *cpuWait,
                            pid_t pid,
                            pid_t tid);
 
+typedef enum {
+    VIR_PROCESS_TASK_STATS_WAIT = (1 << 0), /* fill in @cpuWait */
+    VIR_PROCESS_TASK_STATS_DELAY = (1 << 1), /* fill in @cpuDelay */
+} virProcessTaskStatsFlags;
+
+typedef struct _virProcessTaskStats virProcessTaskStats;
+struct _virProcessTaskStats {
+    pid_t tid; /* filled in by caller */
+
+    unsigned long long cpuTime; /* user + system time, in ns */
+    int lastCpu;
+    unsigned long long cpuWait; /* in ns */
+    unsigned long long cpuDelay; /* in ns */
+};
+
+int virProcessGetTaskStats(pid_t pid,
+                           virProcessTaskStats *stats,
+                           size_t nstats,
+                           unsigned int flags);
+
 int virProcessSchedCoreAvailable(void);
 
 int virProcessSchedCoreCreate(void);
@@ -22,14 +22,19 @@
 #include <config.h>
 
 #include <fcntl.h>
+#include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <gio/gio.h>
 
 #include "virrotatingfile.h"
 #include "viralloc.h"
+#include "virendian.h"
 #include "virerror.h"
 #include "virfile.h"
 #include "virlog.h"
+#include "virthread.h"
+#include "virthreadpool.h"
 
 VIR_LOG_INIT("util.rotatingfile");
 
@@ -37,12 +42,47 @@ VIR_LOG_INIT("util.rotatingfile");
 
 #define VIR_MAX_MAX_BACKUP 32
 
+/*
+ * Rotated files are compressed into a series of gzip members, each holding
+ * up to VIR_ROTATING_FILE_BLOCK_SIZE bytes of the original file. The result
+ * can be read by any gzip tool, while the extra field in the header of each
+ * member stores the size of the member and the inode of the original file.
+ * That is enough to find the member holding any offset by skipping from one
+ * header to the next, and to seek to positions recorded before compression.
+ */
+#define VIR_ROTATING_FILE_GZ_SUFFIX ".gz"
+#define VIR_ROTATING_FILE_BLOCK_SIZE (64 * 1024)
+#define VIR_ROTATING_FILE_GZ_HEADER_SIZE 28
+#define VIR_ROTATING_FILE_GZ_TRAILER_SIZE 8
+#define VIR_ROTATING_FILE_GZ_EXTRA_SIZE 12
+
+/* Serializes rollover with compressed files replacing the plain ones */
+static virMutex virRotatingFileRenameLock = VIR_MUTEX_INITIALIZER;
+
+static virThreadPool *virRotatingFileCompressPool;
+static uint32_t virRotatingFileCRCTable[256];
+
+typedef struct virRotatingFileCompressJob virRotatingFileCompressJob;
+struct virRotatingFileCompressJob {
+    char *path;
+    size_t maxbackup;
+};
+
+typedef struct virRotatingFileBlock virRotatingFileBlock;
+struct virRotatingFileBlock {
+    off_t offset;       /* offset of the gzip member in the compressed file */
+    size_t size;        /* size of the gzip member */
+    off_t dataOffset;   /* offset of the data in the original file */
+    size_t dataSize;    /* size of the uncompressed data */
+};
+
 typedef struct virRotatingFileWriterEntry virRotatingFileWriterEntry;
 
 typedef struct virRotatingFileReaderEntry virRotatingFileReaderEntry;
 
 struct virRotatingFileWriterEntry {
     int fd;
+    int splicefd; /* opened without O_APPEND which splice() refuses */
     off_t inode;
     off_t pos;
     off_t len;
@@ -54,6 +94,8 @@ struct virRotatingFileWriter {
     size_t maxbackup;
     mode_t mode;
     size_t maxlen;
+    bool nosplice;
+    bool compress;
 };
 
 
@@ -61,6 +103,15 @@ struct virRotatingFileReaderEntry {
     char *path;
     int fd;
     off_t inode;
+
+    /* Index and current block of a compressed file */
+    bool compressed;
+    virRotatingFileBlock *blocks;
+    size_t nblocks;
+    size_t next;        /* block to load once @data is consumed */
+    char *data;
+    size_t datalen;
+    size_t datapos;
 };
 
 struct virRotatingFileReader {
@@ -77,6 +128,7 @@ virRotatingFileWriterEntryFree(virRotatingFileWriterEntry *entry)
         return;
 
     VIR_FORCE_CLOSE(entry->fd);
+    VIR_FORCE_CLOSE(entry->splicefd);
     g_free(entry);
 }
 
@@ -89,6 +141,8 @@ virRotatingFileReaderEntryFree(virRotatingFileReaderEntry *entry)
 
     g_free(entry->path);
     VIR_FORCE_CLOSE(entry->fd);
+    g_free(entry->blocks);
+    g_free(entry->data);
     g_free(entry);
 }
 
@@ -103,6 +157,7 @@ virRotatingFileWriterEntryNew(const char *path,
     VIR_DEBUG("Opening %s mode=0%02o", path, mode);
 
     entry = g_new0(virRotatingFileWriterEntry, 1);
+    entry->splicefd = -1;
 
     if ((entry->fd = open(path, O_CREAT|O_APPEND|O_WRONLY|O_CLOEXEC, mode)) < 0) {
         virReportSystemError(errno,
@@ -136,6 +191,287 @@ virRotatingFileWriterEntryNew(const char *path,
 }
 
 
+static void virRotatingFileCompressWorker(void *jobdata, void *opaque);
+
+static int
+virRotatingFileOnceInit(void)
+{
+    size_t i;
+    size_t j;
+
+    for (i = 0; i < G_N_ELEMENTS(virRotatingFileCRCTable); i++) {
+        uint32_t crc = i;
+
+        for (j = 0; j < 8; j++)
+            crc = (crc & 1) ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+
+        virRotatingFileCRCTable[i] = crc;
+    }
+
+    if (!(virRotatingFileCompressPool = virThreadPoolNewFull(0, 1, 0,
+                                                             virRotatingFileCompressWorker,
+                                                             "rotating-compress",
+                                                             NULL, NULL)))
+        return -1;
+
+    return 0;
+}
+
+VIR_ONCE_GLOBAL_INIT(virRotatingFile);
+
+
+static uint32_t
+virRotatingFileCRC32(const char *buf,
+                     size_t len)
+{
+    uint32_t crc = 0xffffffff;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        crc = virRotatingFileCRCTable[(crc ^ (unsigned char)buf[i]) & 0xff] ^ (crc >> 8);
+
+    return crc ^ 0xffffffff;
+}
+
+
+static void
+virRotatingFileWriteLE(unsigned char *buf,
+                       uint64_t val,
+                       size_t bytes)
+{
+    size_t i;
+
+    for (i = 0; i < bytes; i++)
+        buf[i] = (val >> (8 * i)) & 0xff;
+}
+
+
+static void
+virRotatingFileBlockHeaderFormat(unsigned char *buf,
+                                 size_t size,
+                                 ino_t inode)
+{
+    memset(buf, 0, VIR_ROTATING_FILE_GZ_HEADER_SIZE);
+
+    buf[0] = 0x1f;  /* ID1 */
+    buf[1] = 0x8b;  /* ID2 */
+    buf[2] = 8;     /* CM: deflate */
+    buf[3] = 0x04;  /* FLG: FEXTRA */
+    buf[9] = 3;     /* OS: Unix */
+    virRotatingFileWriteLE(buf + 10, VIR_ROTATING_FILE_GZ_EXTRA_SIZE + 4, 2);
+    buf[12] = 'L';
+    buf[13] = 'V';
+    virRotatingFileWriteLE(buf + 14, VIR_ROTATING_FILE_GZ_EXTRA_SIZE, 2);
+    virRotatingFileWriteLE(buf + 16, size, 4);
+    virRotatingFileWriteLE(buf + 20, inode, 8);
+}
+
+
+static int
+virRotatingFileBlockHeaderParse(const unsigned char *buf,
+                                size_t *size,
+                                ino_t *inode)
+{
+    if (buf[0] != 0x1f || buf[1] != 0x8b || buf[2] != 8 || buf[3] != 0x04 ||
+        virReadBufInt16LE(buf + 10) != VIR_ROTATING_FILE_GZ_EXTRA_SIZE + 4 ||
+        buf[12] != 'L' || buf[13] != 'V' ||
+        virReadBufInt16LE(buf + 14) != VIR_ROTATING_FILE_GZ_EXTRA_SIZE)
+        return -1;
+
+    *size = virReadBufInt32LE(buf + 16);
+    *inode = virReadBufInt64LE(buf + 20);
+
+    if (*size < VIR_ROTATING_FILE_GZ_HEADER_SIZE + VIR_ROTATING_FILE_GZ_TRAILER_SIZE)
+        return -1;
+
+    return 0;
+}
+
+
+static int
+virRotatingFileReaderEntryLoadIndex(virRotatingFileReaderEntry *entry)
+{
+    off_t offset = 0;
+    off_t dataOffset = 0;
+
+    while (true) {
+        unsigned char header[VIR_ROTATING_FILE_GZ_HEADER_SIZE];
+        unsigned char trailer[VIR_ROTATING_FILE_GZ_TRAILER_SIZE];
+        virRotatingFileBlock block = { 0 };
+        ino_t inode;
+        ssize_t got;
+
+        if ((got = pread(entry->fd, header, sizeof(header), offset)) == 0)
+            break;
+
+        if (got != sizeof(header) ||
+            virRotatingFileBlockHeaderParse(header, &block.size, &inode) < 0 ||
+            pread(entry->fd, trailer, sizeof(trailer),
+                  offset + block.size - sizeof(trailer)) != sizeof(trailer)) {
+            if (got < 0) {
+                virReportSystemError(errno,
+                                     _("Unable to read from file %1$s"),
+                                     entry->path);
+            } else {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("Malformed compressed file %1$s at offset %2$llu"),
+                               entry->path, (unsigned long long)offset);
+            }
+            return -1;
+        }
+
+        if (entry->nblocks == 0)
+            entry->inode = inode;
+
+        block.offset = offset;
+        block.dataOffset = dataOffset;
+        block.dataSize = virReadBufInt32LE(trailer + 4);
+
+        offset += block.size;
+        dataOffset += block.dataSize;
+
+        VIR_APPEND_ELEMENT(entry->blocks, entry->nblocks, block);
+    }
+
+    return 0;
+}
+
+
+static int
+virRotatingFileReaderEntryLoadBlock(virRotatingFileReaderEntry *entry,
+                                    size_t idx)
+{
+    virRotatingFileBlock *block = &entry->blocks[idx];
+    g_autoptr(GZlibDecompressor) decompressor = NULL;
+    g_autoptr(GError) err = NULL;
+    g_autofree char *buf = g_new(char, block->size);
+    size_t inlen = block->size - VIR_ROTATING_FILE_GZ_HEADER_SIZE - VIR_ROTATING_FILE_GZ_TRAILER_SIZE;
+    const char *in = buf + VIR_ROTATING_FILE_GZ_HEADER_SIZE;
+    size_t datalen = 0;
+    GConverterResult res;
+
+    if (pread(entry->fd, buf, block->size, block->offset) != block->size) {
+        virReportSystemError(errno,
+                             _("Unable to read from file %1$s"),
+                             entry->path);
+        return -1;
+    }
+
+    /* One byte more than expected to detect corrupted blocks */
+    entry->data = g_realloc(entry->data, block->dataSize + 1);
+    decompressor = g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW);
+
+    do {
+        gsize nread = 0;
+        gsize nwritten = 0;
+
+        res = g_converter_convert(G_CONVERTER(decompressor),
+                                  in, inlen,
+                                  entry->data + datalen,
+                                  block->dataSize + 1 - datalen,
+                                  G_CONVERTER_INPUT_AT_END,
+                                  &nread, &nwritten, &err);
+        if (res == G_CONVERTER_ERROR) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Unable to decompress file %1$s: %2$s"),
+                           entry->path, err->message);
+            return -1;
+        }
+
+        in += nread;
+        inlen -= nread;
+        datalen += nwritten;
+    } while (res != G_CONVERTER_FINISHED);
+
+    if (datalen != block->dataSize ||
+        virRotatingFileCRC32(entry->data, datalen) !=
+        virReadBufInt32LE((unsigned char *)buf + block->size - VIR_ROTATING_FILE_GZ_TRAILER_SIZE)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Malformed compressed file %1$s at offset %2$llu"),
+                       entry->path, (unsigned long long)block->offset);
+        return -1;
+    }
+
+    entry->datalen = datalen;
+    entry->datapos = 0;
+    entry->next = idx + 1;
+
+    return 0;
+}
+
+
+static int
+virRotatingFileReaderEntrySeek(virRotatingFileReaderEntry *entry,
+                               off_t offset)
+{
+    size_t i;
+
+    if (!entry->compressed) {
+        if (lseek(entry->fd, offset, SEEK_SET) == (off_t)-1) {
+            virReportSystemError(errno,
+                                 _("Unable to seek to inode %1$llu offset %2$llu"),
+                                 (unsigned long long)entry->inode,
+                                 (unsigned long long)offset);
+            return -1;
+        }
+
+        return 0;
+    }
+
+    for (i = 0; i < entry->nblocks; i++) {
+        virRotatingFileBlock *block = &entry->blocks[i];
+
+        if (offset >= block->dataOffset + block->dataSize)
+            continue;
+
+        if (virRotatingFileReaderEntryLoadBlock(entry, i) < 0)
+            return -1;
+
+        entry->datapos = offset - block->dataOffset;
+        return 0;
+    }
+
+    /* Past the end of the file */
+    entry->next = entry->nblocks;
+    entry->datalen = 0;
+    entry->datapos = 0;
+    return 0;
+}
+
+
+static ssize_t
+virRotatingFileReaderEntryRead(virRotatingFileReaderEntry *entry,
+                               char *buf,
+                               size_t len)
+{
+    ssize_t got;
+
+    if (!entry->compressed) {
+        if ((got = saferead(entry->fd, buf, len)) < 0) {
+            virReportSystemError(errno,
+                                 _("Unable to read from file %1$s"),
+                                 entry->path);
+        }
+
+        return got;
+    }
+
+    if (entry->datapos == entry->datalen) {
+        if (entry->next >= entry->nblocks)
+            return 0;
+
+        if (virRotatingFileReaderEntryLoadBlock(entry, entry->next) < 0)
+            return -1;
+    }
+
+    got = MIN(len, entry->datalen - entry->datapos);
+    memcpy(buf, entry->data + entry->datapos, got);
+    entry->datapos += got;
+
+    return got;
+}
+
+
 static virRotatingFileReaderEntry *
 virRotatingFileReaderEntryNew(const char *path)
 {
@@ -146,15 +482,34 @@ virRotatingFileReaderEntryNew(const char *path)
 
     entry = g_new0(virRotatingFileReaderEntry, 1);
 
+    entry->path = g_strdup(path);
+
     if ((entry->fd = open(path, O_RDONLY|O_CLOEXEC)) < 0) {
         if (errno != ENOENT) {
             virReportSystemError(errno,
                                  _("Unable to open file: %1$s"), path);
             goto error;
         }
+
+        g_free(entry->path);
+        entry->path = g_strdup_printf("%s" VIR_ROTATING_FILE_GZ_SUFFIX, path);
+
+        if ((entry->fd = open(entry->path, O_RDONLY|O_CLOEXEC)) < 0) {
+            if (errno != ENOENT) {
+                virReportSystemError(errno,
+                                     _("Unable to open file: %1$s"), entry->path);
+                goto error;
+            }
+        } else {
+            entry->compressed = true;
+        }
     }
 
-    if (entry->fd != -1) {
+    if (entry->compressed) {
+        if (virRotatingFileInitialize() < 0 ||
+            virRotatingFileReaderEntryLoadIndex(entry) < 0)
+            goto error;
+    } else if (entry->fd != -1) {
         if (fstat(entry->fd, &sb) < 0) {
             virReportSystemError(errno,
                                  _("Unable to determine current file inode: %1$s"),
@@ -165,8 +520,6 @@ virRotatingFileReaderEntryNew(const char *path)
         entry->inode = sb.st_ino;
     }
 
-    entry->path = g_strdup(path);
-
     return entry;
 
  error:
@@ -175,6 +528,34 @@ virRotatingFileReaderEntryNew(const char *path)
 }
 
 
+/*
+ * Removes a rotated file in both its plain and compressed form.
+ */
+static int
+virRotatingFileUnlinkBackup(const char *path)
+{
+    g_autofree char *gzpath = g_strdup_printf("%s" VIR_ROTATING_FILE_GZ_SUFFIX, path);
+
+    if (unlink(path) < 0 &&
+        errno != ENOENT) {
+        virReportSystemError(errno,
+                             _("Unable to delete file %1$s"),
+                             path);
+        return -1;
+    }
+
+    if (unlink(gzpath) < 0 &&
+        errno != ENOENT) {
+        virReportSystemError(errno,
+                             _("Unable to delete file %1$s"),
+                             gzpath);
+        return -1;
+    }
+
+    return 0;
+}
+
+
 static int
 virRotatingFileWriterDelete(virRotatingFileWriter *file)
 {
@@ -189,18 +570,10 @@ virRotatingFileWriterDelete(virRotatingFileWriter *file)
     }
 
     for (i = 0; i < file->maxbackup; i++) {
-        char *oldpath;
-        oldpath = g_strdup_printf("%s.%zu", file->basepath, i);
+        g_autofree char *oldpath = g_strdup_printf("%s.%zu", file->basepath, i);
 
-        if (unlink(oldpath) < 0 &&
-            errno != ENOENT) {
-            virReportSystemError(errno,
-                                 _("Unable to delete file %1$s"),
-                                 oldpath);
-            VIR_FREE(oldpath);
+        if (virRotatingFileUnlinkBackup(oldpath) < 0)
             return -1;
-        }
-        VIR_FREE(oldpath);
     }
 
     return 0;
@@ -316,6 +689,22 @@ virRotatingFileReaderNew(const char *path,
 }
 
 
+/**
+ * virRotatingFileWriterSetCompress:
+ * @file: the file context
+ * @compress: whether to compress rotated files
+ *
+ * Enable compression of files rotated by @file. Compression happens in a
+ * background thread after each rollover, see virRotatingFileCompress.
+ */
+void
+virRotatingFileWriterSetCompress(virRotatingFileWriter *file,
+                                 bool compress)
+{
+    file->compress = compress;
+}
+
+
 /**
  * virRotatingFileWriterGetPath:
  * @file: the file context
@@ -355,9 +744,250 @@ virRotatingFileWriterGetOffset(virRotatingFileWriter *file)
 }
 
 
+/*
+ * Moves the file compressed in @tmppath in place of the rotated file
+ * identified by @sb, wherever rollover moved it meanwhile. The compressed
+ * file is dropped if the original was rotated out of existence.
+ */
+static int
+virRotatingFileReplaceBackup(const char *path,
+                             size_t maxbackup,
+                             struct stat *sb,
+                             const char *tmppath)
+{
+    VIR_LOCK_GUARD lock = virLockGuardLock(&virRotatingFileRenameLock);
+    size_t i;
+
+    for (i = 0; i < maxbackup; i++) {
+        g_autofree char *backuppath = g_strdup_printf("%s.%zu", path, i);
+        g_autofree char *gzpath = NULL;
+        struct stat backupsb;
+
+        if (stat(backuppath, &backupsb) < 0 ||
+            backupsb.st_dev != sb->st_dev ||
+            backupsb.st_ino != sb->st_ino)
+            continue;
+
+        gzpath = g_strdup_printf("%s" VIR_ROTATING_FILE_GZ_SUFFIX, backuppath);
+
+        if (rename(tmppath, gzpath) < 0) {
+            virReportSystemError(errno,
+                                 _("Unable to rename %1$s to %2$s"),
+                                 tmppath, gzpath);
+            return -1;
+        }
+
+        if (unlink(backuppath) < 0) {
+            virReportSystemError(errno,
+                                 _("Unable to delete file %1$s"),
+                                 backuppath);
+            return -1;
+        }
+
+        return 0;
+    }
+
+    VIR_DEBUG("%s.* no longer contains inode %llu, dropping compressed copy",
+              path, (unsigned long long)sb->st_ino);
+    unlink(tmppath);
+    return 0;
+}
+
+
+static int
+virRotatingFileCompressBackup(const char *path,
+                              size_t maxbackup,
+                              size_t idx)
+{
+    g_autofree char *backuppath = g_strdup_printf("%s.%zu", path, idx);
+    g_autofree char *tmppath = NULL;
+    g_autofree char *in = g_new(char, VIR_ROTATING_FILE_BLOCK_SIZE);
+    g_autofree unsigned char *out = NULL;
+    g_autoptr(GZlibCompressor) compressor = NULL;
+    size_t outsize;
+    VIR_AUTOCLOSE fd = -1;
+    VIR_AUTOCLOSE outfd = -1;
+    struct stat sb;
+    ssize_t got;
+
+    if ((fd = open(backuppath, O_RDONLY|O_CLOEXEC)) < 0) {
+        if (errno == ENOENT)
+            return 0;
+
+        virReportSystemError(errno,
+                             _("Unable to open file: %1$s"), backuppath);
+        return -1;
+    }
+
+    if (fstat(fd, &sb) < 0) {
+        virReportSystemError(errno,
+                             _("Unable to determine current file inode: %1$s"),
+                             backuppath);
+        return -1;
+    }
+
+    /* An empty gzip file is not valid, keep the empty original */
+    if (sb.st_size == 0)
+        return 0;
+
+    VIR_DEBUG("Compressing %s", backuppath);
+
+    tmppath = g_strdup_printf("%s" VIR_ROTATING_FILE_GZ_SUFFIX ".XXXXXX", backuppath);
+    if ((outfd = g_mkstemp_full(tmppath, O_WRONLY|O_CLOEXEC, sb.st_mode & 0777)) < 0) {
+        virReportSystemError(errno,
+                             _("Unable to create file %1$s"), tmppath);
+        return -1;
+    }
+
+    /* Incompressible data grows by a few bytes per 16 KiB of input */
+    outsize = VIR_ROTATING_FILE_GZ_HEADER_SIZE + VIR_ROTATING_FILE_BLOCK_SIZE +
+              VIR_ROTATING_FILE_BLOCK_SIZE / 8 + VIR_ROTATING_FILE_GZ_TRAILER_SIZE;
+    out = g_new(unsigned char, outsize);
+    compressor = g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW, -1);
+
+    while ((got = saferead(fd, in, VIR_ROTATING_FILE_BLOCK_SIZE)) > 0) {
+        g_autoptr(GError) err = NULL;
+        const char *data = in;
+        size_t datalen = got;
+        size_t outlen = VIR_ROTATING_FILE_GZ_HEADER_SIZE;
+        GConverterResult res;
+
+        g_converter_reset(G_CONVERTER(compressor));
+
+        do {
+            gsize nread = 0;
+            gsize nwritten = 0;
+
+            res = g_converter_convert(G_CONVERTER(compressor),
+                                      data, datalen,
+                                      out + outlen,
+                                      outsize - outlen - VIR_ROTATING_FILE_GZ_TRAILER_SIZE,
+                                      G_CONVERTER_INPUT_AT_END,
+                                      &nread, &nwritten, &err);
+            if (res == G_CONVERTER_ERROR) {
+                virReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("Unable to compress file %1$s: %2$s"),
+                               backuppath, err->message);
+                goto error;
+            }
+
+            data += nread;
+            datalen -= nread;
+            outlen += nwritten;
+        } while (res != G_CONVERTER_FINISHED);
+
+        virRotatingFileWriteLE(out + outlen, virRotatingFileCRC32(in, got), 4);
+        virRotatingFileWriteLE(out + outlen + 4, got, 4);
+        outlen += VIR_ROTATING_FILE_GZ_TRAILER_SIZE;
+        virRotatingFileBlockHeaderFormat(out, outlen, sb.st_ino);
+
+        if (safewrite(outfd, out, outlen) != outlen) {
+            virReportSystemError(errno,
+                                 _("Unable to write to file %1$s"), tmppath);
+            goto error;
+        }
+    }
+
+    if (got < 0) {
+        virReportSystemError(errno,
+                             _("Unable to read from file %1$s"), backuppath);
+        goto error;
+    }
+
+    if (VIR_CLOSE(outfd) < 0) {
+        virReportSystemError(errno,
+                             _("Unable to close file %1$s"), tmppath);
+        goto error;
+    }
+
+    if (virRotatingFileReplaceBackup(path, maxbackup, &sb, tmppath) < 0)
+        goto error;
+
+    return 0;
+
+ error:
+    unlink(tmppath);
+    return -1;
+}
+
+
+/**
+ * virRotatingFileCompress:
+ * @path: the base path for files
+ * @maxbackup: number of backup files
+ *
+ * Compress all rotated files of @path which are not compressed yet.
+ * Compressed files are named after the original ones with a ".gz" suffix
+ * and are read transparently by virRotatingFileReader. This is safe to
+ * call while a virRotatingFileWriter appends to @path and rolls it over.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int
+virRotatingFileCompress(const char *path,
+                        size_t maxbackup)
+{
+    size_t i;
+
+    if (virRotatingFileInitialize() < 0)
+        return -1;
+
+    for (i = 0; i < maxbackup; i++) {
+        if (virRotatingFileCompressBackup(path, maxbackup, i) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+static void
+virRotatingFileCompressWorker(void *jobdata,
+                              void *opaque G_GNUC_UNUSED)
+{
+    virRotatingFileCompressJob *job = jobdata;
+
+    if (virRotatingFileCompress(job->path, job->maxbackup) < 0) {
+        VIR_WARN("Unable to compress rotated files of %s: %s",
+                 job->path, virGetLastErrorMessage());
+        virResetLastError();
+    }
+
+    g_free(job->path);
+    g_free(job);
+}
+
+
+static void
+virRotatingFileWriterScheduleCompress(virRotatingFileWriter *file)
+{
+    virRotatingFileCompressJob *job;
+
+    if (virRotatingFileInitialize() < 0) {
+        VIR_WARN("Unable to compress rotated files of %s: %s",
+                 file->basepath, virGetLastErrorMessage());
+        virResetLastError();
+        return;
+    }
+
+    job = g_new0(virRotatingFileCompressJob, 1);
+    job->path = g_strdup(file->basepath);
+    job->maxbackup = file->maxbackup;
+
+    if (virThreadPoolSendJob(virRotatingFileCompressPool, 0, job) < 0) {
+        VIR_WARN("Unable to compress rotated files of %s: %s",
+                 file->basepath, virGetLastErrorMessage());
+        virResetLastError();
+        g_free(job->path);
+        g_free(job);
+    }
+}
+
+
 static int
 virRotatingFileWriterRollover(virRotatingFileWriter *file)
 {
+    VIR_LOCK_GUARD lock = virLockGuardLock(&virRotatingFileRenameLock);
     size_t i;
     char *nextpath = NULL;
     char *thispath = NULL;
@@ -375,6 +1005,11 @@ virRotatingFileWriterRollover(virRotatingFileWriter *file)
     } else {
         nextpath = g_strdup_printf("%s.%zu", file->basepath, file->maxbackup - 1);
 
+        /* The oldest file may be either plain or compressed, make sure
+         * neither form is left behind */
+        if (virRotatingFileUnlinkBackup(nextpath) < 0)
+            goto cleanup;
+
         for (i = file->maxbackup; i > 0; i--) {
             if (i == 1) {
                 thispath = g_strdup(file->basepath);
@@ -391,9 +1026,27 @@ virRotatingFileWriterRollover(virRotatingFileWriter *file)
                 goto cleanup;
             }
 
+            if (i > 1) {
+                g_autofree char *thisgzpath = g_strdup_printf("%s" VIR_ROTATING_FILE_GZ_SUFFIX,
+                                                              thispath);
+                g_autofree char *nextgzpath = g_strdup_printf("%s" VIR_ROTATING_FILE_GZ_SUFFIX,
+                                                              nextpath);
+
+                if (rename(thisgzpath, nextgzpath) < 0 &&
+                    errno != ENOENT) {
+                    virReportSystemError(errno,
+                                         _("Unable to rename %1$s to %2$s"),
+                                         thisgzpath, nextgzpath);
+                    goto cleanup;
+                }
+            }
+
             VIR_FREE(nextpath);
             nextpath = g_steal_pointer(&thispath);
         }
+
+        if (file->compress)
+            virRotatingFileWriterScheduleCompress(file);
     }
 
     VIR_DEBUG("Rollover done %s", file->basepath);
@@ -491,6 +1144,133 @@ virRotatingFileWriterAppend(virRotatingFileWriter *file,
 }
 
 
+#if WITH_SPLICE
+/*
+ * Moves data from pipe @fd to the end of the current file without copying
+ * it through userspace. The caller must make sure @len bytes fit into the
+ * file.
+ *
+ * Returns the number of bytes moved, 0 on end of file, -1 on error or -2
+ * if splice() can't be used for the file or the data.
+ */
+static ssize_t
+virRotatingFileWriterSplice(virRotatingFileWriter *file,
+                            int fd,
+                            size_t len)
+{
+    virRotatingFileWriterEntry *entry = file->entry;
+    struct stat sb;
+    loff_t off;
+    ssize_t got;
+
+    if (entry->splicefd < 0) {
+        if ((entry->splicefd = open(file->basepath, O_WRONLY|O_CLOEXEC)) < 0 ||
+            fstat(entry->splicefd, &sb) < 0 ||
+            sb.st_ino != entry->inode) {
+            VIR_DEBUG("Cannot splice to %s, file was replaced or is not accessible",
+                      file->basepath);
+            VIR_FORCE_CLOSE(entry->splicefd);
+            file->nosplice = true;
+            return -2;
+        }
+    } else if (fstat(entry->splicefd, &sb) < 0) {
+        virReportSystemError(errno,
+                             _("Unable to determine size of file %1$s"),
+                             file->basepath);
+        return -1;
+    }
+
+    /* Unlike writes to the O_APPEND descriptor, splice() writes at the
+     * given offset. Follow the size of the file in case it was truncated,
+     * eg. by logrotate's copytruncate, rather than leaving a hole. */
+    if (sb.st_size != entry->pos) {
+        VIR_DEBUG("Size of %s changed from %lld to %lld",
+                  file->basepath, (long long)entry->pos, (long long)sb.st_size);
+        entry->pos = sb.st_size;
+        entry->len = sb.st_size;
+
+        if (file->maxlen != 0 && entry->pos + len > file->maxlen)
+            return -2;
+    }
+
+    off = entry->pos;
+
+ retry:
+    if ((got = splice(fd, NULL, entry->splicefd, &off, len, SPLICE_F_MOVE)) < 0) {
+        if (errno == EINTR)
+            goto retry;
+
+        if (errno == EINVAL || errno == ENOSYS) {
+            VIR_DEBUG("splice to %s not supported: %s",
+                      file->basepath, g_strerror(errno));
+            file->nosplice = true;
+            return -2;
+        }
+
+        virReportSystemError(errno,
+                             _("Unable to write to file %1$s"),
+                             file->basepath);
+        return -1;
+    }
+
+    entry->pos += got;
+    entry->len += got;
+
+    return got;
+}
+#endif /* WITH_SPLICE */
+
+
+/**
+ * virRotatingFileWriterAppendFD:
+ * @file: the file context
+ * @fd: the pipe to read data from
+ * @len: the maximum number of bytes to move
+ *
+ * Move up to @len bytes available in pipe @fd to the file, performing
+ * rollover of the files if their size would exceed the limit. Where the
+ * data fits into the current file it is moved using splice() without
+ * copying it through userspace.
+ *
+ * Returns the number of bytes moved, 0 on end of file, or -1 on error
+ */
+ssize_t
+virRotatingFileWriterAppendFD(virRotatingFileWriter *file,
+                              int fd,
+                              size_t len)
+{
+    g_autofree char *buf = NULL;
+    ssize_t got;
+
+#if WITH_SPLICE
+    if (!file->nosplice &&
+        (file->maxlen == 0 || file->entry->pos + len <= file->maxlen)) {
+        if ((got = virRotatingFileWriterSplice(file, fd, len)) != -2)
+            return got;
+    }
+#endif /* WITH_SPLICE */
+
+    buf = g_new(char, len);
+
+ reread:
+    if ((got = read(fd, buf, len)) < 0) {
+        if (errno == EINTR)
+            goto reread;
+
+        virReportSystemError(errno,
+                             _("Unable to read data for file %1$s"),
+                             file->basepath);
+        return -1;
+    }
+
+    if (got > 0 &&
+        virRotatingFileWriterAppend(file, buf, got) != got)
+        return -1;
+
+    return got;
+}
+
+
 /**
  * virRotatingFileReaderSeek
  * @file: the file context
@@ -509,7 +1289,6 @@ virRotatingFileReaderSeek(virRotatingFileReader *file,
                           off_t offset)
 {
     size_t i;
-    off_t ret;
 
     for (i = 0; i < file->nentries; i++) {
         virRotatingFileReaderEntry *entry = file->entries[i];
@@ -517,27 +1296,15 @@ virRotatingFileReaderSeek(virRotatingFileReader *file,
             entry->fd == -1)
             continue;
 
-        ret = lseek(entry->fd, offset, SEEK_SET);
-        if (ret == (off_t)-1) {
-            virReportSystemError(errno,
-                                 _("Unable to seek to inode %1$llu offset %2$llu"),
-                                 (unsigned long long)inode, (unsigned long long)offset);
+        if (virRotatingFileReaderEntrySeek(entry, offset) < 0)
             return -1;
-        }
 
         file->current = i;
         return 0;
     }
 
     file->current = 0;
-    ret = lseek(file->entries[0]->fd, offset, SEEK_SET);
-    if (ret == (off_t)-1) {
-        virReportSystemError(errno,
-                             _("Unable to seek to inode %1$llu offset %2$llu"),
-                             (unsigned long long)inode, (unsigned long long)offset);
-        return -1;
-    }
-    return 0;
+    return virRotatingFileReaderEntrySeek(file->entries[0], offset);
 }
 
 
@@ -573,13 +1340,8 @@ virRotatingFileReaderConsume(virRotatingFileReader *file,
             continue;
         }
 
-        got = saferead(entry->fd, buf + ret, len);
-        if (got < 0) {
-            virReportSystemError(errno,
-                                 _("Unable to read from file %1$s"),
-                                 entry->path);
+        if ((got = virRotatingFileReaderEntryRead(entry, buf + ret, len)) < 0)
             return -1;
-        }
 
         if (got == 0) {
             file->current++;
@@ -36,6 +36,9 @@ virRotatingFileWriter *virRotatingFileWriterNew(const char *path,
 virRotatingFileReader *virRotatingFileReaderNew(const char *path,
                                                   size_t maxbackup);
 
+void virRotatingFileWriterSetCompress(virRotatingFileWriter *file,
+                                      bool compress);
+
 const char *virRotatingFileWriterGetPath(virRotatingFileWriter *file);
 
 ino_t virRotatingFileWriterGetINode(virRotatingFileWriter *file);
@@ -44,6 +47,9 @@ off_t virRotatingFileWriterGetOffset(virRotatingFileWriter *file);
 ssize_t virRotatingFileWriterAppend(virRotatingFileWriter *file,
                                     const char *buf,
                                     size_t len);
+ssize_t virRotatingFileWriterAppendFD(virRotatingFileWriter *file,
+                                      int fd,
+                                      size_t len);
 
 int virRotatingFileReaderSeek(virRotatingFileReader *file,
                               ino_t inode,
@@ -53,5 +59,8 @@ ssize_t virRotatingFileReaderConsume(virRotatingFileReader *file,
                                      char *buf,
                                      size_t len);
 
+int virRotatingFileCompress(const char *path,
+                            size_t maxbackup);
+
 void virRotatingFileWriterFree(virRotatingFileWriter *file);
 void virRotatingFileReaderFree(virRotatingFileReader *file);
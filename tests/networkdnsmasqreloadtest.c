@@ -0,0 +1,189 @@
+/*
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include <config.h>
+
+#include <signal.h>
+
+#include "testutils.h"
+#include "network/bridge_driver.h"
+#define LIBVIRT_BRIDGE_DRIVERPRIV_H_ALLOW
+#include "network/bridge_driverpriv.h"
+#include "virfile.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+static virNetworkDriverState driver;
+static virNetworkObj *network;
+
+/* This process stands in for dnsmasq of @network */
+static volatile sig_atomic_t reloads;
+
+static const char *networkXML =
+    "<network>\n"
+    "  <name>default</name>\n"
+    "  <bridge name='virbr0'/>\n"
+    "  <ip address='192.168.122.1' netmask='255.255.255.0'>\n"
+    "    <dhcp>\n"
+    "      <range start='192.168.122.2' end='192.168.122.254'/>\n"
+    "      <host mac='00:16:3e:77:e2:ed' name='a.example.com' ip='192.168.122.10'/>\n"
+    "    </dhcp>\n"
+    "  </ip>\n"
+    "</network>\n";
+
+
+static void
+testReloadHandler(int sig G_GNUC_UNUSED)
+{
+    reloads++;
+}
+
+
+static int
+testRefreshDeferred(const void *opaque G_GNUC_UNUSED)
+{
+    g_autoptr(virNetworkDriverConfig) cfg = virNetworkDriverGetConfig(&driver);
+    g_autofree char *hostsfile = NULL;
+    g_autofree char *actual = NULL;
+    int rc = 0;
+
+    hostsfile = g_strdup_printf("%s/default.hostsfile", cfg->dnsmasqStateDir);
+    reloads = 0;
+
+    /* a burst of host updates */
+    VIR_WITH_OBJECT_LOCK_GUARD(network) {
+        if (networkRefreshDhcpDaemon(&driver, network, true) < 0 ||
+            virNetworkObjUpdate(network,
+                                VIR_NETWORK_UPDATE_COMMAND_ADD_LAST,
+                                VIR_NETWORK_SECTION_IP_DHCP_HOST, -1,
+                                "<host mac='00:16:3e:3e:a9:1a' name='b.example.com' ip='192.168.122.11'/>",
+                                driver.xmlopt,
+                                VIR_NETWORK_UPDATE_AFFECT_LIVE) < 0 ||
+            networkRefreshDhcpDaemon(&driver, network, true) < 0)
+            rc = -1;
+    }
+
+    if (rc < 0)
+        return -1;
+
+    if (virFileExists(hostsfile) || reloads != 0) {
+        VIR_TEST_VERBOSE("host files were written before the timer fired");
+        return -1;
+    }
+
+    while (driver.dnsmasqReloadTimer != -1) {
+        if (virEventRunDefaultImpl() < 0)
+            return -1;
+    }
+
+    if (reloads != 1) {
+        VIR_TEST_VERBOSE("expected 1 reload, got %d", (int) reloads);
+        return -1;
+    }
+
+    if (virFileReadAll(hostsfile, 1024, &actual) < 0)
+        return -1;
+
+    return virTestCompareToString("00:16:3e:77:e2:ed,192.168.122.10,a.example.com\n"
+                                  "00:16:3e:3e:a9:1a,192.168.122.11,b.example.com\n",
+                                  actual);
+}
+
+
+static int
+testRefreshDeferredUnwritable(const void *opaque G_GNUC_UNUSED)
+{
+    g_autofree char *stateDir = NULL;
+    g_autofree char *file = NULL;
+    int rc = 0;
+
+    /* the directory can't be created below a regular file */
+    file = g_strdup_printf("%s/file", g_getenv("LIBVIRT_FAKE_ROOT_DIR"));
+    if (virFileTouch(file, 0600) < 0)
+        return -1;
+
+    stateDir = g_steal_pointer(&driver.config->dnsmasqStateDir);
+    driver.config->dnsmasqStateDir = g_strdup_printf("%s/dnsmasq", file);
+
+    VIR_WITH_OBJECT_LOCK_GUARD(network) {
+        rc = networkRefreshDhcpDaemon(&driver, network, true);
+    }
+
+    g_free(driver.config->dnsmasqStateDir);
+    driver.config->dnsmasqStateDir = g_steal_pointer(&stateDir);
+
+    if (rc == 0) {
+        VIR_TEST_VERBOSE("refresh with unwritable host files succeeded");
+        return -1;
+    }
+
+    if (driver.dnsmasqReloadTimer != -1) {
+        VIR_TEST_VERBOSE("reload scheduled despite the failure");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+mymain(void)
+{
+    const char *fakerootdir = g_getenv("LIBVIRT_FAKE_ROOT_DIR");
+    struct sigaction sa = { .sa_handler = testReloadHandler };
+    virNetworkDef *def = NULL;
+    int ret = 0;
+
+    /* keep the per-user driver directories in the fake root */
+    g_setenv("XDG_CONFIG_HOME", fakerootdir, TRUE);
+    g_setenv("XDG_RUNTIME_DIR", fakerootdir, TRUE);
+
+    if (sigaction(SIGHUP, &sa, NULL) < 0)
+        return EXIT_FAILURE;
+
+    virEventRegisterDefaultImpl();
+
+    if (virMutexInit(&driver.lock) < 0)
+        return EXIT_FAILURE;
+
+    driver.dnsmasqReloadTimer = -1;
+    driver.dnsmasqReloadPending = g_hash_table_new_full(g_str_hash,
+                                                        g_str_equal,
+                                                        g_free,
+                                                        NULL);
+
+    if (!(driver.config = virNetworkDriverConfigNew(false)) ||
+        !(driver.xmlopt = networkDnsmasqCreateXMLConf()) ||
+        !(driver.networks = virNetworkObjListNew()))
+        return EXIT_FAILURE;
+
+    if (!(def = virNetworkDefParse(networkXML, NULL, driver.xmlopt, false)))
+        return EXIT_FAILURE;
+
+    if (!(network = virNetworkObjAssignDef(driver.networks, def, 0))) {
+        virNetworkDefFree(def);
+        return EXIT_FAILURE;
+    }
+
+    virNetworkObjSetActive(network, true);
+    virNetworkObjSetDnsmasqPid(network, getpid());
+    virObjectUnlock(network);
+
+    if (virTestRun("Refresh deferred", testRefreshDeferred, NULL) < 0)
+        ret = -1;
+    if (virTestRun("Refresh deferred unwritable",
+                   testRefreshDeferredUnwritable, NULL) < 0)
+        ret = -1;
+
+    virObjectUnref(network);
+    virObjectUnref(driver.networks);
+    virObjectUnref(driver.xmlopt);
+    virObjectUnref(driver.config);
+    g_hash_table_unref(driver.dnsmasqReloadPending);
+    virMutexDestroy(&driver.lock);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIR_TEST_MAIN(mymain)
@@ -70,24 +70,48 @@ VIR_MOCK_WRAP_RET_ARGS(g_dbus_connection_call_sync,
 }
 
 static void
-testCommandDryRun(const char *const*args G_GNUC_UNUSED,
+testCommandDryRun(const char *const*args,
                   const char *const*env G_GNUC_UNUSED,
-                  const char *input G_GNUC_UNUSED,
+                  const char *input,
                   char **output,
                   char **error,
                   int *status,
-                  void *opaque G_GNUC_UNUSED)
+                  void *opaque)
 {
+    virBuffer *buf = opaque;
+    bool echo = STREQ_NULLABLE(args[1], "-ae");
+
     *status = 0;
+    *error = g_strdup("");
+
+    /* nft reading a script from stdin, record the script itself */
+    if (input && g_strv_contains(args, "-f")) {
+        g_auto(GStrv) lines = g_strsplit(input, "\n", -1);
+        g_auto(virBuffer) echoBuf = VIR_BUFFER_INITIALIZER;
+        size_t i;
+
+        virBufferAdd(buf, input, -1);
+
+        /* with -ae, nft echoes every created object with its handle */
+        for (i = 0; echo && lines[i]; i++) {
+            if (*lines[i])
+                virBufferAsprintf(&echoBuf, "%s # handle 5309\n", lines[i]);
+        }
+
+        *output = virBufferContentAndReset(&echoBuf);
+        if (!*output)
+            *output = g_strdup("");
+        return;
+    }
+
     /* if arg[1] is -ae then this is an nft command,
      * and the caller requested to get the handle
      * of the newly added object in stdout
      */
-    if (STREQ_NULLABLE(args[1], "-ae"))
+    if (echo)
         *output = g_strdup("# handle 5309");
     else
         *output = g_strdup("");
-    *error = g_strdup("");
 }
 
 static int testCompareXMLToArgvFiles(const char *xml,
@@ -101,7 +125,7 @@ static int testCompareXMLToArgvFiles(const char *xml,
     char *actual;
     g_autoptr(virCommandDryRunToken) dryRunToken = virCommandDryRunTokenNew();
 
-    virCommandSetDryRun(dryRunToken, &buf, true, true, testCommandDryRun, NULL);
+    virCommandSetDryRun(dryRunToken, &buf, true, true, testCommandDryRun, &buf);
 
     if (!(def = virNetworkDefParse(NULL, xml, NULL, false)))
         return -1;
@@ -59,9 +59,16 @@ getrealpath(char **newpath,
             const char *path)
 {
     if (STRPREFIX(path, LEASEDIR)) {
-        *newpath = g_strdup_printf("%s/nssdata/%s",
-                                   abs_srcdir,
-                                   path + strlen(LEASEDIR));
+        const char *datadir = getenv("VIR_NSS_MOCK_DATADIR");
+
+        if (datadir)
+            *newpath = g_strdup_printf("%s/%s",
+                                       datadir,
+                                       path + strlen(LEASEDIR));
+        else
+            *newpath = g_strdup_printf("%s/nssdata/%s",
+                                       abs_srcdir,
+                                       path + strlen(LEASEDIR));
     } else {
         *newpath = g_strdup(path);
     }
@@ -151,6 +158,17 @@ access(const char *path, int mode)
     free(newpath);
     return ret;
 }
+
+# include "virmockstathelpers.c"
+
+static int
+virMockStatRedirect(const char *path, char **newpath)
+{
+    if (STRPREFIX(path, LEASEDIR))
+        return getrealpath(newpath, path);
+
+    return 0;
+}
 #else
 /* Nothing to override if NSS plugin is not enabled */
 #endif
@@ -23,6 +23,10 @@
 #ifdef WITH_NSS
 
 # include "libvirt_nss.h"
+# include "virfile.h"
+# include "virjson.h"
+# include "virleaseindex.h"
+# include "virmacmap.h"
 
 # define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -150,8 +154,61 @@ testGetHostByName(const void *opaque)
     return 0;
 }
 
+
+/*
+ * Copy the lease and MAC map files of @bridge into @dir and write
+ * their indexes the way the network driver and leaseshelper do.
+ */
 static int
-mymain(void)
+testPrepareIndex(const char *dir,
+                 const char *bridge)
+{
+    g_autofree char *srcStatus = NULL;
+    g_autofree char *dstStatus = NULL;
+    g_autofree char *srcMacs = NULL;
+    g_autofree char *dstMacs = NULL;
+    g_autofree char *macsIndex = NULL;
+    g_autofree char *buf = NULL;
+    g_autoptr(virJSONValue) leases = NULL;
+    g_autoptr(virLeaseIndex) idx = NULL;
+    g_autoptr(virMacMap) mgr = NULL;
+
+    srcStatus = g_strdup_printf("%s/nssdata/%s.status", abs_srcdir, bridge);
+    dstStatus = g_strdup_printf("%s/%s.status", dir, bridge);
+    srcMacs = g_strdup_printf("%s/nssdata/%s.macs", abs_srcdir, bridge);
+    dstMacs = g_strdup_printf("%s/%s.macs", dir, bridge);
+
+    if (virFileReadAll(srcStatus, 1024 * 1024, &buf) < 0 ||
+        virFileWriteStr(dstStatus, buf, 0644) < 0)
+        return -1;
+
+    if (!(leases = virJSONValueFromString(buf)))
+        return -1;
+
+    idx = virLeaseIndexNew();
+
+    if (virLeaseIndexAddLeases(idx, leases) < 0 ||
+        virLeaseIndexWrite(idx, dstStatus) < 0)
+        return -1;
+
+    if (!(mgr = virMacMapNew(srcMacs)) ||
+        virMacMapWriteFile(mgr, dstMacs) < 0)
+        return -1;
+
+    /* virMacMapWriteFile() only warns about the index */
+    macsIndex = virLeaseIndexFileName(dstMacs);
+    if (!virFileExists(macsIndex)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       "Index %s was not written", macsIndex);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+testNSSLookups(const char *prefix)
 {
     int ret = 0;
 
@@ -161,7 +218,8 @@ mymain(void)
         struct testNSSData data = { \
             .hostname = name, .ipAddr = addr, .af = family, \
         }; \
-        if (virTestRun(name, testGetHostByName, &data) < 0) \
+        g_autofree char *testname = g_strdup_printf("%s%s", prefix, name); \
+        if (virTestRun(testname, testGetHostByName, &data) < 0) \
             ret = -1; \
     } while (0)
 
@@ -177,6 +235,47 @@ mymain(void)
     DO_TEST("suse", AF_INET, "192.168.122.3");
 # endif /* defined(LIBVIRT_NSS_GUEST) */
 
+# undef DO_TEST
+
+    return ret;
+}
+
+
+# define SCRATCHDIRTEMPLATE abs_builddir "/nssdir-XXXXXX"
+
+static int
+mymain(void)
+{
+    char scratchdir[] = SCRATCHDIRTEMPLATE;
+    int ret = 0;
+
+    /* Plain JSON files from nssdata first */
+    if (testNSSLookups("") < 0)
+        ret = -1;
+
+    /* And then the same lookups once more through the indexes */
+    if (!g_mkdtemp(scratchdir)) {
+        fprintf(stderr, "Cannot create nssdir");
+        abort();
+    }
+
+    if (testPrepareIndex(scratchdir, "virbr0") < 0 ||
+        testPrepareIndex(scratchdir, "virbr1") < 0) {
+        fprintf(stderr, "Cannot prepare indexes: %s\n",
+                virGetLastErrorMessage());
+        ret = -1;
+    } else {
+        g_setenv("VIR_NSS_MOCK_DATADIR", scratchdir, TRUE);
+
+        if (testNSSLookups("index ") < 0)
+            ret = -1;
+
+        g_unsetenv("VIR_NSS_MOCK_DATADIR");
+    }
+
+    if (getenv("LIBVIRT_SKIP_CLEANUP") == NULL)
+        virFileDeleteTree(scratchdir);
+
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
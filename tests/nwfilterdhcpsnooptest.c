@@ -0,0 +1,279 @@
+/*
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include <config.h>
+
+#include "testutils.h"
+
+#ifdef WITH_LIBPCAP
+
+# include <sys/socket.h>
+# include <netinet/in.h>
+# include <netinet/ip.h>
+# include <netinet/udp.h>
+# include <net/ethernet.h>
+
+# define LIBVIRT_NWFILTER_DHCPSNOOPPRIV_H_ALLOW
+# include "nwfilter/nwfilter_dhcpsnooppriv.h"
+
+# define VIR_FROM_THIS VIR_FROM_NONE
+
+# define TEST_VM_MAC "52:54:00:11:22:33"
+# define TEST_OTHER_MAC "52:54:00:44:55:66"
+
+# define TEST_BLOCK_SIZE 4096
+/* where the Ethernet frame starts within a packet of the block */
+# define TEST_FRAME_OFFSET \
+    TPACKET_ALIGN(TPACKET_ALIGN(sizeof(struct tpacket3_hdr)) + \
+                  sizeof(struct sockaddr_ll))
+
+typedef struct _testFrame testFrame;
+struct _testFrame {
+    const char *src;    /* source MAC address */
+    uint16_t ethertype; /* IPv4 if 0 */
+    uint8_t protocol;   /* UDP if 0 */
+    uint16_t sport;
+    uint16_t dport;
+    size_t trunc;       /* number of bytes cut off the end */
+};
+
+struct testDHCPFrame {
+    uint8_t dst[VIR_MAC_BUFLEN];
+    uint8_t src[VIR_MAC_BUFLEN];
+    uint16_t type;
+    struct iphdr ip;
+    struct udphdr udp;
+} ATTRIBUTE_PACKED;
+
+
+static size_t
+testBuildFrame(uint8_t *buf,
+               const testFrame *frame)
+{
+    struct testDHCPFrame dhcp = { 0 };
+    virMacAddr mac;
+
+    if (virMacAddrParse(frame->src, &mac) < 0)
+        abort();
+
+    memset(dhcp.dst, 0xff, sizeof(dhcp.dst));
+    memcpy(dhcp.src, mac.addr, sizeof(dhcp.src));
+    dhcp.type = htons(frame->ethertype ? frame->ethertype : ETHERTYPE_IP);
+    dhcp.ip.version = 4;
+    dhcp.ip.ihl = sizeof(dhcp.ip) >> 2;
+    dhcp.ip.protocol = frame->protocol ? frame->protocol : IPPROTO_UDP;
+    dhcp.udp.source = htons(frame->sport);
+    dhcp.udp.dest = htons(frame->dport);
+
+    memcpy(buf, &dhcp, sizeof(dhcp));
+
+    return sizeof(dhcp) - frame->trunc;
+}
+
+
+typedef struct _testPacket testPacket;
+struct _testPacket {
+    int ifindex;
+    unsigned char pkttype;
+    bool fromVM;        /* expected direction */
+    const char *src;    /* source MAC address of the frame */
+};
+
+static const testPacket testBlockPackets[] = {
+    { .ifindex = 3, .pkttype = PACKET_HOST, .fromVM = true,
+      .src = TEST_VM_MAC },
+    /* a tap device sends to the VM what the host transmits on it */
+    { .ifindex = 4, .pkttype = PACKET_OUTGOING, .fromVM = false,
+      .src = TEST_OTHER_MAC },
+    { .ifindex = 5, .pkttype = PACKET_BROADCAST, .fromVM = true,
+      .src = TEST_OTHER_MAC },
+};
+
+typedef struct _testSeen testSeen;
+struct _testSeen {
+    size_t npackets;
+    bool failed;
+};
+
+
+static void
+testBlockPacket(int ifindex,
+                bool fromVM,
+                void *packet,
+                int len,
+                void *opaque)
+{
+    testSeen *seen = opaque;
+    const testPacket *exp;
+    virMacAddr mac;
+
+    if (seen->npackets >= G_N_ELEMENTS(testBlockPackets)) {
+        VIR_TEST_VERBOSE("unexpected packet %zu", seen->npackets);
+        seen->failed = true;
+        return;
+    }
+
+    exp = &testBlockPackets[seen->npackets++];
+
+    if (virMacAddrParse(exp->src, &mac) < 0)
+        abort();
+
+    if (ifindex != exp->ifindex || fromVM != exp->fromVM ||
+        len != (int) sizeof(struct testDHCPFrame) ||
+        memcmp((uint8_t *)packet + VIR_MAC_BUFLEN, mac.addr, VIR_MAC_BUFLEN) != 0) {
+        VIR_TEST_VERBOSE("packet %zu: got ifindex=%d fromVM=%d len=%d, expected ifindex=%d fromVM=%d",
+                         seen->npackets - 1, ifindex, fromVM, len,
+                         exp->ifindex, exp->fromVM);
+        seen->failed = true;
+    }
+}
+
+
+static int
+testSharedBlock(const void *opaque G_GNUC_UNUSED)
+{
+    g_autofree uint8_t *block = g_new0(uint8_t, TEST_BLOCK_SIZE);
+    struct tpacket_block_desc *bd;
+    struct tpacket3_hdr *ppd = NULL;
+    size_t off;
+    testSeen seen = { 0 };
+    size_t i;
+
+    VIR_WARNINGS_NO_CAST_ALIGN
+    bd = (struct tpacket_block_desc *)block;
+    off = TPACKET_ALIGN(sizeof(*bd));
+
+    bd->version = TPACKET_V3;
+    bd->hdr.bh1.block_status = TP_STATUS_USER;
+    bd->hdr.bh1.num_pkts = G_N_ELEMENTS(testBlockPackets);
+    bd->hdr.bh1.offset_to_first_pkt = off;
+
+    for (i = 0; i < G_N_ELEMENTS(testBlockPackets); i++) {
+        const testPacket *pkt = &testBlockPackets[i];
+        const testFrame frame = {
+            .src = pkt->src, .sport = 68, .dport = 67,
+        };
+        struct sockaddr_ll *sll;
+        size_t len;
+
+        ppd = (struct tpacket3_hdr *)(block + off);
+        sll = (struct sockaddr_ll *)(block + off +
+                                     TPACKET_ALIGN(sizeof(*ppd)));
+
+        len = testBuildFrame(block + off + TEST_FRAME_OFFSET, &frame);
+
+        sll->sll_family = AF_PACKET;
+        sll->sll_ifindex = pkt->ifindex;
+        sll->sll_pkttype = pkt->pkttype;
+
+        ppd->tp_mac = TEST_FRAME_OFFSET;
+        ppd->tp_snaplen = len;
+        ppd->tp_len = len;
+        ppd->tp_next_offset = TPACKET_ALIGN(TEST_FRAME_OFFSET + len);
+        off += ppd->tp_next_offset;
+    }
+    VIR_WARNINGS_RESET
+
+    /* the kernel leaves the offset of the last packet zero */
+    ppd->tp_next_offset = 0;
+    bd->hdr.bh1.blk_len = off;
+
+    virNWFilterSnoopSharedBlock(bd, testBlockPacket, &seen);
+
+    if (seen.failed)
+        return -1;
+
+    if (seen.npackets != G_N_ELEMENTS(testBlockPackets)) {
+        VIR_TEST_VERBOSE("walked %zu packets, expected %zu",
+                         seen.npackets, G_N_ELEMENTS(testBlockPackets));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+typedef struct _testAcceptData testAcceptData;
+struct _testAcceptData {
+    testFrame frame;
+    bool fromVM;
+    bool accept;
+};
+
+
+static int
+testSharedAccept(const void *opaque)
+{
+    const testAcceptData *data = opaque;
+    uint8_t buf[sizeof(struct testDHCPFrame)];
+    virMacAddr mac;
+    size_t len;
+
+    if (virMacAddrParse(TEST_VM_MAC, &mac) < 0)
+        return -1;
+
+    len = testBuildFrame(buf, &data->frame);
+
+    if (virNWFilterSnoopSharedAccept(&mac, buf, len, data->fromVM) != data->accept) {
+        VIR_TEST_VERBOSE("expected the packet to be %s",
+                         data->accept ? "accepted" : "dropped");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virTestRun("Shared ring block", testSharedBlock, NULL) < 0)
+        ret = -1;
+
+# define DO_TEST_ACCEPT(name, FromVM, Accept, ...) \
+    do { \
+        const testAcceptData data = { \
+            .frame = { __VA_ARGS__ }, \
+            .fromVM = FromVM, .accept = Accept, \
+        }; \
+        if (virTestRun("Shared accept " name, testSharedAccept, &data) < 0) \
+            ret = -1; \
+    } while (0)
+
+    DO_TEST_ACCEPT("request", true, true,
+                   .src = TEST_VM_MAC, .sport = 68, .dport = 67);
+    DO_TEST_ACCEPT("request of another VM", true, false,
+                   .src = TEST_OTHER_MAC, .sport = 68, .dport = 67);
+    DO_TEST_ACCEPT("reply", false, true,
+                   .src = TEST_OTHER_MAC, .sport = 67, .dport = 68);
+    DO_TEST_ACCEPT("reply from VM", true, false,
+                   .src = TEST_VM_MAC, .sport = 67, .dport = 68);
+    DO_TEST_ACCEPT("request to VM", false, false,
+                   .src = TEST_OTHER_MAC, .sport = 68, .dport = 67);
+    DO_TEST_ACCEPT("not IPv4", true, false,
+                   .src = TEST_VM_MAC, .sport = 68, .dport = 67,
+                   .ethertype = ETHERTYPE_IPV6);
+    DO_TEST_ACCEPT("not UDP", true, false,
+                   .src = TEST_VM_MAC, .sport = 68, .dport = 67,
+                   .protocol = IPPROTO_TCP);
+    DO_TEST_ACCEPT("truncated", true, false,
+                   .src = TEST_VM_MAC, .sport = 68, .dport = 67,
+                   .trunc = 4);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIR_TEST_MAIN(mymain)
+
+#else /* !WITH_LIBPCAP */
+
+int
+main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#endif /* !WITH_LIBPCAP */
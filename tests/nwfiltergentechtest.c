@@ -0,0 +1,435 @@
+/*
+ * nwfiltergentechtest.c: Test updating the filters of bindings
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "testutils.h"
+#include "nwfilter/nwfilter_gentech_driver.h"
+#include "nwfilter/nwfilter_learnipaddr.h"
+#include "nwfilter/nwfilter_nftables_driver.h"
+#include "nwfilter_ipaddrmap.h"
+#include "virnwfilterbindingobjlist.h"
+#include "virbuffer.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+static virNWFilterDriverState driver;
+
+/* operations of the technology driver, as "<operation> <interface>" */
+static virMutex testOpsLock = VIR_MUTEX_INITIALIZER;
+static GPtrArray *testOps;
+
+/* applying new rules to this interface fails */
+static const char *testFailIface;
+
+
+static void
+testTechDriverRecord(const char *op,
+                     const char *ifname)
+{
+    VIR_LOCK_GUARD lock = virLockGuardLock(&testOpsLock);
+
+    g_ptr_array_add(testOps, g_strdup_printf("%s %s", op, ifname));
+}
+
+
+static int
+testTechDriverInit(bool privileged G_GNUC_UNUSED)
+{
+    nftables_driver.flags = TECHDRV_FLAG_INITIALIZED;
+    return 0;
+}
+
+
+static void
+testTechDriverShutdown(void)
+{
+    nftables_driver.flags = 0;
+}
+
+
+static int
+testTechDriverApplyNewRules(const char *ifname,
+                            virNWFilterRuleInst **rules G_GNUC_UNUSED,
+                            size_t nrules G_GNUC_UNUSED)
+{
+    if (STREQ_NULLABLE(ifname, testFailIface)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       "cannot apply rules");
+        return -1;
+    }
+
+    testTechDriverRecord("apply", ifname);
+    return 0;
+}
+
+
+static int
+testTechDriverTearNewRules(const char *ifname)
+{
+    testTechDriverRecord("tear-new", ifname);
+    return 0;
+}
+
+
+static int
+testTechDriverTearOldRules(const char *ifname)
+{
+    testTechDriverRecord("tear-old", ifname);
+    return 0;
+}
+
+
+static int
+testTechDriverAllTeardown(const char *ifname)
+{
+    testTechDriverRecord("teardown", ifname);
+    return 0;
+}
+
+
+/* Replaces the nftables driver so that the generic code picks it up */
+static virNWFilterTechDriver testTechDriver = {
+    .name = NFTABLES_DRIVER_ID,
+
+    .init     = testTechDriverInit,
+    .shutdown = testTechDriverShutdown,
+
+    .applyNewRules = testTechDriverApplyNewRules,
+    .tearNewRules  = testTechDriverTearNewRules,
+    .tearOldRules  = testTechDriverTearOldRules,
+    .allTeardown   = testTechDriverAllTeardown,
+};
+
+
+static int
+testCompareOps(const void *a,
+               const void *b)
+{
+    return strcmp(*(const char **)a, *(const char **)b);
+}
+
+
+/*
+ * Returns the recorded operations sorted, since the rules of the
+ * interfaces are applied in parallel. Operations applying rules are
+ * left out with @skipApply.
+ */
+static char *
+testFormatOps(bool skipApply)
+{
+    g_auto(virBuffer) buf = VIR_BUFFER_INITIALIZER;
+    size_t i;
+
+    g_ptr_array_sort(testOps, testCompareOps);
+
+    for (i = 0; i < testOps->len; i++) {
+        const char *op = g_ptr_array_index(testOps, i);
+
+        if (skipApply && STRPREFIX(op, "apply "))
+            continue;
+
+        virBufferAsprintf(&buf, "%s\n", op);
+    }
+
+    return virBufferContentAndReset(&buf);
+}
+
+
+static int
+testNWFilterRebuild(void *opaque)
+{
+    return virNWFilterBuildAll(opaque, true);
+}
+
+
+static int
+testNWFilterDefine(const char *xml)
+{
+    virNWFilterDef *def;
+    virNWFilterObj *obj = NULL;
+
+    if (!(def = virNWFilterDefParse(xml, NULL, 0)))
+        return -1;
+
+    VIR_WITH_MUTEX_LOCK_GUARD(&driver.updateLock) {
+        obj = virNWFilterObjListAssignDef(driver.nwfilters, def);
+    }
+
+    if (!obj) {
+        virNWFilterDefFree(def);
+        return -1;
+    }
+
+    virNWFilterObjUnlock(obj);
+    return 0;
+}
+
+
+static int
+testNWFilterAddBinding(const char *portdev,
+                       const char *filter)
+{
+    g_autofree char *xml = NULL;
+    virNWFilterBindingDef *def;
+    virNWFilterBindingObj *obj;
+    int ret = -1;
+
+    xml = g_strdup_printf("<filterbinding>\n"
+                          "  <owner>\n"
+                          "    <name>%s</name>\n"
+                          "    <uuid>d54df46f-1ab5-4a22-8618-4560ef5fac2c</uuid>\n"
+                          "  </owner>\n"
+                          "  <portdev name='%s'/>\n"
+                          "  <mac address='52:54:00:7b:35:93'/>\n"
+                          "  <filterref filter='%s'/>\n"
+                          "</filterbinding>\n",
+                          portdev, portdev, filter);
+
+    if (!(def = virNWFilterBindingDefParse(xml, NULL, 0)))
+        return -1;
+
+    if (!(obj = virNWFilterBindingObjListAdd(driver.bindings, def))) {
+        virNWFilterBindingDefFree(def);
+        return -1;
+    }
+
+    VIR_WITH_MUTEX_LOCK_GUARD(&driver.updateLock) {
+        ret = virNWFilterInstantiateFilter(&driver, def);
+    }
+
+    virNWFilterBindingObjEndAPI(&obj);
+    return ret;
+}
+
+
+#define TEST_FILTER(name, uuid, body) \
+    "<filter name='" name "' chain='root'>\n" \
+    "  <uuid>" uuid "</uuid>\n" \
+    body \
+    "</filter>\n"
+
+#define TEST_RULE(action, direction, protocolid) \
+    "  <rule action='" action "' direction='" direction "' priority='500'>\n" \
+    "    <mac protocolid='" protocolid "'/>\n" \
+    "  </rule>\n"
+
+#define TEST_REF(name) \
+    "  <filterref filter='" name "'/>\n"
+
+#define TEST_LEAF(protocolid) \
+    TEST_FILTER("leaf", "f9a4ca34-7cd2-4c1d-a0a4-d3b38f4c1f01", \
+                TEST_RULE("drop", "out", protocolid))
+
+#define TEST_MID \
+    TEST_FILTER("mid", "f9a4ca34-7cd2-4c1d-a0a4-d3b38f4c1f02", \
+                TEST_REF("leaf"))
+
+#define TEST_TOP_A(extra) \
+    TEST_FILTER("top-a", "f9a4ca34-7cd2-4c1d-a0a4-d3b38f4c1f03", \
+                TEST_REF("mid") \
+                TEST_RULE("drop", "in", "ipv6") \
+                extra)
+
+#define TEST_TOP_B(protocolid, extra) \
+    TEST_FILTER("top-b", "f9a4ca34-7cd2-4c1d-a0a4-d3b38f4c1f04", \
+                TEST_RULE("accept", "out", protocolid) \
+                extra)
+
+#define TEST_EMPTY \
+    TEST_FILTER("empty", "f9a4ca34-7cd2-4c1d-a0a4-d3b38f4c1f05", "")
+
+
+static int
+testNWFilterSetup(void)
+{
+    driver.nwfilters = virNWFilterObjListNew();
+    driver.bindings = virNWFilterBindingObjListNew();
+    if (!driver.bindings ||
+        virMutexInitRecursive(&driver.updateLock) < 0)
+        return -1;
+    driver.updateLockInitialized = true;
+
+    if (virNWFilterIPAddrMapInit() < 0 ||
+        virNWFilterLearnInit() < 0)
+        return -1;
+
+    nftables_driver = testTechDriver;
+    if (virNWFilterTechDriversInit(false, NFTABLES_DRIVER_ID) < 0)
+        return -1;
+
+    if (virNWFilterConfLayerInit(testNWFilterRebuild, &driver) < 0)
+        return -1;
+
+    if (testNWFilterDefine(TEST_LEAF("arp")) < 0 ||
+        testNWFilterDefine(TEST_MID) < 0 ||
+        testNWFilterDefine(TEST_TOP_A("")) < 0 ||
+        testNWFilterDefine(TEST_TOP_B("ipv4", "")) < 0 ||
+        testNWFilterDefine(TEST_EMPTY) < 0)
+        return -1;
+
+    /* vnet0: top-a -> mid -> leaf, vnet1: top-b, vnet2: mid -> leaf */
+    if (testNWFilterAddBinding("vnet0", "top-a") < 0 ||
+        testNWFilterAddBinding("vnet1", "top-b") < 0 ||
+        testNWFilterAddBinding("vnet2", "mid") < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static void
+testNWFilterShutdown(void)
+{
+    virNWFilterConfLayerShutdown();
+    virNWFilterTechDriversShutdown();
+    virNWFilterLearnShutdown();
+    virNWFilterIPAddrMapShutdown();
+    virObjectUnref(driver.bindings);
+    virNWFilterObjListFree(driver.nwfilters);
+    if (driver.updateLockInitialized)
+        virMutexDestroy(&driver.updateLock);
+}
+
+
+struct testNWFilterUpdateData {
+    const char *filter;
+    const char *teardown;
+    const char *fail;
+    const char *expect;
+};
+
+
+static int
+testNWFilterUpdate(const void *opaque)
+{
+    const struct testNWFilterUpdateData *data = opaque;
+    g_autofree char *actual = NULL;
+    int rc = -1;
+
+    g_ptr_array_set_size(testOps, 0);
+
+    if (data->teardown) {
+        virNWFilterBindingObj *obj;
+
+        if (!(obj = virNWFilterBindingObjListFindByPortDev(driver.bindings,
+                                                           data->teardown)))
+            return -1;
+
+        VIR_WITH_MUTEX_LOCK_GUARD(&driver.updateLock) {
+            rc = virNWFilterTeardownFilter(virNWFilterBindingObjGetDef(obj));
+        }
+        virNWFilterBindingObjEndAPI(&obj);
+
+        if (rc < 0)
+            return -1;
+    }
+
+    testFailIface = data->fail;
+    rc = testNWFilterDefine(data->filter);
+    testFailIface = NULL;
+
+    if (data->fail) {
+        if (rc == 0) {
+            VIR_TEST_VERBOSE("updating the filter should have failed");
+            return -1;
+        }
+        virResetLastError();
+    } else if (rc < 0) {
+        return -1;
+    }
+
+    /* which of the rules got applied before the failure was noticed
+     * depends on scheduling */
+    actual = testFormatOps(!!data->fail);
+
+    return virTestCompareToString(data->expect, NULLSTR_EMPTY(actual));
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    testOps = g_ptr_array_new_with_free_func(g_free);
+
+    if (testNWFilterSetup() < 0) {
+        ret = -1;
+        goto cleanup;
+    }
+
+#define DO_TEST(name, ...) \
+    do { \
+        struct testNWFilterUpdateData data = { __VA_ARGS__ }; \
+        if (virTestRun(name, testNWFilterUpdate, &data) < 0) \
+            ret = -1; \
+    } while (0)
+
+    /* The tests share the filters and the rules in effect */
+
+    /* only the bindings including the filter are updated */
+    DO_TEST("include",
+            .filter = TEST_LEAF("ipv4"),
+            .expect = "apply vnet0\n"
+                      "apply vnet2\n"
+                      "tear-old vnet0\n"
+                      "tear-old vnet2\n");
+
+    DO_TEST("direct",
+            .filter = TEST_TOP_B("arp", ""),
+            .expect = "apply vnet1\n"
+                      "tear-old vnet1\n");
+
+    /* the empty filter does not change the rules of vnet0 */
+    DO_TEST("unchanged",
+            .filter = TEST_TOP_A(TEST_REF("empty")),
+            .expect = "");
+
+    /* the rules of vnet1 are gone, they need applying again */
+    DO_TEST("teardown",
+            .filter = TEST_TOP_B("arp", TEST_REF("empty")),
+            .teardown = "vnet1",
+            .expect = "apply vnet1\n"
+                      "tear-old vnet1\n"
+                      "teardown vnet1\n");
+
+    /* all bindings go back to their old rules */
+    DO_TEST("rollback",
+            .filter = TEST_LEAF("arp"),
+            .fail = "vnet2",
+            .expect = "tear-new vnet0\n"
+                      "tear-new vnet2\n");
+
+    /* the failed update did not record the new rules as applied */
+    DO_TEST("after-rollback",
+            .filter = TEST_LEAF("arp"),
+            .expect = "apply vnet0\n"
+                      "apply vnet2\n"
+                      "tear-old vnet0\n"
+                      "tear-old vnet2\n");
+
+ cleanup:
+    testNWFilterShutdown();
+    g_ptr_array_unref(testOps);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIR_TEST_MAIN_PRELOAD(mymain, VIR_TEST_MOCK("nwfiltergentech"))
@@ -0,0 +1,395 @@
+/*
+ * nwfilternftablestest.c: Test nftables rule generation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "testutils.h"
+#include "nwfilter/nwfilter_nftables_driver.h"
+#include "virbuffer.h"
+
+#define LIBVIRT_VIRCOMMANDPRIV_H_ALLOW
+#include "vircommandpriv.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+
+#define NFT_PREFIX "bridge libvirt_nwfilter "
+
+#define VIR_NWFILTER_NFT_INFRA \
+    "nft -f -\n" \
+    "add table bridge libvirt_nwfilter\n" \
+    "add map " NFT_PREFIX "l2_in { type ifname : verdict; }\n" \
+    "add map " NFT_PREFIX "l2_out { type ifname : verdict; }\n" \
+    "add map " NFT_PREFIX "fwd_in { type ifname : verdict; }\n" \
+    "add map " NFT_PREFIX "fwd_out { type ifname : verdict; }\n" \
+    "add map " NFT_PREFIX "host_in { type ifname : verdict; }\n" \
+    "add chain " NFT_PREFIX "prerouting { type filter hook prerouting priority -300; policy accept; }\n" \
+    "flush chain " NFT_PREFIX "prerouting\n" \
+    "add chain " NFT_PREFIX "postrouting { type filter hook postrouting priority 300; policy accept; }\n" \
+    "flush chain " NFT_PREFIX "postrouting\n" \
+    "add chain " NFT_PREFIX "forward { type filter hook forward priority 0; policy accept; }\n" \
+    "flush chain " NFT_PREFIX "forward\n" \
+    "add chain " NFT_PREFIX "input { type filter hook input priority 0; policy accept; }\n" \
+    "flush chain " NFT_PREFIX "input\n" \
+    "add rule " NFT_PREFIX "prerouting iifname vmap @l2_in\n" \
+    "add rule " NFT_PREFIX "postrouting oifname vmap @l2_out\n" \
+    "add rule " NFT_PREFIX "forward iifname vmap @fwd_in\n" \
+    "add rule " NFT_PREFIX "forward oifname vmap @fwd_out\n" \
+    "add rule " NFT_PREFIX "input iifname vmap @host_in\n"
+
+#define VIR_NWFILTER_NFT_DISPATCH \
+    "add chain " NFT_PREFIX "\"vnet0/l2_in\"\n" \
+    "add element " NFT_PREFIX "l2_in { \"vnet0\" : jump \"vnet0/l2_in\" }\n" \
+    "add chain " NFT_PREFIX "\"vnet0/l2_out\"\n" \
+    "add element " NFT_PREFIX "l2_out { \"vnet0\" : jump \"vnet0/l2_out\" }\n" \
+    "add chain " NFT_PREFIX "\"vnet0/fwd_in\"\n" \
+    "add element " NFT_PREFIX "fwd_in { \"vnet0\" : jump \"vnet0/fwd_in\" }\n" \
+    "add chain " NFT_PREFIX "\"vnet0/fwd_out\"\n" \
+    "add element " NFT_PREFIX "fwd_out { \"vnet0\" : jump \"vnet0/fwd_out\" }\n" \
+    "add chain " NFT_PREFIX "\"vnet0/host_in\"\n" \
+    "add element " NFT_PREFIX "host_in { \"vnet0\" : jump \"vnet0/host_in\" }\n"
+
+#define VIR_NWFILTER_NFT_CREATE(gen) \
+    "add chain " NFT_PREFIX "\"vnet0/" gen "/l2_in\"\n" \
+    "add chain " NFT_PREFIX "\"vnet0/" gen "/l2_out\"\n" \
+    "add chain " NFT_PREFIX "\"vnet0/" gen "/fwd_in\"\n" \
+    "add chain " NFT_PREFIX "\"vnet0/" gen "/fwd_out\"\n" \
+    "add chain " NFT_PREFIX "\"vnet0/" gen "/host_in\"\n"
+
+#define VIR_NWFILTER_NFT_LINK(gen) \
+    "flush chain " NFT_PREFIX "\"vnet0/l2_in\"\n" \
+    "add rule " NFT_PREFIX "\"vnet0/l2_in\" goto \"vnet0/" gen "/l2_in\"\n" \
+    "flush chain " NFT_PREFIX "\"vnet0/l2_out\"\n" \
+    "add rule " NFT_PREFIX "\"vnet0/l2_out\" goto \"vnet0/" gen "/l2_out\"\n" \
+    "flush chain " NFT_PREFIX "\"vnet0/fwd_in\"\n" \
+    "add rule " NFT_PREFIX "\"vnet0/fwd_in\" goto \"vnet0/" gen "/fwd_in\"\n" \
+    "flush chain " NFT_PREFIX "\"vnet0/fwd_out\"\n" \
+    "add rule " NFT_PREFIX "\"vnet0/fwd_out\" goto \"vnet0/" gen "/fwd_out\"\n" \
+    "flush chain " NFT_PREFIX "\"vnet0/host_in\"\n" \
+    "add rule " NFT_PREFIX "\"vnet0/host_in\" goto \"vnet0/" gen "/host_in\"\n"
+
+#define VIR_NWFILTER_NFT_REMOVE(gen) \
+    "add chain " NFT_PREFIX "\"vnet0/" gen "/l2_in\"\n" \
+    "flush chain " NFT_PREFIX "\"vnet0/" gen "/l2_in\"\n" \
+    "add chain " NFT_PREFIX "\"vnet0/" gen "/l2_out\"\n" \
+    "flush chain " NFT_PREFIX "\"vnet0/" gen "/l2_out\"\n" \
+    "add chain " NFT_PREFIX "\"vnet0/" gen "/fwd_in\"\n" \
+    "flush chain " NFT_PREFIX "\"vnet0/" gen "/fwd_in\"\n" \
+    "add chain " NFT_PREFIX "\"vnet0/" gen "/fwd_out\"\n" \
+    "flush chain " NFT_PREFIX "\"vnet0/" gen "/fwd_out\"\n" \
+    "add chain " NFT_PREFIX "\"vnet0/" gen "/host_in\"\n" \
+    "flush chain " NFT_PREFIX "\"vnet0/" gen "/host_in\"\n" \
+    "delete chain " NFT_PREFIX "\"vnet0/" gen "/l2_in\"\n" \
+    "delete chain " NFT_PREFIX "\"vnet0/" gen "/l2_out\"\n" \
+    "delete chain " NFT_PREFIX "\"vnet0/" gen "/fwd_in\"\n" \
+    "delete chain " NFT_PREFIX "\"vnet0/" gen "/fwd_out\"\n" \
+    "delete chain " NFT_PREFIX "\"vnet0/" gen "/host_in\"\n"
+
+
+static void
+testCommandDryRun(const char *const*args,
+                  const char *const*env G_GNUC_UNUSED,
+                  const char *input,
+                  char **output,
+                  char **error,
+                  int *status,
+                  void *opaque)
+{
+    virBuffer *buf = opaque;
+
+    *status = 0;
+    *error = g_strdup("");
+    *output = g_strdup("");
+
+    /* nft reading a script from stdin, record the script itself */
+    if (input && g_strv_contains(args, "-f"))
+        virBufferAdd(buf, input, -1);
+}
+
+
+static int
+testNWFilterNftablesRun(const char *expected,
+                        int (*func)(void))
+{
+    g_auto(virBuffer) buf = VIR_BUFFER_INITIALIZER;
+    g_autofree char *actual = NULL;
+    g_autoptr(virCommandDryRunToken) dryRunToken = virCommandDryRunTokenNew();
+
+    virCommandSetDryRun(dryRunToken, &buf, false, true, testCommandDryRun, &buf);
+
+    if (func() < 0)
+        return -1;
+
+    actual = virBufferContentAndReset(&buf);
+
+    if (virTestCompareToString(expected, actual) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static int
+testApplyBasicRules(void)
+{
+    virMacAddr mac = { .addr = { 0x10, 0x20, 0x30, 0x40, 0x50, 0x60 } };
+
+    return nftables_driver.applyBasicRules("vnet0", &mac);
+}
+
+
+static int
+testNWFilterNftablesApplyBasicRules(const void *opaque G_GNUC_UNUSED)
+{
+    const char *expected =
+        "nft list chains bridge\n"
+        VIR_NWFILTER_NFT_INFRA
+        VIR_NWFILTER_NFT_DISPATCH
+        VIR_NWFILTER_NFT_CREATE("1")
+        "add rule " NFT_PREFIX "\"vnet0/1/l2_in\" ether saddr != 10:20:30:40:50:60 drop\n"
+        "add rule " NFT_PREFIX "\"vnet0/1/l2_in\" ether type ip accept\n"
+        "add rule " NFT_PREFIX "\"vnet0/1/l2_in\" ether type arp accept\n"
+        "add rule " NFT_PREFIX "\"vnet0/1/l2_in\" drop\n"
+        VIR_NWFILTER_NFT_LINK("1");
+
+    return testNWFilterNftablesRun(expected, testApplyBasicRules);
+}
+
+
+static int
+testApplyDHCPOnlyRules(void)
+{
+    virMacAddr mac = { .addr = { 0x10, 0x20, 0x30, 0x40, 0x50, 0x60 } };
+    g_autoptr(virNWFilterVarValue) val = virNWFilterVarValueCreateSimpleCopyValue("192.168.122.1");
+
+    if (virNWFilterVarValueAddValueCopy(val, "10.0.0.1") < 0)
+        return -1;
+
+    return nftables_driver.applyDHCPOnlyRules("vnet0", &mac, val, false);
+}
+
+
+static int
+testNWFilterNftablesApplyDHCPOnlyRules(const void *opaque G_GNUC_UNUSED)
+{
+    const char *expected =
+        VIR_NWFILTER_NFT_INFRA
+        VIR_NWFILTER_NFT_DISPATCH
+        VIR_NWFILTER_NFT_CREATE("2")
+        "add rule " NFT_PREFIX "\"vnet0/2/l2_in\" ether saddr 10:20:30:40:50:60 ether type ip "
+        "ip protocol udp udp sport 68 udp dport 67 accept\n"
+        "add rule " NFT_PREFIX "\"vnet0/2/l2_in\" drop\n"
+        "add rule " NFT_PREFIX "\"vnet0/2/l2_out\" ether daddr { 10:20:30:40:50:60, ff:ff:ff:ff:ff:ff } "
+        "ether type ip ip saddr { 192.168.122.1, 10.0.0.1 } "
+        "ip protocol udp udp sport 67 udp dport 68 accept\n"
+        "add rule " NFT_PREFIX "\"vnet0/2/l2_out\" drop\n"
+        VIR_NWFILTER_NFT_LINK("2")
+        VIR_NWFILTER_NFT_REMOVE("1");
+
+    return testNWFilterNftablesRun(expected, testApplyDHCPOnlyRules);
+}
+
+
+static int
+testApplyDropAllRules(void)
+{
+    return nftables_driver.applyDropAllRules("vnet0");
+}
+
+
+static int
+testNWFilterNftablesApplyDropAllRules(const void *opaque G_GNUC_UNUSED)
+{
+    const char *expected =
+        VIR_NWFILTER_NFT_INFRA
+        VIR_NWFILTER_NFT_DISPATCH
+        VIR_NWFILTER_NFT_CREATE("3")
+        "add rule " NFT_PREFIX "\"vnet0/3/l2_in\" drop\n"
+        "add rule " NFT_PREFIX "\"vnet0/3/l2_out\" drop\n"
+        VIR_NWFILTER_NFT_LINK("3")
+        VIR_NWFILTER_NFT_REMOVE("2");
+
+    return testNWFilterNftablesRun(expected, testApplyDropAllRules);
+}
+
+
+static int
+testTearNewRules(void)
+{
+    return nftables_driver.tearNewRules("vnet0");
+}
+
+
+static int
+testNWFilterNftablesTearNewRules(const void *opaque G_GNUC_UNUSED)
+{
+    /* there are no rules waiting to be switched to */
+    return testNWFilterNftablesRun("", testTearNewRules);
+}
+
+
+static int
+testAllTeardown(void)
+{
+    return nftables_driver.allTeardown("vnet0");
+}
+
+
+static int
+testNWFilterNftablesAllTeardown(const void *opaque G_GNUC_UNUSED)
+{
+    const char *expected =
+        VIR_NWFILTER_NFT_INFRA
+        VIR_NWFILTER_NFT_DISPATCH
+        "delete element " NFT_PREFIX "l2_in { \"vnet0\" }\n"
+        "delete element " NFT_PREFIX "l2_out { \"vnet0\" }\n"
+        "delete element " NFT_PREFIX "fwd_in { \"vnet0\" }\n"
+        "delete element " NFT_PREFIX "fwd_out { \"vnet0\" }\n"
+        "delete element " NFT_PREFIX "host_in { \"vnet0\" }\n"
+        "add chain " NFT_PREFIX "\"vnet0/3/l2_in\"\n"
+        "flush chain " NFT_PREFIX "\"vnet0/3/l2_in\"\n"
+        "add chain " NFT_PREFIX "\"vnet0/3/l2_out\"\n"
+        "flush chain " NFT_PREFIX "\"vnet0/3/l2_out\"\n"
+        "add chain " NFT_PREFIX "\"vnet0/3/fwd_in\"\n"
+        "flush chain " NFT_PREFIX "\"vnet0/3/fwd_in\"\n"
+        "add chain " NFT_PREFIX "\"vnet0/3/fwd_out\"\n"
+        "flush chain " NFT_PREFIX "\"vnet0/3/fwd_out\"\n"
+        "add chain " NFT_PREFIX "\"vnet0/3/host_in\"\n"
+        "flush chain " NFT_PREFIX "\"vnet0/3/host_in\"\n"
+        "add chain " NFT_PREFIX "\"vnet0/l2_in\"\n"
+        "flush chain " NFT_PREFIX "\"vnet0/l2_in\"\n"
+        "add chain " NFT_PREFIX "\"vnet0/l2_out\"\n"
+        "flush chain " NFT_PREFIX "\"vnet0/l2_out\"\n"
+        "add chain " NFT_PREFIX "\"vnet0/fwd_in\"\n"
+        "flush chain " NFT_PREFIX "\"vnet0/fwd_in\"\n"
+        "add chain " NFT_PREFIX "\"vnet0/fwd_out\"\n"
+        "flush chain " NFT_PREFIX "\"vnet0/fwd_out\"\n"
+        "add chain " NFT_PREFIX "\"vnet0/host_in\"\n"
+        "flush chain " NFT_PREFIX "\"vnet0/host_in\"\n"
+        "delete chain " NFT_PREFIX "\"vnet0/3/l2_in\"\n"
+        "delete chain " NFT_PREFIX "\"vnet0/3/l2_out\"\n"
+        "delete chain " NFT_PREFIX "\"vnet0/3/fwd_in\"\n"
+        "delete chain " NFT_PREFIX "\"vnet0/3/fwd_out\"\n"
+        "delete chain " NFT_PREFIX "\"vnet0/3/host_in\"\n"
+        "delete chain " NFT_PREFIX "\"vnet0/l2_in\"\n"
+        "delete chain " NFT_PREFIX "\"vnet0/l2_out\"\n"
+        "delete chain " NFT_PREFIX "\"vnet0/fwd_in\"\n"
+        "delete chain " NFT_PREFIX "\"vnet0/fwd_out\"\n"
+        "delete chain " NFT_PREFIX "\"vnet0/host_in\"\n";
+
+    return testNWFilterNftablesRun(expected, testAllTeardown);
+}
+
+
+static void
+testCommandDryRunFail(const char *const*args,
+                      const char *const*env,
+                      const char *input,
+                      char **output,
+                      char **error,
+                      int *status,
+                      void *opaque)
+{
+    testCommandDryRun(args, env, input, output, error, status, opaque);
+
+    /* nft rejects the whole script */
+    if (input && g_strv_contains(args, "-f")) {
+        g_free(*error);
+        *error = g_strdup("Error: Could not process rule");
+        *status = 1;
+    }
+}
+
+
+static int
+testNWFilterNftablesApplyFailure(const void *opaque G_GNUC_UNUSED)
+{
+    /* the failed transaction must not be replayed command by command */
+    const char *expected =
+        VIR_NWFILTER_NFT_INFRA
+        VIR_NWFILTER_NFT_DISPATCH
+        VIR_NWFILTER_NFT_CREATE("4")
+        "add rule " NFT_PREFIX "\"vnet0/4/l2_in\" drop\n"
+        "add rule " NFT_PREFIX "\"vnet0/4/l2_out\" drop\n"
+        VIR_NWFILTER_NFT_LINK("4");
+    g_auto(virBuffer) buf = VIR_BUFFER_INITIALIZER;
+    g_autofree char *actual = NULL;
+    g_autoptr(virCommandDryRunToken) dryRunToken = virCommandDryRunTokenNew();
+
+    virCommandSetDryRun(dryRunToken, &buf, false, true,
+                        testCommandDryRunFail, &buf);
+
+    if (nftables_driver.applyDropAllRules("vnet0") == 0) {
+        fprintf(stderr, "Applying rules was expected to fail\n");
+        return -1;
+    }
+    virResetLastError();
+
+    actual = virBufferContentAndReset(&buf);
+
+    return virTestCompareToString(expected, actual);
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (nftables_driver.init(true) < 0)
+        return EXIT_FAILURE;
+
+    /* The tests share the state of the driver and follow the life of
+     * a port */
+    if (virTestRun("nftablesApplyBasicRules",
+                   testNWFilterNftablesApplyBasicRules,
+                   NULL) < 0)
+        ret = -1;
+
+    if (virTestRun("nftablesApplyDHCPOnlyRules",
+                   testNWFilterNftablesApplyDHCPOnlyRules,
+                   NULL) < 0)
+        ret = -1;
+
+    if (virTestRun("nftablesApplyDropAllRules",
+                   testNWFilterNftablesApplyDropAllRules,
+                   NULL) < 0)
+        ret = -1;
+
+    if (virTestRun("nftablesTearNewRules",
+                   testNWFilterNftablesTearNewRules,
+                   NULL) < 0)
+        ret = -1;
+
+    if (virTestRun("nftablesAllTeardown",
+                   testNWFilterNftablesAllTeardown,
+                   NULL) < 0)
+        ret = -1;
+
+    if (virTestRun("nftablesApplyFailure",
+                   testNWFilterNftablesApplyFailure,
+                   NULL) < 0)
+        ret = -1;
+
+    nftables_driver.shutdown();
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIR_TEST_MAIN_PRELOAD(mymain, VIR_TEST_MOCK("virfirewall"))
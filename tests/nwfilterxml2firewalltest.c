@@ -25,6 +25,7 @@
 
 # include "testutils.h"
 # include "nwfilter/nwfilter_ebiptables_driver.h"
+# include "nwfilter/nwfilter_nftables_driver.h"
 # include "virbuffer.h"
 
 # define LIBVIRT_VIRCOMMANDPRIV_H_ALLOW
@@ -141,6 +142,46 @@ static const char *commonRules[] = {
 };
 
 
+/*
+ * The nftables driver sets up its table and the dispatch chains of the
+ * port along with every new set of rules
+ */
+static const char *commonNftablesRules[] = {
+    /* Setting up the table, its base chains and verdict maps */
+    "add table bridge libvirt_nwfilter\n"
+    "add map bridge libvirt_nwfilter l2_in { type ifname : verdict; }\n"
+    "add map bridge libvirt_nwfilter l2_out { type ifname : verdict; }\n"
+    "add map bridge libvirt_nwfilter fwd_in { type ifname : verdict; }\n"
+    "add map bridge libvirt_nwfilter fwd_out { type ifname : verdict; }\n"
+    "add map bridge libvirt_nwfilter host_in { type ifname : verdict; }\n"
+    "add chain bridge libvirt_nwfilter prerouting { type filter hook prerouting priority -300; policy accept; }\n"
+    "flush chain bridge libvirt_nwfilter prerouting\n"
+    "add chain bridge libvirt_nwfilter postrouting { type filter hook postrouting priority 300; policy accept; }\n"
+    "flush chain bridge libvirt_nwfilter postrouting\n"
+    "add chain bridge libvirt_nwfilter forward { type filter hook forward priority 0; policy accept; }\n"
+    "flush chain bridge libvirt_nwfilter forward\n"
+    "add chain bridge libvirt_nwfilter input { type filter hook input priority 0; policy accept; }\n"
+    "flush chain bridge libvirt_nwfilter input\n"
+    "add rule bridge libvirt_nwfilter prerouting iifname vmap @l2_in\n"
+    "add rule bridge libvirt_nwfilter postrouting oifname vmap @l2_out\n"
+    "add rule bridge libvirt_nwfilter forward iifname vmap @fwd_in\n"
+    "add rule bridge libvirt_nwfilter forward oifname vmap @fwd_out\n"
+    "add rule bridge libvirt_nwfilter input iifname vmap @host_in\n",
+
+    /* Creating the dispatch chains */
+    "add chain bridge libvirt_nwfilter \"vnet0/l2_in\"\n"
+    "add element bridge libvirt_nwfilter l2_in { \"vnet0\" : jump \"vnet0/l2_in\" }\n"
+    "add chain bridge libvirt_nwfilter \"vnet0/l2_out\"\n"
+    "add element bridge libvirt_nwfilter l2_out { \"vnet0\" : jump \"vnet0/l2_out\" }\n"
+    "add chain bridge libvirt_nwfilter \"vnet0/fwd_in\"\n"
+    "add element bridge libvirt_nwfilter fwd_in { \"vnet0\" : jump \"vnet0/fwd_in\" }\n"
+    "add chain bridge libvirt_nwfilter \"vnet0/fwd_out\"\n"
+    "add element bridge libvirt_nwfilter fwd_out { \"vnet0\" : jump \"vnet0/fwd_out\" }\n"
+    "add chain bridge libvirt_nwfilter \"vnet0/host_in\"\n"
+    "add element bridge libvirt_nwfilter host_in { \"vnet0\" : jump \"vnet0/host_in\" }\n",
+};
+
+
 static GHashTable *
 virNWFilterCreateVarsFrom(GHashTable *vars1,
                           GHashTable *vars2)
@@ -285,14 +326,16 @@ virNWFilterDefToInst(const char *xml,
 }
 
 
-static void testRemoveCommonRules(char *rules)
+static void testRemoveCommonRules(char *rules,
+                                  const char **common,
+                                  size_t ncommon)
 {
     size_t i;
     char *offset = rules;
 
-    for (i = 0; i < G_N_ELEMENTS(commonRules); i++) {
-        char *tmp = strstr(offset, commonRules[i]);
-        size_t len = strlen(commonRules[i]);
+    for (i = 0; i < ncommon; i++) {
+        char *tmp = strstr(offset, common[i]);
+        size_t len = strlen(common[i]);
         if (tmp) {
             memmove(tmp, tmp + len, (strlen(tmp) + 1) - len);
             offset = tmp;
@@ -367,7 +410,7 @@ static int testCompareXMLToArgvFiles(const char *xml,
 
     actualargv = virBufferContentAndReset(&buf);
 
-    testRemoveCommonRules(actualargv);
+    testRemoveCommonRules(actualargv, commonRules, G_N_ELEMENTS(commonRules));
 
     if (virTestCompareToFileFull(actualargv, cmdline, false) < 0)
         goto cleanup;
@@ -379,8 +422,86 @@ static int testCompareXMLToArgvFiles(const char *xml,
     return ret;
 }
 
+
+static void
+testCommandDryRunNftables(const char *const*args,
+                          const char *const*env G_GNUC_UNUSED,
+                          const char *input,
+                          char **output,
+                          char **error,
+                          int *status,
+                          void *opaque)
+{
+    virBuffer *buf = opaque;
+
+    *status = 0;
+    *error = g_strdup("");
+    *output = g_strdup("");
+
+    /* nft reading a script from stdin, record the script itself */
+    if (input && g_strv_contains(args, "-f"))
+        virBufferAdd(buf, input, -1);
+}
+
+
+static int testCompareXMLToNftablesFiles(const char *xml,
+                                         const char *expected,
+                                         bool fail)
+{
+    g_autofree char *actual = NULL;
+    g_auto(virBuffer) buf = VIR_BUFFER_INITIALIZER;
+    g_autoptr(GHashTable) vars = virHashNew(virNWFilterVarValueHashFree);
+    virNWFilterInst inst = { 0 };
+    int rc;
+    int ret = -1;
+    g_autoptr(virCommandDryRunToken) dryRunToken = virCommandDryRunTokenNew();
+
+    virCommandSetDryRun(dryRunToken, NULL, false, false,
+                        testCommandDryRunNftables, &buf);
+
+    if (testSetDefaultParameters(vars) < 0)
+        goto cleanup;
+
+    if (virNWFilterDefToInst(xml,
+                             vars,
+                             &inst) < 0)
+        goto cleanup;
+
+    rc = nftables_driver.applyNewRules("vnet0", inst.rules, inst.nrules);
+
+    /* forget about the port so that the next test starts from scratch */
+    nftables_driver.shutdown();
+
+    if (fail) {
+        if (rc == 0) {
+            VIR_TEST_DEBUG("nftables driver unexpectedly accepted the filter");
+            goto cleanup;
+        }
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (rc < 0)
+        goto cleanup;
+
+    actual = virBufferContentAndReset(&buf);
+
+    testRemoveCommonRules(actual, commonNftablesRules,
+                          G_N_ELEMENTS(commonNftablesRules));
+
+    if (virTestCompareToFileFull(actual, expected, false) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    virNWFilterInstReset(&inst);
+    return ret;
+}
+
 struct testInfo {
     const char *name;
+    bool fail;
 };
 
 
@@ -403,6 +524,22 @@ testCompareXMLToIPTablesHelper(const void *data)
 }
 
 
+static int
+testCompareXMLToNftablesHelper(const void *data)
+{
+    const struct testInfo *info = data;
+    g_autofree char *xml = NULL;
+    g_autofree char *expected = NULL;
+
+    xml = g_strdup_printf("%s/nwfilterxml2firewalldata/%s.xml",
+                          abs_srcdir, info->name);
+    expected = g_strdup_printf("%s/nwfilterxml2firewalldata/%s-%s.nftables",
+                               abs_srcdir, info->name, RULESTYPE);
+
+    return testCompareXMLToNftablesFiles(xml, expected, info->fail);
+}
+
+
 static int
 mymain(void)
 {
@@ -411,13 +548,29 @@ mymain(void)
 # define DO_TEST(name) \
     do { \
         static struct testInfo info = { \
-            name, \
+            name, false, \
         }; \
         if (virTestRun("NWFilter XML-2-firewall " name, \
                        testCompareXMLToIPTablesHelper, &info) < 0) \
             ret = -1; \
     } while (0)
 
+# define DO_TEST_NFTABLES_FULL(name, fail) \
+    do { \
+        static struct testInfo info = { \
+            name, fail, \
+        }; \
+        if (virTestRun("NWFilter XML-2-nftables " name, \
+                       testCompareXMLToNftablesHelper, &info) < 0) \
+            ret = -1; \
+    } while (0)
+
+# define DO_TEST_NFTABLES(name) \
+    DO_TEST_NFTABLES_FULL(name, false)
+
+# define DO_TEST_NFTABLES_FAIL(name) \
+    DO_TEST_NFTABLES_FULL(name, true)
+
     DO_TEST("ah");
     DO_TEST("ah-ipv6");
     DO_TEST("all");
@@ -458,6 +611,28 @@ mymain(void)
     DO_TEST("udplite-ipv6");
     DO_TEST("vlan");
 
+    DO_TEST_NFTABLES("all");
+    DO_TEST_NFTABLES("chains");
+    DO_TEST_NFTABLES("example-1");
+    DO_TEST_NFTABLES("example-2");
+    DO_TEST_NFTABLES("icmp");
+    DO_TEST_NFTABLES("ip");
+    DO_TEST_NFTABLES("ipv6");
+    DO_TEST_NFTABLES("iter1");
+    DO_TEST_NFTABLES("iter2");
+    DO_TEST_NFTABLES("iter3");
+    DO_TEST_NFTABLES("mac");
+    DO_TEST_NFTABLES("rarp");
+    DO_TEST_NFTABLES("target");
+    DO_TEST_NFTABLES("tcp");
+    DO_TEST_NFTABLES("vlan");
+
+    /* gratuitous ARP, STP header fields, ipsets and connection limits */
+    DO_TEST_NFTABLES_FAIL("arp");
+    DO_TEST_NFTABLES_FAIL("conntrack");
+    DO_TEST_NFTABLES_FAIL("ipset");
+    DO_TEST_NFTABLES_FAIL("stp");
+
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
@@ -0,0 +1,455 @@
+/*
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include <config.h>
+
+#include "testutils.h"
+#include "testutilsqemu.h"
+#include "tests/testutilsqemuschema.h"
+#include "qemumonitortestutils.h"
+#include "qemu/qemu_domain.h"
+#include "qemu/qemu_migration_params.h"
+#define LIBVIRT_QEMU_MIGRATION_PARAMSPRIV_H_ALLOW
+#include "qemu/qemu_migration_paramspriv.h"
+#define LIBVIRT_QEMU_MIGRATIONPRIV_H_ALLOW
+#include "qemu/qemu_migrationpriv.h"
+#include "qemu/qemu_migration_tune.h"
+#include "virtime.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define MiB (1024ULL * 1024)
+#define GiB (1024ULL * MiB)
+
+/* Give up on migrations which do not converge in 10 minutes */
+#define SIM_TIMEOUT (600 * 1000)
+
+static virQEMUDriver driver;
+
+typedef struct _testMigrationTuneData testMigrationTuneData;
+struct _testMigrationTuneData {
+    const char *name;
+    GHashTable *qmpschema;
+
+    /* guest */
+    double memory;          /* bytes */
+    double dirtyRate;       /* bytes/s */
+    double workingSet;      /* bytes */
+
+    /* host */
+    double link;            /* bytes/s */
+    unsigned long long targetTime;  /* ms */
+    unsigned long long maxDowntime; /* ms */
+    bool autoConverge;
+
+    /* expected results */
+    bool untunedConverges;
+    long long maxTime;              /* ms the tuned migration may take */
+    bool saveBandwidth;
+};
+
+typedef struct _testMigrationSim testMigrationSim;
+struct _testMigrationSim {
+    double bandwidth;       /* bytes/s, max-bandwidth */
+    unsigned long long downtime;    /* ms, downtime-limit */
+    int throttleIncrement;  /* %, cpu-throttle-increment */
+    double throttle;        /* % of vCPU time taken by auto-converge */
+
+    double firstPass;       /* bytes not sent even once */
+    double backlog;         /* bytes dirtied since they were sent */
+    double transferred;     /* bytes */
+    double dirtied;         /* bytes dirtied in the last second */
+
+    unsigned long long peakDowntime;
+    int peakThrottleIncrement;
+};
+
+
+static int
+testMigrationTuneApply(testMigrationTuneData *data,
+                       testMigrationSim *sim,
+                       qemuMigrationParams *migParams)
+{
+    g_autoptr(virJSONValue) json = NULL;
+    g_auto(virBuffer) debug = VIR_BUFFER_INITIALIZER;
+    unsigned long long ull;
+    int i;
+
+    if (!(json = qemuMigrationParamsToJSON(migParams, false)))
+        return -1;
+
+    if (testQEMUSchemaValidateCommand("migrate-set-parameters", json,
+                                      data->qmpschema, false, false, false,
+                                      &debug) < 0) {
+        VIR_TEST_VERBOSE("invalid migration parameters: %s",
+                         virBufferCurrentContent(&debug));
+        return -1;
+    }
+
+    if (qemuMigrationParamsGetULL(migParams,
+                                  QEMU_MIGRATION_PARAM_MAX_BANDWIDTH,
+                                  &ull) == 0)
+        sim->bandwidth = ull;
+
+    if (qemuMigrationParamsGetULL(migParams,
+                                  QEMU_MIGRATION_PARAM_DOWNTIME_LIMIT,
+                                  &ull) == 0) {
+        sim->downtime = ull;
+        sim->peakDowntime = MAX(sim->peakDowntime, sim->downtime);
+    }
+
+    if (qemuMigrationParamsGetInt(migParams,
+                                  QEMU_MIGRATION_PARAM_THROTTLE_INCREMENT,
+                                  &i) == 0) {
+        sim->throttleIncrement = i;
+        sim->peakThrottleIncrement = MAX(sim->peakThrottleIncrement, i);
+    }
+
+    return 0;
+}
+
+
+/*
+ * Simulates a pre-copy migration of a guest which keeps rewriting a working
+ * set of memory at a constant rate, in steps of QEMU_MIGRATION_TUNE_INTERVAL.
+ * Auto-converge throttles vCPUs in the way QEMU does once the dirty rate is
+ * too high compared to the transfer rate. Migration switches over as soon as
+ * everything that is left can be sent within the downtime limit.
+ *
+ * Returns the time in ms it took to migrate the guest, 0 if it did not
+ * converge, or -1 on error.
+ */
+static long long
+testMigrationTuneSimulate(testMigrationTuneData *data,
+                          testMigrationSim *sim,
+                          qemuMigrationTuner *tuner)
+{
+    unsigned long long now;
+
+    sim->bandwidth = data->link * 100;
+    sim->downtime = 300;
+    sim->throttleIncrement = 10;
+    sim->firstPass = data->memory;
+
+    for (now = 0; now <= SIM_TIMEOUT; now += QEMU_MIGRATION_TUNE_INTERVAL) {
+        double rate = MIN(data->link, sim->bandwidth);
+        double remaining = sim->firstPass + sim->backlog;
+        double sent;
+        double dirty;
+
+        if (tuner) {
+            g_autoptr(qemuMigrationParams) migParams = NULL;
+            qemuMonitorMigrationStats stats = {
+                .status = QEMU_MONITOR_MIGRATION_STATUS_ACTIVE,
+                .total_time = now,
+                .ram_total = data->memory,
+                .ram_transferred = sim->transferred,
+                .ram_remaining = remaining,
+                .ram_dirty_rate = sim->dirtied / 4096,
+                .ram_page_size = 4096,
+            };
+
+            if (qemuMigrationTunerUpdate(tuner, &stats, &migParams) < 0)
+                return -1;
+
+            if (migParams &&
+                testMigrationTuneApply(data, sim, migParams) < 0)
+                return -1;
+
+            rate = MIN(data->link, sim->bandwidth);
+        }
+
+        if (remaining * 1000 / rate <= sim->downtime)
+            return now + remaining * 1000 / rate;
+
+        dirty = data->dirtyRate * (100 - sim->throttle) / 100;
+
+        sent = MIN(sim->firstPass, rate);
+        sim->firstPass -= sent;
+        sim->transferred += sent;
+        sent = MIN(sim->backlog, rate - sent);
+        sim->backlog -= sent;
+        sim->transferred += sent;
+
+        sim->backlog = MIN(sim->backlog + dirty, data->workingSet);
+        sim->backlog = MIN(sim->backlog, data->memory - sim->firstPass);
+        sim->dirtied = dirty;
+
+        if (data->autoConverge && sim->firstPass == 0 && dirty > rate / 2) {
+            if (sim->throttle == 0)
+                sim->throttle = 20;
+            else
+                sim->throttle = MIN(99, sim->throttle + sim->throttleIncrement);
+        }
+    }
+
+    return 0;
+}
+
+
+static int
+testMigrationTune(const void *opaque)
+{
+    testMigrationTuneData *data = (testMigrationTuneData *) opaque;
+    g_autoptr(qemuMigrationTuner) tuner = NULL;
+    testMigrationSim untuned = { 0 };
+    testMigrationSim tuned = { 0 };
+    long long untunedTime;
+    long long tunedTime;
+
+    tuner = qemuMigrationTunerNew(data->targetTime, data->maxDowntime,
+                                  data->link * 100, 300,
+                                  data->autoConverge, 10);
+
+    if ((untunedTime = testMigrationTuneSimulate(data, &untuned, NULL)) < 0 ||
+        (tunedTime = testMigrationTuneSimulate(data, &tuned, tuner)) < 0)
+        return -1;
+
+    VIR_TEST_DEBUG("untuned: %lld ms, tuned: %lld ms, sent: %.0f B, "
+                   "downtime: %llu ms, throttle increment: %d%%",
+                   untunedTime, tunedTime, tuned.transferred,
+                   tuned.peakDowntime, tuned.peakThrottleIncrement);
+
+    if (!!untunedTime != data->untunedConverges) {
+        VIR_TEST_VERBOSE("untuned migration took %lld ms", untunedTime);
+        return -1;
+    }
+
+    if (tunedTime == 0 || tunedTime > data->maxTime) {
+        VIR_TEST_VERBOSE("tuned migration took %lld ms, expected at most %lld ms",
+                         tunedTime, data->maxTime);
+        return -1;
+    }
+
+    if (data->saveBandwidth &&
+        tuned.transferred * 1000 / tunedTime >= data->link / 2) {
+        VIR_TEST_VERBOSE("tuned migration did not reduce bandwidth");
+        return -1;
+    }
+
+    if (tuned.peakDowntime > MAX(data->maxDowntime, 300)) {
+        VIR_TEST_VERBOSE("downtime limit %llu ms exceeds %llu ms",
+                         tuned.peakDowntime, data->maxDowntime);
+        return -1;
+    }
+
+    if (tuned.peakThrottleIncrement > 50) {
+        VIR_TEST_VERBOSE("cpu-throttle-increment %d%% is too high",
+                         tuned.peakThrottleIncrement);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Replies to query-migrate issued by the tuner with statistics of a migration
+ * which is still active, but emits a MIGRATION event saying the migration
+ * completed before the reply, i.e., while the tuner is talking to QEMU.
+ */
+static int
+testMigrationTuneEventHandler(qemuMonitorTest *test,
+                              qemuMonitorTestItem *item,
+                              const char *cmdstr)
+{
+    unsigned long long *eventTime = qemuMonitorTestItemGetPrivateData(item);
+    g_autoptr(virJSONValue) val = NULL;
+    const char *cmdname;
+
+    if (!(val = virJSONValueFromString(cmdstr)))
+        return -1;
+
+    if (!(cmdname = virJSONValueObjectGetString(val, "execute")))
+        return qemuMonitorTestAddErrorResponse(test, "Missing command name in %s", cmdstr);
+
+    if (STRNEQ(cmdname, "query-migrate"))
+        return qemuMonitorTestAddInvalidCommandResponse(test, "query-migrate",
+                                                       cmdname);
+
+    if (virTimeMillisNow(eventTime) < 0)
+        return -1;
+
+    if (qemuMonitorTestAddResponse(test,
+                                   "{\"timestamp\": {\"seconds\": 1, \"microseconds\": 0},"
+                                   " \"event\": \"MIGRATION\","
+                                   " \"data\": {\"status\": \"completed\"}}") < 0)
+        return -1;
+
+    return qemuMonitorTestAddResponse(test,
+                                      "{\"return\": {\"status\": \"active\","
+                                      " \"total-time\": 2000,"
+                                      " \"ram\": {\"transferred\": 1048576,"
+                                      " \"remaining\": 1073741824,"
+                                      " \"total\": 1074790400}}}");
+}
+
+
+/*
+ * Checks that a migration which completes while the tuner is fetching
+ * statistics is noticed right away rather than after another tuning
+ * interval, and that the reply to the tuner's query does not hide the
+ * status reported by the MIGRATION event.
+ */
+static int
+testMigrationTuneWait(const void *opaque)
+{
+    GHashTable *qmpschema = (GHashTable *) opaque;
+    g_autoptr(virDomainObj) vm = NULL;
+    g_autoptr(qemuMonitorTest) test = NULL;
+    g_autoptr(qemuMigrationTuner) tuner = NULL;
+    qemuDomainObjPrivate *priv;
+    qemuDomainJobDataPrivate *privJob;
+    unsigned long long eventTime = 0;
+    unsigned long long now;
+    int rc;
+    int ret = -1;
+
+    if (!(vm = virDomainObjNew(driver.xmlopt)))
+        return -1;
+
+    priv = vm->privateData;
+
+    if (!(vm->def = virDomainDefNew(driver.xmlopt)))
+        return -1;
+
+    vm->def->name = g_strdup("migtune");
+    vm->def->id = 1;
+
+    if (!(test = qemuMonitorTestNew(driver.xmlopt, vm, NULL, qmpschema)))
+        return -1;
+
+    qemuMonitorTestAddHandler(test, "query-migrate",
+                              testMigrationTuneEventHandler,
+                              &eventTime, NULL);
+
+    if (qemuMonitorTestAddItem(test, "query-migrate",
+                               "{\"return\": {\"status\": \"completed\","
+                               " \"total-time\": 2100, \"downtime\": 50,"
+                               " \"ram\": {\"transferred\": 1074790400,"
+                               " \"remaining\": 0,"
+                               " \"total\": 1074790400}}}") < 0)
+        return -1;
+
+    tuner = qemuMigrationTunerNew(0, 300, 1024 * MiB, 300, false, 10);
+
+    virObjectLock(vm);
+
+    if (virDomainObjBeginAsyncJob(vm, VIR_ASYNC_JOB_MIGRATION_OUT,
+                                  VIR_DOMAIN_JOB_OPERATION_MIGRATION_OUT, 0) < 0) {
+        virObjectUnlock(vm);
+        return -1;
+    }
+
+    qemuDomainJobSetStatsType(vm->job->current,
+                              QEMU_DOMAIN_JOB_STATS_TYPE_MIGRATION);
+    privJob = vm->job->current->privateData;
+    privJob->stats.mig.status = QEMU_MONITOR_MIGRATION_STATUS_ACTIVE;
+
+    priv->mon = qemuMonitorTestGetMonitor(test);
+    virObjectUnlock(priv->mon);
+
+    rc = qemuMigrationSrcWaitForCompletion(vm, VIR_ASYNC_JOB_MIGRATION_OUT,
+                                           NULL, 0, tuner, NULL);
+
+    if (virTimeMillisNow(&now) < 0)
+        goto cleanup;
+
+    if (rc < 0) {
+        VIR_TEST_VERBOSE("waiting for migration failed: %d", rc);
+        goto cleanup;
+    }
+
+    if (eventTime == 0) {
+        VIR_TEST_VERBOSE("migration was not tuned");
+        goto cleanup;
+    }
+
+    if (vm->job->current->status != VIR_DOMAIN_JOB_STATUS_HYPERVISOR_COMPLETED) {
+        VIR_TEST_VERBOSE("unexpected job status: %d",
+                         vm->job->current->status);
+        goto cleanup;
+    }
+
+    if (now - eventTime >= QEMU_MIGRATION_TUNE_INTERVAL) {
+        VIR_TEST_VERBOSE("completed migration noticed after %llu ms",
+                         now - eventTime);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virObjectLock(priv->mon);
+    priv->mon = NULL;
+    virDomainObjEndAsyncJob(vm);
+    virObjectUnlock(vm);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    g_autoptr(GHashTable) qmpschema = NULL;
+    int ret = 0;
+
+    if (qemuTestDriverInit(&driver) < 0)
+        return EXIT_FAILURE;
+
+    virEventRegisterDefaultImpl();
+
+    if (!(qmpschema = testQEMUSchemaLoadLatest("x86_64"))) {
+        VIR_TEST_VERBOSE("failed to load QMP schema");
+        return EXIT_FAILURE;
+    }
+
+#define DO_TEST(_name, ...) \
+    do { \
+        testMigrationTuneData data = { \
+            .name = _name, .qmpschema = qmpschema, __VA_ARGS__ \
+        }; \
+        if (virTestRun(_name, testMigrationTune, &data) < 0) \
+            ret = -1; \
+    } while (0)
+
+    /* Fast link, lazy guest: bandwidth can be lowered while still meeting
+     * the target time. */
+    DO_TEST("ahead",
+            .memory = 4 * GiB, .dirtyRate = 20 * MiB, .workingSet = 1 * GiB,
+            .link = 1250ULL * 1000 * 1000, .targetTime = 60 * 1000,
+            .maxDowntime = 300,
+            .untunedConverges = true, .maxTime = 62 * 1000,
+            .saveBandwidth = true);
+
+    /* The guest dirties memory faster than it can be sent, but its working
+     * set fits in a longer downtime. */
+    DO_TEST("downtime",
+            .memory = 8 * GiB, .dirtyRate = 1100ULL * 1000 * 1000,
+            .workingSet = 1500ULL * 1000 * 1000, .link = 1000ULL * 1000 * 1000,
+            .maxDowntime = 2000,
+            .untunedConverges = false, .maxTime = 20 * 1000);
+
+    DO_TEST("downtime-target",
+            .memory = 8 * GiB, .dirtyRate = 1100ULL * 1000 * 1000,
+            .workingSet = 1500ULL * 1000 * 1000, .link = 1000ULL * 1000 * 1000,
+            .targetTime = 30 * 1000, .maxDowntime = 2000,
+            .untunedConverges = false, .maxTime = 20 * 1000);
+
+    /* Only throttling the guest harder helps. */
+    DO_TEST("autoconverge",
+            .memory = 8 * GiB, .dirtyRate = 2000ULL * 1000 * 1000,
+            .workingSet = 6000ULL * 1000 * 1000, .link = 1000ULL * 1000 * 1000,
+            .maxDowntime = 300, .autoConverge = true,
+            .untunedConverges = false, .maxTime = 30 * 1000);
+
+    if (virTestRun("wait-event", testMigrationTuneWait, qmpschema) < 0)
+        ret = -1;
+
+    qemuTestDriverFree(&driver);
+
+    return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIR_TEST_MAIN(mymain)
@@ -745,6 +745,7 @@ static qemuMonitorCallbacks qemuMonitorTestCallbacks = {
     .eofNotify = qemuMonitorTestEOFNotify,
     .errorNotify = qemuMonitorTestErrorNotify,
     .domainDeviceDeleted = qemuProcessHandleDeviceDeleted,
+    .domainMigrationStatus = qemuProcessHandleMigrationStatus,
 };
 
 
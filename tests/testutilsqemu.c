@@ -363,6 +363,9 @@ int qemuTestDriverInit(virQEMUDriver *driver)
     if (!driver->qemuCapsCache)
         goto error;
 
+    /* don't let pre-seeded caches installed on the host leak into tests */
+    virFileCacheSetSystemDir(driver->qemuCapsCache, NULL);
+
     driver->nbdkitCapsCache = qemuNbdkitCapsCacheNew("/dev/null");
     /* the nbdkitCapsCache just interprets the presence of a non-null private
      * data pointer as a signal to skip cache validation. This prevents the
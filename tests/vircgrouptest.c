@@ -810,6 +810,7 @@ testCgroupGetMemoryStat(const void *args G_GNUC_UNUSED)
         "unevictable"
     };
     unsigned long long values[G_N_ELEMENTS(expected_values)];
+    size_t attempt;
 
     if ((rv = virCgroupNewPartition("/virtualmachines", true,
                                     (1 << VIR_CGROUP_CONTROLLER_MEMORY),
@@ -818,23 +819,63 @@ testCgroupGetMemoryStat(const void *args G_GNUC_UNUSED)
         return -1;
     }
 
-    if ((rv = virCgroupGetMemoryStat(cgroup, &values[0],
-                                     &values[1], &values[2],
-                                     &values[3], &values[4],
-                                     &values[5])) < 0) {
-        fprintf(stderr, "Could not retrieve GetMemoryStat for /virtualmachines cgroup: %d\n", -rv);
-        return -1;
-    }
+    /* The second attempt reads through the cached file descriptor */
+    for (attempt = 0; attempt < 2; attempt++) {
+        memset(values, 0, sizeof(values));
 
-    for (i = 0; i < G_N_ELEMENTS(expected_values); i++) {
-        /* NB: virCgroupGetMemoryStat returns a KiB scaled value */
-        if ((expected_values[i] >> 10) != values[i]) {
-            fprintf(stderr,
-                    "Wrong value (%llu) for %s from virCgroupGetMemoryStat "
-                    "(expected %llu)\n",
-                    values[i], names[i], (expected_values[i] >> 10));
+        if ((rv = virCgroupGetMemoryStat(cgroup, &values[0],
+                                         &values[1], &values[2],
+                                         &values[3], &values[4],
+                                         &values[5])) < 0) {
+            fprintf(stderr, "Could not retrieve GetMemoryStat for /virtualmachines cgroup: %d\n", -rv);
             return -1;
         }
+
+        for (i = 0; i < G_N_ELEMENTS(expected_values); i++) {
+            /* NB: virCgroupGetMemoryStat returns a KiB scaled value */
+            if ((expected_values[i] >> 10) != values[i]) {
+                fprintf(stderr,
+                        "Wrong value (%llu) for %s from virCgroupGetMemoryStat "
+                        "(expected %llu)\n",
+                        values[i], names[i], (expected_values[i] >> 10));
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+static int
+testCgroupParseFlatKeyed(const void *args G_GNUC_UNUSED)
+{
+    const char *const keys[] = { "usage_usec", "user_usec", "nr_throttled", NULL };
+    unsigned long long values[G_N_ELEMENTS(keys) - 1] = { 0, 0, 42 };
+
+    if (virCgroupParseFlatKeyed("usage_usec 1000\n"
+                                "user_usec_extra 7\n"
+                                "user_usec 600\n"
+                                "system_usec 400",
+                                "cpu.stat", keys, values) < 0)
+        return -1;
+
+    if (values[0] != 1000 || values[1] != 600 || values[2] != 42) {
+        fprintf(stderr, "Unexpected values %llu %llu %llu\n",
+                values[0], values[1], values[2]);
+        return -1;
+    }
+
+    if (virCgroupParseFlatKeyed("usage_usec\nuser_usec 1",
+                                "cpu.stat", keys, values) == 0) {
+        fprintf(stderr, "Line without value was not rejected\n");
+        return -1;
+    }
+
+    if (virCgroupParseFlatKeyed("user_usec 1x",
+                                "cpu.stat", keys, values) == 0) {
+        fprintf(stderr, "Malformed value was not rejected\n");
+        return -1;
     }
 
     return 0;
@@ -1058,6 +1099,9 @@ mymain(void)
     if (virTestRun("virCgroupGetMemoryStat works", testCgroupGetMemoryStat, NULL) < 0)
         ret = -1;
 
+    if (virTestRun("virCgroupParseFlatKeyed works", testCgroupParseFlatKeyed, NULL) < 0)
+        ret = -1;
+
     if (virTestRun("virCgroupGetPercpuStats works", testCgroupGetPercpuStats, NULL) < 0)
         ret = -1;
     cleanupFakeFS(fakerootdir);
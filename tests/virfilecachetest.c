@@ -204,6 +204,7 @@ mymain(void)
         return EXIT_FAILURE;
 
     virFileCacheSetPriv(cache, &testPriv);
+    virFileCacheSetSystemDir(cache, abs_srcdir "/virfilecachesystemdata");
 
 #define TEST_RUN(name, newData, expectData, expectSave) \
     do { \
@@ -219,6 +220,8 @@ mymain(void)
     TEST_RUN("cacheValid", NULL, "aaa\n", false);
     TEST_RUN("cacheInvalid", "bbb\n", "bbb\n", true);
     TEST_RUN("cacheMissing", "ccc\n", "ccc\n", true);
+    TEST_RUN("cacheSystem", NULL, "ddd\n", false);
+    TEST_RUN("cacheSystemInvalid", "eee\n", "eee\n", true);
 
     virObjectUnref(cache);
 
@@ -22,6 +22,14 @@
 #include "testutils.h"
 
 #include "virlog.h"
+#include "virthread.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+VIR_LOG_INIT("tests.logtest");
+
+#define TEST_ASYNC_THREADS 4
+#define TEST_ASYNC_MESSAGES 5000
 
 struct testLogData {
     const char *str;
@@ -107,6 +115,107 @@ testLogParseFilters(const void *opaque)
     return ret;
 }
 
+struct testLogAsyncData {
+    size_t received;
+    size_t dropped;
+    bool badMetadata;
+};
+
+static void
+testLogAsyncOutput(virLogSource *source,
+                   virLogPriority priority G_GNUC_UNUSED,
+                   const char *filename G_GNUC_UNUSED,
+                   int linenr G_GNUC_UNUSED,
+                   const char *funcname G_GNUC_UNUSED,
+                   const char *timestamp G_GNUC_UNUSED,
+                   struct _virLogMetadata *metadata,
+                   const char *rawstr,
+                   const char *str G_GNUC_UNUSED,
+                   void *opaque)
+{
+    struct testLogAsyncData *data = opaque;
+    unsigned int dropped;
+
+    if (source == &virLogSelf) {
+        if (!metadata || STRNEQ(metadata[0].key, "TEST") ||
+            STRNEQ(metadata[0].s, "async") || metadata[1].key)
+            data->badMetadata = true;
+        data->received++;
+    } else if (sscanf(rawstr, "%u log messages of thread", &dropped) == 1) {
+        data->dropped += dropped;
+    }
+}
+
+static void
+testLogAsyncThread(void *opaque G_GNUC_UNUSED)
+{
+    size_t i;
+
+    for (i = 0; i < TEST_ASYNC_MESSAGES; i++) {
+        struct _virLogMetadata meta[] = {
+            { "TEST", "async", 0 },
+            { NULL, NULL, 0 },
+        };
+
+        virLogMessage(&virLogSelf, VIR_LOG_ERROR, __FILE__, __LINE__, __func__,
+                      meta, "message %zu", i);
+    }
+}
+
+static int
+testLogAsync(const void *opaque G_GNUC_UNUSED)
+{
+    struct testLogAsyncData data = { 0 };
+    virThread threads[TEST_ASYNC_THREADS];
+    virLogOutput **outputs = g_new0(virLogOutput *, 1);
+    size_t i;
+    int ret = -1;
+
+    outputs[0] = virLogOutputNew(testLogAsyncOutput, NULL, &data,
+                                 VIR_LOG_DEBUG, VIR_LOG_TO_STDERR, NULL);
+    if (virLogDefineOutputs(outputs, 1) < 0) {
+        virLogOutputListFree(outputs, 1);
+        return -1;
+    }
+
+    if (virLogSetAsync(true) < 0)
+        goto cleanup;
+
+    for (i = 0; i < TEST_ASYNC_THREADS; i++) {
+        if (virThreadCreate(&threads[i], true, testLogAsyncThread, NULL) < 0) {
+            VIR_TEST_DEBUG("Unable to create thread");
+            while (i-- > 0)
+                virThreadJoin(&threads[i]);
+            goto cleanup;
+        }
+    }
+
+    for (i = 0; i < TEST_ASYNC_THREADS; i++)
+        virThreadJoin(&threads[i]);
+
+    if (virLogSetAsync(false) < 0)
+        goto cleanup;
+
+    /* Every message is either written or accounted for as dropped */
+    if (data.received + data.dropped != TEST_ASYNC_THREADS * TEST_ASYNC_MESSAGES) {
+        VIR_TEST_DEBUG("Expected %d messages, got %zu written and %zu dropped",
+                       TEST_ASYNC_THREADS * TEST_ASYNC_MESSAGES,
+                       data.received, data.dropped);
+        goto cleanup;
+    }
+
+    if (data.badMetadata) {
+        VIR_TEST_DEBUG("Message metadata were not preserved");
+        goto cleanup;
+    }
+
+    ret = 0;
+ cleanup:
+    virLogSetAsync(false);
+    virLogReset();
+    return ret;
+}
+
 static int
 mymain(void)
 {
@@ -151,6 +260,9 @@ mymain(void)
     TEST_PARSE_FILTERS_FAIL(":foo", 1);
     TEST_PARSE_FILTERS_FAIL("1:+", 1);
 
+    if (virTestRun("testLogAsync", testLogAsync, NULL) < 0)
+        ret = -1;
+
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
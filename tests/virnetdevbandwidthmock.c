@@ -18,8 +18,30 @@
 
 #include <config.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/types.h>
 
+#if defined(WITH_LIBNL)
+# include <linux/pkt_cls.h>
+# include <linux/pkt_sched.h>
+# include <linux/rtnetlink.h>
+#endif
+
+#include "virnetdevbandwidth.h"
+#include "virnetdev.h"
+#include "virnetlink.h"
+#include "virbuffer.h"
+#include "virfile.h"
+#include "virmacaddr.h"
+#include "virstring.h"
+
+/* When set, traffic control goes through (mocked) netlink and the
+ * requests are appended to the file named by this variable */
+#define MOCK_NETLINK_ENV "VIR_NETDEV_BANDWIDTH_MOCK_NETLINK"
+/* Comma separated results (0 or -errno) of the requests, the ones
+ * which are not listed succeed */
+#define MOCK_ERRORS_ENV "VIR_NETDEV_BANDWIDTH_MOCK_ERRORS"
+
 uid_t geteuid(void)
 {
     return 0;
@@ -29,3 +51,534 @@ uid_t getuid(void)
 {
     return 0;
 }
+
+bool virNetDevBandwidthUseNetlink(void)
+{
+    /* compare against the tc(8) equivalents of the operations, unless
+     * the test asks for the netlink requests */
+    return !!getenv(MOCK_NETLINK_ENV);
+}
+
+int
+virNetDevGetIndex(const char *ifname G_GNUC_UNUSED,
+                  int *ifindex)
+{
+    *ifindex = 42;
+    return 0;
+}
+
+
+#if defined(WITH_LIBNL)
+
+typedef enum {
+    MOCK_ATTRS_TCA,
+    MOCK_ATTRS_HTB,
+    MOCK_ATTRS_FW,
+    MOCK_ATTRS_U32,
+    MOCK_ATTRS_POLICE,
+    MOCK_ATTRS_LINK,
+} mockAttrsType;
+
+static void
+mockFormatAttrs(virBuffer *buf,
+                mockAttrsType type,
+                const char *kind,
+                struct nlattr *head,
+                int len);
+
+
+static void
+mockFormatRateSpec(virBuffer *buf,
+                   const char *name,
+                   const struct tc_ratespec *spec)
+{
+    virBufferAsprintf(buf,
+                      "%s rate=%u cell_log=%u cell_align=%d linklayer=%u overhead=%u mpu=%u\n",
+                      name, spec->rate, spec->cell_log, spec->cell_align,
+                      spec->linklayer, spec->overhead, spec->mpu);
+}
+
+
+static void
+mockFormatTable(virBuffer *buf,
+                const char *name,
+                struct nlattr *nla)
+{
+    const uint32_t *tab = nla_data(nla);
+    size_t ntab = nla_len(nla) / sizeof(*tab);
+    size_t i;
+
+    virBufferAsprintf(buf, "%s\n", name);
+    virBufferAdjustIndent(buf, 2);
+    for (i = 0; i < ntab; i++) {
+        virBufferAsprintf(buf, "%u", tab[i]);
+        if (i % 8 == 7 || i == ntab - 1)
+            virBufferAddLit(buf, "\n");
+        else
+            virBufferAddLit(buf, " ");
+    }
+    virBufferAdjustIndent(buf, -2);
+}
+
+
+static void
+mockFormatNested(virBuffer *buf,
+                 const char *name,
+                 mockAttrsType type,
+                 const char *kind,
+                 struct nlattr *nla)
+{
+    virBufferAsprintf(buf, "%s\n", name);
+    virBufferAdjustIndent(buf, 2);
+    mockFormatAttrs(buf, type, kind, nla_data(nla), nla_len(nla));
+    virBufferAdjustIndent(buf, -2);
+}
+
+
+static bool
+mockFormatTCAAttr(virBuffer *buf,
+                  const char *kind,
+                  struct nlattr *nla)
+{
+    const struct tc_sfq_qopt *qopt;
+
+    switch (nla_type(nla)) {
+    case TCA_KIND:
+        virBufferAsprintf(buf, "TCA_KIND %s\n", nla_get_string(nla));
+        return true;
+
+    case TCA_OPTIONS:
+        if (STREQ_NULLABLE(kind, "htb")) {
+            mockFormatNested(buf, "TCA_OPTIONS", MOCK_ATTRS_HTB, kind, nla);
+        } else if (STREQ_NULLABLE(kind, "fw")) {
+            mockFormatNested(buf, "TCA_OPTIONS", MOCK_ATTRS_FW, kind, nla);
+        } else if (STREQ_NULLABLE(kind, "u32")) {
+            mockFormatNested(buf, "TCA_OPTIONS", MOCK_ATTRS_U32, kind, nla);
+        } else if (STREQ_NULLABLE(kind, "sfq") &&
+                   nla_len(nla) == (int) sizeof(*qopt)) {
+            qopt = nla_data(nla);
+            virBufferAsprintf(buf,
+                              "TCA_OPTIONS quantum=%u perturb_period=%d limit=%u divisor=%u flows=%u\n",
+                              qopt->quantum, qopt->perturb_period,
+                              qopt->limit, qopt->divisor, qopt->flows);
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    return false;
+}
+
+
+static bool
+mockFormatHTBAttr(virBuffer *buf,
+                  struct nlattr *nla)
+{
+    const struct tc_htb_opt *opt;
+    const struct tc_htb_glob *glob;
+
+    switch (nla_type(nla)) {
+    case TCA_HTB_PARMS:
+        if (nla_len(nla) != (int) sizeof(*opt))
+            return false;
+        opt = nla_data(nla);
+        virBufferAsprintf(buf,
+                          "TCA_HTB_PARMS buffer=%u cbuffer=%u quantum=%u level=%u prio=%u\n",
+                          opt->buffer, opt->cbuffer, opt->quantum,
+                          opt->level, opt->prio);
+        virBufferAdjustIndent(buf, 2);
+        mockFormatRateSpec(buf, "rate", &opt->rate);
+        mockFormatRateSpec(buf, "ceil", &opt->ceil);
+        virBufferAdjustIndent(buf, -2);
+        return true;
+
+    case TCA_HTB_INIT:
+        if (nla_len(nla) != (int) sizeof(*glob))
+            return false;
+        glob = nla_data(nla);
+        virBufferAsprintf(buf,
+                          "TCA_HTB_INIT version=%u rate2quantum=%u defcls=%u debug=%u direct_pkts=%u\n",
+                          glob->version, glob->rate2quantum, glob->defcls,
+                          glob->debug, glob->direct_pkts);
+        return true;
+
+    case TCA_HTB_CTAB:
+        mockFormatTable(buf, "TCA_HTB_CTAB", nla);
+        return true;
+
+    case TCA_HTB_RTAB:
+        mockFormatTable(buf, "TCA_HTB_RTAB", nla);
+        return true;
+
+    case TCA_HTB_RATE64:
+        virBufferAsprintf(buf, "TCA_HTB_RATE64 %llu\n",
+                          (unsigned long long) nla_get_u64(nla));
+        return true;
+
+    case TCA_HTB_CEIL64:
+        virBufferAsprintf(buf, "TCA_HTB_CEIL64 %llu\n",
+                          (unsigned long long) nla_get_u64(nla));
+        return true;
+    }
+
+    return false;
+}
+
+
+static bool
+mockFormatFWAttr(virBuffer *buf,
+                 struct nlattr *nla)
+{
+    uint32_t classid;
+
+    switch (nla_type(nla)) {
+    case TCA_FW_CLASSID:
+        classid = nla_get_u32(nla);
+        virBufferAsprintf(buf, "TCA_FW_CLASSID %x:%x\n",
+                          TC_H_MAJ(classid) >> 16, TC_H_MIN(classid));
+        return true;
+    }
+
+    return false;
+}
+
+
+static bool
+mockFormatU32Attr(virBuffer *buf,
+                  const char *kind,
+                  struct nlattr *nla)
+{
+    const struct tc_u32_sel *sel;
+    uint32_t classid;
+    size_t i;
+
+    switch (nla_type(nla)) {
+    case TCA_U32_CLASSID:
+        classid = nla_get_u32(nla);
+        virBufferAsprintf(buf, "TCA_U32_CLASSID %x:%x\n",
+                          TC_H_MAJ(classid) >> 16, TC_H_MIN(classid));
+        return true;
+
+    case TCA_U32_SEL:
+        sel = nla_data(nla);
+        if (nla_len(nla) < (int) sizeof(*sel) ||
+            nla_len(nla) != (int) (sizeof(*sel) + sel->nkeys * sizeof(sel->keys[0])))
+            return false;
+        virBufferAsprintf(buf,
+                          "TCA_U32_SEL flags=0x%x offshift=%u nkeys=%u offmask=0x%x off=%u offoff=%d hoff=%d hmask=0x%x\n",
+                          sel->flags, sel->offshift, sel->nkeys,
+                          g_ntohs(sel->offmask), sel->off, sel->offoff,
+                          sel->hoff, g_ntohl(sel->hmask));
+        /* the values and masks are in network byte order, as they
+         * are compared to the packet data */
+        virBufferAdjustIndent(buf, 2);
+        for (i = 0; i < sel->nkeys; i++) {
+            virBufferAsprintf(buf, "key val=0x%08x mask=0x%08x off=%d offmask=%d\n",
+                              g_ntohl(sel->keys[i].val), g_ntohl(sel->keys[i].mask),
+                              sel->keys[i].off, sel->keys[i].offmask);
+        }
+        virBufferAdjustIndent(buf, -2);
+        return true;
+
+    case TCA_U32_POLICE:
+        mockFormatNested(buf, "TCA_U32_POLICE", MOCK_ATTRS_POLICE, kind, nla);
+        return true;
+    }
+
+    return false;
+}
+
+
+static bool
+mockFormatPoliceAttr(virBuffer *buf,
+                     struct nlattr *nla)
+{
+    const struct tc_police *police;
+
+    switch (nla_type(nla)) {
+    case TCA_POLICE_TBF:
+        if (nla_len(nla) != (int) sizeof(*police))
+            return false;
+        police = nla_data(nla);
+        virBufferAsprintf(buf,
+                          "TCA_POLICE_TBF index=%u action=%d limit=%u burst=%u mtu=%u\n",
+                          police->index, police->action, police->limit,
+                          police->burst, police->mtu);
+        virBufferAdjustIndent(buf, 2);
+        mockFormatRateSpec(buf, "rate", &police->rate);
+        mockFormatRateSpec(buf, "peakrate", &police->peakrate);
+        virBufferAdjustIndent(buf, -2);
+        return true;
+
+    case TCA_POLICE_RATE:
+        mockFormatTable(buf, "TCA_POLICE_RATE", nla);
+        return true;
+
+    case TCA_POLICE_RATE64:
+        virBufferAsprintf(buf, "TCA_POLICE_RATE64 %llu\n",
+                          (unsigned long long) nla_get_u64(nla));
+        return true;
+    }
+
+    return false;
+}
+
+
+static bool
+mockFormatLinkAttr(virBuffer *buf,
+                   struct nlattr *nla)
+{
+    virMacAddr mac;
+    char macstr[VIR_MAC_STRING_BUFLEN];
+
+    switch (nla_type(nla)) {
+    case IFLA_IFNAME:
+        virBufferAsprintf(buf, "IFLA_IFNAME %s\n", nla_get_string(nla));
+        return true;
+
+    case IFLA_ADDRESS:
+        if (nla_len(nla) != VIR_MAC_BUFLEN)
+            return false;
+        virMacAddrSetRaw(&mac, nla_data(nla));
+        virBufferAsprintf(buf, "IFLA_ADDRESS %s\n",
+                          virMacAddrFormat(&mac, macstr));
+        return true;
+
+    case IFLA_MTU:
+        virBufferAsprintf(buf, "IFLA_MTU %u\n", nla_get_u32(nla));
+        return true;
+
+    case IFLA_MASTER:
+        virBufferAsprintf(buf, "IFLA_MASTER %u\n", nla_get_u32(nla));
+        return true;
+    }
+
+    return false;
+}
+
+
+static void
+mockFormatAttrs(virBuffer *buf,
+                mockAttrsType type,
+                const char *kind,
+                struct nlattr *head,
+                int len)
+{
+    struct nlattr *nla;
+    int rem;
+
+    nla_for_each_attr(nla, head, len, rem) {
+        bool known = false;
+
+        switch (type) {
+        case MOCK_ATTRS_TCA:
+            known = mockFormatTCAAttr(buf, kind, nla);
+            break;
+        case MOCK_ATTRS_HTB:
+            known = mockFormatHTBAttr(buf, nla);
+            break;
+        case MOCK_ATTRS_FW:
+            known = mockFormatFWAttr(buf, nla);
+            break;
+        case MOCK_ATTRS_U32:
+            known = mockFormatU32Attr(buf, kind, nla);
+            break;
+        case MOCK_ATTRS_POLICE:
+            known = mockFormatPoliceAttr(buf, nla);
+            break;
+        case MOCK_ATTRS_LINK:
+            known = mockFormatLinkAttr(buf, nla);
+            break;
+        }
+
+        if (!known)
+            virBufferAsprintf(buf, "unknown attribute %d len=%d\n",
+                              nla_type(nla), nla_len(nla));
+    }
+}
+
+
+static void
+mockFormatLinkMsg(virBuffer *buf,
+                  struct nlmsghdr *hdr)
+{
+    struct ifinfomsg *ifinfo = nlmsg_data(hdr);
+
+    virBufferAsprintf(buf, "RTM_NEWLINK flags=0x%x family=%u ifindex=%d change=0x%x ifflags=0x%x\n",
+                      hdr->nlmsg_flags, ifinfo->ifi_family, ifinfo->ifi_index,
+                      ifinfo->ifi_change, ifinfo->ifi_flags);
+
+    virBufferAdjustIndent(buf, 2);
+    mockFormatAttrs(buf, MOCK_ATTRS_LINK, NULL,
+                    nlmsg_attrdata(hdr, sizeof(*ifinfo)),
+                    nlmsg_attrlen(hdr, sizeof(*ifinfo)));
+    virBufferAdjustIndent(buf, -2);
+}
+
+
+static void
+mockFormatMsg(virBuffer *buf,
+              struct nl_msg *msg)
+{
+    struct nlmsghdr *hdr = nlmsg_hdr(msg);
+    struct tcmsg *tcm = nlmsg_data(hdr);
+    struct nlattr *kindattr;
+    const char *kind;
+    bool filter = false;
+
+    if (hdr->nlmsg_type == RTM_NEWLINK) {
+        mockFormatLinkMsg(buf, hdr);
+        return;
+    }
+
+    kindattr = nlmsg_find_attr(hdr, sizeof(*tcm), TCA_KIND);
+    kind = kindattr ? nla_get_string(kindattr) : NULL;
+
+    switch (hdr->nlmsg_type) {
+    case RTM_NEWQDISC:
+        virBufferAddLit(buf, "RTM_NEWQDISC");
+        break;
+    case RTM_DELQDISC:
+        virBufferAddLit(buf, "RTM_DELQDISC");
+        break;
+    case RTM_NEWTCLASS:
+        virBufferAddLit(buf, "RTM_NEWTCLASS");
+        break;
+    case RTM_DELTCLASS:
+        virBufferAddLit(buf, "RTM_DELTCLASS");
+        break;
+    case RTM_NEWTFILTER:
+        virBufferAddLit(buf, "RTM_NEWTFILTER");
+        filter = true;
+        break;
+    case RTM_DELTFILTER:
+        virBufferAddLit(buf, "RTM_DELTFILTER");
+        filter = true;
+        break;
+    default:
+        virBufferAsprintf(buf, "type=%u", hdr->nlmsg_type);
+        break;
+    }
+
+    virBufferAsprintf(buf, " flags=0x%x family=%u ifindex=%d parent=%x:%x handle=%x:%x",
+                      hdr->nlmsg_flags, tcm->tcm_family, tcm->tcm_ifindex,
+                      TC_H_MAJ(tcm->tcm_parent) >> 16, TC_H_MIN(tcm->tcm_parent),
+                      TC_H_MAJ(tcm->tcm_handle) >> 16, TC_H_MIN(tcm->tcm_handle));
+
+    if (filter) {
+        virBufferAsprintf(buf, " prio=%u protocol=0x%04x\n",
+                          TC_H_MAJ(tcm->tcm_info) >> 16,
+                          g_ntohs(TC_H_MIN(tcm->tcm_info)));
+    } else {
+        virBufferAsprintf(buf, " info=0x%x\n", tcm->tcm_info);
+    }
+
+    virBufferAdjustIndent(buf, 2);
+    mockFormatAttrs(buf, MOCK_ATTRS_TCA, kind,
+                    nlmsg_attrdata(hdr, sizeof(*tcm)),
+                    nlmsg_attrlen(hdr, sizeof(*tcm)));
+    virBufferAdjustIndent(buf, -2);
+}
+
+
+int
+virNetlinkCommandBatch(struct nl_msg **msgs,
+                       size_t nmsgs,
+                       int *errors,
+                       unsigned int protocol G_GNUC_UNUSED)
+{
+    const char *file = getenv(MOCK_NETLINK_ENV);
+    const char *results = getenv(MOCK_ERRORS_ENV);
+    g_auto(GStrv) resultsList = NULL;
+    g_auto(virBuffer) buf = VIR_BUFFER_INITIALIZER;
+    g_autofree char *str = NULL;
+    VIR_AUTOCLOSE fd = -1;
+    size_t i;
+
+    if (!file)
+        abort();
+
+    if (results)
+        resultsList = g_strsplit(results, ",", 0);
+
+    for (i = 0; i < nmsgs; i++) {
+        mockFormatMsg(&buf, msgs[i]);
+
+        errors[i] = 0;
+        if (resultsList && i < g_strv_length(resultsList) &&
+            virStrToLong_i(resultsList[i], NULL, 10, &errors[i]) < 0)
+            abort();
+    }
+
+    if (!(str = virBufferContentAndReset(&buf)))
+        return 0;
+
+    if ((fd = open(file, O_WRONLY | O_CREAT | O_APPEND, 0644)) < 0 ||
+        safewrite(fd, str, strlen(str)) < 0)
+        abort();
+
+    return 0;
+}
+
+
+/* Statistics of the vnet0 link in the RTM_GETLINK dump */
+static const struct rtnl_link_stats64 mockLinkStats = {
+    .rx_packets = 1,
+    .tx_packets = 2,
+    .rx_bytes = 3,
+    .tx_bytes = 4,
+    .rx_errors = 5,
+    .tx_errors = 6,
+    .rx_dropped = 7,
+    .tx_dropped = 8,
+    .rx_missed_errors = 9,
+};
+
+
+static void
+mockDumpLink(virNetlinkDumpCallback callback,
+             void *opaque,
+             int type,
+             const char *ifname,
+             const struct rtnl_link_stats64 *stats)
+{
+    g_autoptr(virNetlinkMsg) msg = nlmsg_alloc_simple(type, NLM_F_MULTI);
+    struct ifinfomsg ifinfo = { .ifi_family = AF_UNSPEC };
+
+    if (!msg ||
+        nlmsg_append(msg, &ifinfo, sizeof(ifinfo), NLMSG_ALIGNTO) < 0 ||
+        nla_put_string(msg, IFLA_IFNAME, ifname) < 0 ||
+        (stats && nla_put(msg, IFLA_STATS64, sizeof(*stats), stats) < 0))
+        abort();
+
+    if (callback(nlmsg_hdr(msg), opaque) < 0)
+        abort();
+}
+
+
+int
+virNetlinkDumpCommand(struct nl_msg *nl_msg,
+                      virNetlinkDumpCallback callback,
+                      uint32_t src_pid G_GNUC_UNUSED,
+                      uint32_t dst_pid G_GNUC_UNUSED,
+                      unsigned int protocol,
+                      unsigned int groups G_GNUC_UNUSED,
+                      void *opaque)
+{
+    struct nlmsghdr *hdr = nlmsg_hdr(nl_msg);
+
+    /* only dumping all links is supported */
+    if (protocol != NETLINK_ROUTE ||
+        hdr->nlmsg_type != RTM_GETLINK ||
+        !(hdr->nlmsg_flags & NLM_F_DUMP))
+        abort();
+
+    mockDumpLink(callback, opaque, RTM_NEWLINK, "vnet0", &mockLinkStats);
+    mockDumpLink(callback, opaque, RTM_NEWLINK, "lo", NULL);
+    mockDumpLink(callback, opaque, RTM_DELLINK, "vnet1", &mockLinkStats);
+
+    return 0;
+}
+
+#endif /* WITH_LIBNL */
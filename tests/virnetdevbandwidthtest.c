@@ -18,9 +18,13 @@
 
 #include <config.h>
 
+#include <unistd.h>
+
 #include "testutils.h"
 #define LIBVIRT_VIRCOMMANDPRIV_H_ALLOW
 #include "vircommandpriv.h"
+#include "virfile.h"
+#include "virnetdev.h"
 #include "virnetdevbandwidth.h"
 #include "virnetdevopenvswitch.h"
 #include "netdev_bandwidth_conf.c"
@@ -106,6 +110,117 @@ testVirNetDevBandwidthSet(const void *data)
     return 0;
 }
 
+
+#if defined(WITH_LIBNL)
+
+# define TEST_NETLINK_FILE abs_builddir "/virnetdevbandwidthtest.netlink"
+# define TEST_MAC "52:54:00:a4:6f:91"
+
+typedef enum {
+    TEST_NETLINK_SET,
+    TEST_NETLINK_PLUG,
+    TEST_NETLINK_UNPLUG,
+    TEST_NETLINK_UPDATE_RATE,
+    TEST_NETLINK_UPDATE_FILTER,
+    TEST_NETLINK_SETUP_LINKS,
+} testNetlinkOp;
+
+struct testNetlinkStruct {
+    const char *name;       /* expected requests in virnetdevbandwidthdata */
+    testNetlinkOp op;
+    const char *band;
+    const char *net_band;   /* bandwidth of the bridge */
+    unsigned int flags;
+    const char *results;    /* results of the requests, see the mock */
+    const char *exp_err;    /* part of the expected error, if any */
+};
+
+static int
+testNetlinkSetupLinks(const virMacAddr *mac)
+{
+    /* vnet0 must be attached to br0 before it's brought up */
+    const virNetDevLinkSetup links[] = {
+        { .ifname = "vnet0", .mac = mac, .mtu = 1500, .master = "br0",
+          .online = VIR_TRISTATE_BOOL_YES },
+        { .ifname = "vnet1", .online = VIR_TRISTATE_BOOL_NO },
+        { .ifname = "vnet2", .mtu = 9000, .online = VIR_TRISTATE_BOOL_YES },
+    };
+
+    return virNetDevSetupLinks(links, G_N_ELEMENTS(links));
+}
+
+static int
+testVirNetDevBandwidthNetlink(const void *data)
+{
+    const struct testNetlinkStruct *info = data;
+    g_autoptr(virNetDevBandwidth) band = NULL;
+    g_autoptr(virNetDevBandwidth) net_band = NULL;
+    g_autofree char *actual = NULL;
+    g_autofree char *expected = NULL;
+    virMacAddr mac;
+    int rc = -1;
+
+    if (testVirNetDevBandwidthParse(&band, info->band) < 0 ||
+        testVirNetDevBandwidthParse(&net_band, info->net_band) < 0 ||
+        virMacAddrParse(TEST_MAC, &mac) < 0)
+        return -1;
+
+    unlink(TEST_NETLINK_FILE);
+    g_setenv("VIR_NETDEV_BANDWIDTH_MOCK_NETLINK", TEST_NETLINK_FILE, TRUE);
+    if (info->results)
+        g_setenv("VIR_NETDEV_BANDWIDTH_MOCK_ERRORS", info->results, TRUE);
+
+    switch (info->op) {
+    case TEST_NETLINK_SET:
+        rc = virNetDevBandwidthSet("eth0", band, info->flags);
+        break;
+    case TEST_NETLINK_PLUG:
+        rc = virNetDevBandwidthPlug("br0", net_band, &mac, band, 3);
+        break;
+    case TEST_NETLINK_UNPLUG:
+        rc = virNetDevBandwidthUnplug("br0", 3);
+        break;
+    case TEST_NETLINK_UPDATE_RATE:
+        rc = virNetDevBandwidthUpdateRate("br0", 2, net_band, 500);
+        break;
+    case TEST_NETLINK_UPDATE_FILTER:
+        rc = virNetDevBandwidthUpdateFilter("br0", &mac, 3);
+        break;
+    case TEST_NETLINK_SETUP_LINKS:
+        rc = testNetlinkSetupLinks(&mac);
+        break;
+    }
+
+    g_unsetenv("VIR_NETDEV_BANDWIDTH_MOCK_NETLINK");
+    g_unsetenv("VIR_NETDEV_BANDWIDTH_MOCK_ERRORS");
+
+    if (info->exp_err) {
+        if (rc == 0) {
+            VIR_TEST_DEBUG("Expected failure with '%s'", info->exp_err);
+            return -1;
+        }
+        if (!strstr(virGetLastErrorMessage(), info->exp_err)) {
+            VIR_TEST_DEBUG("Expected error '%s', got '%s'",
+                           info->exp_err, virGetLastErrorMessage());
+            return -1;
+        }
+        virResetLastError();
+    } else if (rc < 0) {
+        return -1;
+    }
+
+    if (virFileReadAll(TEST_NETLINK_FILE, 1024 * 1024, &actual) < 0)
+        return -1;
+    unlink(TEST_NETLINK_FILE);
+
+    expected = g_strdup_printf("%s/virnetdevbandwidthdata/%s.netlink",
+                               abs_srcdir, info->name);
+
+    return virTestCompareToFile(actual, expected);
+}
+
+#endif /* WITH_LIBNL */
+
 static int
 mymain(void)
 {
@@ -219,6 +334,104 @@ mymain(void)
                             " 'external-ids:ifname=\"eth0\"'\n"
                 OVS_VSCTL " --timeout=5 set Interface eth0 ingress_policing_rate=34359738360\n");
 
+#if defined(WITH_LIBNL)
+# define DO_TEST_NETLINK_FULL(Name, Op, Band, NetBand, Flags, Results, ExpErr) \
+    do { \
+        struct testNetlinkStruct data = { .name = Name, .op = Op, \
+                                          .band = Band, .net_band = NetBand, \
+                                          .flags = Flags, .results = Results, \
+                                          .exp_err = ExpErr }; \
+        if (virTestRun("virNetDevBandwidth netlink " Name, \
+                       testVirNetDevBandwidthNetlink, &data) < 0) \
+            ret = -1; \
+    } while (0)
+
+# define DO_TEST_NETLINK_SET(Name, Band, Flags) \
+    DO_TEST_NETLINK_FULL(Name, TEST_NETLINK_SET, Band, NULL, Flags, NULL, NULL)
+
+# define SET_FLAGS (VIR_NETDEV_BANDWIDTH_SET_DIR_SWAPPED | \
+                    VIR_NETDEV_BANDWIDTH_SET_CLEAR_ALL)
+
+# define BRIDGE_BAND \
+    "<bandwidth>" \
+    "  <inbound average='1000' peak='2000'/>" \
+    "</bandwidth>"
+
+    DO_TEST_NETLINK_SET("set-inbound",
+                        "<bandwidth>"
+                        "  <inbound average='1024'/>"
+                        "</bandwidth>",
+                        SET_FLAGS);
+    DO_TEST_NETLINK_SET("set-outbound",
+                        "<bandwidth>"
+                        "  <outbound average='1024'/>"
+                        "</bandwidth>",
+                        SET_FLAGS);
+    DO_TEST_NETLINK_SET("set-all",
+                        "<bandwidth>"
+                        "  <inbound average='1' peak='2' floor='3' burst='4'/>"
+                        "  <outbound average='5' peak='6' burst='7'/>"
+                        "</bandwidth>",
+                        SET_FLAGS);
+    /* rates above 4GB/s need the 64 bit attributes */
+    DO_TEST_NETLINK_SET("set-rate64",
+                        "<bandwidth>"
+                        "  <inbound average='4294967295'/>"
+                        "  <outbound average='4294967295'/>"
+                        "</bandwidth>",
+                        SET_FLAGS);
+    DO_TEST_NETLINK_SET("set-hierarchical", BRIDGE_BAND,
+                        VIR_NETDEV_BANDWIDTH_SET_HIERARCHICAL_CLASS |
+                        VIR_NETDEV_BANDWIDTH_SET_DIR_SWAPPED);
+
+    DO_TEST_NETLINK_FULL("plug", TEST_NETLINK_PLUG,
+                         "<bandwidth>"
+                         "  <inbound average='1000' floor='500'/>"
+                         "</bandwidth>",
+                         BRIDGE_BAND, 0, NULL, NULL);
+    DO_TEST_NETLINK_FULL("unplug", TEST_NETLINK_UNPLUG,
+                         NULL, NULL, 0, NULL, NULL);
+    DO_TEST_NETLINK_FULL("update-rate", TEST_NETLINK_UPDATE_RATE,
+                         NULL, BRIDGE_BAND, 0, NULL, NULL);
+    DO_TEST_NETLINK_FULL("update-filter", TEST_NETLINK_UPDATE_FILTER,
+                         NULL, NULL, 0, NULL, NULL);
+
+    /* Each acknowledgement belongs to the request at the same index:
+     * deleting is allowed to fail, an existing qdisc 1: is reused */
+    DO_TEST_NETLINK_FULL("set-inbound", TEST_NETLINK_SET,
+                         "<bandwidth>"
+                         "  <inbound average='1024'/>"
+                         "</bandwidth>",
+                         NULL, SET_FLAGS, "-2,-2,-17", NULL);
+    DO_TEST_NETLINK_FULL("set-inbound", TEST_NETLINK_SET,
+                         "<bandwidth>"
+                         "  <inbound average='1024'/>"
+                         "</bandwidth>",
+                         NULL, SET_FLAGS, "0,0,-22",
+                         "Unable to apply 'tc qdisc add dev eth0 root handle 1: htb default 1'");
+    DO_TEST_NETLINK_FULL("set-inbound", TEST_NETLINK_SET,
+                         "<bandwidth>"
+                         "  <inbound average='1024'/>"
+                         "</bandwidth>",
+                         NULL, SET_FLAGS, "0,0,0,-17",
+                         "Unable to apply 'tc class add dev eth0 parent 1: classid 1:1 htb rate 1024kbps quantum 87'");
+    DO_TEST_NETLINK_FULL("unplug", TEST_NETLINK_UNPLUG,
+                         NULL, NULL, 0, "-2,-2,-2", NULL);
+    DO_TEST_NETLINK_FULL("plug", TEST_NETLINK_PLUG,
+                         "<bandwidth>"
+                         "  <inbound average='1000' floor='500'/>"
+                         "</bandwidth>",
+                         BRIDGE_BAND, 0, "0,0,-2",
+                         "Unable to apply 'tc filter add dev br0 protocol ip prio 2 handle 800::803 u32");
+
+    DO_TEST_NETLINK_FULL("setup-links", TEST_NETLINK_SETUP_LINKS,
+                         NULL, NULL, 0, NULL, NULL);
+    /* no link is brought up if any of them can't be set up */
+    DO_TEST_NETLINK_FULL("setup-links-error", TEST_NETLINK_SETUP_LINKS,
+                         NULL, NULL, 0, "0,-19",
+                         "Unable to set up interface vnet1");
+#endif /* WITH_LIBNL */
+
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
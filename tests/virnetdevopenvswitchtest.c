@@ -23,6 +23,7 @@
 #include "vircommandpriv.h"
 #include "virnetdevbandwidth.h"
 #include "virnetdevopenvswitch.h"
+#include "virnetdevtap.h"
 #include "netdev_bandwidth_conf.c"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
@@ -68,6 +69,38 @@ testVirNetDevBandwidthParse(virNetDevBandwidth **var,
 
 static const unsigned char vm_id[VIR_UUID_BUFLEN] = "fakeuuid";
 
+static int
+testCompareStats(const virDomainInterfaceStatsStruct *expect,
+                 const virDomainInterfaceStatsStruct *actual)
+{
+    if (memcmp(actual, expect, sizeof(*actual)) != 0) {
+        fprintf(stderr,
+                "Expected stats: %lld %lld %lld %lld %lld %lld %lld %lld\n"
+                "Actual stats: %lld %lld %lld %lld %lld %lld %lld %lld",
+                expect->rx_bytes,
+                expect->rx_packets,
+                expect->rx_errs,
+                expect->rx_drop,
+                expect->tx_bytes,
+                expect->tx_packets,
+                expect->tx_errs,
+                expect->tx_drop,
+                actual->rx_bytes,
+                actual->rx_packets,
+                actual->rx_errs,
+                actual->rx_drop,
+                actual->tx_bytes,
+                actual->tx_packets,
+                actual->tx_errs,
+                actual->tx_drop);
+
+        return -1;
+    }
+
+    return 0;
+}
+
+
 static int
 testInterfaceParseStats(const void *opaque)
 {
@@ -85,32 +118,165 @@ testInterfaceParseStats(const void *opaque)
     if (virNetDevOpenvswitchInterfaceParseStats(buf, &actual) < 0)
         return -1;
 
-    if (memcmp(&actual, &data->stats, sizeof(actual)) != 0) {
-        fprintf(stderr,
-                "Expected stats: %lld %lld %lld %lld %lld %lld %lld %lld\n"
-                "Actual stats: %lld %lld %lld %lld %lld %lld %lld %lld",
-                data->stats.rx_bytes,
-                data->stats.rx_packets,
-                data->stats.rx_errs,
-                data->stats.rx_drop,
-                data->stats.tx_bytes,
-                data->stats.tx_packets,
-                data->stats.tx_errs,
-                data->stats.tx_drop,
-                actual.rx_bytes,
-                actual.rx_packets,
-                actual.rx_errs,
-                actual.rx_drop,
-                actual.tx_bytes,
-                actual.tx_packets,
-                actual.tx_errs,
-                actual.tx_drop);
+    return testCompareStats(&data->stats, &actual);
+}
+
+
+/* Stats of the OVS interfaces in stats-all.json */
+static const virDomainInterfaceStatsStruct statsAllVnet0 = {
+    5, 8, 7, 6, 1, 4, 3, 2
+};
+static const virDomainInterfaceStatsStruct statsAllVnet2 = {
+    -1, -1, -1, -1, 12406, 173, -1, -1
+};
+/* Stats in stats1.json */
+static const virDomainInterfaceStatsStruct stats1 = {
+    9, 12, 11, 10, 2, 8, 5, 4
+};
+
+
+static void
+testInterfaceStatsDryRun(const char *const*args,
+                         const char *const*env G_GNUC_UNUSED,
+                         const char *input G_GNUC_UNUSED,
+                         char **output,
+                         char **error G_GNUC_UNUSED,
+                         int *status,
+                         void *opaque G_GNUC_UNUSED)
+{
+    const char *filename = "stats-all.json";
+    g_autofree char *path = NULL;
+    size_t nargs = g_strv_length((char **) args);
+
+    /* a single interface is queried if its name follows "Interface" */
+    if (STRNEQ(args[nargs - 1], "Interface"))
+        filename = "stats1.json";
+
+    path = g_strdup_printf("%s/virnetdevopenvswitchdata/%s",
+                           abs_srcdir, filename);
+
+    if (virFileReadAll(path, 1024, output) < 0)
+        *status = 1;
+}
+
+
+static int
+testInterfaceStatsAll(const void *opaque G_GNUC_UNUSED)
+{
+    g_auto(virBuffer) buf = VIR_BUFFER_INITIALIZER;
+    g_autoptr(virCommandDryRunToken) dryRunToken = virCommandDryRunTokenNew();
+    g_autoptr(GHashTable) ifaces = NULL;
+    g_autofree char *actual_cmd = NULL;
+    virDomainInterfaceStatsPtr stats;
+
+    virCommandSetDryRun(dryRunToken, &buf, false, false,
+                        testInterfaceStatsDryRun, NULL);
+
+    if (!(ifaces = virNetDevOpenvswitchInterfaceStatsAll()))
+        return -1;
+
+    actual_cmd = virBufferContentAndReset(&buf);
+    if (virTestCompareToString(OVS_VSCTL " --timeout=5 --format=json"
+                               " --columns=name,statistics list Interface\n",
+                               actual_cmd) < 0)
+        return -1;
 
+    /* vnet1 has no statistics at all */
+    if (g_hash_table_size(ifaces) != 2) {
+        fprintf(stderr, "Expected 2 interfaces, got %u\n",
+                g_hash_table_size(ifaces));
         return -1;
     }
 
+    if (!(stats = g_hash_table_lookup(ifaces, "vnet0")) ||
+        testCompareStats(&statsAllVnet0, stats) < 0)
+        return -1;
+
+    if (!(stats = g_hash_table_lookup(ifaces, "vnet2")) ||
+        testCompareStats(&statsAllVnet2, stats) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static int
+testInterfaceStatsSnapshot(const void *opaque G_GNUC_UNUSED)
+{
+    g_auto(virBuffer) buf = VIR_BUFFER_INITIALIZER;
+    g_autoptr(virCommandDryRunToken) dryRunToken = virCommandDryRunTokenNew();
+    g_autoptr(virNetDevTapStatsSnapshot) snapshot = virNetDevTapStatsSnapshotNew();
+    g_autofree char *actual_cmd = NULL;
+    virDomainInterfaceStatsStruct stats;
+
+    virCommandSetDryRun(dryRunToken, &buf, false, false,
+                        testInterfaceStatsDryRun, NULL);
+
+    if (virNetDevTapStatsSnapshotOpenvswitchStats(snapshot, "vnet0", &stats) < 0 ||
+        testCompareStats(&statsAllVnet0, &stats) < 0)
+        return -1;
+
+    if (virNetDevTapStatsSnapshotOpenvswitchStats(snapshot, "vnet2", &stats) < 0 ||
+        testCompareStats(&statsAllVnet2, &stats) < 0)
+        return -1;
+
+    /* interfaces missing from the snapshot are queried one by one */
+    if (virNetDevTapStatsSnapshotOpenvswitchStats(snapshot, "vnet9", &stats) < 0 ||
+        testCompareStats(&stats1, &stats) < 0)
+        return -1;
+
+    actual_cmd = virBufferContentAndReset(&buf);
+    return virTestCompareToString(OVS_VSCTL " --timeout=5 --format=json"
+                                  " --columns=name,statistics list Interface\n"
+                                  OVS_VSCTL " --timeout=5 --if-exists"
+                                  " --format=list --data=json --no-headings"
+                                  " --columns=statistics list Interface vnet9\n",
+                                  actual_cmd);
+}
+
+
+#if defined(WITH_LIBNL)
+static int
+testLinkStatsAll(const void *opaque G_GNUC_UNUSED)
+{
+    /* see virNetlinkDumpCommand() in virnetdevbandwidthmock.c, rx_drop
+     * includes rx_missed_errors */
+    const virDomainInterfaceStatsStruct expect = {
+        3, 1, 5, 16, 4, 2, 6, 8
+    };
+    const virDomainInterfaceStatsStruct expectSwapped = {
+        4, 2, 6, 8, 3, 1, 5, 16
+    };
+    g_autoptr(GHashTable) links = NULL;
+    g_autoptr(virNetDevTapStatsSnapshot) snapshot = virNetDevTapStatsSnapshotNew();
+    virDomainInterfaceStatsPtr stats;
+    virDomainInterfaceStatsStruct actual;
+
+    if (!(links = virNetDevGetAllLinkStats()))
+        return -1;
+
+    /* "lo" carries no statistics and "vnet1" is not a RTM_NEWLINK */
+    if (g_hash_table_size(links) != 1) {
+        fprintf(stderr, "Expected 1 link, got %u\n",
+                g_hash_table_size(links));
+        return -1;
+    }
+
+    if (!(stats = g_hash_table_lookup(links, "vnet0")) ||
+        testCompareStats(&expect, stats) < 0)
+        return -1;
+
+    if (virNetDevTapStatsSnapshotInterfaceStats(snapshot, "vnet0", &actual, false) < 0 ||
+        testCompareStats(&expect, &actual) < 0)
+        return -1;
+
+    if (virNetDevTapStatsSnapshotInterfaceStats(snapshot, "vnet0", &actual, true) < 0 ||
+        testCompareStats(&expectSwapped, &actual) < 0)
+        return -1;
+
     return 0;
 }
+#endif /* WITH_LIBNL */
 
 
 typedef struct _escapeData escapeData;
@@ -229,6 +395,15 @@ mymain(void)
     TEST_INTERFACE_STATS("stats1.json", 9, 12, 11, 10, 2, 8, 5, 4);
     TEST_INTERFACE_STATS("stats2.json", 12406, 173, 0, 0, 0, 0, 0, 0);
 
+    if (virTestRun("Interface stats all", testInterfaceStatsAll, NULL) < 0)
+        ret = -1;
+    if (virTestRun("Interface stats snapshot", testInterfaceStatsSnapshot, NULL) < 0)
+        ret = -1;
+#if defined(WITH_LIBNL)
+    if (virTestRun("Link stats all", testLinkStatsAll, NULL) < 0)
+        ret = -1;
+#endif
+
 #define TEST_NAME_ESCAPE(str, fail) \
     do { \
         const escapeData data = {str, fail};\
@@ -60,6 +60,67 @@ test_virProcessGetStat(const void *opaque)
 }
 
 
+struct testTaskData {
+    const char *dirname;
+    size_t ntids;
+    const pid_t *tids;
+    const virProcessTaskStats *expect;
+};
+
+
+static int
+test_virProcessGetTaskStats(const void *opaque)
+{
+    const struct testTaskData *data = opaque;
+    const unsigned long long jiff2nsec = 1000ull * 1000ull * 1000ull /
+                                         (unsigned long long) sysconf(_SC_CLK_TCK);
+    g_autofree char *data_dir = NULL;
+    g_autofree virProcessTaskStats *stats = g_new0(virProcessTaskStats, data->ntids);
+    size_t i;
+    int rc;
+
+    data_dir = g_strdup_printf("%s/virprocessstatdata/%s/",
+                               abs_srcdir, data->dirname);
+
+    for (i = 0; i < data->ntids; i++)
+        stats[i].tid = data->tids[i];
+
+    virFileWrapperAddPrefix("/proc/-1/task/", data_dir);
+
+    rc = virProcessGetTaskStats(-1, stats, data->ntids,
+                                VIR_PROCESS_TASK_STATS_WAIT |
+                                VIR_PROCESS_TASK_STATS_DELAY);
+
+    virFileWrapperClearPrefixes();
+
+    if (rc < 0) {
+        fprintf(stderr, "Could not get task stats\n");
+        return -1;
+    }
+
+    for (i = 0; i < data->ntids; i++) {
+        const virProcessTaskStats *exp = data->expect + i;
+
+        if (stats[i].cpuTime != exp->cpuTime * jiff2nsec ||
+            stats[i].lastCpu != exp->lastCpu ||
+            stats[i].cpuWait != exp->cpuWait ||
+            stats[i].cpuDelay != exp->cpuDelay) {
+            fprintf(stderr,
+                    "Task %d: expected time=%llu cpu=%d wait=%llu delay=%llu, "
+                    "got time=%llu cpu=%d wait=%llu delay=%llu\n",
+                    (int) data->tids[i],
+                    exp->cpuTime * jiff2nsec, exp->lastCpu,
+                    exp->cpuWait, exp->cpuDelay,
+                    stats[i].cpuTime, stats[i].lastCpu,
+                    stats[i].cpuWait, stats[i].cpuDelay);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
 static int
 mymain(void)
 {
@@ -82,6 +143,38 @@ mymain(void)
     DO_TEST("simple", "command", 5, true);
     DO_TEST("complex", "this) is ( a \t weird )\n)( (command ( ", 100, false);
 
+#define DO_TEST_TASKS(_dirname, ...) \
+    do { \
+        static const pid_t tids[] = { __VA_ARGS__ }; \
+        struct testTaskData taskData = { \
+            .dirname = _dirname, \
+            .ntids = G_N_ELEMENTS(tids), \
+            .tids = tids, \
+            .expect = expect, \
+        }; \
+        if (virTestRun("Reading task stats: " _dirname, \
+                       test_virProcessGetTaskStats, &taskData) < 0) \
+            ret = -1; \
+    } while (0)
+
+    {
+        /* cpuTime is in jiffies here, the test scales it */
+        static const virProcessTaskStats expect[] = {
+            { .cpuTime = 180, .lastCpu = 2,
+              .cpuWait = 12500000, .cpuDelay = 12500000 },
+            { .cpuTime = 370, .lastCpu = 5,
+              .cpuWait = 750000, .cpuDelay = 750000 },
+        };
+        DO_TEST_TASKS("tasks", 10, 11);
+    }
+
+    {
+        static const virProcessTaskStats expect[] = {
+            { .cpuTime = 120, .lastCpu = 1 },
+        };
+        DO_TEST_TASKS("tasks-nosched", 20);
+    }
+
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
@@ -22,7 +22,9 @@
 #include <fcntl.h>
 
 #include "virrotatingfile.h"
+#include "virfile.h"
 #include "virlog.h"
+#include "virutil.h"
 #include "testutils.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
@@ -32,6 +34,8 @@ VIR_LOG_INIT("tests.rotatingfiletest");
 #define FILENAME "virrotatingfiledata.txt"
 #define FILENAME0 "virrotatingfiledata.txt.0"
 #define FILENAME1 "virrotatingfiledata.txt.1"
+#define FILENAME0GZ "virrotatingfiledata.txt.0.gz"
+#define FILENAME1GZ "virrotatingfiledata.txt.1.gz"
 
 #define FILEBYTE 0xde
 #define FILEBYTE0 0xad
@@ -555,6 +559,133 @@ static int testRotatingFileWriterLargeFile(const void *data G_GNUC_UNUSED)
 }
 
 
+static int testRotatingFileWriterAppendFD(const void *data G_GNUC_UNUSED)
+{
+    virRotatingFileWriter *file = NULL;
+    int pipefd[2] = { -1, -1 };
+    int ret = -1;
+    char buf[768];
+
+    if (testRotatingFileInitFiles((off_t)-1,
+                                  (off_t)-1,
+                                  (off_t)-1) < 0)
+        return -1;
+
+    if (virPipeQuiet(pipefd) < 0)
+        goto cleanup;
+
+    file = virRotatingFileWriterNew(FILENAME,
+                                    1024,
+                                    2,
+                                    false,
+                                    0700);
+    if (!file)
+        goto cleanup;
+
+    memset(buf, 0x5e, sizeof(buf));
+
+    /* Fits into the current file */
+    if (safewrite(pipefd[1], buf, sizeof(buf)) != sizeof(buf) ||
+        virRotatingFileWriterAppendFD(file, pipefd[0], sizeof(buf)) != sizeof(buf))
+        goto cleanup;
+
+    if (testRotatingFileWriterAssertFileSizes(768,
+                                              (off_t)-1,
+                                              (off_t)-1) < 0)
+        goto cleanup;
+
+    /* Needs a rollover */
+    if (safewrite(pipefd[1], buf, sizeof(buf)) != sizeof(buf) ||
+        virRotatingFileWriterAppendFD(file, pipefd[0], sizeof(buf)) != sizeof(buf))
+        goto cleanup;
+
+    if (testRotatingFileWriterAssertFileSizes(512,
+                                              1024,
+                                              (off_t)-1) < 0)
+        goto cleanup;
+
+    /* Fits again after the rollover */
+    if (safewrite(pipefd[1], buf, 256) != 256 ||
+        virRotatingFileWriterAppendFD(file, pipefd[0], sizeof(buf)) != 256)
+        goto cleanup;
+
+    if (testRotatingFileWriterAssertFileSizes(768,
+                                              1024,
+                                              (off_t)-1) < 0)
+        goto cleanup;
+
+    VIR_FORCE_CLOSE(pipefd[1]);
+
+    if (virRotatingFileWriterAppendFD(file, pipefd[0], sizeof(buf)) != 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    virRotatingFileWriterFree(file);
+    VIR_FORCE_CLOSE(pipefd[0]);
+    VIR_FORCE_CLOSE(pipefd[1]);
+    unlink(FILENAME);
+    unlink(FILENAME0);
+    unlink(FILENAME1);
+    return ret;
+}
+
+
+static int testRotatingFileWriterAppendFDTruncated(const void *data G_GNUC_UNUSED)
+{
+    virRotatingFileWriter *file = NULL;
+    int pipefd[2] = { -1, -1 };
+    int ret = -1;
+    char buf[512];
+
+    if (testRotatingFileInitFiles((off_t)-1,
+                                  (off_t)-1,
+                                  (off_t)-1) < 0)
+        return -1;
+
+    if (virPipeQuiet(pipefd) < 0)
+        goto cleanup;
+
+    file = virRotatingFileWriterNew(FILENAME,
+                                    1024,
+                                    2,
+                                    false,
+                                    0700);
+    if (!file)
+        goto cleanup;
+
+    memset(buf, 0x5e, sizeof(buf));
+
+    if (safewrite(pipefd[1], buf, sizeof(buf)) != sizeof(buf) ||
+        virRotatingFileWriterAppendFD(file, pipefd[0], sizeof(buf)) != sizeof(buf))
+        goto cleanup;
+
+    /* Like logrotate's copytruncate */
+    if (truncate(FILENAME, 0) < 0)
+        goto cleanup;
+
+    /* Must continue at the start of the file rather than leave a hole */
+    if (safewrite(pipefd[1], buf, 256) != 256 ||
+        virRotatingFileWriterAppendFD(file, pipefd[0], sizeof(buf)) != 256)
+        goto cleanup;
+
+    if (testRotatingFileWriterAssertFileSizes(256,
+                                              (off_t)-1,
+                                              (off_t)-1) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    virRotatingFileWriterFree(file);
+    VIR_FORCE_CLOSE(pipefd[0]);
+    VIR_FORCE_CLOSE(pipefd[1]);
+    unlink(FILENAME);
+    unlink(FILENAME0);
+    unlink(FILENAME1);
+    return ret;
+}
+
+
 static int testRotatingFileReaderOne(const void *data G_GNUC_UNUSED)
 {
     virRotatingFileReader *file;
@@ -692,6 +823,61 @@ static int testRotatingFileReaderSeek(const void *data G_GNUC_UNUSED)
     return ret;
 }
 
+static int testRotatingFileReaderCompressed(const void *data G_GNUC_UNUSED)
+{
+    virRotatingFileReader *file = NULL;
+    int ret = -1;
+    g_autofree char *buf = g_new0(char, 90000);
+    ssize_t got;
+    size_t regions[] = { 80000, 256 };
+    struct stat sb;
+
+    /* Large enough to be split into several compressed blocks */
+    if (testRotatingFileInitFiles(256, 150000, 256) < 0)
+        return -1;
+
+    if (stat(FILENAME0, &sb) < 0) {
+        virReportSystemError(errno, "Cannot stat %s", FILENAME0);
+        goto cleanup;
+    }
+
+    if (virRotatingFileCompress(FILENAME, 2) < 0)
+        goto cleanup;
+
+    if (testRotatingFileWriterAssertFileSizes(256, -1, -1) < 0)
+        goto cleanup;
+
+    if (!virFileExists(FILENAME0GZ) || !virFileExists(FILENAME1GZ)) {
+        fprintf(stderr, "Compressed files are missing\n");
+        goto cleanup;
+    }
+
+    file = virRotatingFileReaderNew(FILENAME, 2);
+    if (!file)
+        goto cleanup;
+
+    if (virRotatingFileReaderSeek(file, sb.st_ino, 70000) < 0)
+        goto cleanup;
+
+    if ((got = virRotatingFileReaderConsume(file, buf, 90000)) < 0)
+        goto cleanup;
+
+    if (testRotatingFileReaderAssertBufferContent(buf, got,
+                                                  G_N_ELEMENTS(regions),
+                                                  regions) < 0)
+        goto cleanup;
+
+    ret = 0;
+ cleanup:
+    virRotatingFileReaderFree(file);
+    unlink(FILENAME);
+    unlink(FILENAME0);
+    unlink(FILENAME1);
+    unlink(FILENAME0GZ);
+    unlink(FILENAME1GZ);
+    return ret;
+}
+
 static int
 mymain(void)
 {
@@ -724,6 +910,12 @@ mymain(void)
     if (virTestRun("Rotating file write to file larger then maxlen", testRotatingFileWriterLargeFile, NULL) < 0)
         ret = -1;
 
+    if (virTestRun("Rotating file write from pipe", testRotatingFileWriterAppendFD, NULL) < 0)
+        ret = -1;
+
+    if (virTestRun("Rotating file write from pipe to truncated file", testRotatingFileWriterAppendFDTruncated, NULL) < 0)
+        ret = -1;
+
     if (virTestRun("Rotating file read one", testRotatingFileReaderOne, NULL) < 0)
         ret = -1;
 
@@ -736,6 +928,9 @@ mymain(void)
     if (virTestRun("Rotating file read seek", testRotatingFileReaderSeek, NULL) < 0)
         ret = -1;
 
+    if (virTestRun("Rotating file read compressed", testRotatingFileReaderCompressed, NULL) < 0)
+        ret = -1;
+
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
@@ -0,0 +1,201 @@
+/*
+ * libvirt_nss_index.c: Name Service Switch plugin lease index reader
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include <config.h>
+
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "libvirt_nss_index.h"
+#include "libvirt_nss.h"
+
+
+/**
+ * openIndex:
+ * @file: lease status or MAC map file
+ * @idx: index to fill in
+ *
+ * Map the index written next to @file into memory. Callers must
+ * parse @file instead if there's no index, or the index doesn't
+ * describe the current contents of @file.
+ *
+ * Returns 0 if @idx is usable,
+ *        -1 otherwise.
+ */
+int
+openIndex(const char *file,
+          nssIndex *idx)
+{
+    char *path = NULL;
+    struct stat sb;
+    struct stat isb;
+    const void *data;
+    size_t off = sizeof(virLeaseIndexHeader);
+    int fd = -1;
+    int ret = -1;
+
+    memset(idx, 0, sizeof(*idx));
+
+    if (asprintf(&path, "%s" VIR_LEASE_INDEX_SUFFIX, file) < 0) {
+        path = NULL;
+        goto cleanup;
+    }
+
+    if (stat(file, &sb) < 0 ||
+        (fd = open(path, O_RDONLY)) < 0 ||
+        fstat(fd, &isb) < 0) {
+        DEBUG("No index %s", path);
+        goto cleanup;
+    }
+
+    if (isb.st_size < (off_t) off)
+        goto cleanup;
+
+    idx->len = isb.st_size;
+    if ((idx->map = mmap(NULL, idx->len, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        idx->map = NULL;
+        ERROR("Cannot map %s", path);
+        goto cleanup;
+    }
+    idx->header = idx->map;
+
+    if (memcmp(idx->header->magic, VIR_LEASE_INDEX_MAGIC,
+               sizeof(idx->header->magic)) != 0) {
+        ERROR("Unknown format of %s", path);
+        goto cleanup;
+    }
+
+    if (idx->header->sourceIno != (uint64_t) sb.st_ino ||
+        idx->header->sourceSize != (uint64_t) sb.st_size ||
+        idx->header->sourceMtime != virLeaseIndexMtime(&sb)) {
+        DEBUG("Index %s is stale", path);
+        goto cleanup;
+    }
+
+    /* The number of buckets being an even power of two keeps the
+     * entries (which follow the bucket heads) properly aligned. */
+    if (idx->header->nbuckets < 2 ||
+        (idx->header->nbuckets & (idx->header->nbuckets - 1)) != 0 ||
+        idx->header->nbuckets > (idx->len - off) / sizeof(*idx->buckets)) {
+        ERROR("Index %s is corrupted", path);
+        goto cleanup;
+    }
+    data = (const char *) idx->map + off;
+    idx->buckets = data;
+    off += idx->header->nbuckets * sizeof(*idx->buckets);
+
+    if (idx->header->nentries > (idx->len - off) / sizeof(*idx->entries)) {
+        ERROR("Index %s is corrupted", path);
+        goto cleanup;
+    }
+    data = (const char *) idx->map + off;
+    idx->entries = data;
+    off += idx->header->nentries * sizeof(*idx->entries);
+
+    idx->strings = (const char *) idx->map + off;
+    idx->nstrings = idx->len - off;
+    if (idx->nstrings == 0 || idx->strings[idx->nstrings - 1] != '\0') {
+        ERROR("Index %s is corrupted", path);
+        goto cleanup;
+    }
+
+    DEBUG("Using index %s with %u entries", path, idx->header->nentries);
+    ret = 0;
+
+ cleanup:
+    if (ret < 0)
+        closeIndex(idx);
+    if (fd != -1)
+        close(fd);
+    free(path);
+    return ret;
+}
+
+
+void
+closeIndex(nssIndex *idx)
+{
+    if (idx->map)
+        munmap(idx->map, idx->len);
+    memset(idx, 0, sizeof(*idx));
+}
+
+
+const char *
+getIndexString(nssIndex *idx,
+               uint32_t offset)
+{
+    /* The string table is known to end with NUL byte */
+    if (offset >= idx->nstrings)
+        return NULL;
+
+    return idx->strings + offset;
+}
+
+
+/**
+ * lookupIndex:
+ * @idx: opened index
+ * @prev: entry returned by previous call, or NULL
+ * @type: type of @key
+ * @key: key to look up
+ *
+ * Find the first entry of @type matching @key (if @prev is NULL), or
+ * the next one after @prev, in the order they were added to the index.
+ * MAC addresses are compared exactly, host and domain names case
+ * insensitively.
+ *
+ * Returns the entry found, or NULL if there's none (left).
+ */
+const virLeaseIndexEntry *
+lookupIndex(nssIndex *idx,
+            const virLeaseIndexEntry *prev,
+            virLeaseIndexKeyType type,
+            const char *key)
+{
+    uint32_t hash = virLeaseIndexHash(type, key);
+    uint32_t next;
+
+    if (prev)
+        next = prev->next;
+    else
+        next = idx->buckets[hash & (idx->header->nbuckets - 1)];
+
+    while (next) {
+        const virLeaseIndexEntry *entry;
+        const char *entryKey;
+
+        if (next > idx->header->nentries)
+            return NULL;
+
+        entry = &idx->entries[next - 1];
+
+        /* Each entry links to one added after it, which also makes
+         * sure a corrupted index can't make us loop forever. */
+        if (entry->next != 0 && entry->next <= next)
+            return NULL;
+        next = entry->next;
+
+        if (entry->hash != hash || entry->type != type ||
+            !(entryKey = getIndexString(idx, entry->key)))
+            continue;
+
+        if (type == VIR_LEASE_INDEX_KEY_MAC ?
+            strcmp(entryKey, key) != 0 :
+            strcasecmp(entryKey, key) != 0)
+            continue;
+
+        return entry;
+    }
+
+    return NULL;
+}
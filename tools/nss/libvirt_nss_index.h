@@ -0,0 +1,39 @@
+/*
+ * libvirt_nss_index.h: Name Service Switch plugin lease index reader
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include "virleaseindex.h"
+
+typedef struct {
+    void *map;
+    size_t len;
+
+    const virLeaseIndexHeader *header;
+    const uint32_t *buckets;
+    const virLeaseIndexEntry *entries;
+    const char *strings;
+    size_t nstrings;
+} nssIndex;
+
+int
+openIndex(const char *file,
+          nssIndex *idx);
+
+void
+closeIndex(nssIndex *idx);
+
+const virLeaseIndexEntry *
+lookupIndex(nssIndex *idx,
+            const virLeaseIndexEntry *prev,
+            virLeaseIndexKeyType type,
+            const char *key);
+
+const char *
+getIndexString(nssIndex *idx,
+               uint32_t offset);
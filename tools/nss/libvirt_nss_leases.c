@@ -29,6 +29,7 @@
 #include <json.h>
 
 #include "libvirt_nss_leases.h"
+#include "libvirt_nss_index.h"
 #include "libvirt_nss.h"
 
 
@@ -245,6 +246,62 @@ findLeaseInJSON(json_object *jobj,
 }
 
 
+/**
+ * findLeaseInIndex
+ *
+ * Same as findLeaseInJSON, but looks the leases up in index @idx.
+ */
+static int
+findLeaseInIndex(nssIndex *idx,
+                 const char *name,
+                 char **macs,
+                 size_t nmacs,
+                 int af,
+                 time_t now,
+                 leaseAddress **addrs,
+                 size_t *naddrs,
+                 bool *found)
+{
+    size_t nkeys = macs ? nmacs : 1;
+    size_t i;
+
+    for (i = 0; i < nkeys; i++) {
+        virLeaseIndexKeyType type = VIR_LEASE_INDEX_KEY_HOSTNAME;
+        const char *key = name;
+        const virLeaseIndexEntry *entry = NULL;
+
+        if (macs) {
+            type = VIR_LEASE_INDEX_KEY_MAC;
+            key = macs[i];
+        }
+
+        while ((entry = lookupIndex(idx, entry, type, key))) {
+            const char *ipaddr;
+
+            if (entry->expirytime > 0 && entry->expirytime < now) {
+                DEBUG("Skipping expired lease for %s", name);
+                continue;
+            }
+
+            if (!(ipaddr = getIndexString(idx, entry->value)))
+                continue;
+
+            DEBUG("Found record for %s", name);
+            *found = true;
+
+            if (appendAddr(name,
+                           addrs, naddrs,
+                           ipaddr,
+                           entry->expirytime,
+                           af) < 0)
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+
 int
 findLeases(const char *file,
            const char *name,
@@ -264,8 +321,16 @@ findLeases(const char *file,
     int jsonflags = JSON_TOKENER_STRICT | JSON_TOKENER_VALIDATE_UTF8;
     char line[1024];
     size_t nreadTotal = 0;
+    nssIndex idx;
     int rv;
 
+    if (openIndex(file, &idx) == 0) {
+        ret = findLeaseInIndex(&idx, name, macs, nmacs, af, now,
+                               addrs, naddrs, found);
+        closeIndex(&idx);
+        goto cleanup;
+    }
+
     if ((fd = open(file, O_RDONLY)) < 0) {
         ERROR("Cannot open %s", file);
         goto cleanup;
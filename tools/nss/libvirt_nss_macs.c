@@ -28,6 +28,7 @@
 #include <json.h>
 
 #include "libvirt_nss_macs.h"
+#include "libvirt_nss_index.h"
 #include "libvirt_nss.h"
 
 
@@ -111,6 +112,42 @@ findMACsFromJSON(json_object *jobj,
 }
 
 
+/**
+ * findMACsInIndex
+ *
+ * Same as findMACsFromJSON, but looks the MAC addresses up in index @idx.
+ */
+static int
+findMACsInIndex(nssIndex *idx,
+                const char *name,
+                char ***macs,
+                size_t *nmacs)
+{
+    const virLeaseIndexEntry *entry = NULL;
+
+    while ((entry = lookupIndex(idx, entry, VIR_LEASE_INDEX_KEY_DOMAIN, name))) {
+        const char *mac = getIndexString(idx, entry->value);
+        char **tmpMacs = NULL;
+        char *macstr;
+
+        if (!mac)
+            continue;
+
+        tmpMacs = realloc(*macs, sizeof(char *) * (*nmacs + 1));
+        if (!tmpMacs)
+            return -1;
+
+        *macs = tmpMacs;
+
+        if (!(macstr = strdup(mac)))
+            return -1;
+        (*macs)[(*nmacs)++] = macstr;
+    }
+
+    return 0;
+}
+
+
 int
 findMACs(const char *file,
          const char *name,
@@ -125,9 +162,16 @@ findMACs(const char *file,
     enum json_tokener_error jerr = json_tokener_error_parse_eof;
     int jsonflags = JSON_TOKENER_STRICT | JSON_TOKENER_VALIDATE_UTF8;
     size_t nreadTotal = 0;
+    nssIndex idx;
     int rv;
     size_t i;
 
+    if (openIndex(file, &idx) == 0) {
+        ret = findMACsInIndex(&idx, name, macs, nmacs);
+        closeIndex(&idx);
+        goto cleanup;
+    }
+
     if ((fd = open(file, O_RDONLY)) < 0) {
         ERROR("Cannot open %s", file);
         goto cleanup;
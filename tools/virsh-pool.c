@@ -704,6 +704,10 @@ static const vshCmdInfo info_pool_refresh = {
 
 static const vshCmdOptDef opts_pool_refresh[] = {
     VIRSH_COMMON_OPT_POOL_FULL(VIR_CONNECT_LIST_STORAGE_POOLS_ACTIVE),
+    {.name = "incremental",
+     .type = VSH_OT_BOOL,
+     .help = N_("probe only volumes changed since the last refresh")
+    },
 
     {.name = NULL}
 };
@@ -714,11 +718,15 @@ cmdPoolRefresh(vshControl *ctl, const vshCmd *cmd)
     g_autoptr(virshStoragePool) pool = NULL;
     bool ret = true;
     const char *name;
+    unsigned int flags = 0;
 
     if (!(pool = virshCommandOptPool(ctl, cmd, "pool", &name)))
         return false;
 
-    if (virStoragePoolRefresh(pool, 0) == 0) {
+    if (vshCommandOptBool(cmd, "incremental"))
+        flags |= VIR_STORAGE_POOL_REFRESH_INCREMENTAL;
+
+    if (virStoragePoolRefresh(pool, flags) == 0) {
         vshPrintExtra(ctl, _("Pool %1$s refreshed\n"), name);
     } else {
         vshError(ctl, _("Failed to refresh pool %1$s"), name);